@@ -19,8 +19,13 @@
 
 
 #include "PN5180.h"
+#include "PN5180MbedHAL.h"
 #include "pn5180_trace.h"
 
+#if defined (__MBED__)
+#include "platform/mbed_critical.h"
+#endif
+
 
 
 // PN5180 1-Byte Direct Commands
@@ -29,6 +34,7 @@
 #define PN5180_WRITE_REGISTER_OR_MASK   (0x01)
 #define PN5180_WRITE_REGISTER_AND_MASK  (0x02)
 #define PN5180_READ_REGISTER            (0x04)
+#define PN5180_WRITE_EEPROM             (0x06)
 #define PN5180_READ_EEPROM              (0x07)
 #define PN5180_SEND_DATA                (0x09)
 #define PN5180_READ_DATA                (0x0A)
@@ -42,12 +48,98 @@
 #define HIGH    true
 
 
+uint8_t PN5180RxBufferPool::_buffers[MBED_CONF_PN5180_RX_BUFFERS][MBED_CONF_PN5180_RX_BUFFER_SIZE];
+uint32_t PN5180RxBufferPool::_used = 0;
+
+uint8_t * PN5180RxBufferPool::acquire()
+{
+    uint8_t *buffer = 0L;
+#if defined (__MBED__)
+    core_util_critical_section_enter();
+#endif
+    for (uint8_t i=0; i<MBED_CONF_PN5180_RX_BUFFERS; i++) {
+        if (0 == (_used & (1UL << i))) {
+            _used |= (1UL << i);
+            buffer = _buffers[i];
+            break;
+        }
+    }
+#if defined (__MBED__)
+    core_util_critical_section_exit();
+#endif
+    return buffer;
+}
+
+void PN5180RxBufferPool::release(uint8_t *buffer)
+{
+    size_t i = (buffer - &_buffers[0][0]) / MBED_CONF_PN5180_RX_BUFFER_SIZE;
+#if defined (__MBED__)
+    core_util_critical_section_enter();
+#endif
+    _used &= ~(1UL << i);
+#if defined (__MBED__)
+    core_util_critical_section_exit();
+#endif
+}
+
+uint8_t PN5180RxBufferPool::available()
+{
+    uint8_t n = 0;
+    for (uint8_t i=0; i<MBED_CONF_PN5180_RX_BUFFERS; i++) {
+        if (0 == (_used & (1UL << i))) {
+            n++;
+        }
+    }
+    return n;
+}
+
+
+#if defined (DEVICE_SPI)
 PN5180::PN5180(PinName mosi, PinName miso, PinName sck, PinName cs, PinName reset, PinName busy) :
-    _spi(mosi, miso, sck),
-    _cs(cs, 1), //don't select chip by default
-    _reset(reset, 0), //keep in reset state by default
-    _busy(busy)
+    _hal(new PN5180MbedHAL(mosi, miso, sck, cs, reset, busy)),
+    _ownsHal(true)
 {
+    init();
+}
+#endif
+
+PN5180::PN5180(PN5180HAL &hal) :
+    _hal(&hal),
+    _ownsHal(false)
+{
+    init();
+}
+
+PN5180::~PN5180()
+{
+    releaseData();
+    if (_ownsHal) {
+        delete _hal;
+    }
+}
+
+void PN5180::init()
+{
+    _busyTimeout[PN5180_CC_REGISTER] = MBED_CONF_PN5180_BUSY_TIMEOUT_REGISTER_US;
+    _busyTimeout[PN5180_CC_EEPROM] = MBED_CONF_PN5180_BUSY_TIMEOUT_EEPROM_US;
+    _busyTimeout[PN5180_CC_RF] = MBED_CONF_PN5180_BUSY_TIMEOUT_RF_US;
+    _lastError = PN5180_OK;
+    _rfConfigValid = false;
+    _txConf = 0xFF;
+    _rxConf = 0xFF;
+    _rfOn = false;
+    _numShadows = 0;
+    _lastRecoveryTime = 0;
+    _identityValid = false;
+    _transceiveReady = false;
+    _rxBuffer = 0L;
+    memset(&_counters, 0, sizeof(_counters));
+    _countersUpdated = _hal->micros();
+#if MBED_CONF_PN5180_CAPTURE_ENABLE
+    _captureWriter = 0L;
+    _captureContext = 0L;
+    _captureLast = 0;
+#endif
 }
 
 void PN5180::powerUp(void)
@@ -58,16 +150,16 @@ void PN5180::powerUp(void)
    * extended by signal line BUSY. The maximum SPI speed is 7 Mbps and fixed to CPOL
    * = 0 (idle low) and CPHA = 0 (sample rising edge).
    */
-    _reset.write(1);
-    _spi.frequency(5000000);
-    _spi.format(8,0);
-    wait_ms(0.1);
+    _hal->begin();
+    _hal->setNSS(HIGH);
+    _hal->setReset(HIGH);
+    _hal->delayMicros(100);
 }
 
 void PN5180::powerDown(void)
 {
-    _cs.write(1);
-    _reset.write(0);
+    _hal->setNSS(HIGH);
+    _hal->setReset(LOW);
 }
 
 
@@ -81,6 +173,10 @@ bool PN5180::writeRegister(uint8_t reg, uint32_t value)
 {
     uint8_t *p = (uint8_t*)&value;
 
+    if (SYSTEM_CONFIG == reg) {
+        _transceiveReady = false;
+    }
+
 #if DEBUG_PN5180
     tr_debug("Write Register 0x%s, value (LSB first)=0x", formatHex(reg));
     for (int i=0; i<4; i++) {
@@ -96,6 +192,9 @@ bool PN5180::writeRegister(uint8_t reg, uint32_t value)
     uint8_t buf[6] = { PN5180_WRITE_REGISTER, reg, p[0], p[1], p[2], p[3] };
 
     bool success = transceiveCommand(buf, 6);
+    if (success) {
+        updateShadow(reg, value, 0, 0xffffffff);
+    }
 
     return success;
 }
@@ -112,6 +211,10 @@ bool PN5180::writeRegisterWithOrMask(uint8_t reg, uint32_t mask)
 {
     uint8_t *p = (uint8_t*)&mask;
 
+    if (SYSTEM_CONFIG == reg) {
+        _transceiveReady = false;
+    }
+
 #if DEBUG_PN5180
     tr_debug("Write Register 0x%s with OR mask (LSB first)=0x", formatHex(reg));
     for (int i=0; i<4; i++) {
@@ -123,6 +226,9 @@ bool PN5180::writeRegisterWithOrMask(uint8_t reg, uint32_t mask)
     uint8_t buf[6] = { PN5180_WRITE_REGISTER_OR_MASK, reg, p[0], p[1], p[2], p[3] };
 
     bool success = transceiveCommand(buf, 6);
+    if (success) {
+        updateShadow(reg, 0, mask, 0xffffffff);
+    }
 
     return success;
 }
@@ -139,6 +245,10 @@ bool PN5180::writeRegisterWithAndMask(uint8_t reg, uint32_t mask)
 {
     uint8_t *p = (uint8_t*)&mask;
 
+    if (SYSTEM_CONFIG == reg) {
+        _transceiveReady = false;
+    }
+
 #if DEBUG_PN5180
     tr_debug("Write Register 0x%s with AND mask (LSB first)=0x", formatHex(reg));
     for (int i=0; i<4; i++) {
@@ -150,6 +260,9 @@ bool PN5180::writeRegisterWithAndMask(uint8_t reg, uint32_t mask)
     uint8_t buf[6] = { PN5180_WRITE_REGISTER_AND_MASK, reg, p[0], p[1], p[2], p[3] };
 
     bool success = transceiveCommand(buf, 6);
+    if (success) {
+        updateShadow(reg, 0, 0, mask);
+    }
 
     return success;
 }
@@ -210,6 +323,92 @@ bool PN5180::readEEprom(uint8_t addr, uint8_t *buffer, uint8_t len)
     return success;
 }
 
+/*
+ * WRITE_EEPROM - 0x06
+ * This command is used to write data to EEPROM memory area. The field 'Address'
+ * indicates the start address of the write operation. The length of the write operation is
+ * determined by the length of the data.
+ * EEPROM Address must be in the range from 0 to 254, inclusive. Write operation must
+ * not go beyond EEPROM address 254. If the condition is not fulfilled, an exception is
+ * raised.
+ * The identity header up to EEPROM_VERSION is read-only and rejected here. Longer
+ * writes are split into commands of 32 bytes.
+ */
+bool PN5180::writeEEprom(uint8_t addr, const uint8_t *data, uint8_t len) 
+{
+    if ((addr < EEPROM_VERSION + 2) || ((addr+len) > 255)) {
+        tr_error("ERROR: EEPROM write outside 0x16..0xfe!\n");
+        return false;
+    }
+
+    tr_debug("Writing EEPROM at 0x%s, size=%d...\n", formatHex(addr), len);
+
+    uint8_t buf[2 + 32];
+    while (len > 0) {
+        uint8_t n = (len > 32) ? 32 : len;
+        buf[0] = PN5180_WRITE_EEPROM;
+        buf[1] = addr;
+        memcpy(&buf[2], data, n);
+        if (!transceiveCommand(buf, 2 + n)) {
+            return false;
+        }
+        addr += n;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+/*
+ * Bring the EEPROM to the given settings. Each area is read first and only
+ * written if it differs, so once the settings are persisted a boot costs one
+ * read per area and the EEPROM is not worn by rewrites. The number of areas
+ * written goes to *written. EEPROM settings take effect at the next reset.
+ */
+bool PN5180::applyEEpromSettings(const PN5180EEpromSetting *settings, uint8_t count, uint8_t *written)
+{
+    if (written) {
+        *written = 0;
+    }
+    for (uint8_t i=0; i<count; i++) {
+        const PN5180EEpromSetting &setting = settings[i];
+        uint8_t current[32];
+        if (setting.len > sizeof(current)) {
+            tr_error("ERROR: EEPROM setting longer than 32 bytes\n");
+            return false;
+        }
+        if (!readEEprom(setting.addr, current, setting.len)) {
+            return false;
+        }
+        if (0 == memcmp(current, setting.data, setting.len)) {
+            continue;
+        }
+        tr_info("EEPROM 0x%s changed\n", formatHex(setting.addr));
+        if (!writeEEprom(setting.addr, setting.data, setting.len)) {
+            return false;
+        }
+        if (written) {
+            (*written)++;
+        }
+    }
+    return true;
+}
+
+/*
+ * Die identifier and versions in one EEPROM read, later calls return the
+ * cached copy. Returns 0 if the read failed.
+ */
+const PN5180Identity * PN5180::getIdentity()
+{
+    if (!_identityValid) {
+        if (!readEEprom(DIE_IDENTIFIER, (uint8_t *)&_identity, sizeof(_identity))) {
+            return 0L;
+        }
+        _identityValid = true;
+    }
+    return &_identity;
+}
+
 /*
  * SEND_DATA - 0x09
  * This command writes data to the RF transmission buffer and starts the RF transmission.
@@ -243,21 +442,27 @@ bool PN5180::sendData(uint8_t *data, uint8_t len, uint8_t validBits)
         buffer[2+i] = data[i];
     }
 
-    writeRegisterWithAndMask(SYSTEM_CONFIG, 0xfffffff8);  // Idle/StopCom Command
-    writeRegisterWithOrMask(SYSTEM_CONFIG, 0x00000003);   // Transceive Command
-    /*
-    * Transceive command; initiates a transceive cycle.
-    * Note: Depending on the value of the Initiator bit, a
-    * transmission is started or the receiver is enabled
-    * Note: The transceive command does not finish
-    * automatically. It stays in the transceive cycle until
-    * stopped via the IDLE/StopCom command
-    */
-
-    PN5180TransceiveStat transceiveState = getTransceiveState();
-    if (PN5180_TS_WaitTransmit != transceiveState) {
-        //tr_error("*** ERROR: Transceiver not in state WaitTransmit!?\n");
-        return false;
+    if (_transceiveReady) {
+        // the transceive cycle is back in WaitTransmit after the last reception
+        _transceiveReady = false;
+    }
+    else {
+        writeRegisterWithAndMask(SYSTEM_CONFIG, 0xfffffff8);  // Idle/StopCom Command
+        writeRegisterWithOrMask(SYSTEM_CONFIG, 0x00000003);   // Transceive Command
+        /*
+        * Transceive command; initiates a transceive cycle.
+        * Note: Depending on the value of the Initiator bit, a
+        * transmission is started or the receiver is enabled
+        * Note: The transceive command does not finish
+        * automatically. It stays in the transceive cycle until
+        * stopped via the IDLE/StopCom command
+        */
+
+        PN5180TransceiveStat transceiveState = getTransceiveState();
+        if (PN5180_TS_WaitTransmit != transceiveState) {
+            //tr_error("*** ERROR: Transceiver not in state WaitTransmit!?\n");
+            return false;
+        }
     }
 
     bool success = transceiveCommand(buffer, len+2);
@@ -277,29 +482,49 @@ bool PN5180::sendData(uint8_t *data, uint8_t len, uint8_t validBits)
  */
 uint8_t * PN5180::readData(uint16_t len) 
 {
-    if (len > 508) {
-        error("*** FATAL: PN5180 does not support reading more than 508 bytes!");
-        return 0L; //system halts here!
+    if (len > MBED_CONF_PN5180_RX_BUFFER_SIZE) {
+        tr_error("*** ERROR: Response of %d bytes exceeds MBED_CONF_PN5180_RX_BUFFER_SIZE!", len);
+        return 0L;
+    }
+    if (0L == _rxBuffer) {
+        _rxBuffer = PN5180RxBufferPool::acquire();
+        if (0L == _rxBuffer) {
+            tr_error("*** ERROR: No free receive buffer, see MBED_CONF_PN5180_RX_BUFFERS!");
+            return 0L;
+        }
     }
     
     tr_debug("Reading Data (len=%d)...\n", len);
 
     uint8_t cmd[2] = { PN5180_READ_DATA, 0x00 };
 
-    bool success = transceiveCommand(cmd, 2, readBuffer, len);
-    if(!success)
+    bool success = transceiveCommand(cmd, 2, _rxBuffer, len);
+    if(!success) {
+        releaseData();
         return 0L;
+    }
 
 #if DEBUG_PN5180
     tr_debug("Data read: ");
     for (int i=0; i<len; i++) {
-        tr_debug(formatHex(readBuffer[i]));
+        tr_debug(formatHex(_rxBuffer[i]));
         tr_debug(" ");
     }
     tr_debug("\n");
 #endif
 
-    return readBuffer;
+    return _rxBuffer;
+}
+
+/*
+ * The response returned by readData() is valid until releaseData().
+ */
+void PN5180::releaseData() 
+{
+    if (_rxBuffer) {
+        PN5180RxBufferPool::release(_rxBuffer);
+        _rxBuffer = 0L;
+    }
 }
 
 /*
@@ -325,8 +550,15 @@ bool PN5180::loadRFConfig(uint8_t txConf, uint8_t rxConf)
     tr_debug("Load RF-Config: txConf=%s, rxConf=%s\n", formatHex(txConf), formatHex(rxConf));
 
     uint8_t cmd[3] = { PN5180_LOAD_RF_CONFIG, txConf, rxConf };
+    _transceiveReady = false;
 
     bool success = transceiveCommand(cmd, 3);
+    if (success) {
+        // 0xFF keeps the current configuration
+        if (0xFF != txConf) _txConf = txConf;
+        if (0xFF != rxConf) _rxConf = rxConf;
+        _rfConfigValid = (0xFF != txConf) || _rfConfigValid;
+    }
 
     return success;
 }
@@ -335,6 +567,8 @@ bool PN5180::loadRFConfig(uint8_t txConf, uint8_t rxConf)
  * RF_ON - 0x16
  * This command is used to switch on the internal RF field. If enabled the TX_RFON_IRQ is
  * set after the field is switched on.
+ * Fails with PN5180_ERR_RF_ON_TIMEOUT if the IRQ is not set within MBED_CONF_PN5180_RF_TIMEOUT_US,
+ * e.g. with a detuned antenna.
  */
 bool PN5180::setRF_on() 
 {
@@ -342,17 +576,28 @@ bool PN5180::setRF_on()
 
     uint8_t cmd[2] = { PN5180_RF_ON, 0x00 };
 
-    bool success = transceiveCommand(cmd, 2);
+    _counters.rfOn++;
+    _lastError = PN5180_OK;
+    _transceiveReady = false;
+    if (!transceiveCommand(cmd, 2)) {
+        return false;
+    }
 
-    while (0 == (TX_RFON_IRQ_STAT & getIRQStatus())); // wait for RF field to set up
+    if (!waitForIRQ(TX_RFON_IRQ_STAT, MBED_CONF_PN5180_RF_TIMEOUT_US)) { // wait for RF field to set up
+        tr_error("RF ON timeout\n");
+        if (PN5180_OK == _lastError) _lastError = PN5180_ERR_RF_ON_TIMEOUT;
+        return false;
+    }
     clearIRQStatus(TX_RFON_IRQ_STAT);
-    return success;
+    setRFState(true);
+    return true;
 }
 
 /*
  * RF_OFF - 0x17
  * This command is used to switch off the internal RF field. If enabled, the TX_RFOFF_IRQ
  * is set after the field is switched off.
+ * Fails with PN5180_ERR_RF_OFF_TIMEOUT if the IRQ is not set within MBED_CONF_PN5180_RF_TIMEOUT_US.
  */
 bool PN5180::setRF_off() 
 {
@@ -360,11 +605,20 @@ bool PN5180::setRF_off()
 
     uint8_t cmd[2] = { PN5180_RF_OFF, 0x00 };
 
-    bool success = transceiveCommand(cmd, 2);
+    _lastError = PN5180_OK;
+    _transceiveReady = false;
+    if (!transceiveCommand(cmd, 2)) {
+        return false;
+    }
+    setRFState(false);
 
-    while (0 == (TX_RFOFF_IRQ_STAT & getIRQStatus())); // wait for RF field to shut down
+    if (!waitForIRQ(TX_RFOFF_IRQ_STAT, MBED_CONF_PN5180_RF_TIMEOUT_US)) { // wait for RF field to shut down
+        tr_error("RF OFF timeout\n");
+        if (PN5180_OK == _lastError) _lastError = PN5180_ERR_RF_OFF_TIMEOUT;
+        return false;
+    }
     clearIRQStatus(TX_RFOFF_IRQ_STAT);
-    return success;
+    return true;
 }
 
 //---------------------------------------------------------------------------------------------
@@ -406,6 +660,26 @@ status register contain information on the exception.
  * If there is a parameter error, the IRQ is set to ACTIVE and a GENERAL_ERROR_IRQ is set.
  */
 bool PN5180::transceiveCommand(uint8_t *sendBuffer, size_t sendBufferLen, uint8_t *recvBuffer, size_t recvBufferLen) 
+{
+    _counters.hostCommands++;
+#if MBED_CONF_PN5180_CAPTURE_ENABLE
+    if (0L != _captureWriter) {
+        uint32_t start = _hal->micros();
+        uint32_t busyTx = 0;
+        uint32_t busyRx = 0;
+        bool success = exchangeFrames(sendBuffer, sendBufferLen, recvBuffer, recvBufferLen, &busyTx, &busyRx);
+        captureRecord(PN5180_CAPTURE_FRAME, start, sendBuffer, sendBufferLen, recvBuffer, recvBufferLen, busyTx, busyRx, success);
+        return success;
+    }
+#endif
+    return exchangeFrames(sendBuffer, sendBufferLen, recvBuffer, recvBufferLen, 0L, 0L);
+}
+
+/*
+ * The SPI frames of a host interface command. The BUSY phases after the frames
+ * are measured for the capture if busyTx/busyRx are given.
+ */
+bool PN5180::exchangeFrames(uint8_t *sendBuffer, size_t sendBufferLen, uint8_t *recvBuffer, size_t recvBufferLen, uint32_t *busyTx, uint32_t *busyRx) 
 {
 #if DEBUG_PN5180
     tr_debug("Sending SPI frame: '");
@@ -418,25 +692,29 @@ bool PN5180::transceiveCommand(uint8_t *sendBuffer, size_t sendBufferLen, uint8_
     tr_debug("'\n");
 #endif
 
+    uint32_t timeout = _busyTimeout[commandClass(sendBuffer[0])];
+
     // Wait until busy is low
-    if(waitForBusyState(LOW) == false)
+    if(waitForBusyState(LOW, timeout) == false)
         return false;
     // 1. Assert NSS to Low
-    _cs = 0; 
-    wait_ms(2);
+    _hal->setNSS(LOW);
+    _hal->delayMicros(MBED_CONF_PN5180_NSS_DELAY_US);
     // 2. Perform Data Exchange
-    for (uint8_t i=0; i<sendBufferLen; i++) {
-        _spi.write(sendBuffer[i]);
-    }
+    _hal->transfer(sendBuffer, 0, sendBufferLen);
     // 3. Wait until BUSY is high
-    if(waitForBusyState(HIGH) == false)
+    if(waitForBusyState(HIGH, timeout) == false)
         return false;
     // 4. Deassert NSS
-    _cs = 1; 
-    wait_ms(1);
+    _hal->setNSS(HIGH);
+    uint32_t deassert = busyTx ? _hal->micros() : 0;
+    _hal->delayMicros(MBED_CONF_PN5180_NSS_DELAY_US);
     // 5. Wait until BUSY is low
-    if(waitForBusyState(LOW) == false)
+    if(waitForBusyState(LOW, timeout) == false)
         return false;
+    if (busyTx) {
+        *busyTx = _hal->micros() - deassert;
+    }
 
     // stop here if we only want to send data
     if ((0 == recvBuffer) || (0 == recvBufferLen)) 
@@ -444,21 +722,23 @@ bool PN5180::transceiveCommand(uint8_t *sendBuffer, size_t sendBufferLen, uint8_
 
     tr_debug("Receiving SPI frame...\n");
     // 1. Assert NSS to Low
-    _cs = 0; 
-    wait_ms(2);
+    _hal->setNSS(LOW);
+    _hal->delayMicros(MBED_CONF_PN5180_NSS_DELAY_US);
     // 2. Perform Data Exchange
-    for (uint8_t i=0; i<recvBufferLen; i++) {
-        recvBuffer[i] = _spi.write(0xff);
-    }
+    _hal->transfer(0, recvBuffer, recvBufferLen);
     // 3. Wait until BUSY is high
-    if(waitForBusyState(HIGH) == false)
+    if(waitForBusyState(HIGH, timeout) == false)
         return false;
     // 4. Deassert NSS
-    _cs = 1; 
-    wait_ms(1);
+    _hal->setNSS(HIGH);
+    deassert = busyRx ? _hal->micros() : 0;
+    _hal->delayMicros(MBED_CONF_PN5180_NSS_DELAY_US);
     // 5. Wait until BUSY is low
-    if(waitForBusyState(LOW) == false)
+    if(waitForBusyState(LOW, timeout) == false)
         return false;
+    if (busyRx) {
+        *busyRx = _hal->micros() - deassert;
+    }
 
 #if DEBUG_PN5180
     tr_debug("Received: ");
@@ -474,34 +754,311 @@ bool PN5180::transceiveCommand(uint8_t *sendBuffer, size_t sendBufferLen, uint8_
     return true;
 }
 
-bool PN5180::waitForBusyState(bool stateToWaitFor)
+#if MBED_CONF_PN5180_CAPTURE_ENABLE
+void PN5180::startCapture(PN5180CaptureWriter writer, void *context) 
 {
-    uint16_t ctr=0;
-    while(_busy != stateToWaitFor) {
-        wait_ms(0.05);
-        ctr++;
-        if(ctr > 2000) { //100ms = timeout
+    uint8_t header[4] = { PN5180_CAPTURE_MAGIC[0], PN5180_CAPTURE_MAGIC[1], PN5180_CAPTURE_MAGIC[2], PN5180_CAPTURE_VERSION };
+    writer(context, header, sizeof(header));
+    _captureContext = context;
+    _captureLast = _hal->micros();
+    _captureWriter = writer;
+}
+
+static uint8_t putVarint(uint8_t *p, uint32_t value) 
+{
+    uint8_t n = 0;
+    while (value >= 0x80) {
+        p[n++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    p[n++] = value;
+    return n;
+}
+
+/*
+ * Write a record, see PN5180Capture.h. The frames are passed to the writer
+ * as they are, the numbers around them are encoded into a small buffer.
+ */
+void PN5180::captureRecord(uint8_t tag, uint32_t start, const uint8_t *tx, size_t txLen, const uint8_t *rx, size_t rxLen,
+                           uint32_t busyTx, uint32_t busyRx, bool success) 
+{
+    uint8_t buf[16];
+    uint8_t n = 0;
+    buf[n++] = tag;
+    n += putVarint(&buf[n], start - _captureLast);
+    _captureLast = start;
+    if (PN5180_CAPTURE_FRAME != tag) {
+        _captureWriter(_captureContext, buf, n);
+        return;
+    }
+
+    if (!success || (0L == rx)) {
+        rxLen = 0;
+    }
+    n += putVarint(&buf[n], txLen);
+    _captureWriter(_captureContext, buf, n);
+    _captureWriter(_captureContext, tx, txLen);
+    n = putVarint(buf, rxLen);
+    _captureWriter(_captureContext, buf, n);
+    if (rxLen > 0) {
+        _captureWriter(_captureContext, rx, rxLen);
+    }
+    n = putVarint(buf, busyTx);
+    n += putVarint(&buf[n], busyRx);
+    buf[n++] = success ? PN5180_CAPTURE_OK : PN5180_CAPTURE_FAILED;
+    _captureWriter(_captureContext, buf, n);
+}
+#endif
+
+/*
+ * Wait for BUSY with a deadline on the microsecond ticker.
+ * Most BUSY phases of host interface commands last a few microseconds, so BUSY is
+ * polled without any delay for MBED_CONF_PN5180_BUSY_SPIN_US first. RF_ON, RF_OFF,
+ * LOAD_RF_CONFIG and the startup take some hundred microseconds, they are polled
+ * every MBED_CONF_PN5180_BUSY_POLL_US up to MBED_CONF_PN5180_BUSY_SLEEP_US instead
+ * of being rounded up to a millisecond. Longer phases (EEPROM writes) are polled
+ * every millisecond with sleepMillis(), which puts the thread to sleep when the
+ * RTOS is present.
+ */
+bool PN5180::waitForBusyState(bool stateToWaitFor, uint32_t timeout_us)
+{
+    uint32_t start = _hal->micros();
+    while(_hal->getBusy() != stateToWaitFor) {
+        uint32_t elapsed = _hal->micros() - start; // wrap-around safe
+        if(elapsed >= timeout_us) {
             tr_error("Busy pin timeout\n");
+            _lastError = PN5180_ERR_BUSY_TIMEOUT;
+            _counters.busyTimeouts++;
             return false;
         }
+        if(elapsed >= MBED_CONF_PN5180_BUSY_SLEEP_US) {
+            _hal->sleepMillis(1);
+        }
+        else if(elapsed >= MBED_CONF_PN5180_BUSY_SPIN_US) {
+            _hal->delayMicros(MBED_CONF_PN5180_BUSY_POLL_US);
+        }
     }
     return true;
 }
 
+void PN5180::setBusyTimeout(PN5180CommandClass commandClass, uint32_t timeout_us)
+{
+    if (commandClass < PN5180_CC_COUNT) {
+        _busyTimeout[commandClass] = timeout_us;
+    }
+}
+
+PN5180CommandClass PN5180::commandClass(uint8_t command)
+{
+    switch (command) 
+    {
+        case PN5180_WRITE_EEPROM:
+        case PN5180_READ_EEPROM:
+            return PN5180_CC_EEPROM;
+        case PN5180_LOAD_RF_CONFIG:
+        case PN5180_RF_ON:
+        case PN5180_RF_OFF:
+            return PN5180_CC_RF;
+        default:
+            return PN5180_CC_REGISTER;
+    }
+}
+
 
 /*
  * Reset NFC device
+ * Fails with PN5180_ERR_STARTUP_TIMEOUT if the IDLE IRQ is not set within
+ * MBED_CONF_PN5180_STARTUP_TIMEOUT_US after the reset pulse.
  */
-void PN5180::reset() 
+bool PN5180::reset() 
 {
-    _reset = 0;  // at least 10us required
-    wait_ms(10);
-    _reset = 1; // 2ms to ramp up required
-    wait_ms(10);
+    _counters.resets++;
+    _lastError = PN5180_OK;
+    setRFState(false);
+    _transceiveReady = false;
+
+#if MBED_CONF_PN5180_CAPTURE_ENABLE
+    if (0L != _captureWriter) {
+        captureRecord(PN5180_CAPTURE_RESET, _hal->micros(), 0L, 0, 0L, 0, 0, 0, true);
+    }
+#endif
+    _hal->setReset(LOW);  // at least 10us required
+    _hal->delayMicros(100);
+    _hal->setReset(HIGH); // 2ms to ramp up required
+    _hal->sleepMillis(2);
     
-    while (0 == (IDLE_IRQ_STAT & getIRQStatus())); // wait for system to start up
+    if (!waitForIRQ(IDLE_IRQ_STAT, MBED_CONF_PN5180_STARTUP_TIMEOUT_US)) { // wait for system to start up
+        tr_error("Startup timeout\n");
+        if (PN5180_OK == _lastError) _lastError = PN5180_ERR_STARTUP_TIMEOUT;
+        return false;
+    }
     
-    clearIRQStatus(0xffffffff); // clear all flags
+    return clearIRQStatus(0xffffffff); // clear all flags
+}
+
+/*
+ * Start the reader after power-on. A PN5180 fresh from its power-on reset has
+ * IDLE_IRQ set with the field off and the transceiver idle; the reset pulse
+ * and its ramp-up wait are skipped then. IDLE_IRQ alone does not tell a
+ * power-on, a previous run of the host may have left it set, so after a
+ * restart of the host with the field on, a TX_RFON_IRQ pending or the
+ * transceiver busy the reader is reset as usual. The EEPROM settings are
+ * applied next (see applyEEpromSettings), with a reset if any of them was
+ * written, so the first boot persists them and later boots only compare.
+ */
+bool PN5180::boot(const PN5180EEpromSetting *settings, uint8_t count, uint8_t *written)
+{
+    powerUp();
+    _lastError = PN5180_OK;
+    setRFState(false);
+    _transceiveReady = false;
+
+    uint32_t irqStatus = 0;
+    uint32_t rfStatus = 0;
+    bool powerOn = readRegister(IRQ_STATUS, &irqStatus) && (0xffffffff != irqStatus) &&
+                   (irqStatus & IDLE_IRQ_STAT) && !(irqStatus & TX_RFON_IRQ_STAT) &&
+                   readRegister(RF_STATUS, &rfStatus) && !(rfStatus & TX_RF_STATUS) &&
+                   (PN5180_TS_Idle == TRANSCEIVE_STATE(rfStatus));
+    if (powerOn) {
+        tr_debug("Booted from power-on\n");
+        if (!clearIRQStatus(0xffffffff)) {
+            return false;
+        }
+    }
+    else if (!reset()) {
+        return false;
+    }
+
+    uint8_t changed = 0;
+    if (!applyEEpromSettings(settings, count, &changed)) {
+        return false;
+    }
+    if (written) {
+        *written = changed;
+    }
+    return (0 == changed) || reset();
+}
+
+/*
+ * Bring a wedged reader back: reset pulse, then the last RF configuration and
+ * the shadowed configuration registers are restored and the RF field is switched
+ * on again if it was on. The duration is available from getLastRecoveryTime().
+ */
+bool PN5180::recover() 
+{
+    uint32_t start = _hal->micros();
+    bool rfWasOn = _rfOn;
+
+    tr_info("Recovering PN5180...\n");
+    _counters.recoveries++;
+
+    if (!reset()) {
+        return false;
+    }
+    if (_rfConfigValid && !loadRFConfig(_txConf, _rxConf)) {
+        return false;
+    }
+    for (uint8_t i=0; i<_numShadows; i++) {
+        if (!writeRegister(_shadow[i].reg, _shadow[i].value)) {
+            return false;
+        }
+    }
+    if (rfWasOn && !setRF_on()) {
+        return false;
+    }
+
+    _lastRecoveryTime = _hal->micros() - start;
+    tr_info("Recovered in %d us\n", (int)_lastRecoveryTime);
+    return true;
+}
+
+/*
+ * The field state, with the field on time counted up to the change. Called
+ * with false for RF_OFF, reset() and boot().
+ */
+void PN5180::setRFState(bool on) 
+{
+    getCounters();
+    _rfOn = on;
+    if (!on) {
+        fieldLost();
+    }
+}
+
+const PN5180Counters & PN5180::getCounters() 
+{
+    uint32_t now = _hal->micros();
+    uint32_t elapsed = now - _countersUpdated; // wrap-around safe
+    _countersUpdated = now;
+    _counters.time_us += elapsed;
+    if (_rfOn) {
+        _counters.rfOnTime_us += elapsed;
+    }
+    return _counters;
+}
+
+/*
+ * Poll IRQ_STATUS until one of the bits in irqMask is set or the deadline passed.
+ * The IRQs waited for here take hundreds of microseconds, so IRQ_STATUS is read
+ * every MBED_CONF_PN5180_IRQ_POLL_US instead of keeping the SPI bus busy.
+ */
+bool PN5180::waitForIRQ(uint32_t irqMask, uint32_t timeout_us) 
+{
+    uint32_t start = _hal->micros();
+    while (0 == (irqMask & getIRQStatus())) {
+        if ((_hal->micros() - start) >= timeout_us) {
+            _counters.irqTimeouts++;
+            return false;
+        }
+        _hal->delayMicros(MBED_CONF_PN5180_IRQ_POLL_US);
+    }
+    return true;
+}
+
+/*
+ * Keep track of configuration register contents for recover().
+ * Status registers and the command/IRQ clear registers are not shadowed.
+ * A register modified only by OR/AND mask is read back once to learn its value.
+ */
+void PN5180::updateShadow(uint8_t reg, uint32_t value, uint32_t orMask, uint32_t andMask) 
+{
+    switch (reg) 
+    {
+        case SYSTEM_CONFIG:
+        case IRQ_STATUS:
+        case IRQ_CLEAR:
+        case RX_STATUS:
+        case RF_STATUS:
+        case SYSTEM_STATUS:
+            return;
+        default:
+            break;
+    }
+
+    bool fullWrite = (0 == orMask) && (0xffffffff == andMask);
+    for (uint8_t i=0; i<_numShadows; i++) {
+        if (_shadow[i].reg == reg) {
+            if (fullWrite) {
+                _shadow[i].value = value;
+            }
+            else {
+                _shadow[i].value = (_shadow[i].value | orMask) & andMask;
+            }
+            return;
+        }
+    }
+
+    if (_numShadows >= MBED_CONF_PN5180_REGISTER_SHADOW_ENTRIES) {
+        tr_error("Register shadow full, 0x%s not restored on recovery\n", formatHex(reg));
+        _lastError = PN5180_ERR_SHADOW_FULL;
+        return;
+    }
+    if (!fullWrite && !readRegister(reg, &value)) {
+        return;
+    }
+    _shadow[_numShadows].reg = reg;
+    _shadow[_numShadows].value = value;
+    _numShadows++;
 }
 
 /**
@@ -512,7 +1069,7 @@ uint32_t PN5180::getIRQStatus()
 {
     tr_debug("Read IRQ-Status register...\n");
 
-    uint32_t irqStatus;
+    uint32_t irqStatus = 0;
     readRegister(IRQ_STATUS, &irqStatus);
 
     tr_debug("IRQ-Status=0x%s\n", formatHex(irqStatus));
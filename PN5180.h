@@ -19,9 +19,15 @@
 #ifndef PN5180_H
 #define PN5180_H
 
-#if defined (DEVICE_SPI)
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "PN5180HAL.h"
+#include "PN5180Capture.h"
 
+#if defined (DEVICE_SPI)
 #include "mbed.h"
+#endif
 
 // PN5180 Registers
 #define SYSTEM_CONFIG       (0x00)
@@ -34,6 +40,7 @@
 #define RX_WAIT_CONFIG      (0x11)
 #define CRC_RX_CONFIG       (0x12)
 #define RX_STATUS           (0x13)
+#define TX_CONFIG           (0x18)
 #define RF_STATUS           (0x1d)
 #define SYSTEM_STATUS       (0x24)
 #define TEMP_CONTROL        (0x25)
@@ -44,6 +51,103 @@
 #define FIRMWARE_VERSION    (0x12)
 #define EEPROM_VERSION      (0x14)
 #define IRQ_PIN_CONFIG      (0x1A)
+#define MISO_PULLUP_ENABLE  (0x1B)
+
+// Delay after asserting and after deasserting NSS
+#ifndef MBED_CONF_PN5180_NSS_DELAY_US
+#define MBED_CONF_PN5180_NSS_DELAY_US 10
+#endif
+// Busy-wait: BUSY is polled without delay for this long before sleeping between polls
+#ifndef MBED_CONF_PN5180_BUSY_SPIN_US
+#define MBED_CONF_PN5180_BUSY_SPIN_US 100
+#endif
+// then every BUSY_POLL_US up to BUSY_SLEEP_US, and every millisecond after that
+#ifndef MBED_CONF_PN5180_BUSY_POLL_US
+#define MBED_CONF_PN5180_BUSY_POLL_US 50
+#endif
+#ifndef MBED_CONF_PN5180_BUSY_SLEEP_US
+#define MBED_CONF_PN5180_BUSY_SLEEP_US 2000
+#endif
+// Default BUSY timeouts per command class
+#ifndef MBED_CONF_PN5180_BUSY_TIMEOUT_REGISTER_US
+#define MBED_CONF_PN5180_BUSY_TIMEOUT_REGISTER_US 10000
+#endif
+#ifndef MBED_CONF_PN5180_BUSY_TIMEOUT_EEPROM_US
+#define MBED_CONF_PN5180_BUSY_TIMEOUT_EEPROM_US 50000
+#endif
+#ifndef MBED_CONF_PN5180_BUSY_TIMEOUT_RF_US
+#define MBED_CONF_PN5180_BUSY_TIMEOUT_RF_US 100000
+#endif
+
+// Deadlines for the IRQ of RF_ON/RF_OFF and for the IDLE IRQ after reset
+#ifndef MBED_CONF_PN5180_RF_TIMEOUT_US
+#define MBED_CONF_PN5180_RF_TIMEOUT_US 20000
+#endif
+#ifndef MBED_CONF_PN5180_STARTUP_TIMEOUT_US
+#define MBED_CONF_PN5180_STARTUP_TIMEOUT_US 50000
+#endif
+// Interval between IRQ_STATUS reads while waiting for these IRQs
+#ifndef MBED_CONF_PN5180_IRQ_POLL_US
+#define MBED_CONF_PN5180_IRQ_POLL_US 50
+#endif
+// Number of configuration registers restored by recover()
+#ifndef MBED_CONF_PN5180_REGISTER_SHADOW_ENTRIES
+#define MBED_CONF_PN5180_REGISTER_SHADOW_ENTRIES 8
+#endif
+// Receive buffers shared by all readers, one is leased per response (max. 32)
+#ifndef MBED_CONF_PN5180_RX_BUFFERS
+#define MBED_CONF_PN5180_RX_BUFFERS 2
+#endif
+// Size of a receive buffer, the longest response that can be read (max. 508)
+#ifndef MBED_CONF_PN5180_RX_BUFFER_SIZE
+#define MBED_CONF_PN5180_RX_BUFFER_SIZE 508
+#endif
+#if (MBED_CONF_PN5180_RX_BUFFERS > 32) || (MBED_CONF_PN5180_RX_BUFFER_SIZE > 508)
+#error "MBED_CONF_PN5180_RX_BUFFERS is limited to 32, MBED_CONF_PN5180_RX_BUFFER_SIZE to 508"
+#endif
+
+enum PN5180Error {
+    PN5180_OK = 0,
+    PN5180_ERR_BUSY_TIMEOUT = 1,    // BUSY line did not change in time
+    PN5180_ERR_STARTUP_TIMEOUT = 2, // no IDLE IRQ after reset
+    PN5180_ERR_RF_ON_TIMEOUT = 3,   // no TX_RFON IRQ after RF_ON
+    PN5180_ERR_RF_OFF_TIMEOUT = 4,  // no TX_RFOFF IRQ after RF_OFF
+    PN5180_ERR_SHADOW_FULL = 5      // register shadow has no free entry
+};
+
+// EEPROM area applied by boot(), e.g. { IRQ_PIN_CONFIG, 1, &activeHigh }
+struct PN5180EEpromSetting {
+    uint8_t addr;
+    uint8_t len;
+    const uint8_t *data;
+};
+
+// Read-only EEPROM header, addresses DIE_IDENTIFIER to EEPROM_VERSION + 1
+struct PN5180Identity {
+    uint8_t dieIdentifier[16];
+    uint8_t productVersion[2];  // minor, major
+    uint8_t firmwareVersion[2];
+    uint8_t eepromVersion[2];
+};
+
+enum PN5180CommandClass {
+    PN5180_CC_REGISTER = 0,     // register access, SEND_DATA, READ_DATA
+    PN5180_CC_EEPROM = 1,       // EEPROM access
+    PN5180_CC_RF = 2,           // LOAD_RF_CONFIG, RF_ON, RF_OFF
+    PN5180_CC_COUNT = 3
+};
+
+// Host interface and RF counters since construction, see PN5180::getCounters()
+struct PN5180Counters {
+    uint64_t time_us;           // reader clock, 64 bit
+    uint64_t rfOnTime_us;       // time the RF field was on
+    uint32_t hostCommands;      // host interface commands
+    uint32_t busyTimeouts;      // BUSY did not change in time
+    uint32_t irqTimeouts;       // no IRQ after reset, RF_ON or RF_OFF
+    uint32_t resets;
+    uint32_t recoveries;
+    uint32_t rfOn;              // RF_ON commands
+};
 
 enum PN5180TransceiveStat {
     PN5180_TS_Idle = 0,
@@ -103,6 +207,7 @@ enum PN5180RFRXConfig {
     PN5180_RF_RX_CFG_NFC_ACTIVEINITIATOR_424KBIT    = 0x80 + PN5180_RF_TX_CFG_NFC_ACTIVEINITIATOR_424KBIT,
     PN5180_RF_RX_CFG_ISO15693_ASK100_26KBIT         = 0x80 + PN5180_RF_TX_CFG_ISO15693_ASK100_26KBIT,
     PN5180_RF_RX_CFG_ISO15693_ASK10_26KBIT          = 0x80 + PN5180_RF_TX_CFG_ISO15693_ASK10_26KBIT,
+    PN5180_RF_RX_CFG_ISO15693_53KBIT                = 0x8E, // fast (double data rate) responses
     PN5180_RF_RX_CFG_ISO18003M3MANCH_424_4_18KBIT   = 0x80 + PN5180_RF_TX_CFG_ISO18003M3MANCH_424_4_18KBIT,
     PN5180_RF_RX_CFG_ISO18003M3MANCH_424_2_9KBIT    = 0x80 + PN5180_RF_TX_CFG_ISO18003M3MANCH_424_2_9KBIT,
     PN5180_RF_RX_CFG_ISO18003M3MANCH_848_4_18KBIT   = 0x80 + PN5180_RF_TX_CFG_ISO18003M3MANCH_848_4_18KBIT,
@@ -129,14 +234,50 @@ enum PN5180RFRXConfig {
 #define TX_RFON_IRQ_STAT    (1<<9)  // RF Field ON in PCD IRQ
 #define RX_SOF_DET_IRQ_STAT (1<<14) // RF SOF Detection IRQ
 
+// PN5180 RF_STATUS
+#define TX_RF_STATUS                (1<<20) // RF field of the PCD is on
+#define TRANSCEIVE_STATE(rfStatus)  (((rfStatus) >> 24) & 0x07)
+
+// PN5180 RX_STATUS
+#define RX_NUM_BYTES_RECEIVED_MASK  (0x000001ff)
+#define RX_NUM_LAST_BITS_MASK       (0x0000e000) // valid bits of the last byte, 0 = all
+#define RX_DATA_INTEGRITY_ERROR     (1<<16) // CRC or parity error in received frame
+#define RX_PROTOCOL_ERROR           (1<<17) // Framing/coding error in received frame
+#define RX_COLLISION_DETECTED       (1<<18) // Collision in received frame
+
+/*
+ * Pool of receive buffers shared by all PN5180 instances. A reader leases a
+ * buffer in readData() and returns it with releaseData() once the response
+ * is parsed, so the RAM needed depends on the responses processed at the same
+ * time (one per thread using a reader), not on the number of readers.
+ */
+class PN5180RxBufferPool
+{
+public:
+    static uint8_t *acquire();
+    static void release(uint8_t *buffer);
+    static uint8_t available();
+
+private:
+    static uint8_t _buffers[MBED_CONF_PN5180_RX_BUFFERS][MBED_CONF_PN5180_RX_BUFFER_SIZE];
+    static uint32_t _used; // one bit per buffer
+};
+
 class PN5180 
 {
 public:
+#if defined (DEVICE_SPI)
     PN5180(PinName mosi, PinName miso, PinName sck, PinName cs, PinName reset, PinName busy); 
+#endif
+    PN5180(PN5180HAL &hal);
+    virtual ~PN5180();
 
     void powerUp();
     void powerDown();
-    void reset();
+    bool reset();
+    bool recover();
+    // power up, reset unless fresh from power-on, and persist the settings
+    bool boot(const PN5180EEpromSetting *settings = 0, uint8_t count = 0, uint8_t *written = 0);
 
     // cmd 0x00 
     bool writeRegister(uint8_t reg, uint32_t value);
@@ -146,36 +287,102 @@ public:
     bool writeRegisterWithAndMask(uint8_t addr, uint32_t mask);
     //cmd 0x04
     bool readRegister(uint8_t reg, uint32_t *value);
+    //cmd 0x06
+    bool writeEEprom(uint8_t addr, const uint8_t *data, uint8_t len);
     //cmd 0x07
     bool readEEprom(uint8_t addr, uint8_t *buffer, uint8_t len);
+    // write the settings differing from the EEPROM contents
+    bool applyEEpromSettings(const PN5180EEpromSetting *settings, uint8_t count, uint8_t *written = 0);
+    // read once, then served from the cache
+    const PN5180Identity * getIdentity();
     //cmd 0x09
     bool sendData(uint8_t *data, uint8_t len, uint8_t validBits = 0);
     //cmd 0x0a
     uint8_t * readData(uint16_t len);
+    // return the buffer leased by readData() to the pool
+    void releaseData();
     //cmd 0x11
     bool loadRFConfig(uint8_t txConf, uint8_t rxConf);
+    uint8_t getRxConfig() { return _rxConf; }
     //cmd 0x16
     bool setRF_on();
     //cmd 0x17
     bool setRF_off();
-
+    bool isRFOn() { return _rfOn; }
 
     uint32_t getIRQStatus();
     bool clearIRQStatus(uint32_t irqMask);
 
     PN5180TransceiveStat getTransceiveState();
 
+    void setBusyTimeout(PN5180CommandClass commandClass, uint32_t timeout_us);
+
+    PN5180Error getLastError() { return _lastError; }
+    uint32_t getLastRecoveryTime() { return _lastRecoveryTime; } // in us
+
+    uint32_t getMicros() { return _hal->micros(); }
+
+    // the clocks are brought up to date, call at least once per hour (micros() wraps)
+    const PN5180Counters & getCounters();
+
+#if MBED_CONF_PN5180_CAPTURE_ENABLE
+    // record all host interface commands to the writer, see PN5180Capture.h
+    void startCapture(PN5180CaptureWriter writer, void *context);
+    void stopCapture() { _captureWriter = 0L; }
+#endif
+
+protected:
+    void sleepMillis(uint32_t ms) { _hal->sleepMillis(ms); }
+    void delayMicros(uint32_t us) { _hal->delayMicros(us); }
+    // RX_IRQ seen in transceive mode, the next sendData() skips the transceive setup
+    void setTransceiveReady() { _transceiveReady = true; }
+    // the RF field went off or the chip was reset: tags in the field lost their state
+    virtual void fieldLost() {}
+
 private:
-    SPI _spi;
-    DigitalOut _cs;
-    DigitalOut _reset;
-    DigitalIn _busy;
+    PN5180HAL *_hal;
+    bool _ownsHal;
+    bool _transceiveReady;
+
+    uint8_t *_rxBuffer; // leased from PN5180RxBufferPool
+    uint32_t _busyTimeout[PN5180_CC_COUNT];
+    PN5180Error _lastError;
+
+    // state restored by recover()
+    bool _rfConfigValid;
+    uint8_t _txConf;
+    uint8_t _rxConf;
+    bool _rfOn;
+    struct RegisterShadow {
+        uint8_t reg;
+        uint32_t value;
+    };
+    RegisterShadow _shadow[MBED_CONF_PN5180_REGISTER_SHADOW_ENTRIES];
+    uint8_t _numShadows;
+    uint32_t _lastRecoveryTime;
+
+    PN5180Identity _identity;
+    bool _identityValid;
+
+    PN5180Counters _counters;
+    uint32_t _countersUpdated;  // micros() the clocks of _counters are counted up to
 
-    uint8_t readBuffer[508];
+#if MBED_CONF_PN5180_CAPTURE_ENABLE
+    PN5180CaptureWriter _captureWriter;
+    void *_captureContext;
+    uint32_t _captureLast;      // start of the previous record
+    void captureRecord(uint8_t tag, uint32_t start, const uint8_t *tx, size_t txLen, const uint8_t *rx, size_t rxLen,
+                       uint32_t busyTx, uint32_t busyRx, bool success);
+#endif
 
     bool transceiveCommand(uint8_t *sendBuffer, size_t sendBufferLen, uint8_t *recvBuffer = 0, size_t recvBufferLen = 0);
-    bool waitForBusyState(bool stateToWaitFor);
+    bool exchangeFrames(uint8_t *sendBuffer, size_t sendBufferLen, uint8_t *recvBuffer, size_t recvBufferLen, uint32_t *busyTx, uint32_t *busyRx);
+    bool waitForBusyState(bool stateToWaitFor, uint32_t timeout_us);
+    PN5180CommandClass commandClass(uint8_t command);
+    bool waitForIRQ(uint32_t irqMask, uint32_t timeout_us);
+    void updateShadow(uint8_t reg, uint32_t value, uint32_t orMask, uint32_t andMask);
+    void setRFState(bool on);
+    void init();
 };
 
-#endif // DEVICE_SPI
 #endif // PN5180_H
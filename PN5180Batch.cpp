@@ -0,0 +1,209 @@
+// NAME: PN5180Batch.cpp
+//
+// DESC: One write applied to every tag in the field.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+
+#include "PN5180Batch.h"
+#include "pn5180_trace.h"
+
+#if MBED_CONF_PN5180_BATCH_ENABLE
+
+PN5180Batch::PN5180Batch(PN5180ISO15693 &nfc)
+    : _nfc(nfc)
+{
+    memset(&_stats, 0, sizeof(_stats));
+    _start = 0;
+    _headerLen = 0;
+}
+
+uint16_t PN5180Batch::write(const uint8_t *uids, uint16_t numTags, const PN5180BatchWrite &spec, PN5180BatchResult *results)
+{
+    if (!begin(spec)) {
+        return 0;
+    }
+    uint16_t n = writeTags(uids, numTags, spec, results);
+    end();
+    return n;
+}
+
+/*
+ * Inventory the tags still answering and write to them, until a round finds
+ * no new tag. Tags done before are quiet and no longer take part in the
+ * inventory; one that missed its stay quiet or lost it answers again, it is
+ * skipped by its UID in the results.
+ */
+uint16_t PN5180Batch::writeAll(const PN5180BatchWrite &spec, PN5180BatchResult *results, uint16_t maxResults)
+{
+    if (!begin(spec)) {
+        return 0;
+    }
+    uint16_t n = 0;
+    while (n < maxResults) {
+        uint8_t numTags = 0;
+        ISO15693ErrorCode rc = _nfc.getInventoryMultiple(_uids, MBED_CONF_PN5180_BATCH_TAGS, &numTags);
+        _stats.rounds++;
+        if ((0 == numTags) && (ISO15693_EC_OK != rc) && (EC_NO_CARD != rc)) {
+            tr_debug("Batch inventory failed: %s\n", _nfc.errorToString(rc));
+        }
+
+        uint16_t numNew = 0;
+        for (uint8_t i=0; (i < numTags) && (n + numNew < maxResults); i++) {
+            if (!isDone(&_uids[8*i], results, n)) {
+                memmove(&_uids[8*numNew], &_uids[8*i], 8);
+                numNew++;
+            }
+        }
+        if (0 == numNew) {
+            break;
+        }
+        n += writeTags(_uids, numNew, spec, &results[n]);
+    }
+    end();
+    return n;
+}
+
+bool PN5180Batch::isDone(const uint8_t *uid, const PN5180BatchResult *results, uint16_t n)
+{
+    for (uint16_t i=0; i<n; i++) {
+        if (0 == memcmp(results[i].uid, uid, 8)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t PN5180Batch::getTagsPerSecond()
+{
+    if (0 == _stats.time_us) {
+        return 0;
+    }
+    return (uint32_t)((uint64_t)_stats.tags * 1000000 / _stats.time_us);
+}
+
+bool PN5180Batch::begin(const PN5180BatchWrite &spec)
+{
+    memset(&_stats, 0, sizeof(_stats));
+    if ((0 == spec.numBlocks) || (0 == spec.blockSize) || (spec.blockSize > 32) ||
+        (0L == spec.data) || ((spec.blockNo + spec.numBlocks) > 256)) {
+        tr_error("ERROR: Invalid batch write!\n");
+        return false;
+    }
+
+    // a selection pays off from the second exchange (10 byte SELECT vs. 8 bytes per frame)
+    bool select = (spec.numBlocks > 1) || spec.verify;
+    _frame[0] = select ? ISO15693_CF_SINGLESUBCARRIER_SELECTED : ISO15693_CF_SINGLESUBCARRIER_ADDRESSED;
+    _frame[1] = ISO15693_CMD_WRITESINGLEBLOCK;
+    _headerLen = select ? 2 : 10;
+
+    _start = _nfc.getMicros();
+    return true;
+}
+
+void PN5180Batch::end()
+{
+    _stats.time_us = _nfc.getMicros() - _start;
+    tr_debug("Batch: %d tags, %d failed, %lu us\n", _stats.tags, _stats.failed, (unsigned long)_stats.time_us);
+}
+
+uint16_t PN5180Batch::writeTags(const uint8_t *uids, uint16_t numTags, const PN5180BatchWrite &spec, PN5180BatchResult *results)
+{
+    for (uint16_t i=0; i<numTags; i++) {
+        writeTag(&uids[8*i], spec, &results[i]);
+    }
+    return numTags;
+}
+
+/*
+ * Write all blocks to one tag, then send it to the quiet state. A tag that
+ * stopped answering is left alone, it may have left the field.
+ */
+void PN5180Batch::writeTag(const uint8_t *uid, const PN5180BatchWrite &spec, PN5180BatchResult *result)
+{
+    memcpy(result->uid, uid, 8);
+    result->blocksWritten = 0;
+
+    ISO15693ErrorCode rc = ISO15693_EC_OK;
+    if (ISO15693_CF_SINGLESUBCARRIER_SELECTED == _frame[0]) {
+        rc = _nfc.select(result->uid);
+    }
+    else {
+        memcpy(&_frame[2], uid, 8);
+    }
+    for (uint8_t i=0; (ISO15693_EC_OK == rc) && (i < spec.numBlocks); i++) {
+        rc = writeBlock(result->uid, spec, i);
+        if ((ISO15693_EC_OK == rc) && spec.verify) {
+            rc = verifyBlock(result->uid, spec, i);
+        }
+        if (ISO15693_EC_OK == rc) {
+            result->blocksWritten++;
+        }
+    }
+    if (EC_NO_CARD != rc) {
+        _nfc.stayQuiet(result->uid);
+    }
+    result->rc = (int8_t)rc;
+
+    _stats.tags++;
+    if (ISO15693_EC_OK == rc) {
+        _stats.succeeded++;
+    }
+    else {
+        tr_debug("Batch write failed at block #%d: %s\n", spec.blockNo + result->blocksWritten, _nfc.errorToString(rc));
+        _stats.failed++;
+    }
+}
+
+/*
+ * Block i of the write, the frame header is shared by all tags of the batch
+ */
+ISO15693ErrorCode PN5180Batch::writeBlock(uint8_t *uid, const PN5180BatchWrite &spec, uint8_t i)
+{
+    uint8_t blockNo = spec.blockNo + i;
+    if (_nfc.isBlockLocked(uid, blockNo)) {
+        return ISO15693_EC_BLOCK_IS_LOCKED;
+    }
+
+    uint8_t len = _headerLen;
+    _frame[len++] = blockNo;
+    memcpy(&_frame[len], &spec.data[i * spec.blockSize], spec.blockSize);
+    len += spec.blockSize;
+
+    uint8_t *resultPtr;
+    ISO15693ErrorCode rc = _nfc.issueISO15693Command(_frame, len, &resultPtr);
+    if (ISO15693_EC_OK == rc) {
+        _nfc.releaseData();
+    }
+    else if (ISO15693_EC_BLOCK_IS_LOCKED == rc) {
+        _nfc.setBlockLocked(uid, blockNo, true);
+    }
+    return rc;
+}
+
+ISO15693ErrorCode PN5180Batch::verifyBlock(uint8_t *uid, const PN5180BatchWrite &spec, uint8_t i)
+{
+    uint8_t blockData[32];
+    ISO15693ErrorCode rc = _nfc.readSingleBlock(uid, spec.blockNo + i, blockData, spec.blockSize);
+    if (ISO15693_EC_OK != rc) {
+        return rc;
+    }
+    if (0 != memcmp(blockData, &spec.data[i * spec.blockSize], spec.blockSize)) {
+        return ISO15693_EC_BLOCK_NOT_PROGRAMMED;
+    }
+    return ISO15693_EC_OK;
+}
+
+#endif // MBED_CONF_PN5180_BATCH_ENABLE
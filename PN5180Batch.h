@@ -0,0 +1,108 @@
+// NAME: PN5180Batch.h
+//
+// DESC: One write applied to every tag in the field.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180BATCH_H
+#define PN5180BATCH_H
+
+#include "PN5180ISO15693.h"
+
+// Compile the batch layer (0 leaves it out)
+#ifndef MBED_CONF_PN5180_BATCH_ENABLE
+#define MBED_CONF_PN5180_BATCH_ENABLE 1
+#endif
+
+#if MBED_CONF_PN5180_BATCH_ENABLE
+
+// UIDs inventoried per round of PN5180Batch::writeAll()
+#ifndef MBED_CONF_PN5180_BATCH_TAGS
+#define MBED_CONF_PN5180_BATCH_TAGS 16
+#endif
+
+struct PN5180BatchWrite {
+    uint8_t blockNo;        // first block
+    uint8_t numBlocks;
+    uint8_t blockSize;      // up to 32 bytes
+    const uint8_t *data;    // numBlocks * blockSize bytes
+    bool verify;            // read every block back after writing
+};
+
+// outcome per tag
+struct PN5180BatchResult {
+    uint8_t uid[8];
+    int8_t rc;              // ISO15693ErrorCode of the first failing command
+    uint8_t blocksWritten;
+};
+
+struct PN5180BatchStats {
+    uint16_t tags;
+    uint16_t succeeded;
+    uint16_t failed;
+    uint16_t rounds;        // inventories of writeAll()
+    uint32_t time_us;       // from the start of the batch until the last tag was done
+};
+
+/*
+ * Applies one write to a whole set of tags, e.g. a lot number to block 0 of
+ * every tag on a tray. For each tag, the blocks are written (and read back
+ * with verify), then the tag is sent to the quiet state: it no longer answers
+ * inventories, so writeAll() can inventory again until no unprocessed tag is
+ * left. Failing tags are sent to quiet as well, their result holds the error.
+ * A tag answering again is not written twice, e.g. one that did not answer
+ * the write and was therefore not sent to quiet.
+ *
+ * The write frames are built once per batch, only the block number and data
+ * are filled in per block. A tag is selected first when it takes more than
+ * one exchange, so the frames go without the 8 byte UID; a single write is
+ * sent addressed. Quiet tags return to the ready state with resetToReady(uid)
+ * or when the field is switched off.
+ */
+class PN5180Batch
+{
+public:
+    PN5180Batch(PN5180ISO15693 &nfc);
+
+    // write to numTags tags (8 bytes per UID, e.g. from getInventoryMultiple), one result per tag
+    uint16_t write(const uint8_t *uids, uint16_t numTags, const PN5180BatchWrite &spec, PN5180BatchResult *results);
+    // inventory and write until no new tag answers or maxResults tags are done
+    uint16_t writeAll(const PN5180BatchWrite &spec, PN5180BatchResult *results, uint16_t maxResults);
+
+    const PN5180BatchStats & getStats() { return _stats; }
+    // tags processed per second by the last batch
+    uint32_t getTagsPerSecond();
+
+private:
+    PN5180ISO15693 &_nfc;
+    PN5180BatchStats _stats;
+    uint32_t _start;
+
+    //      flags, cmd, uid (opt.), blockNo, blockData (max. 32 bytes)
+    uint8_t _frame[2+8+1+32];
+    uint8_t _headerLen;
+    uint8_t _uids[8 * MBED_CONF_PN5180_BATCH_TAGS];
+
+    bool begin(const PN5180BatchWrite &spec);
+    void end();
+    uint16_t writeTags(const uint8_t *uids, uint16_t numTags, const PN5180BatchWrite &spec, PN5180BatchResult *results);
+    void writeTag(const uint8_t *uid, const PN5180BatchWrite &spec, PN5180BatchResult *result);
+    bool isDone(const uint8_t *uid, const PN5180BatchResult *results, uint16_t n);
+    ISO15693ErrorCode writeBlock(uint8_t *uid, const PN5180BatchWrite &spec, uint8_t i);
+    ISO15693ErrorCode verifyBlock(uint8_t *uid, const PN5180BatchWrite &spec, uint8_t i);
+};
+
+#endif // MBED_CONF_PN5180_BATCH_ENABLE
+#endif // PN5180BATCH_H
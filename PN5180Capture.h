@@ -0,0 +1,57 @@
+// NAME: PN5180Capture.h
+//
+// DESC: Binary log format of the SPI conversation with a PN5180.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180CAPTURE_H
+#define PN5180CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Record the SPI conversation on request, see PN5180::startCapture() (0 leaves it out)
+#ifndef MBED_CONF_PN5180_CAPTURE_ENABLE
+#define MBED_CONF_PN5180_CAPTURE_ENABLE 1
+#endif
+
+/*
+ * A capture starts with the header "P5C" and the format version, followed by
+ * one record per host interface command or reset pulse. Numbers are unsigned
+ * LEB128 varints (7 bits per byte, LSB first), times in microseconds.
+ *
+ *   FRAME: tag 0x01, dt, txLen, tx bytes, rxLen, rx bytes, busyTx, busyRx, status
+ *   RESET: tag 0x02, dt
+ *
+ * dt is the time since the start of the previous record (since the capture
+ * started for the first one). busyTx and busyRx are the BUSY phases after the
+ * send and the receive frame, from NSS deassert until BUSY is low. status is 0
+ * when the command completed; after a BUSY timeout it is 1 and no rx bytes are
+ * recorded. IRQ and RF state are captured with the register reads (IRQ_STATUS,
+ * RX_STATUS, RF_STATUS) the driver polls them with.
+ */
+#define PN5180_CAPTURE_MAGIC        "P5C"
+#define PN5180_CAPTURE_VERSION      1
+
+#define PN5180_CAPTURE_FRAME        0x01
+#define PN5180_CAPTURE_RESET        0x02
+
+#define PN5180_CAPTURE_OK           0
+#define PN5180_CAPTURE_FAILED       1
+
+// appends len bytes to the capture; called from within the host interface commands
+typedef void (*PN5180CaptureWriter)(void *context, const uint8_t *data, size_t len);
+
+#endif // PN5180CAPTURE_H
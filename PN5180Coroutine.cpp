@@ -0,0 +1,263 @@
+// NAME: PN5180Coroutine.cpp
+//
+// DESC: C++20 coroutine API over the non-blocking PN5180ISO15693Async engine.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+
+#include "PN5180Coroutine.h"
+
+#if PN5180_COROUTINES
+
+#include "pn5180_trace.h"
+
+static_assert(MBED_CONF_PN5180_COROUTINE_FRAMES <= 32, "PN5180FramePool supports up to 32 frames");
+
+PN5180FramePool::Frame PN5180FramePool::_frames[MBED_CONF_PN5180_COROUTINE_FRAMES];
+uint32_t PN5180FramePool::_used = 0;
+
+void * PN5180FramePool::allocate(size_t size)
+{
+    if (size > sizeof(Frame)) {
+        tr_error("Coroutine frame of %d bytes exceeds MBED_CONF_PN5180_COROUTINE_FRAME_SIZE\n", (int)size);
+        return 0;
+    }
+    for (uint8_t i=0; i<MBED_CONF_PN5180_COROUTINE_FRAMES; i++) {
+        if (0 == (_used & (1UL << i))) {
+            _used |= (1UL << i);
+            return &_frames[i];
+        }
+    }
+    return 0;
+}
+
+void PN5180FramePool::release(void *frame)
+{
+    size_t i = (Frame *)frame - _frames;
+    _used &= ~(1UL << i);
+}
+
+uint8_t PN5180FramePool::available()
+{
+    uint8_t n = 0;
+    for (uint8_t i=0; i<MBED_CONF_PN5180_COROUTINE_FRAMES; i++) {
+        if (0 == (_used & (1UL << i))) {
+            n++;
+        }
+    }
+    return n;
+}
+
+PN5180Task & PN5180Task::operator=(PN5180Task &&other) noexcept
+{
+    if (this != &other) {
+        if (_handle) {
+            _handle.destroy();
+        }
+        _handle = other._handle;
+        other._handle = 0;
+    }
+    return *this;
+}
+
+PN5180Task::~PN5180Task()
+{
+    if (_handle) {
+        _handle.destroy();
+    }
+}
+
+// start the awaited task, it resumes the awaiting one when finished
+std::coroutine_handle<> PN5180Task::await_suspend(std::coroutine_handle<> awaiting) noexcept
+{
+    _handle.promise().continuation = awaiting;
+    return _handle;
+}
+
+ISO15693ErrorCode PN5180Task::await_resume() noexcept
+{
+    if (!_handle) {
+        return ISO15693_EC_UNKNOWN_ERROR; // no frame available
+    }
+    return _handle.promise().result;
+}
+
+PN5180Scheduler::PN5180Scheduler()
+{
+    _numReaders = 0;
+    _readyHead = 0;
+    _readyCount = 0;
+    _numTasks = 0;
+}
+
+bool PN5180Scheduler::spawn(PN5180Task &&task)
+{
+    if (!task._handle) {
+        return false;
+    }
+    for (uint8_t i=0; i<MBED_CONF_PN5180_COROUTINE_FRAMES; i++) {
+        if (!_tasks[i]) {
+            _tasks[i] = task._handle;
+            task._handle = 0;
+            _numTasks++;
+            ready(_tasks[i]);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PN5180Scheduler::addReader(PN5180CoReader *reader)
+{
+    if (_numReaders >= MBED_CONF_PN5180_COROUTINE_READERS) {
+        tr_error("Too many readers for PN5180Scheduler\n");
+        return false;
+    }
+    _readers[_numReaders++] = reader;
+    return true;
+}
+
+void PN5180Scheduler::ready(std::coroutine_handle<> handle)
+{
+    _ready[(_readyHead + _readyCount) % MBED_CONF_PN5180_COROUTINE_FRAMES] = handle;
+    _readyCount++;
+}
+
+bool PN5180Scheduler::runOnce()
+{
+    for (uint8_t i=0; i<_numReaders; i++) {
+        _readers[i]->poll();
+    }
+
+    // coroutines made ready while resuming run in the next round
+    for (uint8_t n=_readyCount; n>0; n--) {
+        std::coroutine_handle<> handle = _ready[_readyHead];
+        _readyHead = (_readyHead + 1) % MBED_CONF_PN5180_COROUTINE_FRAMES;
+        _readyCount--;
+        handle.resume();
+    }
+
+    for (uint8_t i=0; i<MBED_CONF_PN5180_COROUTINE_FRAMES; i++) {
+        if (_tasks[i] && _tasks[i].done()) {
+            _tasks[i].destroy();
+            _tasks[i] = 0;
+            _numTasks--;
+        }
+    }
+    return (_numTasks > 0);
+}
+
+void PN5180CoOperation::await_suspend(std::coroutine_handle<> handle) noexcept
+{
+    _handle = handle;
+    _reader.submit(this);
+}
+
+void PN5180CoOperation::completed(void *context, ISO15693ErrorCode rc)
+{
+    PN5180CoOperation *op = (PN5180CoOperation *)context;
+    op->_rc = rc;
+    op->_reader._scheduler.ready(op->_handle);
+}
+
+bool PN5180CoInventory::start()
+{
+    if (!_reader._async.inventoryAsync(_uid, completed, this)) {
+        _rc = ISO15693_EC_UNKNOWN_ERROR;
+        return false;
+    }
+    return true;
+}
+
+bool PN5180CoSystemInfo::start()
+{
+    if (!_reader._async.getSystemInfoAsync(_uid, _blockSize, _numBlocks, completed, this)) {
+        _rc = ISO15693_EC_UNKNOWN_ERROR;
+        return false;
+    }
+    return true;
+}
+
+bool PN5180CoBlocks::start()
+{
+    bool started;
+    if (_write) {
+        started = _reader._async.writeBlocksAsync(_uid, _blockNo, _numBlocks, _blockData, _blockSize, completed, this);
+    }
+    else {
+        started = _reader._async.readBlocksAsync(_uid, _blockNo, _numBlocks, _blockData, _blockSize, completed, this);
+    }
+    if (!started) {
+        _rc = ISO15693_EC_OPTION_NOT_SUPPORTED; // invalid block range
+    }
+    return started;
+}
+
+bool PN5180CoRegister::start()
+{
+    bool ok;
+    if (_write) {
+        ok = _reader._nfc.writeRegister(_reg, _value);
+    }
+    else {
+        ok = _reader._nfc.readRegister(_reg, _result);
+    }
+    _rc = ok ? ISO15693_EC_OK : ISO15693_EC_UNKNOWN_ERROR;
+    return false;
+}
+
+PN5180CoReader::PN5180CoReader(PN5180ISO15693 &nfc, PN5180Scheduler &scheduler)
+    : _nfc(nfc), _async(nfc), _scheduler(scheduler)
+{
+    _head = 0;
+    _tail = 0;
+    _scheduler.addReader(this);
+}
+
+void PN5180CoReader::submit(PN5180CoOperation *op)
+{
+    op->_next = 0;
+    if (_tail) {
+        _tail->_next = op;
+    }
+    else {
+        _head = op;
+    }
+    _tail = op;
+    dispatch();
+}
+
+// start queued operations while the async engine is free
+void PN5180CoReader::dispatch()
+{
+    while (_head && !_async.isBusy()) {
+        PN5180CoOperation *op = _head;
+        _head = op->_next;
+        if (0 == _head) {
+            _tail = 0;
+        }
+        if (!op->start()) {
+            _scheduler.ready(op->_handle);
+        }
+    }
+}
+
+void PN5180CoReader::poll()
+{
+    _async.poll();
+    dispatch();
+}
+
+#endif // PN5180_COROUTINES
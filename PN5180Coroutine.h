@@ -0,0 +1,299 @@
+// NAME: PN5180Coroutine.h
+//
+// DESC: C++20 coroutine API over the non-blocking PN5180ISO15693Async engine.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180COROUTINE_H
+#define PN5180COROUTINE_H
+
+// Only available when compiled as C++20 with coroutine support
+#if defined (__cpp_impl_coroutine) && (__cpp_impl_coroutine >= 201902L) && defined (__has_include)
+#if __has_include(<coroutine>)
+#define PN5180_COROUTINES 1
+#endif
+#endif
+
+#if PN5180_COROUTINES
+#include "PN5180ISO15693Async.h"
+#if !MBED_CONF_PN5180_ASYNC_ENABLE
+#undef PN5180_COROUTINES // built on PN5180ISO15693Async
+#endif
+#endif
+
+#if PN5180_COROUTINES
+
+#include <coroutine>
+
+// Coroutine frames, shared by all tasks (max. 32)
+#ifndef MBED_CONF_PN5180_COROUTINE_FRAMES
+#define MBED_CONF_PN5180_COROUTINE_FRAMES 8
+#endif
+// Size of a frame in bytes; a coroutine with a larger frame fails to start
+#ifndef MBED_CONF_PN5180_COROUTINE_FRAME_SIZE
+#define MBED_CONF_PN5180_COROUTINE_FRAME_SIZE 384
+#endif
+// Readers driven by one scheduler
+#ifndef MBED_CONF_PN5180_COROUTINE_READERS
+#define MBED_CONF_PN5180_COROUTINE_READERS 2
+#endif
+
+/*
+ * Fixed pool of coroutine frames. Frames are returned when a coroutine
+ * finishes and are reused by the next one, nothing is taken from the heap.
+ */
+class PN5180FramePool
+{
+public:
+    static void *allocate(size_t size);
+    static void release(void *frame);
+    static uint8_t available();
+
+private:
+    union Frame {
+        max_align_t align;
+        uint8_t data[MBED_CONF_PN5180_COROUTINE_FRAME_SIZE];
+    };
+    static Frame _frames[MBED_CONF_PN5180_COROUTINE_FRAMES];
+    static uint32_t _used; // one bit per frame
+};
+
+/*
+ * Coroutine returning an ISO15693ErrorCode with co_return. A task starts
+ * suspended; it runs either as a top level task after
+ * PN5180Scheduler::spawn() or as part of a task awaiting it with co_await.
+ * When no frame is free, the task is not valid and awaiting it returns
+ * ISO15693_EC_UNKNOWN_ERROR.
+ */
+class PN5180Task
+{
+public:
+    struct promise_type {
+        ISO15693ErrorCode result = ISO15693_EC_OK;
+        std::coroutine_handle<> continuation;
+
+        static void *operator new(size_t size) noexcept { return PN5180FramePool::allocate(size); }
+        static void operator delete(void *frame) noexcept { PN5180FramePool::release(frame); }
+        static PN5180Task get_return_object_on_allocation_failure() noexcept { return PN5180Task(); }
+
+        PN5180Task get_return_object() noexcept {
+            return PN5180Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        // resume the awaiting task, if any
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                if (h.promise().continuation) {
+                    return h.promise().continuation;
+                }
+                return std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+        FinalAwaiter final_suspend() noexcept { return {}; }
+
+        void return_value(ISO15693ErrorCode rc) noexcept { result = rc; }
+        void unhandled_exception() noexcept {}
+    };
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    PN5180Task() : _handle(0) {}
+    PN5180Task(PN5180Task &&other) noexcept : _handle(other._handle) { other._handle = 0; }
+    PN5180Task & operator=(PN5180Task &&other) noexcept;
+    PN5180Task(const PN5180Task &) = delete;
+    PN5180Task & operator=(const PN5180Task &) = delete;
+    ~PN5180Task();
+
+    bool valid() const { return (bool)_handle; }
+
+    bool await_ready() noexcept { return !_handle || _handle.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept;
+    ISO15693ErrorCode await_resume() noexcept;
+
+private:
+    friend class PN5180Scheduler;
+    explicit PN5180Task(Handle handle) : _handle(handle) {}
+    Handle _handle;
+};
+
+class PN5180CoReader;
+
+/*
+ * Single-threaded scheduler. runOnce() polls the readers and resumes the
+ * coroutines whose operations completed; call it from the main loop or a
+ * dedicated thread, never from more than one thread.
+ */
+class PN5180Scheduler
+{
+public:
+    PN5180Scheduler();
+
+    // run a task to completion, its frame is released afterwards
+    bool spawn(PN5180Task &&task);
+
+    // returns true while tasks are alive
+    bool runOnce();
+    uint8_t getNumTasks() { return _numTasks; }
+
+private:
+    friend class PN5180CoReader;
+    friend class PN5180CoOperation;
+
+    PN5180CoReader *_readers[MBED_CONF_PN5180_COROUTINE_READERS];
+    uint8_t _numReaders;
+
+    // each suspended coroutine is ready at most once
+    std::coroutine_handle<> _ready[MBED_CONF_PN5180_COROUTINE_FRAMES];
+    uint8_t _readyHead;
+    uint8_t _readyCount;
+
+    PN5180Task::Handle _tasks[MBED_CONF_PN5180_COROUTINE_FRAMES];
+    uint8_t _numTasks;
+
+    bool addReader(PN5180CoReader *reader);
+    void ready(std::coroutine_handle<> handle);
+};
+
+/*
+ * Awaitable reader operation. It is part of the awaiting coroutine's frame,
+ * so awaiting allocates nothing. Operations of all coroutines using the same
+ * reader are queued and run one after the other.
+ */
+class PN5180CoOperation
+{
+public:
+    bool await_ready() noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) noexcept;
+    ISO15693ErrorCode await_resume() noexcept { return _rc; }
+
+protected:
+    PN5180CoOperation(PN5180CoReader &reader) : _reader(reader), _next(0), _rc(ISO15693_EC_OK) {}
+    // true when started on the async engine, false when finished with _rc
+    virtual bool start() = 0;
+    static void completed(void *context, ISO15693ErrorCode rc);
+
+    PN5180CoReader &_reader;
+
+private:
+    friend class PN5180CoReader;
+    PN5180CoOperation *_next;
+    std::coroutine_handle<> _handle;
+
+protected:
+    ISO15693ErrorCode _rc;
+};
+
+class PN5180CoInventory : public PN5180CoOperation
+{
+public:
+    PN5180CoInventory(PN5180CoReader &reader, uint8_t *uid) : PN5180CoOperation(reader), _uid(uid) {}
+protected:
+    virtual bool start();
+private:
+    uint8_t *_uid;
+};
+
+class PN5180CoSystemInfo : public PN5180CoOperation
+{
+public:
+    PN5180CoSystemInfo(PN5180CoReader &reader, uint8_t *uid, uint8_t *blockSize, uint8_t *numBlocks)
+        : PN5180CoOperation(reader), _uid(uid), _blockSize(blockSize), _numBlocks(numBlocks) {}
+protected:
+    virtual bool start();
+private:
+    uint8_t *_uid;
+    uint8_t *_blockSize;
+    uint8_t *_numBlocks;
+};
+
+class PN5180CoBlocks : public PN5180CoOperation
+{
+public:
+    PN5180CoBlocks(PN5180CoReader &reader, bool write, uint8_t *uid, uint8_t blockNo, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize)
+        : PN5180CoOperation(reader), _write(write), _uid(uid), _blockNo(blockNo), _numBlocks(numBlocks), _blockData(blockData), _blockSize(blockSize) {}
+protected:
+    virtual bool start();
+private:
+    bool _write;
+    uint8_t *_uid;
+    uint8_t _blockNo;
+    uint16_t _numBlocks;
+    uint8_t *_blockData;
+    uint8_t _blockSize;
+};
+
+// host interface commands finish at once, but wait for the RF exchange in flight
+class PN5180CoRegister : public PN5180CoOperation
+{
+public:
+    PN5180CoRegister(PN5180CoReader &reader, bool write, uint8_t reg, uint32_t value, uint32_t *result)
+        : PN5180CoOperation(reader), _write(write), _reg(reg), _value(value), _result(result) {}
+protected:
+    virtual bool start();
+private:
+    bool _write;
+    uint8_t _reg;
+    uint32_t _value;
+    uint32_t *_result;
+};
+
+/*
+ * A reader driven by a scheduler. All methods return awaitables, e.g.
+ *   ISO15693ErrorCode rc = co_await reader.readBlocks(uid, 0, 8, data, 4);
+ * The UID and result buffers must live in the coroutine or beyond.
+ */
+class PN5180CoReader
+{
+public:
+    PN5180CoReader(PN5180ISO15693 &nfc, PN5180Scheduler &scheduler);
+
+    PN5180CoInventory inventory(uint8_t *uid) { return PN5180CoInventory(*this, uid); }
+    PN5180CoSystemInfo getSystemInfo(uint8_t *uid, uint8_t *blockSize, uint8_t *numBlocks) {
+        return PN5180CoSystemInfo(*this, uid, blockSize, numBlocks);
+    }
+    PN5180CoBlocks readBlocks(uint8_t *uid, uint8_t blockNo, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize) {
+        return PN5180CoBlocks(*this, false, uid, blockNo, numBlocks, blockData, blockSize);
+    }
+    PN5180CoBlocks writeBlocks(uint8_t *uid, uint8_t blockNo, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize) {
+        return PN5180CoBlocks(*this, true, uid, blockNo, numBlocks, blockData, blockSize);
+    }
+    PN5180CoRegister readRegister(uint8_t reg, uint32_t *value) { return PN5180CoRegister(*this, false, reg, 0, value); }
+    PN5180CoRegister writeRegister(uint8_t reg, uint32_t value) { return PN5180CoRegister(*this, true, reg, value, 0); }
+
+    PN5180ISO15693 & getReader() { return _nfc; }
+
+private:
+    friend class PN5180Scheduler;
+    friend class PN5180CoOperation;
+    friend class PN5180CoInventory;
+    friend class PN5180CoSystemInfo;
+    friend class PN5180CoBlocks;
+    friend class PN5180CoRegister;
+
+    PN5180ISO15693 &_nfc;
+    PN5180ISO15693Async _async;
+    PN5180Scheduler &_scheduler;
+    PN5180CoOperation *_head;   // queued operations
+    PN5180CoOperation *_tail;
+
+    void submit(PN5180CoOperation *op);
+    void dispatch();
+    void poll();
+};
+
+#endif // PN5180_COROUTINES
+#endif // PN5180COROUTINE_H
@@ -0,0 +1,196 @@
+// NAME: PN5180FieldScheduler.cpp
+//
+// DESC: RF field duty cycling with an adaptive scan period.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+
+#include "PN5180FieldScheduler.h"
+#include "pn5180_trace.h"
+
+#if MBED_CONF_PN5180_FIELD_SCHEDULER_ENABLE
+
+PN5180FieldScheduler::PN5180FieldScheduler(PN5180ISO15693 &nfc)
+    : _nfc(nfc)
+{
+    _schedule.minPeriod_ms = 100;
+    _schedule.maxPeriod_ms = 2000;
+    _schedule.holdWindows = 10;
+    _schedule.backoffPercent = 100;
+    _schedule.settle_us = 1000;
+    _callback = 0L;
+    _context = 0L;
+    _started = false;
+    _period_ms = _schedule.minPeriod_ms;
+    _emptyWindows = 0;
+    _nextWindow = 0;
+    _avgWindow_us = 0;
+    _avgFieldOn_us = 0;
+    resetStats();
+}
+
+void PN5180FieldScheduler::setSchedule(const PN5180FieldSchedule &schedule)
+{
+    _schedule = schedule;
+    if (_schedule.minPeriod_ms < 1) {
+        _schedule.minPeriod_ms = 1;
+    }
+    if (_schedule.maxPeriod_ms < _schedule.minPeriod_ms) {
+        _schedule.maxPeriod_ms = _schedule.minPeriod_ms;
+    }
+    if (_period_ms < _schedule.minPeriod_ms) {
+        _period_ms = _schedule.minPeriod_ms;
+    }
+    if (_period_ms > _schedule.maxPeriod_ms) {
+        _period_ms = _schedule.maxPeriod_ms;
+    }
+}
+
+void PN5180FieldScheduler::setCallback(PN5180FieldCallback callback, void *context)
+{
+    _callback = callback;
+    _context = context;
+}
+
+void PN5180FieldScheduler::resetStats()
+{
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+bool PN5180FieldScheduler::start()
+{
+    if (_nfc.isRFOn() && !_nfc.setRF_off()) {
+        return false;
+    }
+    _started = true;
+    trigger();
+    return true;
+}
+
+void PN5180FieldScheduler::trigger()
+{
+    _period_ms = _schedule.minPeriod_ms;
+    _emptyWindows = 0;
+    _nextWindow = _nfc.getMicros();
+}
+
+uint32_t PN5180FieldScheduler::getTimeToNextWindow_us()
+{
+    int32_t remaining = (int32_t)(_nextWindow - _nfc.getMicros());
+    return (remaining > 0) ? (uint32_t)remaining : 0;
+}
+
+bool PN5180FieldScheduler::poll()
+{
+    if (!_started || (getTimeToNextWindow_us() > 0)) {
+        return false;
+    }
+    runWindow();
+    return true;
+}
+
+/*
+ * Field on, settle, inventory, field off. The tags found are reported after
+ * the field is off again, so slow callbacks do not cost field time.
+ */
+void PN5180FieldScheduler::runWindow()
+{
+    uint32_t start = _nfc.getMicros();
+    uint32_t fieldOff = start;
+    uint8_t numTags = 0;
+    bool activity = false;
+    bool failed = false;
+
+    if (_nfc.setRF_on()) {
+        if (_schedule.settle_us > 0) {
+            _nfc.delayMicros(_schedule.settle_us);
+        }
+        ISO15693ErrorCode rc = _nfc.getInventoryMultiple(_uids, MBED_CONF_PN5180_FIELD_SCHEDULER_TAGS, &numTags);
+        activity = (numTags > 0) || (EC_COLLISION == rc);
+        failed = (ISO15693_EC_OK != rc) && (EC_NO_CARD != rc) && (EC_COLLISION != rc);
+    }
+    else {
+        failed = true;
+    }
+    fieldOff = _nfc.getMicros();
+    if (!_nfc.setRF_off()) {
+        failed = true;
+    }
+
+    uint32_t length = _nfc.getMicros() - start;
+    uint32_t fieldOn = fieldOff - start;
+    _stats.windows++;
+    _stats.fieldOnTime_us += fieldOn;
+    _stats.lastWindow_us = length;
+    if (length > _stats.maxWindow_us) {
+        _stats.maxWindow_us = length;
+    }
+    if (activity) {
+        _stats.activeWindows++;
+    }
+    if (failed) {
+        tr_debug("Scan window failed\n");
+        _stats.failedWindows++;
+    }
+    _avgWindow_us = (1 == _stats.windows) ? length : ((3 * _avgWindow_us + length) / 4);
+    _avgFieldOn_us = (1 == _stats.windows) ? fieldOn : ((3 * _avgFieldOn_us + fieldOn) / 4);
+
+    adapt(activity);
+    _nextWindow = start + _period_ms * 1000;
+
+    if (_callback) {
+        for (uint8_t i=0; i<numTags; i++) {
+            _callback(_context, &_uids[8 * i]);
+        }
+    }
+}
+
+void PN5180FieldScheduler::adapt(bool activity)
+{
+    if (activity) {
+        _period_ms = _schedule.minPeriod_ms;
+        _emptyWindows = 0;
+        return;
+    }
+    if (_emptyWindows < 255) {
+        _emptyWindows++;
+    }
+    if (_emptyWindows <= _schedule.holdWindows) {
+        return;
+    }
+    uint32_t step = (uint32_t)(((uint64_t)_period_ms * _schedule.backoffPercent) / 100);
+    _period_ms += (step > 0) ? step : 1;
+    if (_period_ms > _schedule.maxPeriod_ms) {
+        _period_ms = _schedule.maxPeriod_ms;
+    }
+}
+
+uint32_t PN5180FieldScheduler::getExpectedOnRatio_ppm()
+{
+    uint64_t ppm = ((uint64_t)_avgFieldOn_us * 1000) / _period_ms;
+    return (ppm > 1000000) ? 1000000 : (uint32_t)ppm;
+}
+
+uint32_t PN5180FieldScheduler::getWorstCaseLatency_us()
+{
+    return _period_ms * 1000 + _avgWindow_us;
+}
+
+uint32_t PN5180FieldScheduler::getMaxLatency_us()
+{
+    return _schedule.maxPeriod_ms * 1000 + _avgWindow_us;
+}
+
+#endif // MBED_CONF_PN5180_FIELD_SCHEDULER_ENABLE
@@ -0,0 +1,121 @@
+// NAME: PN5180FieldScheduler.h
+//
+// DESC: RF field duty cycling with an adaptive scan period.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180FIELDSCHEDULER_H
+#define PN5180FIELDSCHEDULER_H
+
+#include "PN5180ISO15693.h"
+
+// Compile the RF field scheduler (0 leaves it out)
+#ifndef MBED_CONF_PN5180_FIELD_SCHEDULER_ENABLE
+#define MBED_CONF_PN5180_FIELD_SCHEDULER_ENABLE 1
+#endif
+
+#if MBED_CONF_PN5180_FIELD_SCHEDULER_ENABLE
+
+// UIDs inventoried per scan window, further tags are left for the next window
+#ifndef MBED_CONF_PN5180_FIELD_SCHEDULER_TAGS
+#define MBED_CONF_PN5180_FIELD_SCHEDULER_TAGS 16
+#endif
+
+struct PN5180FieldSchedule {
+    uint32_t minPeriod_ms;  // scan period after activity
+    uint32_t maxPeriod_ms;  // longest period after the field stayed empty
+    uint8_t holdWindows;    // empty windows at minPeriod before backing off
+    uint8_t backoffPercent; // period increase per further empty window, e.g. 100 doubles it
+    uint16_t settle_us;     // field on before the inventory, for the tags to power up
+};
+
+struct PN5180FieldStats {
+    uint32_t windows;           // scan windows run
+    uint32_t activeWindows;     // windows that found a tag
+    uint32_t failedWindows;     // windows with RF or SPI errors
+    uint64_t fieldOnTime_us;    // from RF_ON until RF_OFF, sum of all windows
+    uint32_t lastWindow_us;     // length of the last window
+    uint32_t maxWindow_us;
+};
+
+// called for every tag found in a scan window
+typedef void (*PN5180FieldCallback)(void *context, const uint8_t *uid);
+
+/*
+ * Scans in short windows instead of keeping the RF field on: the field is
+ * switched on, the tags are inventoried with getInventoryMultiple() and the
+ * field is switched off again. Windows start every scan period, which adapts
+ * to the activity: a window finding a tag sets the period to minPeriod_ms,
+ * it is kept for holdWindows empty windows and then grows by backoffPercent
+ * per empty window up to maxPeriod_ms. trigger() schedules a window at once,
+ * e.g. on a motion sensor.
+ *
+ * poll() runs a window when it is due and returns immediately otherwise, a
+ * window blocks for a few milliseconds. Between windows the application may
+ * sleep for getTimeToNextWindow_us(). The reader must have been set up with
+ * setupRF() before, the scheduler owns the field afterwards.
+ *
+ * The field on ratio and the worst case detection latency (a tag arriving
+ * right after the inventory of a window is found by the end of the next one)
+ * are derived from the current period and the measured window length.
+ */
+class PN5180FieldScheduler
+{
+public:
+    PN5180FieldScheduler(PN5180ISO15693 &nfc);
+
+    void setSchedule(const PN5180FieldSchedule &schedule);
+    const PN5180FieldSchedule & getSchedule() { return _schedule; }
+    void setCallback(PN5180FieldCallback callback, void *context);
+
+    // switch the field off and schedule the first window now
+    bool start();
+    // run a window if one is due, returns true if it ran
+    bool poll();
+    void trigger();
+    uint32_t getTimeToNextWindow_us();
+
+    uint32_t getPeriod_ms() { return _period_ms; }
+    // expected share of time with the field on at the current period, in ppm
+    uint32_t getExpectedOnRatio_ppm();
+    // longest time from a tag entering the field until it is reported
+    uint32_t getWorstCaseLatency_us();
+    // the same at maxPeriod_ms, i.e. for the first tag after a quiet time
+    uint32_t getMaxLatency_us();
+    const PN5180FieldStats & getStats() { return _stats; }
+    void resetStats();
+
+private:
+    PN5180ISO15693 &_nfc;
+    PN5180FieldSchedule _schedule;
+    PN5180FieldCallback _callback;
+    void *_context;
+
+    bool _started;
+    uint32_t _period_ms;
+    uint8_t _emptyWindows;      // since the last activity
+    uint32_t _nextWindow;       // microsecond tick the next window is due
+    uint32_t _avgWindow_us;     // running averages of the window length
+    uint32_t _avgFieldOn_us;    // and of the field on time within
+    PN5180FieldStats _stats;
+
+    uint8_t _uids[8 * MBED_CONF_PN5180_FIELD_SCHEDULER_TAGS];
+
+    void runWindow();
+    void adapt(bool activity);
+};
+
+#endif // MBED_CONF_PN5180_FIELD_SCHEDULER_ENABLE
+#endif // PN5180FIELDSCHEDULER_H
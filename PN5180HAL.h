@@ -0,0 +1,54 @@
+// NAME: PN5180HAL.h
+//
+// DESC: Hardware abstraction of the PN5180 host interface.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180HAL_H
+#define PN5180HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Everything the driver needs from the platform: the SPI bus with NSS, the
+ * RESET and BUSY lines and a microsecond clock. PN5180MbedHAL is used when
+ * the reader is constructed from pin names; other backends (e.g. the chip
+ * simulator in host/) are passed to the constructor taking a PN5180HAL.
+ */
+class PN5180HAL
+{
+public:
+    virtual ~PN5180HAL() {}
+
+    // configure the SPI bus: max. 7 Mbps, CPOL=0, CPHA=0
+    virtual void begin() = 0;
+
+    virtual void setNSS(bool level) = 0;
+    virtual void setReset(bool level) = 0;
+    virtual bool getBusy() = 0;
+
+    // full duplex transfer of one SPI frame, tx may be NULL (sends 0xff), rx may be NULL
+    virtual void transfer(const uint8_t *tx, uint8_t *rx, size_t len) = 0;
+
+    // free running microsecond clock, wraps around
+    virtual uint32_t micros() = 0;
+    // busy-wait
+    virtual void delayMicros(uint32_t us) = 0;
+    // give the CPU away, i.e. sleep the calling thread under an RTOS
+    virtual void sleepMillis(uint32_t ms) { delayMicros(ms * 1000); }
+};
+
+#endif // PN5180HAL_H
@@ -21,9 +21,43 @@
 #include "pn5180_trace.h"
 #include <locale>
 
+#if defined (DEVICE_SPI)
 PN5180ISO15693::PN5180ISO15693(PinName mosi, PinName miso, PinName sck, PinName cs, PinName reset, PinName busy) 
     : PN5180(mosi, miso, sck, cs, reset, busy) 
 {
+    init();
+}
+#endif
+
+PN5180ISO15693::PN5180ISO15693(PN5180HAL &hal) 
+    : PN5180(hal) 
+{
+    init();
+}
+
+void PN5180ISO15693::init() 
+{
+    _selected = false;
+    _singleTagMode = false;
+    clearInventoryFilter();
+    _inventoryMode = ISO15693_INVENTORY_ADAPTIVE;
+    memset(&_inventoryStats, 0, sizeof(_inventoryStats));
+    _population = 0;
+    _retryPolicy.retries = 0;
+    _retryPolicy.backoff_ms = 0;
+    _retryPolicy.cycleRF = false;
+    _manufacturerCode = ISO15693_MFG_NXP;
+#if MBED_CONF_PN5180_METRICS_ENABLE
+    _metricsSequence = 0;
+#endif
+    _exchangeFlags = 0;
+    _exchangeTxDone = false;
+    _exchangeStart = 0;
+    _exchangeTxTime = 0;
+    _exchangeAirTime = 0;
+    _exchangeResponseTimeout = MBED_CONF_PN5180_ISO15693_RESPONSE_TIMEOUT_US;
+    resetErrorCounters();
+    clearLockMap();
 }
 
 /*
@@ -35,10 +69,8 @@ PN5180ISO15693::PN5180ISO15693(PinName mosi, PinName miso, PinName sck, PinName
  */
 ISO15693ErrorCode PN5180ISO15693::getInventory(uint8_t *uid) 
 {
-    //                     Flags,  CMD, maskLen
-    uint8_t inventory[] = { 0x26, ISO15693_CMD_INVENTORY, 0x00 };
-    //                        |\- inventory flag + high data rate
-    //                        \-- 1 slot: only one card, no AFI field present
+    uint8_t inventory[12];
+    uint8_t inventoryLen = buildInventoryRequest(inventory, _inventoryFilter.maskLen, _inventoryFilter.mask, false);
     tr_debug("Get Inventory...\n");
 
     for (int i=0; i<8; i++) {
@@ -46,10 +78,18 @@ ISO15693ErrorCode PN5180ISO15693::getInventory(uint8_t *uid)
     }
     
     uint8_t *readBuffer;
-    ISO15693ErrorCode rc = issueISO15693Command(inventory, sizeof(inventory), &readBuffer);
+    uint16_t len;
+    _errorCounters.inventories++;
+    ISO15693ErrorCode rc = issueISO15693Command(inventory, inventoryLen, &readBuffer, &len);
     if (ISO15693_EC_OK != rc) {
         return rc;
     }
+    if (len < 10) {
+        tr_debug("*** ERROR: Short response, len=%d, expected=10\n", len);
+        releaseData();
+        return ISO15693_EC_UNKNOWN_ERROR;
+    }
+    _errorCounters.tagsFound++;
 
     tr_debug("Response flags: %s, Data Storage Format ID: %s, UID: ", formatHex(readBuffer[0]), formatHex(readBuffer[1]));
     
@@ -60,12 +100,451 @@ ISO15693ErrorCode PN5180ISO15693::getInventory(uint8_t *uid)
         if (i<2) tr_debug(":");
 #endif
     }
+    releaseData();
     
     tr_debug("\n");
 
     return ISO15693_EC_OK;
 }
 
+/*
+ * Set the AFI and UID mask sent with inventory requests. Returns false and
+ * keeps the filter if the mask is longer than a UID.
+ */
+bool PN5180ISO15693::setInventoryFilter(const ISO15693InventoryFilter &filter) 
+{
+    if (filter.maskLen > 64) {
+        tr_debug("*** ERROR: Mask length %d exceeds UID length\n", filter.maskLen);
+        return false;
+    }
+    _inventoryFilter = filter;
+    // unused bits of the last mask byte are sent as zero
+    for (int i=0; i<8; i++) {
+        if (8*i >= filter.maskLen) {
+            _inventoryFilter.mask[i] = 0;
+        }
+        else if (8*(i+1) > filter.maskLen) {
+            _inventoryFilter.mask[i] &= (1 << (filter.maskLen & 7)) - 1;
+        }
+    }
+    return true;
+}
+
+void PN5180ISO15693::clearInventoryFilter() 
+{
+    memset(&_inventoryFilter, 0, sizeof(_inventoryFilter));
+}
+
+/*
+ * Inventory request with the AFI of the inventory filter and the given mask,
+ * up to 12 bytes. Returns the length of the request.
+ */
+uint8_t PN5180ISO15693::buildInventoryRequest(uint8_t *frame, uint8_t maskLen, const uint8_t *mask, bool slots16) 
+{
+    uint8_t pos = 0;
+    //               flags: inventory flag + high data rate, 1 slot, AFI field present
+    frame[pos++] = (slots16 ? 0x06 : 0x26) | (_inventoryFilter.afiEnable ? 0x10 : 0x00);
+    frame[pos++] = ISO15693_CMD_INVENTORY;
+    if (_inventoryFilter.afiEnable) {
+        frame[pos++] = _inventoryFilter.afi;
+    }
+    frame[pos++] = maskLen;
+    for (int i=0; 8*i<maskLen; i++) {
+        frame[pos++] = mask[i];
+    }
+    if (maskLen & 7) { // bits beyond the mask length are sent as zero
+        frame[pos-1] &= (1 << (maskLen & 7)) - 1;
+    }
+    return pos;
+}
+
+/*
+ * Inventory of all tags in the field, code=01
+ *
+ * Tags answer a 16 slot inventory in the slot given by the 4 UID bits following
+ * the mask, the reader starts each further slot with an EOF. A slot with more
+ * than one tag collides and is inventoried again with the mask extended by its
+ * slot number, until every tag answered alone. Slots without collision are not
+ * repeated.
+ *
+ * A single tag is found faster with a 1 slot inventory, while 16 slots resolve
+ * crowds in fewer rounds. In adaptive mode, the number of tags is estimated from
+ * the previous inventories (found tags, 2.39 tags per collided slot) and 16 slots
+ * are used from MBED_CONF_PN5180_ISO15693_MULTI_SLOT_THRESHOLD tags on. A 1 slot
+ * inventory that collides is repeated with 16 slots.
+ *
+ * The UIDs of up to maxTags tags are stored in uids, LSB first. Returns
+ * EC_NO_CARD if no tag answered and EC_COLLISION if no tag could be told apart.
+ */
+ISO15693ErrorCode PN5180ISO15693::getInventoryMultiple(uint8_t *uids, uint8_t maxTags, uint8_t *numTags) 
+{
+    ISO15693InventorySplit split;
+    beginInventory(&split);
+    *numTags = 0;
+
+    ISO15693ErrorCode rc;
+    while (true) {
+        uint16_t collided;
+        rc = inventoryRound(split.maskLen, split.mask, split.slots16, uids, maxTags, numTags, &collided);
+        if ((ISO15693_EC_OK != rc) || (*numTags >= maxTags) || !nextInventoryRound(&split, collided)) {
+            break;
+        }
+    }
+    return endInventory(&split, rc, *numTags);
+}
+
+/*
+ * First round of a getInventoryMultiple(): the mask of the inventory filter,
+ * the number of slots from the estimated population.
+ */
+void PN5180ISO15693::beginInventory(ISO15693InventorySplit *split) 
+{
+    tr_debug("Get Inventory of all tags, estimated %d...\n", getPopulationEstimate());
+
+    split->depth = 0;
+    memcpy(split->mask, _inventoryFilter.mask, 8);
+    split->maskLen = _inventoryFilter.maskLen;
+    split->estimate = _population;
+    split->slots16 = useSlots16(split->maskLen, split->estimate);
+    memset(&_inventoryStats, 0, sizeof(_inventoryStats));
+}
+
+bool PN5180ISO15693::useSlots16(uint8_t maskLen, uint16_t estimate) 
+{
+    return (maskLen <= 60) && ((ISO15693_INVENTORY_16_SLOTS == _inventoryMode) ||
+        ((ISO15693_INVENTORY_ADAPTIVE == _inventoryMode) && (estimate >= 16 * MBED_CONF_PN5180_ISO15693_MULTI_SLOT_THRESHOLD)));
+}
+
+/*
+ * Split the collided slots of the round just finished and set up the next
+ * round. Returns false if no collided slot is left to inventory.
+ */
+bool PN5180ISO15693::nextInventoryRound(ISO15693InventorySplit *split, uint16_t collided) 
+{
+    if (0 != collided) {
+        uint16_t slotEstimate = split->slots16 ? 38 : ((split->estimate > 38) ? split->estimate : 38);
+        if (!split->slots16 && (ISO15693_INVENTORY_ADAPTIVE == _inventoryMode) && (split->maskLen <= 60) &&
+            (slotEstimate >= 16 * MBED_CONF_PN5180_ISO15693_MULTI_SLOT_THRESHOLD)) {
+            split->estimate = slotEstimate; // at least two tags, repeat with 16 slots
+            split->slots16 = true;
+            return true;
+        }
+        uint8_t bits = split->slots16 ? 4 : 1;
+        if ((split->depth < MBED_CONF_PN5180_ISO15693_INVENTORY_DEPTH) && (split->maskLen + bits <= 64)) {
+            ISO15693InventorySplit::Level &level = split->levels[split->depth];
+            level.pending = collided;
+            level.estimate = split->slots16 ? slotEstimate : (slotEstimate / 2);
+            level.maskLen = split->maskLen;
+            level.bits = bits;
+            split->depth++;
+        }
+        else {
+            for (; collided; collided &= collided - 1) {
+                _inventoryStats.unresolved++;
+            }
+        }
+    }
+
+    while ((split->depth > 0) && (0 == split->levels[split->depth-1].pending)) {
+        split->depth--;
+    }
+    if (0 == split->depth) {
+        return false;
+    }
+    ISO15693InventorySplit::Level &level = split->levels[split->depth-1];
+    uint8_t slot = 0;
+    while (0 == (level.pending & (1 << slot))) {
+        slot++;
+    }
+    level.pending &= ~(1 << slot);
+    for (uint8_t i=0; i<level.bits; i++) {
+        uint8_t bit = level.maskLen + i;
+        if (slot & (1 << i)) {
+            split->mask[bit/8] |= 1 << (bit & 7);
+        }
+        else {
+            split->mask[bit/8] &= ~(1 << (bit & 7));
+        }
+    }
+    split->maskLen = level.maskLen + level.bits;
+    split->estimate = level.estimate;
+    split->slots16 = useSlots16(split->maskLen, split->estimate);
+    return true;
+}
+
+/*
+ * Count a finished getInventoryMultiple() and update the estimated population.
+ * Returns its result from rc of the last round and the tags found.
+ */
+ISO15693ErrorCode PN5180ISO15693::endInventory(ISO15693InventorySplit *split, ISO15693ErrorCode rc, uint8_t numTags) 
+{
+    _errorCounters.inventories++;
+    _errorCounters.tagsFound += numTags;
+    if ((ISO15693_EC_OK != rc) && (EC_NO_CARD != rc)) {
+        return rc;
+    }
+
+    // tags found and expected in the collided slots left, weighted with the previous estimate
+    uint32_t population = 16 * (uint32_t)numTags + 38 * (uint32_t)_inventoryStats.unresolved;
+    for (uint8_t i=0; i<split->depth; i++) {
+        for (uint16_t pending = split->levels[i].pending; pending; pending &= pending - 1) {
+            population += split->levels[i].estimate;
+        }
+    }
+    // rounded: rounding down would settle one below the count of a steady population
+    population = (3 * population + _population + 2) / 4;
+    _population = (population > 0xffff) ? 0xffff : (uint16_t)population;
+
+    tr_debug("%d tags in %d rounds, %d slots: %d empty, %d collided\n", numTags,
+        _inventoryStats.rounds, _inventoryStats.slots, _inventoryStats.empty, _inventoryStats.collision);
+
+    if (numTags > 0) {
+        return ISO15693_EC_OK;
+    }
+    return (_inventoryStats.unresolved > 0) ? EC_COLLISION : EC_NO_CARD;
+}
+
+/*
+ * A single inventory request with 1 or 16 slots. UIDs are appended to uids while
+ * numTags is below maxTags. The collided slots are returned as bitmap, a
+ * collision of a 1 slot inventory as both values of the next mask bit.
+ */
+ISO15693ErrorCode PN5180ISO15693::inventoryRound(uint8_t maskLen, const uint8_t *mask, bool slots16, uint8_t *uids, uint8_t maxTags, uint8_t *numTags, uint16_t *collided) 
+{
+    uint8_t request[12];
+    uint8_t requestLen = buildInventoryRequest(request, maskLen, mask, slots16);
+    uint8_t numSlots = slots16 ? 16 : 1;
+    uint32_t txConfig = 0;
+    bool eofOnly = false;
+
+    _errorCounters.commands++;
+    _inventoryStats.rounds++;
+    *collided = 0;
+
+    ISO15693ErrorCode rc = ISO15693_EC_OK;
+    for (uint8_t slot=0; slot<numSlots; slot++) {
+        bool started;
+        if (0 == slot) {
+            started = startExchange(request, requestLen);
+        }
+        else {
+            if (1 == slot) {
+                if (!startEofSlots(&txConfig)) {
+                    return ISO15693_EC_UNKNOWN_ERROR;
+                }
+                eofOnly = true;
+            }
+            started = startExchange(0L, 0);
+        }
+        if (!started) {
+            rc = ISO15693_EC_UNKNOWN_ERROR;
+            break;
+        }
+
+        // most slots stay empty, they are polled closely up to their response timeout
+        uint32_t slotStart = getMicros();
+        uint32_t slotWindow = _exchangeTxTime + MBED_CONF_PN5180_ISO15693_SLOT_TIMEOUT_US;
+        uint8_t *readBuffer;
+        uint16_t len = 0;
+        while (!pollExchange(&rc, &readBuffer, &len)) {
+            if ((getMicros() - slotStart) < slotWindow) {
+                delayMicros(ISO15693_SLOT_POLL_US);
+            }
+            else {
+                sleepMillis(1);
+            }
+        }
+        rc = collectInventorySlot(slot, slots16, rc, readBuffer, len, uids, maxTags, numTags, collided);
+        if (ISO15693_EC_OK != rc) {
+            break;
+        }
+    }
+
+    if (eofOnly && !writeRegister(TX_CONFIG, txConfig)) {
+        return ISO15693_EC_UNKNOWN_ERROR;
+    }
+    return rc;
+}
+
+/*
+ * Further slots of an inventory: no SOF and no data, only the EOF is sent.
+ * The previous TX_CONFIG is returned, to be written back after the round.
+ */
+bool PN5180ISO15693::startEofSlots(uint32_t *txConfig) 
+{
+    return readRegister(TX_CONFIG, txConfig) && writeRegister(TX_CONFIG, *txConfig & 0xfffffb3f);
+}
+
+/*
+ * Outcome of one inventory slot: the UID is appended, a collision marked in
+ * collided. Returns ISO15693_EC_OK unless the round has to be aborted.
+ */
+ISO15693ErrorCode PN5180ISO15693::collectInventorySlot(uint8_t slot, bool slots16, ISO15693ErrorCode rc, uint8_t *response, uint16_t len,
+                                                       uint8_t *uids, uint8_t maxTags, uint8_t *numTags, uint16_t *collided) 
+{
+    _inventoryStats.slots++;
+
+    if ((ISO15693_EC_OK == rc) && (len < 10)) {
+        releaseData();
+        rc = EC_PROTOCOL_ERROR;
+    }
+    if (ISO15693_EC_OK == rc) {
+        _inventoryStats.success++;
+        if (*numTags < maxTags) {
+            memcpy(&uids[8 * *numTags], &response[2], 8);
+            (*numTags)++;
+        }
+        releaseData();
+    }
+    else if (EC_NO_CARD == rc) {
+        _inventoryStats.empty++;
+        rc = ISO15693_EC_OK;
+    }
+    else if (countError(rc) || (EC_COLLISION == rc)) {
+        // overlapping responses also show as CRC or coding errors
+        _inventoryStats.collision++;
+        *collided |= slots16 ? (1 << slot) : 0x0003;
+        rc = ISO15693_EC_OK;
+    }
+    return rc;
+}
+
+/*
+ * Select, code=25
+ *
+ * Request format: SOF, Req.Flags, Select, UID, CRC16, EOF
+ * Response format: SOF, Resp.Flags, ErrorCode (opt.), CRC16, EOF
+ *
+ * The VICC with the given UID enters the selected state, all other VICCs in the
+ * selected state return to ready. As long as the tag stays selected, all commands
+ * issued with its UID are sent with the select flag and without the UID field.
+ */
+ISO15693ErrorCode PN5180ISO15693::select(uint8_t *uid) 
+{
+    //                    flags,                                  cmd,                 uid
+    uint8_t selectCmd[] = { ISO15693_CF_SINGLESUBCARRIER_ADDRESSED, ISO15693_CMD_SELECT, 1,2,3,4,5,6,7,8 }; // UID has LSB first!
+    for (int i=0; i<8; i++) {
+        selectCmd[2+i] = uid[i];
+    }
+
+    tr_debug("Select\n");
+
+    _selected = false;
+
+    uint8_t *resultPtr;
+    ISO15693ErrorCode rc = issueISO15693Command(selectCmd, sizeof(selectCmd), &resultPtr);
+    if (ISO15693_EC_OK != rc) {
+        return rc;
+    }
+    releaseData();
+
+    memcpy(_selectedUid, uid, 8);
+    _selected = true;
+    return ISO15693_EC_OK;
+}
+
+/*
+ * Stay quiet, code=02
+ *
+ * Request format: SOF, Req.Flags, StayQuiet, UID, CRC16, EOF
+ * Response format: no response
+ *
+ * The VICC enters the quiet state and only answers addressed commands until it
+ * is reset to ready, selected or leaves the field.
+ */
+ISO15693ErrorCode PN5180ISO15693::stayQuiet(uint8_t *uid) 
+{
+    //                         flags,                                  cmd,                    uid
+    uint8_t stayQuietCmd[] = { ISO15693_CF_SINGLESUBCARRIER_ADDRESSED, ISO15693_CMD_STAYQUIET, 1,2,3,4,5,6,7,8 }; // UID has LSB first!
+    for (int i=0; i<8; i++) {
+        stayQuietCmd[2+i] = uid[i];
+    }
+
+    tr_debug("Stay Quiet\n");
+
+    if (isSelected(uid)) {
+        _selected = false;
+    }
+
+    if (!sendData(stayQuietCmd, sizeof(stayQuietCmd))) {
+        return ISO15693_EC_UNKNOWN_ERROR;
+    }
+    uint32_t start = getMicros();
+    // no poll before the request was on air, then until the end of transmission
+    sleepMillis((ISO15693_REQUEST_SOF_EOF_US + (sizeof(stayQuietCmd) + 2) * ISO15693_REQUEST_BYTE_US) / 1000);
+    ISO15693ErrorCode rc = ISO15693_EC_OK;
+    while (0 == (getIRQStatus() & TX_IRQ_STAT)) {
+        if ((getMicros() - start) >= MBED_CONF_PN5180_ISO15693_RESPONSE_TIMEOUT_US) {
+            tr_debug("Transmission timeout\n");
+            rc = ISO15693_EC_UNKNOWN_ERROR; // the request may not have been sent
+            break;
+        }
+        delayMicros(MBED_CONF_PN5180_IRQ_POLL_US);
+    }
+    clearIRQStatus(RX_SOF_DET_IRQ_STAT | IDLE_IRQ_STAT | TX_IRQ_STAT | RX_IRQ_STAT);
+    return rc;
+}
+
+/*
+ * Reset to ready, code=26
+ *
+ * Request format: SOF, Req.Flags, ResetToReady, UID (opt.), CRC16, EOF
+ * Response format: SOF, Resp.Flags, ErrorCode (opt.), CRC16, EOF
+ *
+ * Returns a selected or quiet VICC to the ready state.
+ */
+ISO15693ErrorCode PN5180ISO15693::resetToReady(uint8_t *uid) 
+{
+    //             flags, cmd, uid (opt.)
+    uint8_t resetCmd[2+8];
+    uint8_t cmdLen = buildRequestHeader(resetCmd, ISO15693_CMD_RESETTOREADY, uid);
+
+    tr_debug("Reset to Ready\n");
+
+    if (isSelected(uid)) {
+        _selected = false;
+    }
+
+    uint8_t *resultPtr;
+    ISO15693ErrorCode rc = issueISO15693Command(resetCmd, cmdLen, &resultPtr);
+    if (ISO15693_EC_OK == rc) {
+        releaseData();
+    }
+    return rc;
+}
+
+bool PN5180ISO15693::isSelected(uint8_t *uid) 
+{
+    return _selected && (0L != uid) && (0 == memcmp(uid, _selectedUid, 8));
+}
+
+/*
+ * Request flags, command code and UID of a request to the given tag. A selected
+ * tag is addressed with the select flag, saving 8 bytes per frame (~2.4ms at 26kbit/s).
+ * In single tag mode, requests are not addressed at all and uid may be NULL.
+ * Returns the length of the header.
+ */
+uint8_t PN5180ISO15693::buildRequestHeader(uint8_t *frame, uint8_t command, uint8_t *uid) 
+{
+    uint8_t pos = 0;
+    if (_singleTagMode || (0L == uid)) {
+        frame[pos++] = ISO15693_CF_SINGLESUBCARRIER_UNADDRESSED;
+        frame[pos++] = command;
+    }
+    else if (isSelected(uid)) {
+        frame[pos++] = ISO15693_CF_SINGLESUBCARRIER_SELECTED;
+        frame[pos++] = command;
+    }
+    else {
+        frame[pos++] = ISO15693_CF_SINGLESUBCARRIER_ADDRESSED;
+        frame[pos++] = command;
+        for (int i=0; i<8; i++) {
+            frame[pos++] = uid[i]; // UID has LSB first!
+        }
+    }
+    return pos;
+}
+
 /*
  * Read single block, code=20
  *
@@ -96,36 +575,42 @@ ISO15693ErrorCode PN5180ISO15693::getInventory(uint8_t *uid)
  */
 ISO15693ErrorCode PN5180ISO15693::readSingleBlock(uint8_t *uid, uint8_t blockNo, uint8_t *blockData, uint8_t blockSize) 
 {
-    //                            flags,                                  cmd,                          uid,             blockNo
-    uint8_t readSingleBlock[] = { ISO15693_CF_SINGLESUBCARRIER_ADDRESSED, ISO15693_CMD_READSINGLEBLOCK, 1,2,3,4,5,6,7,8, blockNo }; // UID has LSB first!
-    //set uid
-    for (int i=0; i<8; i++) {
-        readSingleBlock[2+i] = uid[i];
-    }
+    //                      flags, cmd, uid (opt.), blockNo
+    uint8_t readSingleBlock[2+8+1];
+    uint8_t cmdLen = buildRequestHeader(readSingleBlock, ISO15693_CMD_READSINGLEBLOCK, uid);
+    readSingleBlock[cmdLen++] = blockNo;
 
 #if DEBUG_PN5180
     tr_debug("Read Single Block #%d, size=%d: ", blockNo, blockSize);
-    for (uint16_t i=0; i<sizeof(readSingleBlock); i++) {
+    for (uint16_t i=0; i<cmdLen; i++) {
         tr_debug("%s ", formatHex(readSingleBlock[i]));
     }
     tr_debug("\n");
 #endif
 
     uint8_t *resultPtr;
-    ISO15693ErrorCode rc = issueISO15693Command(readSingleBlock, sizeof(readSingleBlock), &resultPtr);
+    uint16_t resultLen;
+    ISO15693ErrorCode rc = issueISO15693Command(readSingleBlock, cmdLen, &resultPtr, &resultLen);
     if (ISO15693_EC_OK != rc) {
       return rc;
     }
 
+    // flags, block security status with the option flag, block data
+    uint8_t offset = ((readSingleBlock[0] == ISO15693_CF_SINGLESUBCARRIER_ADDRESSED_WITHOPTIONS) ||
+                      (readSingleBlock[0] == ISO15693_CF_SINGLESUBCARRIER_UNADDRESSED_WITHOPTIONS)) ? 2 : 1;
+    if (resultLen < (offset + blockSize)) {
+        tr_debug("*** ERROR: Short response, len=%d, expected=%d\n", resultLen, offset + blockSize);
+        releaseData();
+        return ISO15693_EC_UNKNOWN_ERROR;
+    }
+
     tr_debug("Value=");
     
     for (int i=0; i<blockSize; i++) {
-        if(readSingleBlock[0] == ISO15693_CF_SINGLESUBCARRIER_ADDRESSED_WITHOPTIONS || readSingleBlock[0] == ISO15693_CF_SINGLESUBCARRIER_UNADDRESSED_WITHOPTIONS)
-            blockData[i] = resultPtr[2+i];
-        else //no options
-            blockData[i] = resultPtr[1+i];
+        blockData[i] = resultPtr[offset+i];
         tr_debug("%s ", formatHex(blockData[i]));  
     }
+    releaseData();
 
 #if DEBUG_PN5180
     tr_debug(" ");
@@ -172,21 +657,23 @@ ISO15693ErrorCode PN5180ISO15693::readSingleBlock(uint8_t *uid, uint8_t blockNo,
  */
 ISO15693ErrorCode PN5180ISO15693::writeSingleBlock(uint8_t *uid, uint8_t blockNo, uint8_t *blockData, uint8_t blockSize) 
 {
-    //                            flags,                                   cmd,                           uid,             blockNo
-    uint8_t writeSingleBlock[] = { ISO15693_CF_SINGLESUBCARRIER_ADDRESSED, ISO15693_CMD_WRITESINGLEBLOCK, 1,2,3,4,5,6,7,8, blockNo }; // UID has LSB first!
+    if (isBlockLocked(uid, blockNo)) {
+        tr_debug("Block #%d is locked, write rejected\n", blockNo);
+        return ISO15693_EC_BLOCK_IS_LOCKED;
+    }
 
-    uint8_t writeCmdSize = sizeof(writeSingleBlock) + blockSize;
-    uint8_t *writeCmd = (uint8_t*)malloc(writeCmdSize);
-    uint8_t pos = 0;
-    writeCmd[pos++] = writeSingleBlock[0];
-    writeCmd[pos++] = writeSingleBlock[1];
-    for (int i=0; i<8; i++) {
-        writeCmd[pos++] = uid[i];
+    if (blockSize > 32) {
+        return ISO15693_EC_OPTION_NOT_SUPPORTED;
     }
+
+    //               flags, cmd, uid (opt.), blockNo, blockData (max. 32 bytes)
+    uint8_t writeCmd[2+8+1+32];
+    uint8_t pos = buildRequestHeader(writeCmd, ISO15693_CMD_WRITESINGLEBLOCK, uid);
     writeCmd[pos++] = blockNo;
     for (int i=0; i<blockSize; i++) {
         writeCmd[pos++] = blockData[i];
     }
+    uint8_t writeCmdSize = pos;
 
 #if DEBUG_PN5180
     tr_debug("Write Single Block #%d, size=%d:", blockNo, blockSize);
@@ -199,11 +686,227 @@ ISO15693ErrorCode PN5180ISO15693::writeSingleBlock(uint8_t *uid, uint8_t blockNo
     uint8_t *resultPtr;
     ISO15693ErrorCode rc = issueISO15693Command(writeCmd, writeCmdSize, &resultPtr);
     if (ISO15693_EC_OK != rc) {
-        free(writeCmd);
+        if (ISO15693_EC_BLOCK_IS_LOCKED == rc) {
+            setBlockLocked(uid, blockNo, true);
+        }
+        return rc;
+    }
+    releaseData();
+
+    return ISO15693_EC_OK;
+}
+
+/*
+ * Read multiple blocks, code=23
+ *
+ * Request format: SOF, Req.Flags, ReadMultipleBlocks, UID (opt.), FirstBlockNumber, NumBlocks-1, CRC16, EOF
+ * Response format:
+ *  when ERROR flag is set:
+ *    SOF, Resp.Flags, ErrorCode, CRC16, EOF
+ *
+ *  when ERROR flag is NOT set:
+ *    SOF, Flags, BlockData (len=numBlocks*blockLength), CRC16, EOF
+ *
+ *  Support of this command is optional for the VICC. Tags without it answer with
+ *  ISO15693_EC_NOT_SUPPORTED or ISO15693_EC_NOT_RECOGNIZED.
+ *  The complete response has to fit into a receive buffer, see MBED_CONF_PN5180_RX_BUFFER_SIZE.
+ */
+ISO15693ErrorCode PN5180ISO15693::readMultipleBlocks(uint8_t *uid, uint8_t blockNo, uint8_t numBlocks, uint8_t *blockData, uint8_t blockSize) 
+{
+    if ((0 == numBlocks) || ((1 + numBlocks * blockSize) > MBED_CONF_PN5180_RX_BUFFER_SIZE)) {
+        tr_error("ERROR: Invalid number of blocks for ReadMultipleBlocks!\n");
+        return ISO15693_EC_OPTION_NOT_SUPPORTED;
+    }
+
+    //                         flags, cmd, uid (opt.), blockNo, numBlocks-1
+    uint8_t readMultipleBlocks[2+8+2];
+    uint8_t cmdLen = buildRequestHeader(readMultipleBlocks, ISO15693_CMD_READMULTIPLEBLOCKS, uid);
+    readMultipleBlocks[cmdLen++] = blockNo;
+    readMultipleBlocks[cmdLen++] = numBlocks-1;
+
+#if DEBUG_PN5180
+    tr_debug("Read Multiple Blocks #%d-%d, size=%d: ", blockNo, blockNo+numBlocks-1, blockSize);
+    for (uint16_t i=0; i<cmdLen; i++) {
+        tr_debug("%s ", formatHex(readMultipleBlocks[i]));
+    }
+    tr_debug("\n");
+#endif
+
+    uint8_t *resultPtr;
+    uint16_t resultLen;
+    ISO15693ErrorCode rc = issueISO15693Command(readMultipleBlocks, cmdLen, &resultPtr, &resultLen);
+    if (ISO15693_EC_OK != rc) {
         return rc;
     }
 
-    free(writeCmd);
+    uint16_t dataLen = numBlocks * blockSize;
+    if (resultLen < (1 + dataLen)) {
+        tr_debug("*** ERROR: Short response, len=%d, expected=%d\n", resultLen, 1 + dataLen);
+        releaseData();
+        return ISO15693_EC_UNKNOWN_ERROR;
+    }
+
+    for (uint16_t i=0; i<dataLen; i++) {
+        blockData[i] = resultPtr[1+i];
+    }
+    releaseData();
+
+    return ISO15693_EC_OK;
+}
+
+/*
+ * Custom command, code=A0..DF
+ *
+ * Request format: SOF, Req.Flags, Command, IC Mfg code, UID (opt.), Parameters, CRC16, EOF
+ * Response format:
+ *  when ERROR flag is set:
+ *    SOF, Resp.Flags, ErrorCode, CRC16, EOF
+ *  when ERROR flag is NOT set:
+ *    SOF, Resp.Flags, Data, CRC16, EOF
+ *
+ *  Only tags of the manufacturer execute a custom command, others ignore it.
+ *  Addressed requests and those to the selected tag carry the manufacturer code
+ *  of the UID, unaddressed ones the code set by setManufacturerCode().
+ *  The length of the data is returned in responseLen, data beyond maxLen is dropped.
+ */
+ISO15693ErrorCode PN5180ISO15693::customCommand(uint8_t *uid, uint8_t command, const uint8_t *params, uint8_t paramsLen,
+                                                uint8_t *response, uint16_t maxLen, uint16_t *responseLen, bool fast) 
+{
+    //      flags, cmd, mfg code, uid (opt.), parameters
+    uint8_t frame[3+8+24];
+    if ((command < 0xA0) || (command > 0xDF) || (paramsLen > 24)) {
+        tr_error("ERROR: Invalid custom command!\n");
+        return ISO15693_EC_OPTION_NOT_SUPPORTED;
+    }
+    if (responseLen) {
+        *responseLen = 0;
+    }
+
+    uint8_t cmdLen = buildCustomRequestHeader(frame, command, uid);
+    for (int i=0; i<paramsLen; i++) {
+        frame[cmdLen++] = params[i];
+    }
+
+    uint8_t *resultPtr;
+    uint16_t resultLen;
+    ISO15693ErrorCode rc = issueISO15693Command(frame, cmdLen, &resultPtr, &resultLen, fast);
+    if (ISO15693_EC_OK != rc) {
+        return rc;
+    }
+
+    uint16_t dataLen = resultLen - 1;
+    if (responseLen) {
+        *responseLen = dataLen;
+    }
+    memcpy(response, &resultPtr[1], (dataLen < maxLen) ? dataLen : maxLen);
+    releaseData();
+
+    return ISO15693_EC_OK;
+}
+
+/*
+ * Request header of a custom command, the IC manufacturer code follows the
+ * command code. Returns the length of the header.
+ */
+uint8_t PN5180ISO15693::buildCustomRequestHeader(uint8_t *frame, uint8_t command, uint8_t *uid) 
+{
+    uint8_t pos = buildRequestHeader(frame, command, uid);
+    memmove(&frame[3], &frame[2], pos - 2);
+    frame[2] = (_singleTagMode || (0L == uid)) ? _manufacturerCode : uid[6];
+    return pos + 1;
+}
+
+/*
+ * Inventory Read, NXP custom code=A0, Fast Inventory Read, code=A1
+ *
+ * Request format: SOF, Req.Flags, Command, IC Mfg code, AFI (opt.), Mask len, Mask value,
+ *                 First block number, Number of blocks-1, CRC16, EOF
+ * Response format: SOF, Resp.Flags, UID (without the mask bytes), BlockData, CRC16, EOF
+ *
+ *  An inventory and READ MULTIPLE BLOCKS in one exchange: the tags matching the
+ *  inventory filter answer in a single slot with their UID and the blocks. The
+ *  response omits the UID bytes completely covered by the mask, they are taken
+ *  from the filter. With more than one tag in the field the response collides
+ *  (EC_COLLISION), use getInventoryMultiple() and addressed reads then.
+ *  The fast variant responds at double data rate.
+ */
+ISO15693ErrorCode PN5180ISO15693::inventoryRead(uint8_t *uid, uint8_t blockNo, uint8_t numBlocks, uint8_t *blockData, uint8_t blockSize, bool fast) 
+{
+    uint8_t maskBytes = _inventoryFilter.maskLen / 8;
+    if ((0 == numBlocks) || ((1 + 8 - maskBytes + numBlocks * blockSize) > MBED_CONF_PN5180_RX_BUFFER_SIZE)) {
+        tr_error("ERROR: Invalid number of blocks for InventoryRead!\n");
+        return ISO15693_EC_OPTION_NOT_SUPPORTED;
+    }
+    memset(uid, 0, 8);
+
+    uint8_t request[12+3];
+    uint8_t requestLen = buildInventoryRequest(request, _inventoryFilter.maskLen, _inventoryFilter.mask, false);
+    // custom command code and manufacturer code instead of the inventory code
+    memmove(&request[3], &request[2], requestLen - 2);
+    request[1] = fast ? ISO15693_CMD_NXP_FAST_INVENTORY_READ : ISO15693_CMD_NXP_INVENTORY_READ;
+    request[2] = _manufacturerCode;
+    requestLen++;
+    request[requestLen++] = blockNo;
+    request[requestLen++] = numBlocks-1;
+    tr_debug("Inventory Read #%d-%d...\n", blockNo, blockNo+numBlocks-1);
+
+    uint8_t *resultPtr;
+    uint16_t resultLen;
+    ISO15693ErrorCode rc = issueISO15693Command(request, requestLen, &resultPtr, &resultLen, fast);
+    if (ISO15693_EC_OK != rc) {
+        return rc;
+    }
+
+    uint16_t dataLen = numBlocks * blockSize;
+    if (resultLen < (1 + 8 - maskBytes + dataLen)) {
+        tr_debug("*** ERROR: Short response, len=%d, expected=%d\n", resultLen, 1 + 8 - maskBytes + dataLen);
+        releaseData();
+        return ISO15693_EC_UNKNOWN_ERROR;
+    }
+
+    memcpy(uid, _inventoryFilter.mask, maskBytes);
+    memcpy(&uid[maskBytes], &resultPtr[1], 8 - maskBytes);
+    memcpy(blockData, &resultPtr[1 + 8 - maskBytes], dataLen);
+    releaseData();
+
+    return ISO15693_EC_OK;
+}
+
+/*
+ * Fast Read Multiple Blocks, NXP custom code=C3
+ *
+ * Request format: SOF, Req.Flags, Command, IC Mfg code, UID (opt.), FirstBlockNumber, numBlocks-1, CRC16, EOF
+ * Response format: like READ MULTIPLE BLOCKS, at double data rate
+ *
+ *  Tags of other manufacturers and tags answering ISO15693_EC_NOT_SUPPORTED
+ *  are read with readMultipleBlocks().
+ */
+ISO15693ErrorCode PN5180ISO15693::fastReadMultipleBlocks(uint8_t *uid, uint8_t blockNo, uint8_t numBlocks, uint8_t *blockData, uint8_t blockSize) 
+{
+    if ((0 == numBlocks) || ((1 + numBlocks * blockSize) > MBED_CONF_PN5180_RX_BUFFER_SIZE)) {
+        tr_error("ERROR: Invalid number of blocks for FastReadMultipleBlocks!\n");
+        return ISO15693_EC_OPTION_NOT_SUPPORTED;
+    }
+    if (!_singleTagMode && (0L != uid) && (ISO15693_MFG_NXP != uid[6])) {
+        return readMultipleBlocks(uid, blockNo, numBlocks, blockData, blockSize);
+    }
+
+    uint8_t params[2] = { blockNo, (uint8_t)(numBlocks-1) };
+    uint16_t dataLen = numBlocks * blockSize;
+    uint16_t resultLen;
+    ISO15693ErrorCode rc = customCommand(uid, ISO15693_CMD_NXP_FAST_READ_MULTIPLE_BLOCKS, params, sizeof(params),
+                                         blockData, dataLen, &resultLen, true);
+    if (ISO15693_EC_NOT_SUPPORTED == rc) {
+        return readMultipleBlocks(uid, blockNo, numBlocks, blockData, blockSize);
+    }
+    if (ISO15693_EC_OK != rc) {
+        return rc;
+    }
+    if (resultLen < dataLen) {
+        tr_debug("*** ERROR: Short response, len=%d, expected=%d\n", resultLen + 1, 1 + dataLen);
+        return ISO15693_EC_UNKNOWN_ERROR;
+    }
+
     return ISO15693_EC_OK;
 }
 
@@ -255,27 +958,55 @@ ISO15693ErrorCode PN5180ISO15693::writeSingleBlock(uint8_t *uid, uint8_t blockNo
  */
 ISO15693ErrorCode PN5180ISO15693::getSystemInfo(uint8_t *uid, uint8_t *blockSize, uint8_t *numBlocks) 
 {
-    uint8_t sysInfo[] = { ISO15693_CF_SINGLESUBCARRIER_ADDRESSED, ISO15693_CMD_GETSYSTEMINFO, 1,2,3,4,5,6,7,8 };  // UID has LSB first!
-    for (int i=0; i<8; i++) {
-        sysInfo[2+i] = uid[i];
-    }
+    //              flags, cmd, uid (opt.)
+    uint8_t sysInfo[2+8];
+    uint8_t cmdLen = buildRequestHeader(sysInfo, ISO15693_CMD_GETSYSTEMINFO, uid);
 
 #if DEBUG_PN5180
     tr_debug("Get System Information");
-    for (uint16_t i=0; i<sizeof(sysInfo); i++) {
+    for (uint16_t i=0; i<cmdLen; i++) {
         tr_debug(" %s", formatHex(sysInfo[i]));
     }
     tr_debug("\n");
 #endif
 
     uint8_t *readBuffer;
-    ISO15693ErrorCode rc = issueISO15693Command(sysInfo, sizeof(sysInfo), &readBuffer);
+    uint16_t len;
+    ISO15693ErrorCode rc = issueISO15693Command(sysInfo, cmdLen, &readBuffer, &len);
     if (ISO15693_EC_OK != rc) {
         return rc;
     }
 
-    for (int i=0; i<8; i++) {
-        uid[i] = readBuffer[2+i];
+    rc = decodeSystemInfo(readBuffer, len, uid, blockSize, numBlocks);
+    releaseData();
+    return rc;
+}
+
+#if DEBUG_PN5180 && MBED_CONF_PN5180_STRINGS_ENABLE
+static const char * packedString(const char *table, uint8_t index);
+
+// Application families by the upper nibble of the AFI, see packedString()
+static const char afiFamilies[] =
+    "All families\0" "Transport\0" "Financial\0" "Identification\0"
+    "Telecommunication\0" "Medical\0" "Multimedia\0" "Gaming\0"
+    "Data storage\0" "Item management\0" "Express parcels\0"
+    "Postal services\0" "Airline bags\0" "Unknown";
+#endif
+
+/*
+ * Response of GET SYSTEM INFORMATION, shared with the asynchronous API.
+ */
+ISO15693ErrorCode PN5180ISO15693::decodeSystemInfo(uint8_t *readBuffer, uint16_t len, uint8_t *uid, uint8_t *blockSize, uint8_t *numBlocks) 
+{
+    if (len < 10) {
+        tr_debug("*** ERROR: Short response, len=%d\n", len);
+        return ISO15693_EC_UNKNOWN_ERROR;
+    }
+
+    if (uid) {
+        for (int i=0; i<8; i++) {
+            uid[i] = readBuffer[2+i];
+        }
     }
     
 #if DEBUG_PN5180
@@ -291,34 +1022,20 @@ ISO15693ErrorCode PN5180ISO15693::getSystemInfo(uint8_t *uid, uint8_t *blockSize
 
     uint8_t infoFlags = readBuffer[1];
     if (infoFlags & 0x01) { // DSFID flag
-        uint8_t dsfid = *p++;
-        tr_debug("DSFID=%s\n", formatHex(dsfid));  // Data storage format identifier
+        tr_debug("DSFID=%s\n", formatHex(*p));  // Data storage format identifier
+        p++;
     }
     else {
         tr_debug("No DSFID\n");
     }
   
     if (infoFlags & 0x02) { // AFI flag
-        uint8_t afi = *p++;
-        tr_debug("AFI=%s - ", formatHex(afi));  // Application family identifier
-        switch (afi >> 4) 
-        {
-            case 0: tr_debug("All families"); break;
-            case 1: tr_debug("Transport"); break;
-            case 2: tr_debug("Financial"); break;
-            case 3: tr_debug("Identification"); break;
-            case 4: tr_debug("Telecommunication"); break;
-            case 5: tr_debug("Medical"); break;
-            case 6: tr_debug("Multimedia"); break;
-            case 7: tr_debug("Gaming"); break;
-            case 8: tr_debug("Data storage"); break;
-            case 9: tr_debug("Item management"); break;
-            case 10: tr_debug("Express parcels"); break;
-            case 11: tr_debug("Postal services"); break;
-            case 12: tr_debug("Airline bags"); break;
-            default: tr_debug("Unknown"); break;
-        }
+        tr_debug("AFI=%s - ", formatHex(*p));  // Application family identifier
+#if DEBUG_PN5180 && MBED_CONF_PN5180_STRINGS_ENABLE
+        tr_debug(packedString(afiFamilies, ((*p >> 4) <= 12) ? (*p >> 4) : 13));
+#endif
         tr_debug("\n");
+        p++;
     }
     else {
         tr_debug("No AFI\n");
@@ -331,17 +1048,16 @@ ISO15693ErrorCode PN5180ISO15693::getSystemInfo(uint8_t *uid, uint8_t *blockSize
 
         *blockSize = *blockSize + 1; // range: 1-32
         *numBlocks = *numBlocks + 1; // range: 1-256
-        uint16_t viccMemSize = (*blockSize) * (*numBlocks);
 
-        tr_debug("VICC MemSize=%d BlockSize=%d NumBlocks=%d\n", viccMemSize, *blockSize, *numBlocks);
+        tr_debug("VICC MemSize=%d BlockSize=%d NumBlocks=%d\n", (*blockSize) * (*numBlocks), *blockSize, *numBlocks);
     }
     else {
         tr_debug("No VICC memory size\n");
     }
    
     if (infoFlags & 0x08) { // IC reference
-        uint8_t icRef = *p++;
-        tr_debug("IC Ref=%s\n", formatHex(icRef));
+        tr_debug("IC Ref=%s\n", formatHex(*p));
+        p++;
     }
     else {
         tr_debug("No IC ref\n");
@@ -350,6 +1066,124 @@ ISO15693ErrorCode PN5180ISO15693::getSystemInfo(uint8_t *uid, uint8_t *blockSize
     return ISO15693_EC_OK;
 }
 
+/*
+ * Get multiple block security status, code=2C
+ *
+ * Request format: SOF, Req.Flags, GetMultipleBlockSecurityStatus, UID (opt.), FirstBlockNumber, NumBlocks-1, CRC16, EOF
+ * Response format:
+ *  when ERROR flag is set:
+ *    SOF, Resp.Flags, ErrorCode, CRC16, EOF
+ *
+ *  when ERROR flag is NOT set:
+ *    SOF, Flags, BlockSecurityStatus (len=numBlocks), CRC16, EOF
+ *
+ *    BlockSecurityStatus:
+ *    xxxx.xxx0
+ *            \_ Lock: 0=not locked, 1=locked
+ *
+ *  The result is stored in the lock map of the tag, so that writeSingleBlock
+ *  rejects writes to locked blocks without any RF traffic.
+ */
+ISO15693ErrorCode PN5180ISO15693::getMultipleBlockSecurityStatus(uint8_t *uid, uint8_t blockNo, uint8_t numBlocks, uint8_t *securityStatus) 
+{
+    if (0 == numBlocks) {
+        return ISO15693_EC_OPTION_NOT_SUPPORTED;
+    }
+
+    //                  flags, cmd, uid (opt.), blockNo, numBlocks-1
+    uint8_t securityCmd[2+8+2];
+    uint8_t cmdLen = buildRequestHeader(securityCmd, ISO15693_CMD_GETMULTIPLEBLOCKSECURITYSTATUS, uid);
+    securityCmd[cmdLen++] = blockNo;
+    securityCmd[cmdLen++] = numBlocks-1;
+
+    tr_debug("Get Multiple Block Security Status #%d-%d\n", blockNo, blockNo+numBlocks-1);
+
+    uint8_t *resultPtr;
+    uint16_t resultLen;
+    ISO15693ErrorCode rc = issueISO15693Command(securityCmd, cmdLen, &resultPtr, &resultLen);
+    if (ISO15693_EC_OK != rc) {
+        return rc;
+    }
+    if (resultLen < (1 + numBlocks)) {
+        tr_debug("*** ERROR: Short response, len=%d, expected=%d\n", resultLen, 1 + numBlocks);
+        releaseData();
+        return ISO15693_EC_UNKNOWN_ERROR;
+    }
+
+    for (uint16_t i=0; i<numBlocks; i++) {
+        uint8_t status = resultPtr[1+i];
+        setBlockLocked(uid, blockNo+i, (status & 0x01));
+        if (securityStatus) {
+            securityStatus[i] = status;
+        }
+    }
+    releaseData();
+
+    return ISO15693_EC_OK;
+}
+
+/*
+ * Lock map: one bit per block for the last MBED_CONF_PN5180_LOCK_MAP_ENTRIES tags,
+ * filled by getMultipleBlockSecurityStatus and by writes failing with
+ * ISO15693_EC_BLOCK_IS_LOCKED. Blocks of unknown status are reported as not locked.
+ */
+bool PN5180ISO15693::isBlockLocked(uint8_t *uid, uint8_t blockNo) 
+{
+    if (0L == uid) {
+        return false;
+    }
+    LockMap *map = findLockMap(uid, false);
+    if (0L == map) {
+        return false;
+    }
+    return (0 != (map->locked[blockNo >> 3] & (1 << (blockNo & 0x07))));
+}
+
+void PN5180ISO15693::clearLockMap() 
+{
+    for (int i=0; i<MBED_CONF_PN5180_LOCK_MAP_ENTRIES; i++) {
+        _lockMap[i].valid = false;
+    }
+    _lockMapNext = 0;
+}
+
+PN5180ISO15693::LockMap * PN5180ISO15693::findLockMap(uint8_t *uid, bool create) 
+{
+    for (int i=0; i<MBED_CONF_PN5180_LOCK_MAP_ENTRIES; i++) {
+        if (_lockMap[i].valid && (0 == memcmp(_lockMap[i].uid, uid, 8))) {
+            return &_lockMap[i];
+        }
+    }
+    if (!create) {
+        return 0L;
+    }
+
+    // replace the oldest entry
+    LockMap *map = &_lockMap[_lockMapNext];
+    _lockMapNext = (_lockMapNext + 1) % MBED_CONF_PN5180_LOCK_MAP_ENTRIES;
+    map->valid = true;
+    memcpy(map->uid, uid, 8);
+    memset(map->locked, 0, sizeof(map->locked));
+    return map;
+}
+
+void PN5180ISO15693::setBlockLocked(uint8_t *uid, uint8_t blockNo, bool locked) 
+{
+    if (0L == uid) {
+        return;
+    }
+    LockMap *map = findLockMap(uid, locked);
+    if (0L == map) {
+        return; // no entry and nothing to remember
+    }
+    if (locked) {
+        map->locked[blockNo >> 3] |= (1 << (blockNo & 0x07));
+    }
+    else {
+        map->locked[blockNo >> 3] &= ~(1 << (blockNo & 0x07));
+    }
+}
+
 /*
  * ISO 15693 - Protocol
  *
@@ -402,28 +1236,281 @@ ISO15693ErrorCode PN5180ISO15693::getSystemInfo(uint8_t *uid, uint8_t *blockSize
  *  Function return values:
  *    0 = OK
  *   -1 = No card detected
+ *   <-1 = Reception error, see RX_STATUS
  *   >0 = Error code
+ *
+ *  Commands failing with a transmission error (CRC, protocol, data integrity)
+ *  are retried according to the retry policy.
+ */
+ISO15693ErrorCode PN5180ISO15693::issueISO15693Command(uint8_t *cmd, uint8_t cmdLen, uint8_t **resultPtr, uint16_t *resultLen, bool fast) 
+{
+    _errorCounters.commands++;
+
+    uint8_t attempt = 0;
+    while (true) {
+        ISO15693ErrorCode rc = transceiveISO15693Command(cmd, cmdLen, resultPtr, resultLen, fast);
+        if (!countError(rc) || (attempt >= _retryPolicy.retries)) {
+            return rc;
+        }
+
+        tr_debug("Retry #%d after %s\n", attempt + 1, errorToString(rc));
+        _errorCounters.retries++;
+        if (_retryPolicy.backoff_ms > 0) {
+            sleepMillis(getBackoff_ms(attempt));
+        }
+        if (_retryPolicy.cycleRF) {
+            setRF_off();
+            setRF_on();
+            sleepMillis(1); // VICC power-up time
+
+            if (ISO15693_CF_SINGLESUBCARRIER_SELECTED == cmd[0]) { // tags power up in the ready state
+                uint8_t selectCmd[] = { ISO15693_CF_SINGLESUBCARRIER_ADDRESSED, ISO15693_CMD_SELECT, 1,2,3,4,5,6,7,8 };
+                memcpy(&selectCmd[2], _selectedUid, 8);
+                uint8_t *selectResult;
+                if (ISO15693_EC_OK != transceiveISO15693Command(selectCmd, sizeof(selectCmd), &selectResult, 0)) {
+                    return rc;
+                }
+                releaseData();
+                _selected = true; // cleared with the field
+            }
+        }
+        attempt++;
+    }
+}
+
+/*
+ * Delay before the retry after the given failed attempt: backoff_ms doubled
+ * per attempt, saturating at MBED_CONF_PN5180_RETRY_MAX_BACKOFF_MS.
+ */
+uint32_t PN5180ISO15693::getBackoff_ms(uint8_t attempt)
+{
+    uint32_t backoff = _retryPolicy.backoff_ms;
+    for (uint8_t i=0; (i<attempt) && (backoff < MBED_CONF_PN5180_RETRY_MAX_BACKOFF_MS); i++) {
+        backoff <<= 1;
+    }
+    return (backoff > MBED_CONF_PN5180_RETRY_MAX_BACKOFF_MS) ? MBED_CONF_PN5180_RETRY_MAX_BACKOFF_MS : backoff;
+}
+
+/*
+ * Count the outcome of an exchange. Returns true for the transmission errors
+ * worth a retry.
+ */
+bool PN5180ISO15693::countError(ISO15693ErrorCode rc) 
+{
+    switch (rc) 
+    {
+        case EC_NO_CARD: _errorCounters.noCard++; return false;
+        case EC_COLLISION: _errorCounters.collision++; return false;
+        case EC_CRC_ERROR: _errorCounters.crcError++; return true;
+        case EC_PROTOCOL_ERROR: _errorCounters.protocolError++; return true;
+        case EC_DATA_INTEGRITY_ERROR: _errorCounters.dataIntegrityError++; return true;
+        case ISO15693_EC_OK: return false;
+        default: _errorCounters.tagError++; return false;
+    }
+}
+
+void PN5180ISO15693::resetErrorCounters() 
+{
+    memset(&_errorCounters, 0, sizeof(_errorCounters));
+}
+
+#if MBED_CONF_PN5180_METRICS_ENABLE
+void PN5180ISO15693::getMetrics(PN5180Metrics *metrics, uint32_t readerId) 
+{
+    const PN5180Counters &counters = getCounters();
+    metrics->readerId = readerId;
+    metrics->sequence = _metricsSequence;
+    metrics->time_ms = counters.time_us / 1000;
+    metrics->rfOnTime_ms = counters.rfOnTime_us / 1000;
+    metrics->hostCommands = counters.hostCommands;
+    metrics->busyTimeouts = counters.busyTimeouts;
+    metrics->irqTimeouts = counters.irqTimeouts;
+    metrics->resets = counters.resets;
+    metrics->recoveries = counters.recoveries;
+    metrics->rfOn = counters.rfOn;
+    metrics->commands = _errorCounters.commands;
+    metrics->retries = _errorCounters.retries;
+    metrics->noCard = _errorCounters.noCard;
+    metrics->collision = _errorCounters.collision;
+    metrics->crcError = _errorCounters.crcError;
+    metrics->protocolError = _errorCounters.protocolError;
+    metrics->dataIntegrityError = _errorCounters.dataIntegrityError;
+    metrics->tagError = _errorCounters.tagError;
+    metrics->inventories = _errorCounters.inventories;
+    metrics->tagsFound = _errorCounters.tagsFound;
+    metrics->tagsInField = _inventoryStats.success;
+    metrics->lastError = getLastError();
+}
+
+/*
+ * Cheap enough for a record every second: the counters are copied and
+ * encoded, there is no host interface traffic.
  */
-ISO15693ErrorCode PN5180ISO15693::issueISO15693Command(uint8_t *cmd, uint8_t cmdLen, uint8_t **resultPtr) 
+size_t PN5180ISO15693::writeMetrics(uint8_t *buffer, size_t maxLen, uint32_t readerId) 
+{
+    PN5180Metrics metrics;
+    getMetrics(&metrics, readerId);
+    metrics.sequence = _metricsSequence + 1;
+    size_t len = PN5180MetricsCodec::encode(metrics, buffer, maxLen);
+    if (len > 0) {
+        _metricsSequence++;
+    }
+    return len;
+}
+#endif
+
+/*
+ * Single attempt of an ISO15693 command. The calling thread sleeps between
+ * polls of the exchange, see pollExchange().
+ */
+ISO15693ErrorCode PN5180ISO15693::transceiveISO15693Command(uint8_t *cmd, uint8_t cmdLen, uint8_t **resultPtr, uint16_t *resultLen, bool fast) 
 {
     tr_debug("Issue Command 0x%s...\n", formatHex(cmd[1]));
 
-    sendData(cmd, cmdLen);
-    wait_ms(10);
+    if (!startExchange(cmd, cmdLen, fast)) {
+        return ISO15693_EC_UNKNOWN_ERROR;
+    }
+
+    ISO15693ErrorCode rc;
+    while (!pollExchange(&rc, resultPtr, resultLen)) {
+        sleepMillis(1);
+    }
+    return rc;
+}
 
-    if (0 == (getIRQStatus() & RX_SOF_DET_IRQ_STAT)) {
-        return EC_NO_CARD;
+/*
+ * Send a request and start its exchange. The exchange follows the transceive
+ * states of the PN5180 and is finished by pollExchange():
+ *   Transmitting: until TX_IRQ
+ *   WaitForData: no RX_SOF_DET yet, no card after the response timeout
+ *   Receiving: RX_SOF_DET set, response expected within the frame timeout
+ *   end of reception: RX_IRQ set, RX_STATUS and the response are read
+ *
+ * Fast custom commands are answered at double data rate. The receiver is
+ * switched to 53 kbit/s for them and back to 26 kbit/s with the next standard
+ * request, each switch costs a LOAD_RF_CONFIG.
+ */
+bool PN5180ISO15693::startExchange(uint8_t *cmd, uint8_t cmdLen, bool fast) 
+{
+    // without request (cmd 0L) an EOF alone starts the next slot of an inventory
+    if (0L != cmd) {
+        _exchangeFlags = cmd[0];
+        if ((fast != (PN5180_RF_RX_CFG_ISO15693_53KBIT == getRxConfig())) &&
+            !loadRFConfig(0xFF, fast ? PN5180_RF_RX_CFG_ISO15693_53KBIT : PN5180_RF_RX_CFG_ISO15693_ASK100_26KBIT)) {
+            return false;
+        }
     }
-    
+    uint8_t rate = (PN5180_RF_RX_CFG_ISO15693_53KBIT == getRxConfig()) ? 2 : 1;
+    _exchangeTxDone = false;
+    _exchangeStart = getMicros();
+    // nothing to poll before the request and an error response (flags, code, CRC) were on air
+    _exchangeTxTime = (0L != cmd) ? (ISO15693_REQUEST_SOF_EOF_US + (cmdLen + 2) * ISO15693_REQUEST_BYTE_US) : ISO15693_REQUEST_EOF_US;
+    _exchangeAirTime = _exchangeTxTime + ISO15693_T1_MIN_US + (ISO15693_RESPONSE_SOF_EOF_US + 4 * ISO15693_RESPONSE_BYTE_US) / rate;
+    _exchangeResponseTimeout = MBED_CONF_PN5180_ISO15693_RESPONSE_TIMEOUT_US;
+    if (_exchangeFlags & 0x04) {
+        // tags answer inventories without programming delay, an empty slot ends first
+        _exchangeAirTime = _exchangeTxTime + MBED_CONF_PN5180_ISO15693_SLOT_TIMEOUT_US;
+        _exchangeResponseTimeout = MBED_CONF_PN5180_ISO15693_SLOT_TIMEOUT_US;
+    }
+    return sendData(cmd, cmdLen);
+}
+
+/*
+ * Check the exchange started by startExchange() without waiting. Returns false
+ * while the exchange is in flight, otherwise the result is stored in rc.
+ */
+bool PN5180ISO15693::pollExchange(ISO15693ErrorCode *rc, uint8_t **resultPtr, uint16_t *resultLen) 
+{
+    if (!_exchangeTxDone && ((getMicros() - _exchangeStart) < _exchangeAirTime)) {
+        return false; // still on air, save the SPI traffic
+    }
+
+    uint32_t irqStatus = getIRQStatus();
+    if (0 == (irqStatus & RX_IRQ_STAT)) {
+        uint32_t now = getMicros();
+        if (!_exchangeTxDone && (irqStatus & TX_IRQ_STAT)) {
+            _exchangeTxDone = true;
+            // tag response timing starts with the end of the request
+            if ((now - _exchangeStart) > _exchangeTxTime) {
+                _exchangeStart += _exchangeTxTime;
+            }
+            else {
+                _exchangeStart = now;
+            }
+        }
+        uint32_t elapsed = now - _exchangeStart;
+        if (!_exchangeTxDone) {
+            if (elapsed < MBED_CONF_PN5180_ISO15693_FRAME_TIMEOUT_US) {
+                return false;
+            }
+            tr_debug("Transmission timeout\n");
+            *rc = ISO15693_EC_UNKNOWN_ERROR;
+        }
+        else if (irqStatus & RX_SOF_DET_IRQ_STAT) {
+            if (elapsed < MBED_CONF_PN5180_ISO15693_FRAME_TIMEOUT_US) {
+                return false;
+            }
+            tr_debug("Response frame timeout\n");
+            *rc = EC_PROTOCOL_ERROR;
+        }
+        else {
+            if (elapsed < _exchangeResponseTimeout) {
+                return false;
+            }
+            if (_exchangeFlags == ISO15693_CF_SINGLESUBCARRIER_SELECTED) {
+                _selected = false; // selected tag left the field, address it again
+            }
+            *rc = EC_NO_CARD;
+        }
+        clearIRQStatus(RX_SOF_DET_IRQ_STAT | IDLE_IRQ_STAT | TX_IRQ_STAT | RX_IRQ_STAT);
+        return true;
+    }
+
+    setTransceiveReady(); // the transceiver is back in WaitTransmit
+    *rc = receiveResponse(resultPtr, resultLen);
+    return true;
+}
+
+/*
+ * Read a received response. The error bits of RX_STATUS are checked before
+ * the response is parsed, so a corrupted frame is never returned as a valid
+ * response. A valid response is left in the leased receive buffer, the caller
+ * returns it with releaseData() after parsing.
+ */
+ISO15693ErrorCode PN5180ISO15693::receiveResponse(uint8_t **resultPtr, uint16_t *resultLen) 
+{
     uint32_t rxStatus;
-    readRegister(RX_STATUS, &rxStatus);
-    
-    uint16_t len = (uint16_t)(rxStatus & 0x000001ff);
+    if (!readRegister(RX_STATUS, &rxStatus)) {
+        tr_debug("Reading RX_STATUS failed\n");
+        return ISO15693_EC_UNKNOWN_ERROR;
+    }
+
+    uint16_t len = (uint16_t)(rxStatus & RX_NUM_BYTES_RECEIVED_MASK);
     tr_debug("RX-Status=%s, len=%d\n", formatHex(rxStatus), len);
 
+    ISO15693ErrorCode rxError = ISO15693_EC_OK;
+    if (rxStatus & RX_COLLISION_DETECTED) { // more than one tag answered
+        rxError = EC_COLLISION;
+    }
+    else if (rxStatus & RX_DATA_INTEGRITY_ERROR) { // ISO15693 frames have a CRC, no parity
+        rxError = EC_CRC_ERROR;
+    }
+    else if ((rxStatus & RX_PROTOCOL_ERROR) || (0 == len)) {
+        rxError = EC_PROTOCOL_ERROR;
+    }
+    if (ISO15693_EC_OK != rxError) {
+        tr_debug("Reception error: %s\n", errorToString(rxError));
+        clearIRQStatus(RX_SOF_DET_IRQ_STAT | IDLE_IRQ_STAT | TX_IRQ_STAT | RX_IRQ_STAT);
+        return rxError;
+    }
+    if (resultLen) {
+        *resultLen = len;
+    }
+
     *resultPtr = readData(len);
     if (0L == *resultPtr) {
         tr_debug("*** ERROR in readData!\n");
+        clearIRQStatus(RX_SOF_DET_IRQ_STAT | IDLE_IRQ_STAT | TX_IRQ_STAT | RX_IRQ_STAT);
         return ISO15693_EC_UNKNOWN_ERROR;
     }
   
@@ -436,17 +1523,13 @@ ISO15693ErrorCode PN5180ISO15693::issueISO15693Command(uint8_t *cmd, uint8_t cmd
     tr_info("\n");
 #endif
 
-    uint32_t irqStatus = getIRQStatus();
-    if (0 == (RX_SOF_DET_IRQ_STAT & irqStatus)) { // no card detected
-        clearIRQStatus(TX_IRQ_STAT | IDLE_IRQ_STAT);
-        return EC_NO_CARD;
-    }
-
     uint8_t responseFlags = (*resultPtr)[0];
     if (responseFlags & (1<<0)) { // error flag
         uint8_t errorCode = (*resultPtr)[1];
         
         tr_debug("ERROR code=%s - %s\n", formatHex(errorCode), errorToString((int)errorCode));
+        releaseData();
+        clearIRQStatus(RX_SOF_DET_IRQ_STAT | IDLE_IRQ_STAT | TX_IRQ_STAT | RX_IRQ_STAT);
 
         if (errorCode >= 0xA0) { // custom command error codes
             return ISO15693_EC_CUSTOM_CMD_ERROR;
@@ -483,27 +1566,80 @@ bool PN5180ISO15693::setupRF()
     return true;
 }
 
+#if MBED_CONF_PN5180_STRINGS_ENABLE
+/*
+ * Index of an error code into the messages of errorToString()
+ */
+static uint8_t errorIndex(int err) 
+{
+    if ((err >= EC_DATA_INTEGRITY_ERROR) && (err <= ISO15693_EC_OPTION_NOT_SUPPORTED)) {
+        return err - EC_DATA_INTEGRITY_ERROR;                   // 0..12
+    }
+    if (ISO15693_EC_UNKNOWN_ERROR == err) {
+        return 13;
+    }
+    if ((err >= ISO15693_EC_BLOCK_NOT_AVAILABLE) && (err <= ISO15693_EC_BLOCK_NOT_LOCKED)) {
+        return 14 + (err - ISO15693_EC_BLOCK_NOT_AVAILABLE);    // 14..18
+    }
+    if ((err >= 0xA0) && (err <= 0xDF)) {
+        return 19;
+    }
+    return 20;
+}
+
+/*
+ * Strings of a table packed into one array, separated by '\0'. Looking one up
+ * walks the table, which is fine for messages but saves a pointer per entry.
+ */
+static const char * packedString(const char *table, uint8_t index) 
+{
+    while (index-- > 0) {
+        table += strlen(table) + 1;
+    }
+    return table;
+}
+
+static const char errorMessages[] =
+    "Data integrity error in response!\0"
+    "Protocol error in response!\0"
+    "CRC error in response!\0"
+    "More than one card answered!\0"
+    "NDEF tag is read-only!\0"
+    "NDEF message does not fit on tag!\0"
+    "No further NDEF record!\0"
+    "Tag is not NDEF formatted!\0"
+    "No card detected!\0"
+    "OK!\0"
+    "Command is not supported!\0"
+    "Command is not recognized!\0"
+    "Option is not supported!\0"
+    "Unknown error!\0"
+    "Specified block is not available!\0"
+    "Specified block is already locked!\0"
+    "Specified block is locked and cannot be changed!\0"
+    "Specified block was not successfully programmed!\0"
+    "Specified block was not successfully locked!\0"
+    "Custom command error code!\0"
+    "Undefined error code in ISO15693!";
+
 const char* PN5180ISO15693::errorToString(int err) 
 {
-    switch ((ISO15693ErrorCode)err) 
-    {
-        case EC_NO_CARD: return "No card detected!";
-        case ISO15693_EC_OK: return "OK!";
-        case ISO15693_EC_NOT_SUPPORTED: return "Command is not supported!";
-        case ISO15693_EC_NOT_RECOGNIZED: return "Command is not recognized!";
-        case ISO15693_EC_OPTION_NOT_SUPPORTED: return "Option is not supported!";
-        case ISO15693_EC_UNKNOWN_ERROR: return "Unknown error!";
-        case ISO15693_EC_BLOCK_NOT_AVAILABLE: return "Specified block is not available!";
-        case ISO15693_EC_BLOCK_ALREADY_LOCKED: return "Specified block is already locked!";
-        case ISO15693_EC_BLOCK_IS_LOCKED: return "Specified block is locked and cannot be changed!";
-        case ISO15693_EC_BLOCK_NOT_PROGRAMMED: return "Specified block was not successfully programmed!";
-        case ISO15693_EC_BLOCK_NOT_LOCKED: return "Specified block was not successfully locked!";
-        default:
-        {
-            if ( (err >= 0xA0) && (err <= 0xDF) ) {
-                return "Custom command error code!";
-            }
-            else return "Undefined error code in ISO15693!";
-        }
+    return packedString(errorMessages, errorIndex(err));
+}
+#else
+// the messages are compiled out, the code is reported instead, e.g. "E-1" or "E12"
+const char* PN5180ISO15693::errorToString(int err) 
+{
+    static const char hexChar[] = "0123456789ABCDEF";
+    static char code[4] = "E";
+    if (err < 0) {
+        code[1] = '-';
+        code[2] = hexChar[(-err) & 0x0f];
     }
+    else {
+        code[1] = hexChar[(err >> 4) & 0x0f];
+        code[2] = hexChar[err & 0x0f];
+    }
+    return code;
 }
+#endif
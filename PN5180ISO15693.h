@@ -20,8 +20,63 @@
 #define PN5180ISO15693_H
 
 #include "PN5180.h"
+#include "PN5180Metrics.h"
+
+// Human-readable messages of errorToString() and in traces (0: short error codes only)
+#ifndef MBED_CONF_PN5180_STRINGS_ENABLE
+#define MBED_CONF_PN5180_STRINGS_ENABLE 1
+#endif
+// Number of tags whose block lock status is cached
+#ifndef MBED_CONF_PN5180_LOCK_MAP_ENTRIES
+#define MBED_CONF_PN5180_LOCK_MAP_ENTRIES 2
+#endif
+// Deadline for the SOF of a tag response, counted from the end of transmission
+#ifndef MBED_CONF_PN5180_ISO15693_RESPONSE_TIMEOUT_US
+#define MBED_CONF_PN5180_ISO15693_RESPONSE_TIMEOUT_US 10000
+#endif
+// Deadline for the SOF of an inventory response, empty slots end after it
+#ifndef MBED_CONF_PN5180_ISO15693_SLOT_TIMEOUT_US
+#define MBED_CONF_PN5180_ISO15693_SLOT_TIMEOUT_US 700
+#endif
+// Estimated number of tags from which getInventoryMultiple() uses 16 slots instead of 1
+#ifndef MBED_CONF_PN5180_ISO15693_MULTI_SLOT_THRESHOLD
+#define MBED_CONF_PN5180_ISO15693_MULTI_SLOT_THRESHOLD 2
+#endif
+// Mask split levels of getInventoryMultiple(), deeper collisions stay unresolved
+#ifndef MBED_CONF_PN5180_ISO15693_INVENTORY_DEPTH
+#define MBED_CONF_PN5180_ISO15693_INVENTORY_DEPTH 16
+#endif
+// Deadline for the end of transmission and for the end of a response once its SOF was detected
+#ifndef MBED_CONF_PN5180_ISO15693_FRAME_TIMEOUT_US
+#define MBED_CONF_PN5180_ISO15693_FRAME_TIMEOUT_US 200000
+#endif
+// Longest delay before a retry, the doubled backoff saturates here
+#ifndef MBED_CONF_PN5180_RETRY_MAX_BACKOFF_MS
+#define MBED_CONF_PN5180_RETRY_MAX_BACKOFF_MS 5000
+#endif
+#if MBED_CONF_PN5180_RETRY_MAX_BACKOFF_MS > 4000000
+#error "MBED_CONF_PN5180_RETRY_MAX_BACKOFF_MS must fit 32 bit microseconds"
+#endif
+
+// Shortest air time of an exchange (26 kbit/s request, high data rate response), in us
+#define ISO15693_REQUEST_BYTE_US        302
+#define ISO15693_REQUEST_SOF_EOF_US     113
+#define ISO15693_REQUEST_EOF_US         38
+#define ISO15693_RESPONSE_BYTE_US       300
+#define ISO15693_RESPONSE_SOF_EOF_US    94
+#define ISO15693_T1_MIN_US              318
+// Poll interval of inventory slots until their response timeout
+#define ISO15693_SLOT_POLL_US           100
 
 enum ISO15693ErrorCode {
+    EC_DATA_INTEGRITY_ERROR             = -9,
+    EC_PROTOCOL_ERROR                   = -8,
+    EC_CRC_ERROR                        = -7,
+    EC_COLLISION                        = -6,
+    EC_NDEF_READ_ONLY                   = -5,
+    EC_NDEF_NO_SPACE                    = -4,
+    EC_NDEF_NO_RECORD                   = -3,
+    EC_NDEF_FORMAT_ERROR                = -2,
     EC_NO_CARD                          = -1,
     ISO15693_EC_OK                      = 0,
     ISO15693_EC_NOT_SUPPORTED           = 0x01,
@@ -39,6 +94,7 @@ enum ISO15693ErrorCode {
 enum ISO15693CommandFlags {
     ISO15693_CF_SINGLESUBCARRIER_UNADDRESSED                = 0x02,
     ISO15693_CF_DUALSUBCARRIER_UNADDRESSED                  = 0x03,
+    ISO15693_CF_SINGLESUBCARRIER_SELECTED                   = 0x12,
     ISO15693_CF_SINGLESUBCARRIER_ADDRESSED                  = 0x22,
     ISO15693_CF_SINGLESUBCARRIER_UNADDRESSED_WITHOPTIONS    = 0x42,
     ISO15693_CF_SINGLESUBCARRIER_ADDRESSED_WITHOPTIONS      = 0x62
@@ -62,25 +118,210 @@ enum ISO15693Command {
     ISO15693_CMD_GETMULTIPLEBLOCKSECURITYSTATUS     = 0x2C
 };
 
+// IC manufacturer code (UID byte 6) of NXP Semiconductors, sent with its custom commands
+#define ISO15693_MFG_NXP    0x04
+
+// Custom commands of NXP ICODE SLIX/SLIX2/DNA tags
+enum ISO15693NxpCommand {
+    ISO15693_CMD_NXP_INVENTORY_READ                 = 0xA0,
+    ISO15693_CMD_NXP_FAST_INVENTORY_READ            = 0xA1,
+    ISO15693_CMD_NXP_FAST_READ_MULTIPLE_BLOCKS      = 0xC3
+};
+
+/*
+ * Retry of ISO15693 commands failing with a transmission error
+ * (EC_CRC_ERROR, EC_PROTOCOL_ERROR, EC_DATA_INTEGRITY_ERROR).
+ */
+struct ISO15693RetryPolicy {
+    uint8_t retries;        // additional attempts, 0 = no retry
+    uint16_t backoff_ms;    // delay before the first retry, doubled for each further one up to MBED_CONF_PN5180_RETRY_MAX_BACKOFF_MS
+    bool cycleRF;           // switch the RF field off and on again before a retry
+};
+
+/*
+ * Selection of the tags answering an inventory. Only tags of the application
+ * family (AFI) and with a UID starting with the mask respond, so fewer tags
+ * collide. A zero AFI nibble matches all families or subfamilies.
+ */
+struct ISO15693InventoryFilter {
+    bool afiEnable;
+    uint8_t afi;
+    uint8_t maskLen;        // UID bits to match, 0..64
+    uint8_t mask[8];        // LSB first, like the UID
+};
+
+enum ISO15693InventoryMode {
+    ISO15693_INVENTORY_ADAPTIVE     = 0,    // 1 or 16 slots by the estimated number of tags
+    ISO15693_INVENTORY_1_SLOT       = 1,    // collisions are split by one mask bit
+    ISO15693_INVENTORY_16_SLOTS     = 2
+};
+
+// Slot outcomes of the last getInventoryMultiple()
+struct ISO15693InventoryStats {
+    uint16_t rounds;        // inventory requests
+    uint16_t slots;
+    uint16_t empty;
+    uint16_t success;
+    uint16_t collision;
+    uint16_t unresolved;    // collided slots beyond the mask length or MBED_CONF_PN5180_ISO15693_INVENTORY_DEPTH
+};
+
+// Progress of a getInventoryMultiple() between its rounds, also kept by PN5180ISO15693Async
+struct ISO15693InventorySplit {
+    // collided slots of a round still to inventory, depth first
+    struct Level {
+        uint16_t pending;   // one bit per slot
+        uint16_t estimate;  // tags x16 per slot
+        uint8_t maskLen;
+        uint8_t bits;       // mask bits per slot
+    } levels[MBED_CONF_PN5180_ISO15693_INVENTORY_DEPTH];
+    uint8_t depth;
+    // next round
+    uint8_t mask[8];
+    uint8_t maskLen;
+    uint16_t estimate;      // tags x16
+    bool slots16;
+};
+
+struct ISO15693ErrorCounters {
+    uint32_t commands;          // commands issued, retries not included
+    uint32_t retries;
+    uint32_t noCard;
+    uint32_t collision;
+    uint32_t crcError;
+    uint32_t protocolError;
+    uint32_t dataIntegrityError;  // not reported by RX_STATUS for ISO15693, see crcError
+    uint32_t tagError;          // error flag set in the tag's response
+    uint32_t inventories;       // getInventory(), getInventoryMultiple() and their async calls
+    uint32_t tagsFound;         // UIDs returned by them
+};
+
 class PN5180ISO15693 : public PN5180 
 {
+    friend class PN5180ISO15693Async;
+    friend class PN5180FieldScheduler;
+    friend class PN5180Batch;
+
 public:
+#if defined (DEVICE_SPI)
     PN5180ISO15693(PinName mosi, PinName miso, PinName sck, PinName cs, PinName reset, PinName busy);
+#endif
+    PN5180ISO15693(PN5180HAL &hal);
   
     ISO15693ErrorCode getInventory(uint8_t *uid);
+    // filter of getInventory() and PN5180ISO15693Async::inventoryAsync()
+    bool setInventoryFilter(const ISO15693InventoryFilter &filter);
+    void clearInventoryFilter();
+    const ISO15693InventoryFilter & getInventoryFilter() { return _inventoryFilter; }
+    // UIDs of all tags matching the inventory filter, 8 bytes each
+    ISO15693ErrorCode getInventoryMultiple(uint8_t *uids, uint8_t maxTags, uint8_t *numTags);
+    void setInventoryMode(ISO15693InventoryMode mode) { _inventoryMode = mode; }
+    const ISO15693InventoryStats & getInventoryStats() { return _inventoryStats; }
+    // number of tags expected by getInventoryMultiple(), from the last inventories
+    uint16_t getPopulationEstimate() { return (_population + 8) / 16; }
+
+    ISO15693ErrorCode select(uint8_t *uid);
+    ISO15693ErrorCode stayQuiet(uint8_t *uid);
+    ISO15693ErrorCode resetToReady(uint8_t *uid);
+    bool isSelected(uint8_t *uid);
+
+    // single tag mode: requests are sent unaddressed, without prior inventory
+    void setSingleTagMode(bool enable) { _singleTagMode = enable; }
+    bool isSingleTagMode() { return _singleTagMode; }
 
     ISO15693ErrorCode readSingleBlock(uint8_t *uid, uint8_t blockNo, uint8_t *blockData, uint8_t blockSize);
     ISO15693ErrorCode writeSingleBlock(uint8_t *uid, uint8_t blockNo, uint8_t *blockData, uint8_t blockSize);
+    ISO15693ErrorCode readMultipleBlocks(uint8_t *uid, uint8_t blockNo, uint8_t numBlocks, uint8_t *blockData, uint8_t blockSize);
 
     ISO15693ErrorCode getSystemInfo(uint8_t *uid, uint8_t *blockSize, uint8_t *numBlocks);
 
+    // custom command (0xA0..0xDF) with the IC manufacturer code of the tag, the
+    // response after the flags byte is copied to response (up to maxLen bytes)
+    ISO15693ErrorCode customCommand(uint8_t *uid, uint8_t command, const uint8_t *params, uint8_t paramsLen,
+                                    uint8_t *response, uint16_t maxLen, uint16_t *responseLen, bool fast = false);
+    // manufacturer code of unaddressed custom commands, ISO15693_MFG_NXP by default
+    void setManufacturerCode(uint8_t code) { _manufacturerCode = code; }
+    // NXP ICODE: UID and blocks of one tag matching the inventory filter in a single exchange
+    ISO15693ErrorCode inventoryRead(uint8_t *uid, uint8_t blockNo, uint8_t numBlocks, uint8_t *blockData, uint8_t blockSize, bool fast = false);
+    // NXP ICODE: readMultipleBlocks() with a double data rate response
+    ISO15693ErrorCode fastReadMultipleBlocks(uint8_t *uid, uint8_t blockNo, uint8_t numBlocks, uint8_t *blockData, uint8_t blockSize);
+
+    ISO15693ErrorCode getMultipleBlockSecurityStatus(uint8_t *uid, uint8_t blockNo, uint8_t numBlocks, uint8_t *securityStatus = 0);
+    bool isBlockLocked(uint8_t *uid, uint8_t blockNo);
+    void clearLockMap();
  
     bool setupRF();
 
+    void setRetryPolicy(const ISO15693RetryPolicy &policy) { _retryPolicy = policy; }
+    const ISO15693ErrorCounters & getErrorCounters() { return _errorCounters; }
+    void resetErrorCounters();
+
+#if MBED_CONF_PN5180_METRICS_ENABLE
+    // getCounters() and getErrorCounters() in one snapshot, see PN5180Metrics.h
+    void getMetrics(PN5180Metrics *metrics, uint32_t readerId = 0);
+    // snapshot encoded as record with the next sequence number, returns its length (0: maxLen too short)
+    size_t writeMetrics(uint8_t *buffer, size_t maxLen, uint32_t readerId = 0);
+#endif
+
     const char* errorToString(int err);
   
 private:
-    ISO15693ErrorCode issueISO15693Command(uint8_t *cmd, uint8_t cmdLen, uint8_t **resultPtr);
+    struct LockMap {
+        bool valid;
+        uint8_t uid[8];
+        uint8_t locked[32];  // one bit per block
+    };
+    LockMap _lockMap[MBED_CONF_PN5180_LOCK_MAP_ENTRIES];
+    uint8_t _lockMapNext;
+
+    bool _selected;
+    uint8_t _selectedUid[8];
+    bool _singleTagMode;
+    ISO15693InventoryFilter _inventoryFilter;
+    ISO15693InventoryMode _inventoryMode;
+    ISO15693InventoryStats _inventoryStats;
+    uint16_t _population;       // estimated number of tags x16
+    ISO15693RetryPolicy _retryPolicy;
+    ISO15693ErrorCounters _errorCounters;
+    uint8_t _manufacturerCode;
+#if MBED_CONF_PN5180_METRICS_ENABLE
+    uint32_t _metricsSequence;
+#endif
+
+    // exchange in flight, see startExchange()
+    uint8_t _exchangeFlags;
+    bool _exchangeTxDone;
+    uint32_t _exchangeStart;
+    uint32_t _exchangeTxTime;   // air time of the request
+    uint32_t _exchangeAirTime;  // request, t1 and the shortest response
+    uint32_t _exchangeResponseTimeout;
+
+    void init();
+    virtual void fieldLost() { _selected = false; }
+    uint8_t buildRequestHeader(uint8_t *frame, uint8_t command, uint8_t *uid);
+    uint8_t buildCustomRequestHeader(uint8_t *frame, uint8_t command, uint8_t *uid);
+    uint8_t buildInventoryRequest(uint8_t *frame, uint8_t maskLen, const uint8_t *mask, bool slots16);
+    ISO15693ErrorCode inventoryRound(uint8_t maskLen, const uint8_t *mask, bool slots16, uint8_t *uids, uint8_t maxTags, uint8_t *numTags, uint16_t *collided);
+    bool startEofSlots(uint32_t *txConfig);
+    ISO15693ErrorCode collectInventorySlot(uint8_t slot, bool slots16, ISO15693ErrorCode rc, uint8_t *response, uint16_t len,
+                                           uint8_t *uids, uint8_t maxTags, uint8_t *numTags, uint16_t *collided);
+    void beginInventory(ISO15693InventorySplit *split);
+    bool useSlots16(uint8_t maskLen, uint16_t estimate);
+    bool nextInventoryRound(ISO15693InventorySplit *split, uint16_t collided);
+    ISO15693ErrorCode endInventory(ISO15693InventorySplit *split, ISO15693ErrorCode rc, uint8_t numTags);
+
+    LockMap * findLockMap(uint8_t *uid, bool create);
+    void setBlockLocked(uint8_t *uid, uint8_t blockNo, bool locked);
+
+    ISO15693ErrorCode issueISO15693Command(uint8_t *cmd, uint8_t cmdLen, uint8_t **resultPtr, uint16_t *resultLen = 0, bool fast = false);
+    ISO15693ErrorCode transceiveISO15693Command(uint8_t *cmd, uint8_t cmdLen, uint8_t **resultPtr, uint16_t *resultLen, bool fast = false);
+    bool countError(ISO15693ErrorCode rc);
+    uint32_t getBackoff_ms(uint8_t attempt);
+
+    bool startExchange(uint8_t *cmd, uint8_t cmdLen, bool fast = false);
+    bool pollExchange(ISO15693ErrorCode *rc, uint8_t **resultPtr, uint16_t *resultLen);
+    ISO15693ErrorCode receiveResponse(uint8_t **resultPtr, uint16_t *resultLen);
+    ISO15693ErrorCode decodeSystemInfo(uint8_t *response, uint16_t len, uint8_t *uid, uint8_t *blockSize, uint8_t *numBlocks);
 };
 
 #endif // PN5180ISO15693_H 
@@ -0,0 +1,462 @@
+// NAME: PN5180ISO15693Async.cpp
+//
+// DESC: Non-blocking ISO15693 commands over PN5180ISO15693.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+
+#include "PN5180ISO15693Async.h"
+#include "pn5180_trace.h"
+
+#if MBED_CONF_PN5180_ASYNC_ENABLE
+
+PN5180ISO15693Async::PN5180ISO15693Async(PN5180ISO15693 &nfc)
+    : _nfc(nfc)
+{
+#if MBED_CONF_EVENTS_PRESENT
+    _queue = 0L;
+    _scheduled = false;
+#endif
+    _state = ASYNC_IDLE;
+    _callback = 0L;
+    _context = 0L;
+}
+
+#if MBED_CONF_EVENTS_PRESENT
+void PN5180ISO15693Async::attach(EventQueue *queue)
+{
+    _queue = queue;
+}
+
+void PN5180ISO15693Async::step()
+{
+    _scheduled = false;
+    if (poll()) {
+        _scheduled = true;
+        _queue->call_in(MBED_CONF_PN5180_ASYNC_POLL_INTERVAL_MS, this, &PN5180ISO15693Async::step);
+    }
+}
+#endif
+
+bool PN5180ISO15693Async::inventoryAsync(uint8_t *uid, ISO15693AsyncCallback callback, void *context)
+{
+    if (!start(ASYNC_OP_INVENTORY, 0L, callback, context)) {
+        return false;
+    }
+    _uidOut = uid;
+    _nfc._errorCounters.inventories++;
+    return true;
+}
+
+bool PN5180ISO15693Async::inventoryMultipleAsync(uint8_t *uids, uint8_t maxTags, uint8_t *numTags, ISO15693AsyncCallback callback, void *context)
+{
+    if (!start(ASYNC_OP_INVENTORY_MULTIPLE, 0L, callback, context)) {
+        return false;
+    }
+    _uidsOut = uids;
+    _maxTags = maxTags;
+    _numTagsOut = numTags;
+    *numTags = 0;
+    _slot = 0;
+    _nfc.beginInventory(&_split);
+    return true;
+}
+
+bool PN5180ISO15693Async::getSystemInfoAsync(uint8_t *uid, uint8_t *blockSize, uint8_t *numBlocks, ISO15693AsyncCallback callback, void *context)
+{
+    if (!start(ASYNC_OP_SYSTEM_INFO, uid, callback, context)) {
+        return false;
+    }
+    _uidOut = uid;
+    _blockSizeOut = blockSize;
+    _numBlocksOut = numBlocks;
+    return true;
+}
+
+bool PN5180ISO15693Async::readBlocksAsync(uint8_t *uid, uint8_t blockNo, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize, ISO15693AsyncCallback callback, void *context)
+{
+    if ((0 == numBlocks) || (0 == blockSize) || (blockSize > 32) || ((blockNo + numBlocks) > 256)) {
+        return false;
+    }
+    if (!start(ASYNC_OP_READ_BLOCKS, uid, callback, context)) {
+        return false;
+    }
+    _blockNo = blockNo;
+    _numBlocks = numBlocks;
+    _blockData = blockData;
+    _blockSize = blockSize;
+    return true;
+}
+
+bool PN5180ISO15693Async::writeBlocksAsync(uint8_t *uid, uint8_t blockNo, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize, ISO15693AsyncCallback callback, void *context)
+{
+    if ((0 == numBlocks) || (0 == blockSize) || (blockSize > 32) || ((blockNo + numBlocks) > 256)) {
+        return false;
+    }
+    if (!start(ASYNC_OP_WRITE_BLOCKS, uid, callback, context)) {
+        return false;
+    }
+    _blockNo = blockNo;
+    _numBlocks = numBlocks;
+    _blockData = blockData;
+    _blockSize = blockSize;
+    return true;
+}
+
+bool PN5180ISO15693Async::start(AsyncOperation op, uint8_t *uid, ISO15693AsyncCallback callback, void *context)
+{
+    if (isBusy()) {
+        return false;
+    }
+
+    _op = op;
+    _callback = callback;
+    _context = context;
+    _addressed = (0L != uid);
+    if (_addressed) {
+        memcpy(_uid, uid, 8);
+    }
+    _uidOut = 0L;
+    _done = 0;
+    _chunk = 0;
+    _multipleUnsupported = false;
+    _framePrepared = false;
+    _eofOnly = false;
+    _attempt = 0;
+    _state = ASYNC_SEND;
+
+#if MBED_CONF_EVENTS_PRESENT
+    if (_queue && !_scheduled) {
+        _scheduled = true;
+        _queue->call(this, &PN5180ISO15693Async::step);
+    }
+#endif
+    return true;
+}
+
+void PN5180ISO15693Async::cancel()
+{
+    if (ASYNC_RECEIVE == _state) {
+        _nfc.clearIRQStatus(RX_SOF_DET_IRQ_STAT | IDLE_IRQ_STAT | TX_IRQ_STAT | RX_IRQ_STAT);
+    }
+    if (_eofOnly) {
+        _nfc.writeRegister(TX_CONFIG, _txConfig);
+        _eofOnly = false;
+    }
+    _state = ASYNC_IDLE;
+}
+
+bool PN5180ISO15693Async::poll()
+{
+    while (true) {
+        switch (_state)
+        {
+            case ASYNC_IDLE:
+                return false;
+
+            case ASYNC_BACKOFF:
+                if ((_nfc.getMicros() - _backoffStart) < _backoffTime) {
+                    return true;
+                }
+                _state = ASYNC_SEND;
+                break;
+
+            case ASYNC_SEND:
+                sendRequest();
+                return isBusy(); // the response takes milliseconds
+
+            case ASYNC_RECEIVE:
+            {
+                ISO15693ErrorCode rc;
+                uint8_t *response = 0L;
+                uint16_t len = 0;
+                if (!_nfc.pollExchange(&rc, &response, &len)) {
+                    return true;
+                }
+                handleResponse(rc, response, len);
+                _nfc.releaseData();
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * Encode the request continuing the operation after the given number of
+ * blocks. Blocks are read with READ MULTIPLE BLOCKS as far as the response
+ * fits into a receive buffer, and one by one if the tag does not support
+ * it. Blocks are written one by one.
+ */
+void PN5180ISO15693Async::encodeRequest(uint16_t done)
+{
+    uint8_t *uid = _addressed ? _uid : 0L;
+    uint8_t len = 0;
+    uint16_t chunk = 1;
+
+    switch (_op)
+    {
+        case ASYNC_OP_INVENTORY:
+            len = _nfc.buildInventoryRequest(_frame, _nfc._inventoryFilter.maskLen, _nfc._inventoryFilter.mask, false);
+            break;
+
+        case ASYNC_OP_INVENTORY_MULTIPLE:
+            len = _nfc.buildInventoryRequest(_frame, _split.maskLen, _split.mask, _split.slots16);
+            break;
+
+        case ASYNC_OP_SYSTEM_INFO:
+            len = _nfc.buildRequestHeader(_frame, ISO15693_CMD_GETSYSTEMINFO, uid);
+            break;
+
+        case ASYNC_OP_READ_BLOCKS:
+        {
+            uint16_t maxChunk = _multipleUnsupported ? 1 : ((MBED_CONF_PN5180_RX_BUFFER_SIZE - 1) / _blockSize);
+            chunk = _numBlocks - done;
+            if (chunk > maxChunk) {
+                chunk = maxChunk;
+            }
+            if (1 == chunk) {
+                len = _nfc.buildRequestHeader(_frame, ISO15693_CMD_READSINGLEBLOCK, uid);
+                _frame[len++] = _blockNo + done;
+            }
+            else {
+                len = _nfc.buildRequestHeader(_frame, ISO15693_CMD_READMULTIPLEBLOCKS, uid);
+                _frame[len++] = _blockNo + done;
+                _frame[len++] = chunk - 1;
+            }
+            break;
+        }
+
+        case ASYNC_OP_WRITE_BLOCKS:
+            len = _nfc.buildRequestHeader(_frame, ISO15693_CMD_WRITESINGLEBLOCK, uid);
+            _frame[len++] = _blockNo + done;
+            memcpy(&_frame[len], &_blockData[done * _blockSize], _blockSize);
+            len += _blockSize;
+            break;
+    }
+
+    _frameLen = len;
+    _frameDone = done;
+    _frameChunk = chunk;
+    _framePrepared = true;
+}
+
+/*
+ * Send the next request of the operation, then encode the one after it while
+ * the response is on air.
+ */
+void PN5180ISO15693Async::sendRequest()
+{
+    if (ASYNC_OP_INVENTORY_MULTIPLE == _op) {
+        sendInventorySlot();
+        return;
+    }
+    if (ASYNC_OP_WRITE_BLOCKS == _op) {
+        uint8_t blockNo = _blockNo + _done;
+        if (_nfc.isBlockLocked(_addressed ? _uid : 0L, blockNo)) {
+            tr_debug("Block #%d is locked, write rejected\n", blockNo);
+            complete(ISO15693_EC_BLOCK_IS_LOCKED);
+            return;
+        }
+    }
+
+    if (!_framePrepared || (_frameDone != _done)) {
+        encodeRequest(_done);
+    }
+    _framePrepared = false;
+    _chunk = _frameChunk;
+
+    if (0 == _attempt) {
+        _nfc._errorCounters.commands++;
+    }
+    if (!_nfc.startExchange(_frame, _frameLen)) {
+        complete(ISO15693_EC_UNKNOWN_ERROR);
+        return;
+    }
+    _state = ASYNC_RECEIVE;
+
+    // sendData() copied the frame, the buffer is free for the next request
+    if (((ASYNC_OP_READ_BLOCKS == _op) || (ASYNC_OP_WRITE_BLOCKS == _op)) && ((_done + _chunk) < _numBlocks)) {
+        encodeRequest(_done + _chunk);
+    }
+}
+
+/*
+ * Start the next slot of a multi-slot inventory, with the request in the
+ * first slot and an EOF in the further ones.
+ */
+void PN5180ISO15693Async::sendInventorySlot()
+{
+    bool started;
+    if (0 == _slot) {
+        encodeRequest(0);
+        _framePrepared = false;
+        _collided = 0;
+        _nfc._errorCounters.commands++;
+        _nfc._inventoryStats.rounds++;
+        started = _nfc.startExchange(_frame, _frameLen);
+    }
+    else {
+        if (1 == _slot) {
+            if (!_nfc.startEofSlots(&_txConfig)) {
+                finishInventory(ISO15693_EC_UNKNOWN_ERROR);
+                return;
+            }
+            _eofOnly = true;
+        }
+        started = _nfc.startExchange(0L, 0);
+    }
+    if (!started) {
+        finishInventory(ISO15693_EC_UNKNOWN_ERROR);
+        return;
+    }
+    _state = ASYNC_RECEIVE;
+}
+
+void PN5180ISO15693Async::handleInventorySlot(ISO15693ErrorCode rc, uint8_t *response, uint16_t len)
+{
+    rc = _nfc.collectInventorySlot(_slot, _split.slots16, rc, response, len, _uidsOut, _maxTags, _numTagsOut, &_collided);
+    if (ISO15693_EC_OK != rc) {
+        finishInventory(rc);
+        return;
+    }
+    _slot++;
+    if (_slot < (_split.slots16 ? 16 : 1)) {
+        _state = ASYNC_SEND;
+        return;
+    }
+
+    _slot = 0;
+    if (_eofOnly) {
+        _eofOnly = false;
+        if (!_nfc.writeRegister(TX_CONFIG, _txConfig)) {
+            finishInventory(ISO15693_EC_UNKNOWN_ERROR);
+            return;
+        }
+    }
+    if ((*_numTagsOut >= _maxTags) || !_nfc.nextInventoryRound(&_split, _collided)) {
+        finishInventory(ISO15693_EC_OK);
+        return;
+    }
+    _state = ASYNC_SEND;
+}
+
+void PN5180ISO15693Async::finishInventory(ISO15693ErrorCode rc)
+{
+    if (_eofOnly) {
+        _eofOnly = false;
+        if (!_nfc.writeRegister(TX_CONFIG, _txConfig)) {
+            rc = ISO15693_EC_UNKNOWN_ERROR;
+        }
+    }
+    complete(_nfc.endInventory(&_split, rc, *_numTagsOut));
+}
+
+void PN5180ISO15693Async::handleResponse(ISO15693ErrorCode rc, uint8_t *response, uint16_t len)
+{
+    if (ASYNC_OP_INVENTORY_MULTIPLE == _op) {
+        handleInventorySlot(rc, response, len);
+        return;
+    }
+
+    if (_nfc.countError(rc) && (_attempt < _nfc._retryPolicy.retries)) {
+        tr_debug("Retry #%d after %s\n", _attempt + 1, _nfc.errorToString(rc));
+        _nfc._errorCounters.retries++;
+        _backoffStart = _nfc.getMicros();
+        _backoffTime = _nfc.getBackoff_ms(_attempt) * 1000;
+        _attempt++;
+        _state = ASYNC_BACKOFF;
+        return;
+    }
+
+    if (ISO15693_EC_OK != rc) {
+        if ((ASYNC_OP_READ_BLOCKS == _op) && (_chunk > 1) &&
+            ((ISO15693_EC_NOT_SUPPORTED == rc) || (ISO15693_EC_NOT_RECOGNIZED == rc))) {
+            tr_debug("Read Multiple Blocks not supported, reading single blocks\n");
+            _multipleUnsupported = true;
+            _framePrepared = false;
+            _attempt = 0;
+            _state = ASYNC_SEND;
+            return;
+        }
+        if ((ASYNC_OP_WRITE_BLOCKS == _op) && (ISO15693_EC_BLOCK_IS_LOCKED == rc)) {
+            _nfc.setBlockLocked(_addressed ? _uid : 0L, _blockNo + _done, true);
+        }
+        complete(rc);
+        return;
+    }
+    _attempt = 0;
+
+    switch (_op)
+    {
+        case ASYNC_OP_INVENTORY:
+            if (len < 10) {
+                complete(ISO15693_EC_UNKNOWN_ERROR);
+                return;
+            }
+            if (_uidOut) {
+                memcpy(_uidOut, &response[2], 8);
+            }
+            _nfc._errorCounters.tagsFound++;
+            complete(ISO15693_EC_OK);
+            return;
+
+        case ASYNC_OP_INVENTORY_MULTIPLE:
+            return; // see handleInventorySlot()
+
+        case ASYNC_OP_SYSTEM_INFO:
+            complete(_nfc.decodeSystemInfo(response, len, _uidOut, _blockSizeOut, _numBlocksOut));
+            return;
+
+        case ASYNC_OP_READ_BLOCKS:
+        {
+            uint16_t dataLen = _chunk * _blockSize;
+            if (len < (1 + dataLen)) {
+                tr_debug("*** ERROR: Short response, len=%d, expected=%d\n", len, 1 + dataLen);
+                complete(ISO15693_EC_UNKNOWN_ERROR);
+                return;
+            }
+            memcpy(&_blockData[_done * _blockSize], &response[1], dataLen);
+            break;
+        }
+
+        case ASYNC_OP_WRITE_BLOCKS:
+            break;
+    }
+
+    _done += _chunk;
+    if (_done >= _numBlocks) {
+        complete(ISO15693_EC_OK);
+    }
+    else {
+        _state = ASYNC_SEND;
+    }
+}
+
+void PN5180ISO15693Async::complete(ISO15693ErrorCode rc)
+{
+    _state = ASYNC_IDLE;
+    if (0L == _callback) {
+        return;
+    }
+#if MBED_CONF_EVENTS_PRESENT
+    if (_queue) {
+        _queue->call(_callback, _context, rc);
+        return;
+    }
+#endif
+    _callback(_context, rc);
+}
+
+#endif // MBED_CONF_PN5180_ASYNC_ENABLE
@@ -0,0 +1,157 @@
+// NAME: PN5180ISO15693Async.h
+//
+// DESC: Non-blocking ISO15693 commands over PN5180ISO15693.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180ISO15693ASYNC_H
+#define PN5180ISO15693ASYNC_H
+
+#include "PN5180ISO15693.h"
+
+// Compile the asynchronous API, also required by the coroutine API (0 leaves it out)
+#ifndef MBED_CONF_PN5180_ASYNC_ENABLE
+#define MBED_CONF_PN5180_ASYNC_ENABLE 1
+#endif
+
+#if MBED_CONF_PN5180_ASYNC_ENABLE
+
+#if defined (__MBED__)
+#include "mbed.h"
+#endif
+
+// Interval between polls of an exchange in flight, when driven by an EventQueue
+#ifndef MBED_CONF_PN5180_ASYNC_POLL_INTERVAL_MS
+#define MBED_CONF_PN5180_ASYNC_POLL_INTERVAL_MS 1
+#endif
+
+typedef void (*ISO15693AsyncCallback)(void *context, ISO15693ErrorCode rc);
+
+/*
+ * Asynchronous ISO15693 commands. A request returns at once, false if another
+ * one is still in flight. The exchange is advanced by poll(), which issues a
+ * few host interface commands at most and never sleeps: either call it from
+ * the application's main loop or attach an EventQueue, which then polls every
+ * MBED_CONF_PN5180_ASYNC_POLL_INTERVAL_MS and gets the completion posted.
+ * Result buffers passed to a request must stay valid until its completion.
+ *
+ * Transmission errors are retried according to the retry policy of the reader,
+ * the backoff is waited without blocking. cycleRF is not supported here.
+ *
+ * inventoryMultipleAsync() splits collisions like getInventoryMultiple(), slot
+ * by slot: each poll() sends at most one slot's request or EOF, the empty slots
+ * are waited without blocking. Collisions are not retried.
+ *
+ * Block transfers are pipelined: the following request is encoded while the
+ * response of the current one is on air and sent within the same poll() that
+ * reads the response.
+ */
+class PN5180ISO15693Async
+{
+public:
+    PN5180ISO15693Async(PN5180ISO15693 &nfc);
+
+#if MBED_CONF_EVENTS_PRESENT
+    void attach(EventQueue *queue);
+#endif
+
+    bool inventoryAsync(uint8_t *uid, ISO15693AsyncCallback callback, void *context);
+    // UIDs of all tags matching the inventory filter, see PN5180ISO15693::getInventoryMultiple()
+    bool inventoryMultipleAsync(uint8_t *uids, uint8_t maxTags, uint8_t *numTags, ISO15693AsyncCallback callback, void *context);
+    bool getSystemInfoAsync(uint8_t *uid, uint8_t *blockSize, uint8_t *numBlocks, ISO15693AsyncCallback callback, void *context);
+    bool readBlocksAsync(uint8_t *uid, uint8_t blockNo, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize, ISO15693AsyncCallback callback, void *context);
+    bool writeBlocksAsync(uint8_t *uid, uint8_t blockNo, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize, ISO15693AsyncCallback callback, void *context);
+
+    PN5180ISO15693 & getReader() { return _nfc; }
+    bool isBusy() { return ASYNC_IDLE != _state; }
+    // advance the request in flight, returns true while it is not finished
+    bool poll();
+    // drop the request in flight without completion
+    void cancel();
+
+private:
+    enum AsyncOperation {
+        ASYNC_OP_INVENTORY,
+        ASYNC_OP_INVENTORY_MULTIPLE,
+        ASYNC_OP_SYSTEM_INFO,
+        ASYNC_OP_READ_BLOCKS,
+        ASYNC_OP_WRITE_BLOCKS
+    };
+    enum AsyncState {
+        ASYNC_IDLE,
+        ASYNC_SEND,         // next request to be sent
+        ASYNC_RECEIVE,      // exchange in flight
+        ASYNC_BACKOFF       // waiting for a retry
+    };
+
+    PN5180ISO15693 &_nfc;
+#if MBED_CONF_EVENTS_PRESENT
+    EventQueue *_queue;
+    bool _scheduled;
+    void step();
+#endif
+
+    AsyncState _state;
+    AsyncOperation _op;
+    ISO15693AsyncCallback _callback;
+    void *_context;
+
+    bool _addressed;
+    uint8_t _uid[8];
+    uint8_t *_uidOut;
+    uint8_t *_blockSizeOut;
+    uint8_t *_numBlocksOut;
+    uint8_t *_blockData;
+    uint8_t _blockSize;
+    uint16_t _blockNo;
+    uint16_t _numBlocks;
+    uint16_t _done;             // blocks read or written
+    uint16_t _chunk;            // blocks in the exchange in flight
+    bool _multipleUnsupported;
+
+    // multi-slot inventory, the rounds are split as by getInventoryMultiple()
+    ISO15693InventorySplit _split;
+    uint8_t *_uidsOut;
+    uint8_t _maxTags;
+    uint8_t *_numTagsOut;
+    uint8_t _slot;              // of the round in flight
+    uint16_t _collided;         // slots of the round in flight
+    uint32_t _txConfig;         // restored after the EOF only slots
+    bool _eofOnly;
+
+    // encoded request, prepared ahead while the previous exchange is in flight
+    //              flags, cmd, uid (opt.), blockNo, numBlocks-1 or blockData (max. 32 bytes)
+    uint8_t _frame[2+8+1+32];
+    uint8_t _frameLen;
+    uint16_t _frameDone;        // progress the frame was encoded for
+    uint16_t _frameChunk;
+    bool _framePrepared;
+
+    uint8_t _attempt;
+    uint32_t _backoffStart;
+    uint32_t _backoffTime;
+
+    bool start(AsyncOperation op, uint8_t *uid, ISO15693AsyncCallback callback, void *context);
+    void encodeRequest(uint16_t done);
+    void sendRequest();
+    void sendInventorySlot();
+    void handleResponse(ISO15693ErrorCode rc, uint8_t *response, uint16_t len);
+    void handleInventorySlot(ISO15693ErrorCode rc, uint8_t *response, uint16_t len);
+    void finishInventory(ISO15693ErrorCode rc);
+    void complete(ISO15693ErrorCode rc);
+};
+
+#endif // MBED_CONF_PN5180_ASYNC_ENABLE
+#endif // PN5180ISO15693ASYNC_H
@@ -0,0 +1,116 @@
+// NAME: PN5180ISO15693Session.cpp
+//
+// DESC: Implementation of PN5180ISO15693Session class.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+
+#include "PN5180ISO15693Session.h"
+#include "pn5180_trace.h"
+
+#if MBED_CONF_PN5180_SESSION_ENABLE
+
+PN5180ISO15693Session::PN5180ISO15693Session(PN5180ISO15693 &nfc) 
+    : _nfc(nfc)
+{
+    memset(_uid, 0, sizeof(_uid));
+    _open = false;
+}
+
+ISO15693ErrorCode PN5180ISO15693Session::open(uint8_t *uid) 
+{
+    if (0L == uid) {
+        tr_error("ERROR: A session needs the UID of its tag!\n");
+        return ISO15693_EC_NOT_SUPPORTED;
+    }
+    memcpy(_uid, uid, sizeof(_uid));
+    _open = true;
+    return ensureSelected();
+}
+
+/*
+ * Return the tag to the ready state and end the session.
+ */
+ISO15693ErrorCode PN5180ISO15693Session::close() 
+{
+    if (!_open) {
+        return ISO15693_EC_OK;
+    }
+    _open = false;
+
+    if (!_nfc.isSelected(_uid)) {
+        return ISO15693_EC_OK; // tag already deselected
+    }
+    return _nfc.resetToReady(_uid);
+}
+
+ISO15693ErrorCode PN5180ISO15693Session::ensureSelected() 
+{
+    if (!_open) {
+        return ISO15693_EC_NOT_RECOGNIZED;
+    }
+    if (_nfc.isSelected(_uid)) {
+        return ISO15693_EC_OK;
+    }
+    tr_debug("Session: (re-)selecting tag\n");
+    return _nfc.select(_uid);
+}
+
+ISO15693ErrorCode PN5180ISO15693Session::readSingleBlock(uint8_t blockNo, uint8_t *blockData, uint8_t blockSize) 
+{
+    ISO15693ErrorCode rc = ensureSelected();
+    if (ISO15693_EC_OK != rc) {
+        return rc;
+    }
+    return _nfc.readSingleBlock(_uid, blockNo, blockData, blockSize);
+}
+
+ISO15693ErrorCode PN5180ISO15693Session::writeSingleBlock(uint8_t blockNo, uint8_t *blockData, uint8_t blockSize) 
+{
+    ISO15693ErrorCode rc = ensureSelected();
+    if (ISO15693_EC_OK != rc) {
+        return rc;
+    }
+    return _nfc.writeSingleBlock(_uid, blockNo, blockData, blockSize);
+}
+
+ISO15693ErrorCode PN5180ISO15693Session::readMultipleBlocks(uint8_t blockNo, uint8_t numBlocks, uint8_t *blockData, uint8_t blockSize) 
+{
+    ISO15693ErrorCode rc = ensureSelected();
+    if (ISO15693_EC_OK != rc) {
+        return rc;
+    }
+    return _nfc.readMultipleBlocks(_uid, blockNo, numBlocks, blockData, blockSize);
+}
+
+ISO15693ErrorCode PN5180ISO15693Session::getSystemInfo(uint8_t *blockSize, uint8_t *numBlocks) 
+{
+    ISO15693ErrorCode rc = ensureSelected();
+    if (ISO15693_EC_OK != rc) {
+        return rc;
+    }
+    return _nfc.getSystemInfo(_uid, blockSize, numBlocks);
+}
+
+ISO15693ErrorCode PN5180ISO15693Session::getMultipleBlockSecurityStatus(uint8_t blockNo, uint8_t numBlocks, uint8_t *securityStatus) 
+{
+    ISO15693ErrorCode rc = ensureSelected();
+    if (ISO15693_EC_OK != rc) {
+        return rc;
+    }
+    return _nfc.getMultipleBlockSecurityStatus(_uid, blockNo, numBlocks, securityStatus);
+}
+
+#endif // MBED_CONF_PN5180_SESSION_ENABLE
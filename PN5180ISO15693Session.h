@@ -0,0 +1,62 @@
+// NAME: PN5180ISO15693Session.h
+//
+// DESC: Selected-state session with one ISO15693 tag on the PN5180.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180ISO15693SESSION_H
+#define PN5180ISO15693SESSION_H
+
+#include "PN5180ISO15693.h"
+
+// Compile the session layer (0 leaves it out)
+#ifndef MBED_CONF_PN5180_SESSION_ENABLE
+#define MBED_CONF_PN5180_SESSION_ENABLE 1
+#endif
+
+#if MBED_CONF_PN5180_SESSION_ENABLE
+
+/*
+ * Keeps one tag in the selected state, so that all commands of the session
+ * are sent with the select flag instead of the 8 byte UID.
+ * If the selection got lost (another session selected its tag, or the tag
+ * left and re-entered the field), the tag is selected again on the next command.
+ */
+class PN5180ISO15693Session 
+{
+public:
+    PN5180ISO15693Session(PN5180ISO15693 &nfc);
+
+    ISO15693ErrorCode open(uint8_t *uid);
+    ISO15693ErrorCode close();
+    bool isOpen() { return _open; }
+    uint8_t * getUID() { return _uid; }
+
+    ISO15693ErrorCode readSingleBlock(uint8_t blockNo, uint8_t *blockData, uint8_t blockSize);
+    ISO15693ErrorCode writeSingleBlock(uint8_t blockNo, uint8_t *blockData, uint8_t blockSize);
+    ISO15693ErrorCode readMultipleBlocks(uint8_t blockNo, uint8_t numBlocks, uint8_t *blockData, uint8_t blockSize);
+    ISO15693ErrorCode getSystemInfo(uint8_t *blockSize, uint8_t *numBlocks);
+    ISO15693ErrorCode getMultipleBlockSecurityStatus(uint8_t blockNo, uint8_t numBlocks, uint8_t *securityStatus = 0);
+
+private:
+    PN5180ISO15693 &_nfc;
+    uint8_t _uid[8];
+    bool _open;
+
+    ISO15693ErrorCode ensureSelected();
+};
+
+#endif // MBED_CONF_PN5180_SESSION_ENABLE
+#endif // PN5180ISO15693SESSION_H
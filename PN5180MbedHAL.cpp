@@ -0,0 +1,48 @@
+// NAME: PN5180MbedHAL.cpp
+//
+// DESC: PN5180 host interface on mbed SPI and GPIO.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+
+#include "PN5180MbedHAL.h"
+
+#if defined (DEVICE_SPI)
+
+PN5180MbedHAL::PN5180MbedHAL(PinName mosi, PinName miso, PinName sck, PinName cs, PinName reset, PinName busy) :
+    _spi(mosi, miso, sck),
+    _cs(cs, 1), //don't select chip by default
+    _reset(reset, 0), //keep in reset state by default
+    _busy(busy)
+{
+}
+
+void PN5180MbedHAL::begin()
+{
+    _spi.frequency(5000000);
+    _spi.format(8,0);
+}
+
+void PN5180MbedHAL::transfer(const uint8_t *tx, uint8_t *rx, size_t len)
+{
+    for (size_t i=0; i<len; i++) {
+        uint8_t in = _spi.write(tx ? tx[i] : 0xff);
+        if (rx) {
+            rx[i] = in;
+        }
+    }
+}
+
+#endif // DEVICE_SPI
@@ -0,0 +1,52 @@
+// NAME: PN5180MbedHAL.h
+//
+// DESC: PN5180 host interface on mbed SPI and GPIO.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180MBEDHAL_H
+#define PN5180MBEDHAL_H
+
+#if defined (DEVICE_SPI)
+
+#include "mbed.h"
+#include "PN5180HAL.h"
+
+class PN5180MbedHAL : public PN5180HAL
+{
+public:
+    PN5180MbedHAL(PinName mosi, PinName miso, PinName sck, PinName cs, PinName reset, PinName busy);
+
+    virtual void begin();
+
+    virtual void setNSS(bool level) { _cs = level; }
+    virtual void setReset(bool level) { _reset = level; }
+    virtual bool getBusy() { return _busy; }
+
+    virtual void transfer(const uint8_t *tx, uint8_t *rx, size_t len);
+
+    virtual uint32_t micros() { return us_ticker_read(); }
+    virtual void delayMicros(uint32_t us) { wait_us(us); }
+    virtual void sleepMillis(uint32_t ms) { wait_ms(ms); }
+
+private:
+    SPI _spi;
+    DigitalOut _cs;
+    DigitalOut _reset;
+    DigitalIn _busy;
+};
+
+#endif // DEVICE_SPI
+#endif // PN5180MBEDHAL_H
@@ -0,0 +1,191 @@
+// NAME: PN5180Metrics.cpp
+//
+// DESC: Compact binary record of the reader counters, for health and throughput monitoring.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#include <string.h>
+#include "PN5180Metrics.h"
+
+#if MBED_CONF_PN5180_METRICS_ENABLE
+
+// fields in record order: offset in PN5180Metrics, 64 bit flag
+#define METRICS_FIELD(name)     { (uint8_t)offsetof(PN5180Metrics, name), sizeof(((PN5180Metrics *)0)->name) == 8 }
+
+static const struct {
+    uint8_t offset;
+    bool is64;
+} metricsFields[] = {
+    METRICS_FIELD(readerId),
+    METRICS_FIELD(sequence),
+    METRICS_FIELD(time_ms),
+    METRICS_FIELD(rfOnTime_ms),
+    METRICS_FIELD(hostCommands),
+    METRICS_FIELD(busyTimeouts),
+    METRICS_FIELD(irqTimeouts),
+    METRICS_FIELD(resets),
+    METRICS_FIELD(recoveries),
+    METRICS_FIELD(rfOn),
+    METRICS_FIELD(commands),
+    METRICS_FIELD(retries),
+    METRICS_FIELD(noCard),
+    METRICS_FIELD(collision),
+    METRICS_FIELD(crcError),
+    METRICS_FIELD(protocolError),
+    METRICS_FIELD(dataIntegrityError),
+    METRICS_FIELD(tagError),
+    METRICS_FIELD(inventories),
+    METRICS_FIELD(tagsFound),
+    METRICS_FIELD(tagsInField),
+    METRICS_FIELD(lastError)
+};
+#define METRICS_FIELDS  (sizeof(metricsFields) / sizeof(metricsFields[0]))
+
+static_assert(METRICS_FIELDS == PN5180_METRICS_FIELDS_32 + PN5180_METRICS_FIELDS_64,
+              "PN5180_METRICS_FIELDS_32/64 do not match the field table");
+static_assert(sizeof(PN5180Metrics) == 4 * PN5180_METRICS_FIELDS_32 + 8 * PN5180_METRICS_FIELDS_64,
+              "field of PN5180Metrics missing in the field table");
+// encode() writes the payload length as a single byte
+static_assert(PN5180_METRICS_MAX_SIZE - 7 < 128, "payload length needs more than one byte");
+
+static size_t putVarint(uint8_t *p, uint64_t value)
+{
+    size_t n = 0;
+    while (value >= 0x80) {
+        p[n++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    p[n++] = (uint8_t)value;
+    return n;
+}
+
+// PN5180_METRICS_TRUNCATED at the end of the data, PN5180_METRICS_INVALID beyond 64 bits
+static PN5180MetricsStatus getVarint(const uint8_t *data, size_t len, size_t *pos, uint64_t *value)
+{
+    *value = 0;
+    for (int shift=0; shift<64; shift+=7) {
+        if (*pos >= len) {
+            return PN5180_METRICS_TRUNCATED;
+        }
+        uint8_t b = data[(*pos)++];
+        *value |= (uint64_t)(b & 0x7f) << shift;
+        if (0 == (b & 0x80)) {
+            return PN5180_METRICS_OK;
+        }
+    }
+    return PN5180_METRICS_INVALID;
+}
+
+uint16_t PN5180MetricsCodec::crc16(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0xffff;
+    for (size_t i=0; i<len; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int bit=0; bit<8; bit++) {
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+/*
+ * The payload stays below 128 bytes (checked above), so its length is a
+ * single varint byte filled in after the fields.
+ */
+size_t PN5180MetricsCodec::encode(const PN5180Metrics &metrics, uint8_t *buffer, size_t maxLen)
+{
+    uint8_t record[PN5180_METRICS_MAX_SIZE];
+    memcpy(record, PN5180_METRICS_MAGIC, 3);
+    record[3] = PN5180_METRICS_VERSION;
+    size_t n = 5;
+    n += putVarint(&record[n], METRICS_FIELDS);
+    for (size_t i=0; i<METRICS_FIELDS; i++) {
+        const uint8_t *field = (const uint8_t *)&metrics + metricsFields[i].offset;
+        uint64_t value;
+        if (metricsFields[i].is64) {
+            memcpy(&value, field, 8);
+        }
+        else {
+            uint32_t v;
+            memcpy(&v, field, 4);
+            value = v;
+        }
+        n += putVarint(&record[n], value);
+    }
+    record[4] = (uint8_t)(n - 5);
+
+    uint16_t crc = crc16(record, n);
+    record[n++] = crc & 0xff;
+    record[n++] = crc >> 8;
+    if (n > maxLen) {
+        return 0;
+    }
+    memcpy(buffer, record, n);
+    return n;
+}
+
+PN5180MetricsStatus PN5180MetricsCodec::decode(const uint8_t *data, size_t len, PN5180Metrics *metrics, size_t *recordLen)
+{
+    if (0 != memcmp(data, PN5180_METRICS_MAGIC, (len < 3) ? len : 3)) {
+        return PN5180_METRICS_INVALID;
+    }
+    if ((len > 3) && ((0 == data[3]) || (data[3] > PN5180_METRICS_VERSION))) {
+        return PN5180_METRICS_INVALID;
+    }
+
+    size_t pos = 4;
+    uint64_t payloadLen;
+    PN5180MetricsStatus status = getVarint(data, len, &pos, &payloadLen);
+    if (PN5180_METRICS_OK != status) {
+        return status;
+    }
+    if (payloadLen > 0xffff) {
+        return PN5180_METRICS_INVALID;
+    }
+    size_t end = pos + (size_t)payloadLen;
+    if (end + 2 > len) {
+        return PN5180_METRICS_TRUNCATED;
+    }
+    if (crc16(data, end) != (data[end] | ((uint16_t)data[end+1] << 8))) {
+        return PN5180_METRICS_INVALID;
+    }
+
+    memset(metrics, 0, sizeof(*metrics));
+    uint64_t numFields;
+    if (PN5180_METRICS_OK != getVarint(data, end, &pos, &numFields)) {
+        return PN5180_METRICS_INVALID;
+    }
+    for (uint64_t i=0; i<numFields; i++) {
+        uint64_t value;
+        if (PN5180_METRICS_OK != getVarint(data, end, &pos, &value)) {
+            return PN5180_METRICS_INVALID;
+        }
+        if (i >= METRICS_FIELDS) {
+            continue; // appended by a newer encoder
+        }
+        uint8_t *field = (uint8_t *)metrics + metricsFields[i].offset;
+        if (metricsFields[i].is64) {
+            memcpy(field, &value, 8);
+        }
+        else {
+            uint32_t v = (uint32_t)value;
+            memcpy(field, &v, 4);
+        }
+    }
+    *recordLen = end + 2;
+    return PN5180_METRICS_OK;
+}
+
+#endif // MBED_CONF_PN5180_METRICS_ENABLE
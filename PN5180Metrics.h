@@ -0,0 +1,102 @@
+// NAME: PN5180Metrics.h
+//
+// DESC: Compact binary record of the reader counters, for health and throughput monitoring.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180METRICS_H
+#define PN5180METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Metrics snapshots, see PN5180ISO15693::writeMetrics() (0 leaves them out)
+#ifndef MBED_CONF_PN5180_METRICS_ENABLE
+#define MBED_CONF_PN5180_METRICS_ENABLE 1
+#endif
+
+/*
+ * A record is the header "P5M" with the format version, the payload length,
+ * the payload and a CRC-16/CCITT (poly 0x1021, init 0xffff, LSB first) over
+ * header, length and payload. The payload is the number of fields followed by
+ * the fields in the order of PN5180Metrics, all unsigned LEB128 varints like
+ * in a capture (see PN5180Capture.h).
+ *
+ * Counters are totals since the reader was constructed (or since
+ * resetErrorCounters() for the ISO15693 ones), so rates are the difference of
+ * two records divided by their time difference, and a lost record costs
+ * resolution only. Fields are only ever appended: a decoder takes the fields
+ * it knows and skips the rest, fields missing in an older record read as 0.
+ * The version changes only if existing fields change their meaning.
+ *
+ * Typically 30 to 60 bytes, at most PN5180_METRICS_MAX_SIZE.
+ */
+#define PN5180_METRICS_MAGIC        "P5M"
+#define PN5180_METRICS_VERSION      1
+// fields of PN5180Metrics by size, up to 5 and 10 bytes as varint
+#define PN5180_METRICS_FIELDS_32    20
+#define PN5180_METRICS_FIELDS_64    2
+// header, length, field count, fields, CRC
+#define PN5180_METRICS_MAX_SIZE     (4 + 1 + 1 + 5 * PN5180_METRICS_FIELDS_32 + 10 * PN5180_METRICS_FIELDS_64 + 2)
+
+struct PN5180Metrics {
+    uint32_t readerId;          // chosen by the application
+    uint32_t sequence;          // records written, gaps show lost records
+    uint64_t time_ms;           // reader clock
+    uint64_t rfOnTime_ms;
+    // PN5180Counters
+    uint32_t hostCommands;
+    uint32_t busyTimeouts;
+    uint32_t irqTimeouts;
+    uint32_t resets;
+    uint32_t recoveries;
+    uint32_t rfOn;
+    // ISO15693ErrorCounters
+    uint32_t commands;
+    uint32_t retries;
+    uint32_t noCard;
+    uint32_t collision;
+    uint32_t crcError;
+    uint32_t protocolError;
+    uint32_t dataIntegrityError;
+    uint32_t tagError;
+    uint32_t inventories;
+    uint32_t tagsFound;
+    // state at the snapshot
+    uint32_t tagsInField;       // UIDs of the last getInventoryMultiple()
+    uint32_t lastError;         // PN5180Error
+};
+
+enum PN5180MetricsStatus {
+    PN5180_METRICS_OK = 0,
+    PN5180_METRICS_TRUNCATED = 1,   // more bytes needed
+    PN5180_METRICS_INVALID = 2      // no record, unknown version or CRC mismatch
+};
+
+/*
+ * Encoder for the reader and decoder for the host (see host/pn5180metrics.cpp).
+ */
+class PN5180MetricsCodec
+{
+public:
+    // returns the record length, 0 if maxLen is too short
+    static size_t encode(const PN5180Metrics &metrics, uint8_t *buffer, size_t maxLen);
+    // record at the start of data, its length in *recordLen if PN5180_METRICS_OK
+    static PN5180MetricsStatus decode(const uint8_t *data, size_t len, PN5180Metrics *metrics, size_t *recordLen);
+
+    static uint16_t crc16(const uint8_t *data, size_t len);
+};
+
+#endif // PN5180METRICS_H
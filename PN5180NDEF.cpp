@@ -0,0 +1,498 @@
+// NAME: PN5180NDEF.cpp
+//
+// DESC: Implementation of PN5180NDEF class.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+
+#include "PN5180NDEF.h"
+#include "pn5180_trace.h"
+
+#if MBED_CONF_PN5180_NDEF_ENABLE
+
+// NFC Forum Type 5 Tag TLV types
+#define TLV_NULL        (0x00)
+#define TLV_NDEF        (0x03)
+#define TLV_TERMINATOR  (0xFE)
+
+// Capability container magic numbers
+#define CC_MAGIC_1BYTE  (0xE1)
+#define CC_MAGIC_2BYTE  (0xE2)
+
+PN5180NDEF::PN5180NDEF(PN5180ISO15693 &nfc)
+    : _nfc(nfc)
+{
+    memset(_uid, 0, sizeof(_uid));
+    _unaddressed = false;
+    _blockSize = 0;
+    _numBlocks = 0;
+    _ccLength = 0;
+    _dataEnd = 0;
+    _readOnly = true;
+    _tlvOffset = 0;
+    _msgOffset = 0;
+    _msgLength = 0;
+    _windowFirst = 0;
+    _windowCount = 0;
+    _bytesRead = 0;
+    _bytesWritten = 0;
+    rewind();
+}
+
+/*
+ * Capability container (block 0, 4 or 8 bytes):
+ *   Byte 0: Magic number, E1 = 1-byte address mode, E2 = 2-byte address mode
+ *   Byte 1: Version and access condition
+ *           vvrr.ww00
+ *           ||||  \_ Write access: 00=always, 01=RFU, 10=proprietary, 11=never
+ *           ||\_____ Read access:  00=always, others=proprietary
+ *           \_______ Major version, must be 1
+ *   Byte 2: MLEN, size of the data area in 8 byte units; 0 = 8 byte CC with MLEN in bytes 6-7
+ *   Byte 3: Additional feature information
+ *
+ * Data area: sequence of TLV blocks
+ *   00          - NULL TLV, no length field
+ *   03 len data - NDEF message TLV
+ *   FE          - Terminator TLV, no length field
+ *   len is 1 byte (00-FE) or FF followed by 2 bytes (big endian)
+ */
+ISO15693ErrorCode PN5180NDEF::begin(uint8_t *uid)
+{
+    tr_debug("NDEF: begin\n");
+
+    _unaddressed = (0L == uid);
+    if (uid) {
+        memcpy(_uid, uid, sizeof(_uid));
+    }
+    _multipleUnsupported = false;
+    _windowCount = 0;
+    _bytesRead = 0;
+    _bytesWritten = 0;
+    _msgOffset = 0;
+    _msgLength = 0;
+
+    uint8_t blockSize = 0, numBlocks = 0;
+    ISO15693ErrorCode rc = _nfc.getSystemInfo(uid, &blockSize, &numBlocks);
+    if (ISO15693_EC_OK != rc) {
+        return rc;
+    }
+    if (0 == blockSize) { // VICC memory size not reported
+        _blockSize = 4;
+        _numBlocks = 0;
+    }
+    else {
+        _blockSize = blockSize;
+        _numBlocks = (0 == numBlocks) ? 256 : numBlocks;
+    }
+
+    uint8_t cc[8];
+    _dataEnd = 4; // until the CC is known
+    rc = readBytes(0, 4, cc, 4);
+    if (ISO15693_EC_OK != rc) {
+        return rc;
+    }
+    if ((CC_MAGIC_1BYTE != cc[0]) && (CC_MAGIC_2BYTE != cc[0])) {
+        tr_debug("NDEF: No capability container, magic=%s\n", formatHex(cc[0]));
+        return EC_NDEF_FORMAT_ERROR;
+    }
+    if (((cc[1] >> 6) > 1) || (0 != ((cc[1] >> 2) & 0x03))) {
+        tr_debug("NDEF: Unsupported version or no read access\n");
+        return EC_NDEF_FORMAT_ERROR;
+    }
+    _readOnly = (0 != (cc[1] & 0x03));
+
+    uint32_t dataSize;
+    if (0 == cc[2]) {
+        _dataEnd = 8;
+        rc = readBytes(4, 4, &cc[4], 8);
+        if (ISO15693_EC_OK != rc) {
+            return rc;
+        }
+        _ccLength = 8;
+        dataSize = (((uint32_t)cc[6] << 8) | cc[7]) * 8;
+    }
+    else {
+        _ccLength = 4;
+        dataSize = (uint32_t)cc[2] * 8;
+    }
+
+    uint32_t dataEnd = _ccLength + dataSize;
+    if (0 == _numBlocks) {
+        _numBlocks = (dataEnd + _blockSize - 1) / _blockSize;
+    }
+    if (dataEnd > (uint32_t)_blockSize * _numBlocks) {
+        dataEnd = (uint32_t)_blockSize * _numBlocks;
+    }
+    _dataEnd = dataEnd;
+
+    tr_debug("NDEF: CC length=%d, data area end=%d, read-only=%d\n", _ccLength, _dataEnd, _readOnly);
+
+    rc = locateNDEF();
+    rewind();
+    return rc;
+}
+
+/*
+ * Scan the TLV blocks of the data area for the NDEF message TLV.
+ * If there is none, the position of the terminator (or the end of the
+ * scanned area) is remembered for writeMessage().
+ */
+ISO15693ErrorCode PN5180NDEF::locateNDEF()
+{
+    uint16_t offset = _ccLength;
+
+    while (offset < _dataEnd) {
+        uint8_t tlv[4];
+        uint16_t n = _dataEnd - offset;
+        if (n > sizeof(tlv)) {
+            n = sizeof(tlv);
+        }
+        ISO15693ErrorCode rc = readBytes(offset, n, tlv, offset + n);
+        if (ISO15693_EC_OK != rc) {
+            return rc;
+        }
+
+        if (TLV_NULL == tlv[0]) {
+            offset++;
+            continue;
+        }
+        if (TLV_TERMINATOR == tlv[0]) {
+            break;
+        }
+
+        if (n < 2) {
+            return EC_NDEF_FORMAT_ERROR;
+        }
+        uint16_t len = tlv[1];
+        uint8_t headerLen = 2;
+        if (0xFF == len) {
+            if (n < 4) {
+                return EC_NDEF_FORMAT_ERROR;
+            }
+            len = ((uint16_t)tlv[2] << 8) | tlv[3];
+            headerLen = 4;
+        }
+        if ((uint32_t)offset + headerLen + len > _dataEnd) {
+            tr_debug("NDEF: TLV %s exceeds data area\n", formatHex(tlv[0]));
+            return EC_NDEF_FORMAT_ERROR;
+        }
+
+        if (TLV_NDEF == tlv[0]) {
+            _tlvOffset = offset;
+            _msgOffset = offset + headerLen;
+            _msgLength = len;
+            tr_debug("NDEF: Message at %d, len=%d\n", _msgOffset, _msgLength);
+            return ISO15693_EC_OK;
+        }
+
+        offset += headerLen + len;
+    }
+
+    tr_debug("NDEF: No message found\n");
+    _tlvOffset = offset;
+    _msgOffset = offset;
+    _msgLength = 0;
+    return ISO15693_EC_OK;
+}
+
+/*
+ * Maximum message length writeMessage() accepts, taking the TLV header
+ * and the terminator TLV into account.
+ */
+uint16_t PN5180NDEF::getCapacity()
+{
+    uint16_t space = (_dataEnd > _tlvOffset) ? (_dataEnd - _tlvOffset) : 0;
+
+    if (space >= 4 + 0xFF + 1) {
+        return space - 4 - 1;
+    }
+    else if (space >= 2 + 1) {
+        uint16_t capacity = space - 2 - 1;
+        return (capacity > 0xFE) ? 0xFE : capacity;
+    }
+    return 0;
+}
+
+void PN5180NDEF::rewind()
+{
+    _cursor = _msgOffset;
+    _lastRecord = (0 == _msgLength);
+    memset(&_record, 0, sizeof(_record));
+    _payloadPos = 0;
+}
+
+/*
+ * Decode the header of the next record. Payloads of records which are not
+ * read with readPayload() are skipped without any RF traffic.
+ */
+ISO15693ErrorCode PN5180NDEF::nextRecord(NDEFRecord *record)
+{
+    uint16_t msgEnd = _msgOffset + _msgLength;
+    if (_lastRecord || (_cursor >= msgEnd)) {
+        return EC_NDEF_NO_RECORD;
+    }
+
+    // header, type length, payload length (1 or 4), id length (opt.)
+    uint8_t header[7];
+    uint16_t n = msgEnd - _cursor;
+    if (n > sizeof(header)) {
+        n = sizeof(header);
+    }
+    if (n < 3) {
+        return EC_NDEF_FORMAT_ERROR;
+    }
+    ISO15693ErrorCode rc = readBytes(_cursor, n, header, msgEnd);
+    if (ISO15693_EC_OK != rc) {
+        return rc;
+    }
+
+    NDEFRecord r;
+    uint8_t pos = 0;
+    r.header = header[pos++];
+    r.typeLength = header[pos++];
+    if (r.header & NDEF_SR) {
+        r.payloadLength = header[pos++];
+    }
+    else {
+        if (pos + 4 > n) {
+            return EC_NDEF_FORMAT_ERROR;
+        }
+        r.payloadLength = ((uint32_t)header[pos] << 24) | ((uint32_t)header[pos+1] << 16) |
+                          ((uint32_t)header[pos+2] << 8) | header[pos+3];
+        pos += 4;
+    }
+    r.idLength = 0;
+    if (r.header & NDEF_IL) {
+        if (pos >= n) {
+            return EC_NDEF_FORMAT_ERROR;
+        }
+        r.idLength = header[pos++];
+    }
+
+    uint32_t typeOffset = (uint32_t)_cursor + pos;
+    uint32_t recordEnd = typeOffset + r.typeLength + r.idLength + r.payloadLength;
+    if (recordEnd > msgEnd) {
+        tr_debug("NDEF: Record exceeds message\n");
+        return EC_NDEF_FORMAT_ERROR;
+    }
+    r.typeOffset = typeOffset;
+    r.idOffset = r.typeOffset + r.typeLength;
+    r.payloadOffset = r.idOffset + r.idLength;
+
+    tr_debug("NDEF: Record header=%s, type len=%d, payload len=%d\n", formatHex(r.header), r.typeLength, (int)r.payloadLength);
+
+    _record = r;
+    _payloadPos = 0;
+    _cursor = recordEnd;
+    _lastRecord = (0 != (r.header & NDEF_ME));
+
+    if (record) {
+        *record = r;
+    }
+    return ISO15693_EC_OK;
+}
+
+/*
+ * Read the type field of the current record, truncated to bufferSize.
+ */
+ISO15693ErrorCode PN5180NDEF::readType(uint8_t *buffer, uint8_t bufferSize)
+{
+    uint8_t n = (_record.typeLength < bufferSize) ? _record.typeLength : bufferSize;
+    if (0 == n) {
+        return ISO15693_EC_OK;
+    }
+    return readBytes(_record.typeOffset, n, buffer, _msgOffset + _msgLength);
+}
+
+/*
+ * Read the next chunk of the current record's payload. bytesRead is 0
+ * once the payload is consumed.
+ */
+ISO15693ErrorCode PN5180NDEF::readPayload(uint8_t *buffer, uint16_t bufferSize, uint16_t *bytesRead)
+{
+    uint32_t remaining = _record.payloadLength - _payloadPos;
+    uint16_t n = (remaining < bufferSize) ? remaining : bufferSize;
+
+    *bytesRead = 0;
+    if (0 == n) {
+        return ISO15693_EC_OK;
+    }
+
+    ISO15693ErrorCode rc = readBytes(_record.payloadOffset + _payloadPos, n, buffer, _msgOffset + _msgLength);
+    if (ISO15693_EC_OK != rc) {
+        return rc;
+    }
+    _payloadPos += n;
+    *bytesRead = n;
+    return ISO15693_EC_OK;
+}
+
+/*
+ * Write a complete NDEF message, followed by a terminator TLV, in place of
+ * the current one. Only the blocks covering the new TLV are written; partly
+ * covered blocks at both ends are read back first to keep their other bytes.
+ */
+ISO15693ErrorCode PN5180NDEF::writeMessage(uint8_t *message, uint16_t len)
+{
+    if (_readOnly) {
+        return EC_NDEF_READ_ONLY;
+    }
+    if (len > getCapacity()) {
+        return EC_NDEF_NO_SPACE;
+    }
+
+    uint8_t tlvHeader[4] = { TLV_NDEF };
+    uint8_t headerLen;
+    if (len < 0xFF) {
+        tlvHeader[1] = len;
+        headerLen = 2;
+    }
+    else {
+        tlvHeader[1] = 0xFF;
+        tlvHeader[2] = len >> 8;
+        tlvHeader[3] = len & 0xff;
+        headerLen = 4;
+    }
+
+    uint16_t start = _tlvOffset;
+    uint16_t end = start + headerLen + len + 1; // incl. terminator
+    uint16_t firstBlock = start / _blockSize;
+    uint16_t lastBlock = (end - 1) / _blockSize;
+
+    tr_debug("NDEF: Writing message, len=%d, blocks #%d-%d\n", len, firstBlock, lastBlock);
+
+    for (uint16_t blockNo = firstBlock; blockNo <= lastBlock; blockNo++) {
+        uint8_t block[32];
+        uint16_t blockStart = blockNo * _blockSize;
+
+        if ((blockStart < start) || (blockStart + _blockSize > end)) {
+            ISO15693ErrorCode rc = readBytes(blockStart, _blockSize, block, blockStart + _blockSize);
+            if (ISO15693_EC_OK != rc) {
+                return rc;
+            }
+        }
+
+        for (uint8_t i=0; i<_blockSize; i++) {
+            uint16_t pos = blockStart + i;
+            if ((pos < start) || (pos >= end)) {
+                continue;
+            }
+            uint16_t k = pos - start;
+            if (k < headerLen) {
+                block[i] = tlvHeader[k];
+            }
+            else if (k < headerLen + len) {
+                block[i] = message[k - headerLen];
+            }
+            else {
+                block[i] = TLV_TERMINATOR;
+            }
+        }
+
+        ISO15693ErrorCode rc = _nfc.writeSingleBlock(tagUid(), blockNo, block, _blockSize);
+        if (ISO15693_EC_OK != rc) {
+            _windowCount = 0;
+            return rc;
+        }
+        _bytesWritten += _blockSize;
+
+        if ((blockNo >= _windowFirst) && (blockNo < _windowFirst + _windowCount)) {
+            memcpy(&_window[(blockNo - _windowFirst) * _blockSize], block, _blockSize);
+        }
+    }
+
+    _msgOffset = start + headerLen;
+    _msgLength = len;
+    rewind();
+    return ISO15693_EC_OK;
+}
+
+/*
+ * Copy len bytes at offset of the tag memory into buffer. Missing blocks are
+ * fetched into the window, at most up to the block holding byte limit-1.
+ */
+ISO15693ErrorCode PN5180NDEF::readBytes(uint16_t offset, uint16_t len, uint8_t *buffer, uint16_t limit)
+{
+    while (len > 0) {
+        uint16_t blockNo = offset / _blockSize;
+        if ((blockNo < _windowFirst) || (blockNo >= _windowFirst + _windowCount)) {
+            ISO15693ErrorCode rc = fetchBlocks(blockNo, (limit - 1) / _blockSize);
+            if (ISO15693_EC_OK != rc) {
+                return rc;
+            }
+        }
+
+        uint16_t pos = offset - _windowFirst * _blockSize;
+        uint16_t n = _windowCount * _blockSize - pos;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(buffer, &_window[pos], n);
+        buffer += n;
+        offset += n;
+        len -= n;
+    }
+    return ISO15693_EC_OK;
+}
+
+ISO15693ErrorCode PN5180NDEF::fetchBlocks(uint16_t blockNo, uint16_t lastBlockNo)
+{
+    uint16_t maxBlocks = sizeof(_window) / _blockSize;
+    if (0 == maxBlocks) {
+        tr_error("ERROR: NDEF window smaller than block size!\n");
+        return ISO15693_EC_UNKNOWN_ERROR;
+    }
+
+    uint16_t count = (lastBlockNo >= blockNo) ? (lastBlockNo - blockNo + 1) : 1;
+    if (count > maxBlocks) {
+        count = maxBlocks;
+    }
+    if ((_numBlocks > 0) && (blockNo + count > _numBlocks)) {
+        count = _numBlocks - blockNo;
+    }
+
+    _windowCount = 0;
+
+    if ((count > 1) && !_multipleUnsupported) {
+        ISO15693ErrorCode rc = _nfc.readMultipleBlocks(tagUid(), blockNo, count, _window, _blockSize);
+        if (ISO15693_EC_OK == rc) {
+            _windowFirst = blockNo;
+            _windowCount = count;
+            _bytesRead += count * _blockSize;
+            return ISO15693_EC_OK;
+        }
+        switch (rc)
+        {
+            case ISO15693_EC_NOT_SUPPORTED:
+            case ISO15693_EC_NOT_RECOGNIZED:
+            case ISO15693_EC_OPTION_NOT_SUPPORTED:
+                _multipleUnsupported = true;
+                break;
+            default:
+                return rc;
+        }
+    }
+
+    ISO15693ErrorCode rc = _nfc.readSingleBlock(tagUid(), blockNo, _window, _blockSize);
+    if (ISO15693_EC_OK != rc) {
+        return rc;
+    }
+    _windowFirst = blockNo;
+    _windowCount = 1;
+    _bytesRead += _blockSize;
+    return ISO15693_EC_OK;
+}
+
+#endif // MBED_CONF_PN5180_NDEF_ENABLE
@@ -0,0 +1,121 @@
+// NAME: PN5180NDEF.h
+//
+// DESC: Streaming NDEF (NFC Forum Type 5 tag) access over PN5180ISO15693.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180NDEF_H
+#define PN5180NDEF_H
+
+#include "PN5180ISO15693.h"
+
+// Compile the NDEF reader/writer (0 leaves it out)
+#ifndef MBED_CONF_PN5180_NDEF_ENABLE
+#define MBED_CONF_PN5180_NDEF_ENABLE 1
+#endif
+
+#if MBED_CONF_PN5180_NDEF_ENABLE
+
+// Size of the block window in bytes, i.e. 8 blocks of a 4 byte ICODE tag
+#ifndef MBED_CONF_PN5180_NDEF_WINDOW_SIZE
+#define MBED_CONF_PN5180_NDEF_WINDOW_SIZE 32
+#endif
+
+// NDEF record header flags
+#define NDEF_MB     (0x80)  // Message begin
+#define NDEF_ME     (0x40)  // Message end
+#define NDEF_CF     (0x20)  // Chunk flag
+#define NDEF_SR     (0x10)  // Short record
+#define NDEF_IL     (0x08)  // ID length present
+#define NDEF_TNF    (0x07)  // Type name format
+
+struct NDEFRecord {
+    uint8_t header;         // MB, ME, CF, SR, IL, TNF
+    uint8_t typeLength;
+    uint8_t idLength;
+    uint32_t payloadLength;
+    uint16_t typeOffset;    // byte offsets into tag memory
+    uint16_t idOffset;
+    uint16_t payloadOffset;
+};
+
+/*
+ * NDEF message access on NFC Forum Type 5 tags.
+ *
+ * begin() reads the capability container and locates the NDEF TLV. Records are
+ * then decoded one by one with nextRecord(), fetching only the blocks holding
+ * the record headers; payloads are read on demand with readPayload(). Blocks
+ * are fetched with READ MULTIPLE BLOCKS, never beyond the end of the message.
+ */
+class PN5180NDEF
+{
+public:
+    PN5180NDEF(PN5180ISO15693 &nfc);
+
+    // uid may be NULL in single tag mode
+    ISO15693ErrorCode begin(uint8_t *uid);
+
+    uint16_t getMessageLength() { return _msgLength; }
+    uint16_t getCapacity();
+
+    ISO15693ErrorCode nextRecord(NDEFRecord *record);
+    ISO15693ErrorCode readType(uint8_t *buffer, uint8_t bufferSize);
+    ISO15693ErrorCode readPayload(uint8_t *buffer, uint16_t bufferSize, uint16_t *bytesRead);
+    void rewind();
+
+    ISO15693ErrorCode writeMessage(uint8_t *message, uint16_t len);
+
+    // block data moved over RF since begin(), compare with getTagSize() for a full-tag read
+    uint32_t getBytesRead() { return _bytesRead; }
+    uint32_t getBytesWritten() { return _bytesWritten; }
+    uint16_t getTagSize() { return _blockSize * _numBlocks; }
+
+private:
+    PN5180ISO15693 &_nfc;
+
+    uint8_t _uid[8];
+    bool _unaddressed;      // begin() with a NULL uid, single tag mode
+    uint8_t _blockSize;
+    uint16_t _numBlocks;
+    bool _multipleUnsupported;
+
+    uint8_t _ccLength;
+    uint16_t _dataEnd;      // end of NDEF data area, as declared in the CC
+    bool _readOnly;
+
+    uint16_t _tlvOffset;    // NDEF TLV or terminator TLV, where a new message is written
+    uint16_t _msgOffset;
+    uint16_t _msgLength;
+
+    uint16_t _cursor;       // next record header
+    bool _lastRecord;
+    NDEFRecord _record;
+    uint32_t _payloadPos;
+
+    uint16_t _windowFirst;  // first block in window
+    uint16_t _windowCount;  // number of valid blocks in window
+    uint8_t _window[MBED_CONF_PN5180_NDEF_WINDOW_SIZE];
+
+    uint32_t _bytesRead;
+    uint32_t _bytesWritten;
+
+    uint8_t * tagUid() { return _unaddressed ? 0L : _uid; }
+    ISO15693ErrorCode readBytes(uint16_t offset, uint16_t len, uint8_t *buffer, uint16_t limit);
+    ISO15693ErrorCode fetchBlocks(uint16_t blockNo, uint16_t lastBlockNo);
+    ISO15693ErrorCode locateNDEF();
+};
+
+#endif // MBED_CONF_PN5180_NDEF_ENABLE
+#endif // PN5180NDEF_H
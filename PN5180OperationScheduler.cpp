@@ -0,0 +1,260 @@
+// NAME: PN5180OperationScheduler.cpp
+//
+// DESC: Priority classes for the operations on one reader.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+
+#include "PN5180OperationScheduler.h"
+#include "pn5180_trace.h"
+
+#if MBED_CONF_PN5180_OPERATION_SCHEDULER_ENABLE && MBED_CONF_PN5180_ASYNC_ENABLE
+
+PN5180OperationScheduler::PN5180OperationScheduler(PN5180ISO15693Async &async)
+    : _async(async)
+{
+#if MBED_CONF_EVENTS_PRESENT
+    _queue = 0L;
+    _scheduled = false;
+#endif
+    for (uint8_t i=0; i<MBED_CONF_PN5180_OPERATION_SCHEDULER_SLOTS; i++) {
+        _slots[i].scheduler = this;
+        _slots[i].used = false;
+    }
+    _current = 0L;
+    _pending = 0;
+    _seq = 0;
+    resetStats();
+}
+
+#if MBED_CONF_EVENTS_PRESENT
+void PN5180OperationScheduler::attach(EventQueue *queue)
+{
+    _queue = queue;
+}
+
+void PN5180OperationScheduler::step()
+{
+    _scheduled = false;
+    if (poll()) {
+        _scheduled = true;
+        _queue->call_in(MBED_CONF_PN5180_ASYNC_POLL_INTERVAL_MS, this, &PN5180OperationScheduler::step);
+    }
+}
+#endif
+
+void PN5180OperationScheduler::resetStats()
+{
+    memset(_stats, 0, sizeof(_stats));
+}
+
+bool PN5180OperationScheduler::inventory(PN5180Priority priority, uint8_t *uid, ISO15693AsyncCallback callback, void *context)
+{
+    return 0L != submit(OP_INVENTORY, priority, uid, callback, context);
+}
+
+bool PN5180OperationScheduler::getSystemInfo(PN5180Priority priority, uint8_t *uid, uint8_t *blockSize, uint8_t *numBlocks, ISO15693AsyncCallback callback, void *context)
+{
+    Slot *slot = submit(OP_SYSTEM_INFO, priority, uid, callback, context);
+    if (0L == slot) {
+        return false;
+    }
+    slot->blockSizeOut = blockSize;
+    slot->numBlocksOut = numBlocks;
+    return true;
+}
+
+bool PN5180OperationScheduler::readBlocks(PN5180Priority priority, uint8_t *uid, uint8_t blockNo, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize, ISO15693AsyncCallback callback, void *context)
+{
+    return submitBlocks(OP_READ_BLOCKS, priority, uid, blockNo, numBlocks, blockData, blockSize, callback, context);
+}
+
+bool PN5180OperationScheduler::writeBlocks(PN5180Priority priority, uint8_t *uid, uint8_t blockNo, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize, ISO15693AsyncCallback callback, void *context)
+{
+    return submitBlocks(OP_WRITE_BLOCKS, priority, uid, blockNo, numBlocks, blockData, blockSize, callback, context);
+}
+
+bool PN5180OperationScheduler::submitBlocks(Operation op, PN5180Priority priority, uint8_t *uid, uint8_t blockNo, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize, ISO15693AsyncCallback callback, void *context)
+{
+    if ((0 == numBlocks) || (0 == blockSize) || (blockSize > 32) || ((blockNo + numBlocks) > 256)) {
+        return false;
+    }
+    Slot *slot = submit(op, priority, uid, callback, context);
+    if (0L == slot) {
+        return false;
+    }
+    slot->blockNo = blockNo;
+    slot->numBlocks = numBlocks;
+    slot->blockData = blockData;
+    slot->blockSize = blockSize;
+    return true;
+}
+
+PN5180OperationScheduler::Slot * PN5180OperationScheduler::submit(Operation op, PN5180Priority priority, uint8_t *uid, ISO15693AsyncCallback callback, void *context)
+{
+    if (priority >= PN5180_PRIORITY_COUNT) {
+        return 0L;
+    }
+    Slot *slot = 0L;
+    for (uint8_t i=0; i<MBED_CONF_PN5180_OPERATION_SCHEDULER_SLOTS; i++) {
+        if (!_slots[i].used) {
+            slot = &_slots[i];
+            break;
+        }
+    }
+    if (0L == slot) {
+        tr_debug("Operation queue full\n");
+        return 0L;
+    }
+
+    slot->used = true;
+    slot->op = op;
+    slot->priority = priority;
+    slot->seq = _seq++;
+    slot->submitted = _async.getReader().getMicros();
+    slot->uid = uid;
+    slot->blockSizeOut = 0L;
+    slot->numBlocksOut = 0L;
+    slot->blockData = 0L;
+    slot->blockSize = 0;
+    slot->blockNo = 0;
+    slot->numBlocks = 0;
+    slot->done = 0;
+    slot->chunk = 0;
+    slot->callback = callback;
+    slot->context = context;
+    _pending++;
+
+#if MBED_CONF_EVENTS_PRESENT
+    if (_queue && !_scheduled) {
+        _scheduled = true;
+        _queue->call(this, &PN5180OperationScheduler::step);
+    }
+#endif
+    return slot;
+}
+
+/*
+ * The oldest operation of the highest priority waiting
+ */
+PN5180OperationScheduler::Slot * PN5180OperationScheduler::next()
+{
+    Slot *best = 0L;
+    for (uint8_t i=0; i<MBED_CONF_PN5180_OPERATION_SCHEDULER_SLOTS; i++) {
+        Slot *slot = &_slots[i];
+        if (!slot->used) {
+            continue;
+        }
+        if ((0L == best) || (slot->priority < best->priority) ||
+            ((slot->priority == best->priority) && ((int32_t)(slot->seq - best->seq) < 0))) {
+            best = slot;
+        }
+    }
+    return best;
+}
+
+bool PN5180OperationScheduler::poll()
+{
+    if (0L != _current) {
+        _async.poll(); // stepCompleted() clears _current
+        if (0L != _current) {
+            return true;
+        }
+    }
+
+    Slot *slot = next();
+    if (0L == slot) {
+        return false;
+    }
+    if (startStep(slot)) {
+        _async.poll(); // send the request at once
+    }
+    // otherwise the reader is busy, retried with the next poll()
+    return true;
+}
+
+bool PN5180OperationScheduler::startStep(Slot *slot)
+{
+    bool started = false;
+    _current = slot;
+    switch (slot->op)
+    {
+        case OP_INVENTORY:
+            started = _async.inventoryAsync(slot->uid, stepCompleted, slot);
+            break;
+        case OP_SYSTEM_INFO:
+            started = _async.getSystemInfoAsync(slot->uid, slot->blockSizeOut, slot->numBlocksOut, stepCompleted, slot);
+            break;
+        case OP_READ_BLOCKS:
+        case OP_WRITE_BLOCKS:
+            slot->chunk = MBED_CONF_PN5180_OPERATION_SCHEDULER_CHUNK_BYTES / slot->blockSize;
+            if (0 == slot->chunk) {
+                slot->chunk = 1;
+            }
+            if (slot->chunk > (slot->numBlocks - slot->done)) {
+                slot->chunk = slot->numBlocks - slot->done;
+            }
+            if (OP_READ_BLOCKS == slot->op) {
+                started = _async.readBlocksAsync(slot->uid, slot->blockNo + slot->done, slot->chunk,
+                    &slot->blockData[slot->done * slot->blockSize], slot->blockSize, stepCompleted, slot);
+            }
+            else {
+                started = _async.writeBlocksAsync(slot->uid, slot->blockNo + slot->done, slot->chunk,
+                    &slot->blockData[slot->done * slot->blockSize], slot->blockSize, stepCompleted, slot);
+            }
+            break;
+    }
+    if (!started) {
+        _current = 0L;
+    }
+    return started;
+}
+
+void PN5180OperationScheduler::stepCompleted(void *context, ISO15693ErrorCode rc)
+{
+    Slot *slot = (Slot *)context;
+    PN5180OperationScheduler *scheduler = slot->scheduler;
+    scheduler->_current = 0L;
+
+    if ((ISO15693_EC_OK == rc) && ((OP_READ_BLOCKS == slot->op) || (OP_WRITE_BLOCKS == slot->op))) {
+        slot->done += slot->chunk;
+        if (slot->done < slot->numBlocks) {
+            return; // next step when its turn comes
+        }
+    }
+    scheduler->finish(slot, rc);
+}
+
+/*
+ * The slot is free again before the callback, which may submit further operations
+ */
+void PN5180OperationScheduler::finish(Slot *slot, ISO15693ErrorCode rc)
+{
+    PN5180PriorityStats &stats = _stats[slot->priority];
+    uint32_t latency = _async.getReader().getMicros() - slot->submitted;
+    stats.completed++;
+    stats.totalLatency_us += latency;
+    if (latency > stats.maxLatency_us) {
+        stats.maxLatency_us = latency;
+    }
+
+    slot->used = false;
+    _pending--;
+    if (slot->callback) {
+        slot->callback(slot->context, rc);
+    }
+}
+
+#endif // MBED_CONF_PN5180_OPERATION_SCHEDULER_ENABLE && MBED_CONF_PN5180_ASYNC_ENABLE
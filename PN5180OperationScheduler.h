@@ -0,0 +1,141 @@
+// NAME: PN5180OperationScheduler.h
+//
+// DESC: Priority classes for the operations on one reader.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180OPERATIONSCHEDULER_H
+#define PN5180OPERATIONSCHEDULER_H
+
+#include "PN5180ISO15693Async.h"
+
+// Compile the operation scheduler, requires ASYNC_ENABLE (0 leaves it out)
+#ifndef MBED_CONF_PN5180_OPERATION_SCHEDULER_ENABLE
+#define MBED_CONF_PN5180_OPERATION_SCHEDULER_ENABLE 1
+#endif
+
+#if MBED_CONF_PN5180_OPERATION_SCHEDULER_ENABLE && MBED_CONF_PN5180_ASYNC_ENABLE
+
+// Operations queued at a time, of all priorities
+#ifndef MBED_CONF_PN5180_OPERATION_SCHEDULER_SLOTS
+#define MBED_CONF_PN5180_OPERATION_SCHEDULER_SLOTS 8
+#endif
+
+// Data bytes per step of a block read or write (at least one block), higher priorities
+// get in between steps; 32 bytes are ~10 ms on air
+#ifndef MBED_CONF_PN5180_OPERATION_SCHEDULER_CHUNK_BYTES
+#define MBED_CONF_PN5180_OPERATION_SCHEDULER_CHUNK_BYTES 32
+#endif
+
+enum PN5180Priority {
+    PN5180_PRIORITY_HIGH    = 0,    // e.g. badge detection, presence checks
+    PN5180_PRIORITY_NORMAL  = 1,
+    PN5180_PRIORITY_BULK    = 2,    // e.g. tag dumps
+    PN5180_PRIORITY_COUNT   = 3
+};
+
+// per priority class, latency from the submission until the completion
+struct PN5180PriorityStats {
+    uint32_t completed;
+    uint32_t maxLatency_us;
+    uint64_t totalLatency_us;
+};
+
+/*
+ * Queues the operations on one reader by priority class. Block reads and
+ * writes are run in steps of MBED_CONF_PN5180_OPERATION_SCHEDULER_CHUNK_BYTES;
+ * after each step the oldest operation of the highest waiting
+ * priority goes on, so a short urgent operation waits at most for one step
+ * of a long one instead of the whole transfer. Within a class operations run
+ * in submission order; a steady load of a higher class starves lower ones.
+ *
+ * Operations are those of PN5180ISO15693Async and complete through the
+ * callback with the result of the first failing step, later steps are not
+ * run then. Buffers must stay valid until the completion. The scheduler is
+ * advanced by poll() from the main loop or by an attached EventQueue; the
+ * PN5180ISO15693Async must not be attached to a queue nor be used otherwise.
+ */
+class PN5180OperationScheduler
+{
+public:
+    PN5180OperationScheduler(PN5180ISO15693Async &async);
+
+#if MBED_CONF_EVENTS_PRESENT
+    void attach(EventQueue *queue);
+#endif
+
+    // return false if all slots are in use or the parameters are invalid
+    bool inventory(PN5180Priority priority, uint8_t *uid, ISO15693AsyncCallback callback, void *context);
+    bool getSystemInfo(PN5180Priority priority, uint8_t *uid, uint8_t *blockSize, uint8_t *numBlocks, ISO15693AsyncCallback callback, void *context);
+    bool readBlocks(PN5180Priority priority, uint8_t *uid, uint8_t blockNo, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize, ISO15693AsyncCallback callback, void *context);
+    bool writeBlocks(PN5180Priority priority, uint8_t *uid, uint8_t blockNo, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize, ISO15693AsyncCallback callback, void *context);
+
+    // advance the step in flight or start the next one, returns true while operations are queued
+    bool poll();
+    uint8_t pending() { return _pending; }
+
+    const PN5180PriorityStats & getStats(PN5180Priority priority) { return _stats[priority]; }
+    void resetStats();
+
+private:
+    enum Operation {
+        OP_INVENTORY,
+        OP_SYSTEM_INFO,
+        OP_READ_BLOCKS,
+        OP_WRITE_BLOCKS
+    };
+    struct Slot {
+        PN5180OperationScheduler *scheduler;
+        bool used;
+        Operation op;
+        PN5180Priority priority;
+        uint32_t seq;           // submission order
+        uint32_t submitted;     // microsecond tick
+        uint8_t *uid;
+        uint8_t *blockSizeOut;
+        uint8_t *numBlocksOut;
+        uint8_t *blockData;
+        uint8_t blockSize;
+        uint8_t blockNo;
+        uint16_t numBlocks;
+        uint16_t done;          // blocks of the finished steps
+        uint16_t chunk;         // blocks of the step in flight
+        ISO15693AsyncCallback callback;
+        void *context;
+    };
+
+    PN5180ISO15693Async &_async;
+    Slot _slots[MBED_CONF_PN5180_OPERATION_SCHEDULER_SLOTS];
+    Slot *_current;             // step in flight
+    uint8_t _pending;
+    uint32_t _seq;
+    PN5180PriorityStats _stats[PN5180_PRIORITY_COUNT];
+
+#if MBED_CONF_EVENTS_PRESENT
+    EventQueue *_queue;
+    bool _scheduled;
+    void step();
+#endif
+
+    Slot * submit(Operation op, PN5180Priority priority, uint8_t *uid, ISO15693AsyncCallback callback, void *context);
+    bool submitBlocks(Operation op, PN5180Priority priority, uint8_t *uid, uint8_t blockNo, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize, ISO15693AsyncCallback callback, void *context);
+    Slot * next();
+    bool startStep(Slot *slot);
+    void finish(Slot *slot, ISO15693ErrorCode rc);
+    static void stepCompleted(void *context, ISO15693ErrorCode rc);
+};
+
+#endif // MBED_CONF_PN5180_OPERATION_SCHEDULER_ENABLE && MBED_CONF_PN5180_ASYNC_ENABLE
+#endif // PN5180OPERATIONSCHEDULER_H
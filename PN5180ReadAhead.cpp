@@ -0,0 +1,152 @@
+// NAME: PN5180ReadAhead.cpp
+//
+// DESC: Implementation of PN5180ReadAhead class.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+
+#include "PN5180ReadAhead.h"
+#include "pn5180_trace.h"
+
+#if MBED_CONF_PN5180_READ_AHEAD_ENABLE
+
+#define NO_BLOCK    (0xffff)
+
+PN5180ReadAhead::PN5180ReadAhead(PN5180ISO15693 &nfc) 
+    : _nfc(nfc)
+{
+    memset(_uid, 0, sizeof(_uid));
+    _unaddressed = false;
+    _blockSize = 0;
+    invalidate();
+}
+
+/*
+ * Forget everything about the current tag, e.g. after a tag change or
+ * after the tag memory was written by other means.
+ */
+void PN5180ReadAhead::invalidate() 
+{
+    _lastBlockNo = NO_BLOCK;
+    _multipleUnsupported = false;
+    _firstCached = 0;
+    _numCached = 0;
+    _endBlock = 256;
+}
+
+bool PN5180ReadAhead::isSameTag(uint8_t *uid, uint8_t blockSize) 
+{
+    if ((blockSize != _blockSize) || ((0L == uid) != _unaddressed)) {
+        return false;
+    }
+    return (0L == uid) || (0 == memcmp(uid, _uid, sizeof(_uid)));
+}
+
+/*
+ * Read a single block, served from the prefetch buffer where possible.
+ *
+ * A read of block n directly following a read of block n-1 is taken as a
+ * sequential scan: blocks n..n+depth-1 are fetched with READ MULTIPLE BLOCKS,
+ * where depth is the number of blocks fitting into the prefetch buffer.
+ * If the tag does not support the command, the request is served with
+ * READ SINGLE BLOCK and no further prefetch is attempted on this tag. A window
+ * reaching beyond the end of tag memory is halved until the tag accepts it.
+ */
+ISO15693ErrorCode PN5180ReadAhead::readSingleBlock(uint8_t *uid, uint8_t blockNo, uint8_t *blockData, uint8_t blockSize) 
+{
+    if (!isSameTag(uid, blockSize)) {
+        invalidate();
+        _unaddressed = (0L == uid);
+        if (uid) {
+            memcpy(_uid, uid, sizeof(_uid));
+        }
+        _blockSize = blockSize;
+    }
+
+    if ((blockNo >= _firstCached) && (blockNo < _firstCached + _numCached)) {
+        tr_debug("Read-ahead hit, block #%d\n", blockNo);
+        memcpy(blockData, &_buffer[(blockNo - _firstCached) * blockSize], blockSize);
+        _lastBlockNo = blockNo;
+        return ISO15693_EC_OK;
+    }
+
+    bool sequential = (NO_BLOCK != _lastBlockNo) && (blockNo == _lastBlockNo + 1);
+    uint16_t depth = (blockSize > 0) ? (sizeof(_buffer) / blockSize) : 0;
+
+    uint16_t numBlocks = depth;
+    if (blockNo + numBlocks > _endBlock) {
+        numBlocks = (_endBlock > blockNo) ? (_endBlock - blockNo) : 0;
+    }
+
+    while (sequential && !_multipleUnsupported && (numBlocks > 1)) {
+        tr_debug("Read-ahead prefetch, blocks #%d-%d\n", blockNo, blockNo + numBlocks - 1);
+        ISO15693ErrorCode rc = _nfc.readMultipleBlocks(uid, blockNo, numBlocks, _buffer, blockSize);
+        if (ISO15693_EC_OK == rc) {
+            _firstCached = blockNo;
+            _numCached = numBlocks;
+            memcpy(blockData, _buffer, blockSize);
+            _lastBlockNo = blockNo;
+            return ISO15693_EC_OK;
+        }
+
+        _numCached = 0;
+        switch (rc) 
+        {
+            case ISO15693_EC_NOT_SUPPORTED:
+            case ISO15693_EC_NOT_RECOGNIZED:
+            case ISO15693_EC_OPTION_NOT_SUPPORTED:
+                tr_debug("READ MULTIPLE BLOCKS not supported, reading single blocks\n");
+                _multipleUnsupported = true;
+                break;
+            case ISO15693_EC_BLOCK_NOT_AVAILABLE:
+                // prefetch window reaches beyond the end of tag memory
+                _endBlock = blockNo + numBlocks - 1;
+                numBlocks = numBlocks / 2;
+                break;
+            case EC_NO_CARD:
+                return rc;
+            default:
+                numBlocks = 0; // let the single block read decide
+                break;
+        }
+    }
+
+    ISO15693ErrorCode rc = _nfc.readSingleBlock(uid, blockNo, blockData, blockSize);
+    if (ISO15693_EC_OK == rc) {
+        _lastBlockNo = blockNo;
+    }
+    return rc;
+}
+
+/*
+ * Write a single block and keep the prefetch buffer coherent.
+ */
+ISO15693ErrorCode PN5180ReadAhead::writeSingleBlock(uint8_t *uid, uint8_t blockNo, uint8_t *blockData, uint8_t blockSize) 
+{
+    ISO15693ErrorCode rc = _nfc.writeSingleBlock(uid, blockNo, blockData, blockSize);
+
+    if (isSameTag(uid, blockSize) && (blockNo >= _firstCached) && (blockNo < _firstCached + _numCached)) {
+        if (ISO15693_EC_OK == rc) {
+            memcpy(&_buffer[(blockNo - _firstCached) * blockSize], blockData, blockSize);
+        }
+        else {
+            _numCached = 0; // block content unknown now
+        }
+    }
+
+    return rc;
+}
+
+#endif // MBED_CONF_PN5180_READ_AHEAD_ENABLE
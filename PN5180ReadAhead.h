@@ -0,0 +1,74 @@
+// NAME: PN5180ReadAhead.h
+//
+// DESC: Sequential read-ahead for ISO15693 block access on the PN5180.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180READAHEAD_H
+#define PN5180READAHEAD_H
+
+#include "PN5180ISO15693.h"
+
+// Compile the read-ahead layer (0 leaves it out)
+#ifndef MBED_CONF_PN5180_READ_AHEAD_ENABLE
+#define MBED_CONF_PN5180_READ_AHEAD_ENABLE 1
+#endif
+
+#if MBED_CONF_PN5180_READ_AHEAD_ENABLE
+
+// Size of the prefetch buffer in bytes, i.e. 8 blocks of a 4 byte ICODE tag
+#ifndef MBED_CONF_PN5180_READ_AHEAD_BUFFER_SIZE
+#define MBED_CONF_PN5180_READ_AHEAD_BUFFER_SIZE 32
+#endif
+
+/*
+ * Block access layer on top of PN5180ISO15693::readSingleBlock.
+ *
+ * As soon as two consecutive blocks of the same tag are requested, the following
+ * blocks are prefetched with one READ MULTIPLE BLOCKS exchange into a fixed buffer
+ * and the next calls are served from there without any RF traffic.
+ * Tags rejecting READ MULTIPLE BLOCKS are remembered and served block by block.
+ * In single tag mode uid may be NULL, the unaddressed tag is cached like any
+ * other; call invalidate() when it is swapped.
+ */
+class PN5180ReadAhead 
+{
+public:
+    PN5180ReadAhead(PN5180ISO15693 &nfc);
+
+    ISO15693ErrorCode readSingleBlock(uint8_t *uid, uint8_t blockNo, uint8_t *blockData, uint8_t blockSize);
+    ISO15693ErrorCode writeSingleBlock(uint8_t *uid, uint8_t blockNo, uint8_t *blockData, uint8_t blockSize);
+
+    void invalidate();
+
+private:
+    PN5180ISO15693 &_nfc;
+
+    uint8_t _uid[8];
+    bool _unaddressed;         // cached for a NULL uid
+    uint8_t _blockSize;
+    uint16_t _lastBlockNo;     // last block served, 0xffff = none
+    bool _multipleUnsupported; // tag rejected READ MULTIPLE BLOCKS
+    uint16_t _endBlock;        // upper bound of tag memory learned from failed prefetches
+
+    uint16_t _firstCached;     // first block in buffer
+    uint16_t _numCached;       // number of valid blocks in buffer
+    uint8_t _buffer[MBED_CONF_PN5180_READ_AHEAD_BUFFER_SIZE];
+
+    bool isSameTag(uint8_t *uid, uint8_t blockSize);
+};
+
+#endif // MBED_CONF_PN5180_READ_AHEAD_ENABLE
+#endif // PN5180READAHEAD_H
@@ -0,0 +1,187 @@
+// NAME: PN5180Scanner.cpp
+//
+// DESC: Concurrent inventory scans over several PN5180 readers.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+
+#include "PN5180Scanner.h"
+#include "pn5180_trace.h"
+
+#if MBED_CONF_PN5180_SCANNER_ENABLE && MBED_CONF_PN5180_ASYNC_ENABLE
+
+PN5180Scanner::PN5180Scanner()
+{
+#if MBED_CONF_EVENTS_PRESENT
+    _queue = 0L;
+    _scheduled = false;
+#endif
+    _numReaders = 0;
+    _scanning = false;
+    _continuous = false;
+    _cycleActive = false;
+    _cycleStart = 0;
+    _cycles = 0;
+    _lastCycleTime = 0;
+    _eventHead = 0;
+    _eventCount = 0;
+    _dropped = 0;
+}
+
+#if MBED_CONF_EVENTS_PRESENT
+void PN5180Scanner::attach(EventQueue *queue)
+{
+    _queue = queue;
+}
+
+void PN5180Scanner::step()
+{
+    _scheduled = false;
+    if (poll()) {
+        _scheduled = true;
+        _queue->call_in(MBED_CONF_PN5180_ASYNC_POLL_INTERVAL_MS, this, &PN5180Scanner::step);
+    }
+}
+#endif
+
+bool PN5180Scanner::addReader(PN5180ISO15693Async &reader, uint8_t id)
+{
+    if (_scanning || (_numReaders >= MBED_CONF_PN5180_SCANNER_READERS)) {
+        return false;
+    }
+    Reader &r = _readers[_numReaders++];
+    r.scanner = this;
+    r.async = &reader;
+    r.id = id;
+    return true;
+}
+
+bool PN5180Scanner::start(bool continuous)
+{
+    if (_scanning || (0 == _numReaders)) {
+        return false;
+    }
+    _scanning = true;
+    _continuous = continuous;
+    startCycle();
+
+#if MBED_CONF_EVENTS_PRESENT
+    if (_queue && !_scheduled) {
+        _scheduled = true;
+        _queue->call(this, &PN5180Scanner::step);
+    }
+#endif
+    return true;
+}
+
+void PN5180Scanner::stop()
+{
+    for (uint8_t i=0; i<_numReaders; i++) {
+        _readers[i].async->cancel();
+    }
+    _cycleActive = false;
+    _scanning = false;
+}
+
+/*
+ * Queue a multi-slot inventory on every reader. The requests are sent by the next
+ * poll(), one reader after the other, so their air times overlap.
+ */
+void PN5180Scanner::startCycle()
+{
+    _cycleStart = now();
+    _cycleActive = true;
+    for (uint8_t i=0; i<_numReaders; i++) {
+        Reader &r = _readers[i];
+        if (!r.async->inventoryMultipleAsync(r.uids, MBED_CONF_PN5180_SCANNER_TAGS, &r.numTags, completed, &r)) {
+            tr_debug("Reader %d busy, skipped in this cycle\n", r.id);
+        }
+    }
+}
+
+bool PN5180Scanner::poll()
+{
+    if (!_cycleActive) {
+        return false;
+    }
+
+    bool busy = false;
+    for (uint8_t i=0; i<_numReaders; i++) {
+        if (_readers[i].async->poll()) {
+            busy = true;
+        }
+    }
+    if (busy) {
+        return true;
+    }
+
+    _cycleActive = false;
+    _lastCycleTime = now() - _cycleStart;
+    _cycles++;
+    if (_continuous) {
+        startCycle();
+        return true;
+    }
+    _scanning = false;
+    return false;
+}
+
+void PN5180Scanner::completed(void *context, ISO15693ErrorCode rc)
+{
+    Reader *r = (Reader *)context;
+    for (uint8_t i=0; i<r->numTags; i++) {
+        r->scanner->pushEvent(*r, ISO15693_EC_OK, &r->uids[8 * i]);
+    }
+    if ((ISO15693_EC_OK == rc) && (r->async->getReader().getInventoryStats().unresolved > 0)) {
+        rc = EC_COLLISION; // further tags that could not be told apart
+    }
+    if ((ISO15693_EC_OK != rc) && (EC_NO_CARD != rc)) {
+        r->scanner->pushEvent(*r, rc, 0L);
+    }
+}
+
+void PN5180Scanner::pushEvent(Reader &reader, ISO15693ErrorCode rc, const uint8_t *uid)
+{
+    if (_eventCount >= MBED_CONF_PN5180_SCANNER_EVENTS) {
+        _eventHead = (_eventHead + 1) % MBED_CONF_PN5180_SCANNER_EVENTS;
+        _eventCount--;
+        _dropped++;
+    }
+    PN5180ScanEvent &e = _events[(_eventHead + _eventCount) % MBED_CONF_PN5180_SCANNER_EVENTS];
+    _eventCount++;
+
+    e.time = now();
+    e.reader = reader.id;
+    e.rc = rc;
+    if (0L != uid) {
+        memcpy(e.uid, uid, 8);
+    }
+    else {
+        memset(e.uid, 0, 8);
+    }
+}
+
+bool PN5180Scanner::readEvent(PN5180ScanEvent *event)
+{
+    if (0 == _eventCount) {
+        return false;
+    }
+    *event = _events[_eventHead];
+    _eventHead = (_eventHead + 1) % MBED_CONF_PN5180_SCANNER_EVENTS;
+    _eventCount--;
+    return true;
+}
+
+#endif // MBED_CONF_PN5180_SCANNER_ENABLE && MBED_CONF_PN5180_ASYNC_ENABLE
@@ -0,0 +1,136 @@
+// NAME: PN5180Scanner.h
+//
+// DESC: Concurrent inventory scans over several PN5180 readers.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180SCANNER_H
+#define PN5180SCANNER_H
+
+#include "PN5180ISO15693Async.h"
+
+// Compile the multi-reader scanner, requires ASYNC_ENABLE (0 leaves it out)
+#ifndef MBED_CONF_PN5180_SCANNER_ENABLE
+#define MBED_CONF_PN5180_SCANNER_ENABLE 1
+#endif
+
+#if MBED_CONF_PN5180_SCANNER_ENABLE && MBED_CONF_PN5180_ASYNC_ENABLE
+
+// Readers driven by one scanner
+#ifndef MBED_CONF_PN5180_SCANNER_READERS
+#define MBED_CONF_PN5180_SCANNER_READERS 4
+#endif
+
+// UIDs inventoried per reader and cycle, further tags are left out
+#ifndef MBED_CONF_PN5180_SCANNER_TAGS
+#define MBED_CONF_PN5180_SCANNER_TAGS 8
+#endif
+
+// Scan events buffered until read, older events are dropped when full
+#ifndef MBED_CONF_PN5180_SCANNER_EVENTS
+#define MBED_CONF_PN5180_SCANNER_EVENTS 16
+#endif
+
+struct PN5180ScanEvent {
+    uint32_t time;          // microseconds, when the inventory completed
+    uint8_t reader;         // id passed to addReader()
+    ISO15693ErrorCode rc;   // ISO15693_EC_OK, EC_COLLISION or a transmission error
+    uint8_t uid[8];         // valid with ISO15693_EC_OK, one event per tag
+};
+
+/*
+ * Inventory scans on several readers at once, each on its own SPI bus and
+ * with its own antenna. All readers are driven by one interleaved state
+ * machine over their PN5180ISO15693Async, so while one reader waits for the
+ * air time of its inventory slot the others send their requests or read their
+ * responses. A scan cycle starts a multi-slot inventory on every reader and
+ * ends when all of them completed, its duration is that of the slowest reader
+ * plus the host interface traffic of the others, not the sum of all readers.
+ *
+ * Results of all readers are merged into one event queue, tagged with the
+ * reader id and in the order the inventories completed. Each tag found gives
+ * an event with its UID, up to MBED_CONF_PN5180_SCANNER_TAGS per reader.
+ * Collisions that could not be resolved give one EC_COLLISION event for the
+ * reader. Empty fields are not reported. Like PN5180ISO15693Async, the scanner is advanced by poll()
+ * from the main loop or by an attached EventQueue; the readers themselves
+ * must not be attached to a queue nor be used otherwise while scanning.
+ * The timestamps are those of the first reader, all readers are expected
+ * to share the microsecond clock.
+ */
+class PN5180Scanner
+{
+public:
+    PN5180Scanner();
+
+#if MBED_CONF_EVENTS_PRESENT
+    void attach(EventQueue *queue);
+#endif
+
+    // returns false if all reader slots are in use or while scanning
+    bool addReader(PN5180ISO15693Async &reader, uint8_t id);
+    uint8_t numReaders() { return _numReaders; }
+
+    // scan cycle after cycle until stop(), or a single cycle
+    bool start(bool continuous = true);
+    void stop();
+    bool isScanning() { return _scanning; }
+    // advance all readers, returns true while scanning
+    bool poll();
+
+    // oldest event, false if there is none
+    bool readEvent(PN5180ScanEvent *event);
+    uint16_t available() { return _eventCount; }
+
+    uint32_t getCycles() { return _cycles; }
+    uint32_t getLastCycleTime() { return _lastCycleTime; }
+    uint32_t getDroppedEvents() { return _dropped; }
+
+private:
+    struct Reader {
+        PN5180Scanner *scanner;
+        PN5180ISO15693Async *async;
+        uint8_t id;
+        uint8_t uids[8 * MBED_CONF_PN5180_SCANNER_TAGS];
+        uint8_t numTags;
+    };
+
+    Reader _readers[MBED_CONF_PN5180_SCANNER_READERS];
+    uint8_t _numReaders;
+    bool _scanning;
+    bool _continuous;
+    bool _cycleActive;
+    uint32_t _cycleStart;
+    uint32_t _cycles;
+    uint32_t _lastCycleTime;
+
+    PN5180ScanEvent _events[MBED_CONF_PN5180_SCANNER_EVENTS];
+    uint16_t _eventHead;        // oldest event
+    uint16_t _eventCount;
+    uint32_t _dropped;
+
+#if MBED_CONF_EVENTS_PRESENT
+    EventQueue *_queue;
+    bool _scheduled;
+    void step();
+#endif
+
+    uint32_t now() { return _readers[0].async->getReader().getMicros(); }
+    void startCycle();
+    void pushEvent(Reader &reader, ISO15693ErrorCode rc, const uint8_t *uid);
+    static void completed(void *context, ISO15693ErrorCode rc);
+};
+
+#endif // MBED_CONF_PN5180_SCANNER_ENABLE && MBED_CONF_PN5180_ASYNC_ENABLE
+#endif // PN5180SCANNER_H
@@ -0,0 +1,254 @@
+// NAME: PN5180UidIndex.cpp
+//
+// DESC: Fixed-capacity index of inventoried UIDs for de-duplication.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+
+#include "PN5180UidIndex.h"
+#include "pn5180_trace.h"
+
+#if MBED_CONF_PN5180_UID_INDEX_ENABLE
+
+#define NO_SLOT     (0xffffffffUL)
+#define SLOT_MASK   (MBED_CONF_PN5180_UID_INDEX_SLOTS - 1)
+
+PN5180UidIndex::PN5180UidIndex()
+{
+    _evictCallback = 0L;
+    _evictContext = 0L;
+    _evictions = 0;
+    clear();
+}
+
+void PN5180UidIndex::setEvictCallback(PN5180UidEvictCallback callback, void *context)
+{
+    _evictCallback = callback;
+    _evictContext = context;
+}
+
+void PN5180UidIndex::clear()
+{
+    for (uint32_t i=0; i<MBED_CONF_PN5180_UID_INDEX_SLOTS; i++) {
+        _slots[i].hits = 0;
+    }
+    _size = 0;
+    _newest = NO_SLOT;
+    _oldest = NO_SLOT;
+}
+
+/*
+ * Home slot of a UID. The serial number bytes differ most between tags, the
+ * manufacturer bytes hardly, so all bytes are mixed (murmur3 finalizer).
+ */
+uint32_t PN5180UidIndex::slotOf(const uint8_t *uid)
+{
+    uint32_t lo = (uint32_t)uid[0] | ((uint32_t)uid[1] << 8) | ((uint32_t)uid[2] << 16) | ((uint32_t)uid[3] << 24);
+    uint32_t hi = (uint32_t)uid[4] | ((uint32_t)uid[5] << 8) | ((uint32_t)uid[6] << 16) | ((uint32_t)uid[7] << 24);
+    uint32_t h = lo ^ (hi * 0x9e3779b1UL);
+    h ^= h >> 16;
+    h *= 0x85ebca6bUL;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35UL;
+    h ^= h >> 16;
+    return h & SLOT_MASK;
+}
+
+uint32_t PN5180UidIndex::lookup(const uint8_t *uid)
+{
+    uint32_t i = slotOf(uid);
+    while (_slots[i].hits) {
+        if (0 == memcmp(_slots[i].uid, uid, 8)) {
+            return i;
+        }
+        i = (i + 1) & SLOT_MASK;
+    }
+    return NO_SLOT;
+}
+
+const PN5180UidEntry * PN5180UidIndex::find(const uint8_t *uid)
+{
+    uint32_t i = lookup(uid);
+    return (NO_SLOT != i) ? &_slots[i] : 0L;
+}
+
+const PN5180UidEntry * PN5180UidIndex::seen(const uint8_t *uid, uint32_t now, bool *isNew)
+{
+    uint32_t i = slotOf(uid);
+    while (_slots[i].hits) {
+        if (0 == memcmp(_slots[i].uid, uid, 8)) {
+            PN5180UidEntry &e = _slots[i];
+            e.hits++;
+            e.lastSeen = now;
+            if (_newest != i) {
+                unlink(i);
+                linkNewest(i);
+            }
+            if (isNew) *isNew = false;
+            return &e;
+        }
+        i = (i + 1) & SLOT_MASK;
+    }
+
+    if (_size >= capacity()) {
+        evict(_oldest);
+        // the eviction may have shifted the probe sequence, search the free slot again
+        i = slotOf(uid);
+        while (_slots[i].hits) {
+            i = (i + 1) & SLOT_MASK;
+        }
+    }
+
+    PN5180UidEntry &e = _slots[i];
+    memcpy(e.uid, uid, 8);
+    e.firstSeen = now;
+    e.lastSeen = now;
+    e.hits = 1;
+    linkNewest(i);
+    _size++;
+    if (isNew) *isNew = true;
+    return &e;
+}
+
+ISO15693ErrorCode PN5180UidIndex::inventory(PN5180ISO15693 &nfc, uint32_t now, const PN5180UidEntry **entry, bool *isNew)
+{
+    uint8_t uid[8];
+    ISO15693ErrorCode rc = nfc.getInventory(uid);
+    if (ISO15693_EC_OK != rc) {
+        return rc;
+    }
+    const PN5180UidEntry *e = seen(uid, now, isNew);
+    if (entry) {
+        *entry = e;
+    }
+    return ISO15693_EC_OK;
+}
+
+bool PN5180UidIndex::remove(const uint8_t *uid)
+{
+    uint32_t i = lookup(uid);
+    if (NO_SLOT == i) {
+        return false;
+    }
+    erase(i);
+    return true;
+}
+
+uint32_t PN5180UidIndex::expire(uint32_t now, uint32_t maxAge)
+{
+    uint32_t n = 0;
+    while ((NO_SLOT != _oldest) && ((now - _slots[_oldest].lastSeen) > maxAge)) {
+        evict(_oldest);
+        n++;
+    }
+    return n;
+}
+
+const PN5180UidEntry * PN5180UidIndex::oldest()
+{
+    return (NO_SLOT != _oldest) ? &_slots[_oldest] : 0L;
+}
+
+const PN5180UidEntry * PN5180UidIndex::newest()
+{
+    return (NO_SLOT != _newest) ? &_slots[_newest] : 0L;
+}
+
+void PN5180UidIndex::unlink(uint32_t slot)
+{
+    PN5180UidEntry &e = _slots[slot];
+    if (NO_SLOT != e.newer) {
+        _slots[e.newer].older = e.older;
+    }
+    else {
+        _newest = e.older;
+    }
+    if (NO_SLOT != e.older) {
+        _slots[e.older].newer = e.newer;
+    }
+    else {
+        _oldest = e.newer;
+    }
+}
+
+void PN5180UidIndex::linkNewest(uint32_t slot)
+{
+    PN5180UidEntry &e = _slots[slot];
+    e.newer = NO_SLOT;
+    e.older = _newest;
+    if (NO_SLOT != _newest) {
+        _slots[_newest].newer = slot;
+    }
+    else {
+        _oldest = slot;
+    }
+    _newest = slot;
+}
+
+// an entry moved into the slot, update its neighbours in the recency list
+void PN5180UidIndex::relink(uint32_t slot)
+{
+    PN5180UidEntry &e = _slots[slot];
+    if (NO_SLOT != e.newer) {
+        _slots[e.newer].older = slot;
+    }
+    else {
+        _newest = slot;
+    }
+    if (NO_SLOT != e.older) {
+        _slots[e.older].newer = slot;
+    }
+    else {
+        _oldest = slot;
+    }
+}
+
+void PN5180UidIndex::evict(uint32_t slot)
+{
+    _evictions++;
+    if (_evictCallback) {
+        _evictCallback(_evictContext, &_slots[slot]);
+    }
+    erase(slot);
+}
+
+/*
+ * Free a slot without tombstones: following entries of the probe sequence
+ * move back into the gap unless their home slot lies behind it.
+ */
+void PN5180UidIndex::erase(uint32_t slot)
+{
+    unlink(slot);
+
+    uint32_t i = slot;
+    uint32_t j = slot;
+    while (true) {
+        j = (j + 1) & SLOT_MASK;
+        if (0 == _slots[j].hits) {
+            break;
+        }
+        uint32_t k = slotOf(_slots[j].uid);
+        bool stays = (i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j));
+        if (!stays) {
+            _slots[i] = _slots[j];
+            relink(i);
+            i = j;
+        }
+    }
+    _slots[i].hits = 0;
+    _size--;
+}
+
+#endif // MBED_CONF_PN5180_UID_INDEX_ENABLE
@@ -0,0 +1,106 @@
+// NAME: PN5180UidIndex.h
+//
+// DESC: Fixed-capacity index of inventoried UIDs for de-duplication.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180UIDINDEX_H
+#define PN5180UIDINDEX_H
+
+#include "PN5180ISO15693.h"
+
+// Compile the UID index (0 leaves it out)
+#ifndef MBED_CONF_PN5180_UID_INDEX_ENABLE
+#define MBED_CONF_PN5180_UID_INDEX_ENABLE 1
+#endif
+
+#if MBED_CONF_PN5180_UID_INDEX_ENABLE
+
+// Slots of the hash table, a power of 2; up to 3/4 of them hold UIDs
+#ifndef MBED_CONF_PN5180_UID_INDEX_SLOTS
+#define MBED_CONF_PN5180_UID_INDEX_SLOTS 256
+#endif
+#if (MBED_CONF_PN5180_UID_INDEX_SLOTS & (MBED_CONF_PN5180_UID_INDEX_SLOTS - 1)) != 0
+#error "MBED_CONF_PN5180_UID_INDEX_SLOTS must be a power of 2"
+#endif
+
+struct PN5180UidEntry {
+    uint8_t uid[8];
+    uint32_t firstSeen;
+    uint32_t lastSeen;
+    uint32_t hits;          // 0 = free slot
+    uint32_t newer;         // recency list, slot numbers
+    uint32_t older;
+};
+
+typedef void (*PN5180UidEvictCallback)(void *context, const PN5180UidEntry *entry);
+
+/*
+ * Index of the UIDs seen by inventories, e.g. to count the distinct tags
+ * passing a portal. Open addressing with linear probing on a hash of the
+ * UID gives O(1) inserts and lookups without any heap allocation. The
+ * entries are kept in a recency list: when the index is full, the least
+ * recently seen UID is evicted, and expire() evicts the UIDs not seen for a
+ * given time. Evicted entries are passed to the evict callback.
+ *
+ * Timestamps are supplied by the caller in any unit that wraps at 32 bits,
+ * e.g. milliseconds. Calls with decreasing timestamps break the age order.
+ */
+class PN5180UidIndex
+{
+public:
+    PN5180UidIndex();
+
+    void setEvictCallback(PN5180UidEvictCallback callback, void *context);
+
+    // count a sighting of the UID, isNew tells if it was not in the index
+    const PN5180UidEntry * seen(const uint8_t *uid, uint32_t now, bool *isNew = 0);
+    // inventory a tag and count it
+    ISO15693ErrorCode inventory(PN5180ISO15693 &nfc, uint32_t now, const PN5180UidEntry **entry = 0, bool *isNew = 0);
+
+    const PN5180UidEntry * find(const uint8_t *uid);
+    bool remove(const uint8_t *uid);
+    // evict all UIDs not seen for more than maxAge, returns their number
+    uint32_t expire(uint32_t now, uint32_t maxAge);
+    void clear();
+
+    // least and most recently seen entries, 0 when empty
+    const PN5180UidEntry * oldest();
+    const PN5180UidEntry * newest();
+
+    uint32_t size() { return _size; }
+    uint32_t capacity() { return MBED_CONF_PN5180_UID_INDEX_SLOTS / 4 * 3; }
+    uint32_t getEvictions() { return _evictions; }
+
+private:
+    PN5180UidEntry _slots[MBED_CONF_PN5180_UID_INDEX_SLOTS];
+    uint32_t _size;
+    uint32_t _newest;
+    uint32_t _oldest;
+    uint32_t _evictions;
+    PN5180UidEvictCallback _evictCallback;
+    void *_evictContext;
+
+    uint32_t slotOf(const uint8_t *uid);
+    uint32_t lookup(const uint8_t *uid);
+    void unlink(uint32_t slot);
+    void linkNewest(uint32_t slot);
+    void relink(uint32_t slot);
+    void evict(uint32_t slot);
+    void erase(uint32_t slot);
+};
+
+#endif // MBED_CONF_PN5180_UID_INDEX_ENABLE
+#endif // PN5180UIDINDEX_H
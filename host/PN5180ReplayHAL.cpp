@@ -0,0 +1,283 @@
+// NAME: PN5180ReplayHAL.cpp
+//
+// DESC: Replay of a captured SPI conversation to the PN5180 driver.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#include <string.h>
+#include "PN5180ReplayHAL.h"
+
+PN5180ReplayHAL::PN5180ReplayHAL()
+{
+    _now_ns = 0;
+    _spiByteTime_ns = 1600; // 5 MHz
+    load(0L, 0);
+}
+
+static bool getVarint(const uint8_t *data, size_t len, size_t *pos, uint32_t *value)
+{
+    *value = 0;
+    for (int shift=0; shift<35; shift+=7) {
+        if (*pos >= len) {
+            return false;
+        }
+        uint8_t b = data[(*pos)++];
+        *value |= (uint32_t)(b & 0x7f) << shift;
+        if (0 == (b & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool getBytes(const uint8_t *data, size_t len, size_t *pos, std::vector<uint8_t> &bytes)
+{
+    uint32_t n;
+    if (!getVarint(data, len, pos, &n) || (n > len - *pos)) {
+        return false;
+    }
+    bytes.assign(data + *pos, data + *pos + n);
+    *pos += n;
+    return true;
+}
+
+/*
+ * Parse a capture and rewind the replay. Returns false if the capture is
+ * truncated or of an unknown format, the records up to the error are kept.
+ */
+bool PN5180ReplayHAL::load(const uint8_t *data, size_t len)
+{
+    _records.clear();
+    _pos = 0;
+    _phase = PHASE_IDLE;
+    _nss = true;
+    _busyDone = false;
+    _busyUntil_ns = 0;
+    _replayStart_ns = 0;
+    _recordStart_ns = 0;
+    memset(&_stats, 0, sizeof(_stats));
+    _stats.firstMismatch = -1;
+
+    if (0L == data) {
+        return false;
+    }
+    if ((len < 4) || (0 != memcmp(data, PN5180_CAPTURE_MAGIC, 3)) || (data[3] > PN5180_CAPTURE_VERSION)) {
+        return false;
+    }
+
+    size_t pos = 4;
+    while (pos < len) {
+        PN5180ReplayRecord r;
+        r.tag = data[pos++];
+        r.busyTx = 0;
+        r.busyRx = 0;
+        r.status = PN5180_CAPTURE_OK;
+        if (!getVarint(data, len, &pos, &r.dt)) {
+            return false;
+        }
+        if (PN5180_CAPTURE_FRAME == r.tag) {
+            if (!getBytes(data, len, &pos, r.tx) || !getBytes(data, len, &pos, r.rx) ||
+                !getVarint(data, len, &pos, &r.busyTx) || !getVarint(data, len, &pos, &r.busyRx) || (pos >= len)) {
+                return false;
+            }
+            r.status = data[pos++];
+        }
+        else if (PN5180_CAPTURE_RESET != r.tag) {
+            return false;
+        }
+        _records.push_back(r);
+    }
+    return true;
+}
+
+bool PN5180ReplayHAL::load(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (0L == f) {
+        return false;
+    }
+    std::vector<uint8_t> data;
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        data.insert(data.end(), buf, buf + n);
+    }
+    fclose(f);
+    return load(data.empty() ? (const uint8_t *)"" : &data[0], data.size());
+}
+
+void PN5180ReplayHAL::fileWriter(void *file, const uint8_t *data, size_t len)
+{
+    fwrite(data, 1, len, (FILE *)file);
+}
+
+/*
+ * The driver starts the next record: compare its start with the capture,
+ * both counted from the first record.
+ */
+void PN5180ReplayHAL::beginRecord()
+{
+    if (_pos >= _records.size()) {
+        return;
+    }
+    if (0 == _stats.records) {
+        _replayStart_ns = _now_ns;
+    }
+    else {
+        _recordStart_ns += (uint64_t)_records[_pos].dt * 1000;
+    }
+    _stats.records++;
+
+    uint64_t replayed = _now_ns - _replayStart_ns;
+    uint64_t deviation = (replayed > _recordStart_ns) ? (replayed - _recordStart_ns) : (_recordStart_ns - replayed);
+    if (deviation / 1000 > _stats.maxDeviationUs) {
+        _stats.maxDeviationUs = (uint32_t)(deviation / 1000);
+    }
+    _stats.recordedUs = _recordStart_ns / 1000;
+    _stats.replayedUs = replayed / 1000;
+}
+
+void PN5180ReplayHAL::endRecord()
+{
+    if (_pos < _records.size()) {
+        _pos++;
+    }
+    _phase = PHASE_IDLE;
+}
+
+void PN5180ReplayHAL::mismatch()
+{
+    if (_stats.firstMismatch < 0) {
+        _stats.firstMismatch = (int32_t)_pos;
+    }
+    _stats.mismatches++;
+}
+
+void PN5180ReplayHAL::setReset(bool level)
+{
+    if (level) {
+        return;
+    }
+    if (PHASE_IDLE != _phase) {
+        endRecord();
+    }
+    if (finished() || (PN5180_CAPTURE_RESET != _records[_pos].tag)) {
+        mismatch(); // reset not in the capture
+        return;
+    }
+    beginRecord();
+    endRecord();
+}
+
+void PN5180ReplayHAL::setNSS(bool level)
+{
+    if (level == _nss) {
+        return;
+    }
+    _nss = level;
+    _busyDone = false;
+
+    if (!level) { // start of frame
+        if ((PHASE_TX_BUSY == _phase) && !finished() && !_records[_pos].rx.empty()) {
+            _phase = PHASE_RX; // a send frame if the driver skips the reception, see transfer()
+            return;
+        }
+        if (PHASE_IDLE != _phase) {
+            endRecord();
+        }
+        while (!finished() && (PN5180_CAPTURE_RESET == _records[_pos].tag)) {
+            mismatch(); // reset in the capture only
+            endRecord();
+        }
+        beginRecord();
+        _phase = PHASE_TX;
+        return;
+    }
+
+    // end of frame: BUSY stays high as long as in the capture, forever after a BUSY timeout
+    uint32_t busy = 0;
+    if (!finished()) {
+        const PN5180ReplayRecord &r = _records[_pos];
+        busy = (PHASE_TX == _phase) ? r.busyTx : r.busyRx;
+        if ((PN5180_CAPTURE_OK != r.status) && ((PHASE_RX == _phase) || r.rx.empty())) {
+            busy = 0xffffffff;
+        }
+    }
+    _busyUntil_ns = _now_ns + (uint64_t)busy * 1000;
+    _phase = (PHASE_TX == _phase) ? PHASE_TX_BUSY : PHASE_RX_BUSY;
+}
+
+bool PN5180ReplayHAL::getBusy()
+{
+    if (!_nss) {
+        return _busyDone;
+    }
+    if ((PHASE_TX_BUSY != _phase) && (PHASE_RX_BUSY != _phase)) {
+        return false;
+    }
+    if (_now_ns < _busyUntil_ns) {
+        _now_ns += 1000;
+        return true;
+    }
+    if ((PHASE_RX_BUSY == _phase) || finished() || _records[_pos].rx.empty()) {
+        endRecord(); // command complete
+    }
+    return false;
+}
+
+void PN5180ReplayHAL::transfer(const uint8_t *tx, uint8_t *rx, size_t len)
+{
+    _now_ns += (uint64_t)len * _spiByteTime_ns;
+    if (_nss) {
+        return;
+    }
+    _busyDone = true;
+
+    if ((PHASE_RX == _phase) && (0L != tx)) {
+        mismatch(); // the driver did not read the response
+        endRecord();
+        beginRecord();
+        _phase = PHASE_TX;
+    }
+
+    if (finished()) {
+        mismatch(); // the driver goes on beyond the capture
+        if (rx) {
+            memset(rx, 0xff, len);
+        }
+        return;
+    }
+
+    const PN5180ReplayRecord &r = _records[_pos];
+    if (PHASE_TX == _phase) {
+        if ((0L == tx) || (len != r.tx.size()) || ((len > 0) && (0 != memcmp(tx, &r.tx[0], len)))) {
+            mismatch();
+        }
+        if (rx) {
+            memset(rx, 0xff, len);
+        }
+    }
+    else {
+        if (len != r.rx.size()) {
+            mismatch();
+        }
+        if (rx) {
+            memset(rx, 0xff, len);
+            if (!r.rx.empty()) {
+                memcpy(rx, &r.rx[0], (len < r.rx.size()) ? len : r.rx.size());
+            }
+        }
+    }
+}
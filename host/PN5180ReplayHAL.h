@@ -0,0 +1,111 @@
+// NAME: PN5180ReplayHAL.h
+//
+// DESC: Replay of a captured SPI conversation to the PN5180 driver.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180REPLAYHAL_H
+#define PN5180REPLAYHAL_H
+
+#include <stdio.h>
+#include <vector>
+#include "PN5180HAL.h"
+#include "PN5180Capture.h"
+
+struct PN5180ReplayRecord {
+    uint8_t tag;
+    uint32_t dt;
+    std::vector<uint8_t> tx;
+    std::vector<uint8_t> rx;
+    uint32_t busyTx;
+    uint32_t busyRx;
+    uint8_t status;
+};
+
+struct PN5180ReplayStats {
+    uint32_t records;           // records replayed
+    uint32_t mismatches;        // frames the driver sent differently or not at all
+    int32_t firstMismatch;      // record number, -1 if none
+    uint64_t recordedUs;        // capture time up to the last replayed record
+    uint64_t replayedUs;        // time the driver took for the same records
+    uint32_t maxDeviationUs;    // largest difference of a record start
+};
+
+/*
+ * PN5180 host interface serving a capture (see PN5180Capture.h) back to the
+ * driver, so a recorded session runs on a PC. Each send frame of the driver is
+ * compared with the recorded one, receive frames return the recorded bytes and
+ * BUSY stays high for the recorded time. The clock only advances when the
+ * driver waits, by the SPI transfer time and by 1 us per BUSY poll, like
+ * PN5180Simulator, so a replay is fully deterministic.
+ *
+ * The start of every record is compared with the capture: the same driver
+ * replays a session with identical frames, and timing deviations show where
+ * a changed driver spends more or less time than the captured one.
+ */
+class PN5180ReplayHAL : public PN5180HAL
+{
+public:
+    PN5180ReplayHAL();
+
+    bool load(const uint8_t *data, size_t len);
+    bool load(const char *path);
+
+    // PN5180HAL
+    virtual void begin() {}
+    virtual void setNSS(bool level);
+    virtual void setReset(bool level);
+    virtual bool getBusy();
+    virtual void transfer(const uint8_t *tx, uint8_t *rx, size_t len);
+    virtual uint32_t micros() { return (uint32_t)(_now_ns / 1000); }
+    virtual void delayMicros(uint32_t us) { _now_ns += (uint64_t)us * 1000; }
+
+    void setSpiByteTime(uint32_t ns) { _spiByteTime_ns = ns; }
+
+    size_t numRecords() { return _records.size(); }
+    const PN5180ReplayRecord & record(size_t i) { return _records[i]; }
+    bool finished() { return _pos >= _records.size(); }
+    const PN5180ReplayStats & getStats() { return _stats; }
+
+    // PN5180CaptureWriter appending to a FILE *
+    static void fileWriter(void *file, const uint8_t *data, size_t len);
+
+private:
+    enum Phase {
+        PHASE_IDLE,             // between records
+        PHASE_TX,               // NSS low, send frame expected
+        PHASE_TX_BUSY,          // after the send frame
+        PHASE_RX,               // NSS low, receive frame expected
+        PHASE_RX_BUSY           // after the receive frame
+    };
+
+    std::vector<PN5180ReplayRecord> _records;
+    size_t _pos;
+    Phase _phase;
+    bool _nss;
+    bool _busyDone;
+    uint64_t _now_ns;
+    uint64_t _busyUntil_ns;
+    uint64_t _replayStart_ns;
+    uint64_t _recordStart_ns;   // capture time of the current record
+    uint32_t _spiByteTime_ns;
+    PN5180ReplayStats _stats;
+
+    void beginRecord();
+    void endRecord();
+    void mismatch();
+};
+
+#endif // PN5180REPLAYHAL_H
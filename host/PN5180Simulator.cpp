@@ -0,0 +1,609 @@
+// NAME: PN5180Simulator.cpp
+//
+// DESC: Host side simulation of a PN5180 with ISO15693 tags in its field.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+
+#include <string.h>
+#include "PN5180Simulator.h"
+#include "PN5180.h"
+
+// ISO15693 timing, 26.48 kbit/s request, high data rate single subcarrier response
+#define SIM_BYTE_TIME_US        302     // 8 bits, both directions
+#define SIM_REQUEST_SOF_EOF_US  113
+#define SIM_REQUEST_EOF_US      38
+#define SIM_RESPONSE_SOF_EOF_US 113
+#define SIM_T1_US               321     // VICC response delay
+
+// busy time of the slow host interface commands
+#define SIM_EEPROM_TIME_US      100
+#define SIM_EEPROM_WRITE_TIME_US 5000
+#define SIM_STARTUP_TIME_US     1500    // after power-on or reset
+#define SIM_RF_CONFIG_TIME_US   500
+#define SIM_RF_SWITCH_TIME_US   500
+
+#define SIM_TX_DATA_ENABLE      (1UL << 10)
+#define SIM_TX_CONFIG_DEFAULT   (0x000004c0)
+
+static uint32_t le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+PN5180Simulator::PN5180Simulator()
+{
+    _ownClock = 0;
+    _clock = &_ownClock;
+    _spiByteTime_ns = 1600; // 5 MHz
+    _writeTime_us = 5000;
+    _commandTime_us = 0;
+    _executeTime_us = 0;
+    _busyUntil_ns = 0;
+    _inReset = false;
+    _nss = true;
+    _busy = false;
+    _responsePos = 0;
+    _responsePending = false;
+    _readFrame = false;
+    _spiFrames = 0;
+    _rfExchanges = 0;
+    _eepromWrites = 0;
+    _rfOn = false;
+    _rxConfig = PN5180_RF_RX_CFG_ISO15693_ASK100_26KBIT;
+    _fieldOnSince_ns = 0;
+    _fieldOnTime_ns = 0;
+    _corruptBits = 0;
+    _corruptCount = 0;
+
+    memset(_eeprom, 0, sizeof(_eeprom));
+    for (int i=0; i<16; i++) {
+        _eeprom[DIE_IDENTIFIER + i] = 0xd0 + i;
+    }
+    _eeprom[PRODUCT_VERSION] = 0x00; _eeprom[PRODUCT_VERSION + 1] = 0x04;
+    _eeprom[FIRMWARE_VERSION] = 0x00; _eeprom[FIRMWARE_VERSION + 1] = 0x04;
+    _eeprom[EEPROM_VERSION] = 0x00; _eeprom[EEPROM_VERSION + 1] = 0x99;
+
+    powerOn();
+}
+
+void PN5180Simulator::switchField(bool on)
+{
+    if (_rfOn && !on) {
+        _fieldOnTime_ns += *_clock - _fieldOnSince_ns;
+    }
+    else if (!_rfOn && on) {
+        _fieldOnSince_ns = *_clock;
+    }
+    _rfOn = on;
+    _reg[RF_STATUS] = on ? (_reg[RF_STATUS] | TX_RF_STATUS) : (_reg[RF_STATUS] & ~TX_RF_STATUS);
+}
+
+uint64_t PN5180Simulator::getFieldOnTime_us()
+{
+    uint64_t t = _fieldOnTime_ns;
+    if (_rfOn) {
+        t += *_clock - _fieldOnSince_ns;
+    }
+    return t / 1000;
+}
+
+void PN5180Simulator::powerOn()
+{
+    memset(_reg, 0, sizeof(_reg));
+    _reg[IRQ_STATUS] = IDLE_IRQ_STAT;
+    _reg[TX_CONFIG] = SIM_TX_CONFIG_DEFAULT;
+    _inventorySlot = 16;
+    switchField(false);
+    _rxPending = false;
+    _rxResponse = false;
+    _responsePending = false;
+    for (size_t i=0; i<_tags.size(); i++) {
+        _tags[i].state = PN5180_SIM_READY;
+    }
+}
+
+PN5180SimTag & PN5180Simulator::addTag(const uint8_t *uid, uint16_t numBlocks, uint8_t blockSize)
+{
+    PN5180SimTag t;
+    memcpy(t.uid, uid, 8);
+    t.dsfid = 0;
+    t.afi = 0;
+    t.icRef = 0x01;
+    t.blockSize = blockSize;
+    t.numBlocks = numBlocks;
+    t.readMultiple = true;
+    t.nxpCommands = (0x04 == t.uid[6]);
+    t.inField = true;
+    t.state = PN5180_SIM_READY;
+    t.memory.assign(numBlocks * blockSize, 0);
+    t.locked.assign(numBlocks, false);
+    _tags.push_back(t);
+    return _tags.back();
+}
+
+void PN5180Simulator::corruptResponses(uint32_t rxErrorBits, uint32_t n)
+{
+    _corruptBits = rxErrorBits;
+    _corruptCount = n;
+}
+
+void PN5180Simulator::setReset(bool level)
+{
+    if (!level) {
+        _inReset = true;
+    }
+    else if (_inReset) {
+        _inReset = false;
+        powerCycle();
+    }
+}
+
+void PN5180Simulator::powerCycle()
+{
+    powerOn();
+    _busy = true;
+    _busyUntil_ns = *_clock + (uint64_t)SIM_STARTUP_TIME_US * 1000;
+}
+
+void PN5180Simulator::setNSS(bool level)
+{
+    if (level == _nss) {
+        return;
+    }
+    _nss = level;
+    if (!level) { // start of frame
+        _frame.clear();
+        _readFrame = _responsePending;
+        return;
+    }
+
+    // end of frame
+    _spiFrames++;
+    if (_readFrame) {
+        _responsePending = false;
+        _response.clear();
+    }
+    else if (!_frame.empty() && !_inReset) {
+        executeCommand();
+    }
+    uint32_t busy = _commandTime_us + _executeTime_us;
+    _executeTime_us = 0;
+    _busyUntil_ns = *_clock + (uint64_t)busy * 1000;
+    _busy = (busy > 0);
+}
+
+bool PN5180Simulator::getBusy()
+{
+    if (_busy && _nss) {
+        if (*_clock >= _busyUntil_ns) {
+            _busy = false;
+        }
+        else {
+            *_clock += 1000;
+        }
+    }
+    return _busy;
+}
+
+void PN5180Simulator::transfer(const uint8_t *tx, uint8_t *rx, size_t len)
+{
+    for (size_t i=0; i<len; i++) {
+        uint8_t out = 0xff;
+        if (!_nss) {
+            if (_readFrame) {
+                if (_responsePos < _response.size()) {
+                    out = _response[_responsePos];
+                }
+                _responsePos++;
+            }
+            else {
+                _frame.push_back(tx ? tx[i] : 0xff);
+            }
+            _busy = true;
+        }
+        if (rx) {
+            rx[i] = out;
+        }
+        *_clock += _spiByteTime_ns;
+    }
+}
+
+void PN5180Simulator::executeCommand()
+{
+    const uint8_t *f = &_frame[0];
+    size_t len = _frame.size();
+
+    switch (f[0])
+    {
+        case 0x00: // WRITE_REGISTER
+            if (len >= 6) writeRegister(f[1], le32(&f[2]));
+            break;
+        case 0x01: // WRITE_REGISTER_OR_MASK
+            if (len >= 6 && f[1] < 0x30) writeRegister(f[1], _reg[f[1]] | le32(&f[2]));
+            break;
+        case 0x02: // WRITE_REGISTER_AND_MASK
+            if (len >= 6 && f[1] < 0x30) writeRegister(f[1], _reg[f[1]] & le32(&f[2]));
+            break;
+        case 0x04: // READ_REGISTER
+        {
+            updateRF();
+            uint32_t value = (len >= 2 && f[1] < 0x30) ? _reg[f[1]] : 0;
+            _response.clear();
+            for (int i=0; i<4; i++) {
+                _response.push_back((value >> (8*i)) & 0xff);
+            }
+            _responsePos = 0;
+            _responsePending = true;
+            break;
+        }
+        case 0x06: // WRITE_EEPROM
+            if ((len >= 3) && (f[1] >= 0x16) && (f[1] + len - 2 <= 255)) {
+                memcpy(&_eeprom[f[1]], &f[2], len - 2);
+                _eepromWrites++;
+                _executeTime_us = SIM_EEPROM_WRITE_TIME_US;
+            }
+            break;
+        case 0x07: // READ_EEPROM
+            if (len >= 3) {
+                _response.assign(&_eeprom[f[1]], &_eeprom[f[1]] + ((f[1] + f[2] <= 256) ? f[2] : 256 - f[1]));
+                _responsePos = 0;
+                _responsePending = true;
+                _executeTime_us = SIM_EEPROM_TIME_US;
+            }
+            break;
+        case 0x09: // SEND_DATA
+            if (len >= 2) transmit(&f[2], len - 2);
+            break;
+        case 0x0A: // READ_DATA
+            _response = _rxBuffer;
+            _responsePos = 0;
+            _responsePending = true;
+            break;
+        case 0x11: // LOAD_RF_CONFIG, 0xFF keeps a configuration
+            if ((len >= 2) && (0xFF != f[1])) _reg[TX_CONFIG] = SIM_TX_CONFIG_DEFAULT;
+            if ((len >= 3) && (0xFF != f[2])) _rxConfig = f[2];
+            _executeTime_us = SIM_RF_CONFIG_TIME_US;
+            break;
+        case 0x16: // RF_ON
+            if (!_rfOn) {
+                for (size_t i=0; i<_tags.size(); i++) {
+                    _tags[i].state = PN5180_SIM_READY; // tags power up
+                }
+            }
+            switchField(true);
+            _reg[IRQ_STATUS] |= TX_RFON_IRQ_STAT;
+            _executeTime_us = SIM_RF_SWITCH_TIME_US;
+            break;
+        case 0x17: // RF_OFF
+            switchField(false);
+            _rxPending = false;
+            _reg[IRQ_STATUS] |= TX_RFOFF_IRQ_STAT;
+            _executeTime_us = SIM_RF_SWITCH_TIME_US;
+            break;
+        default:
+            break;
+    }
+}
+
+void PN5180Simulator::writeRegister(uint8_t reg, uint32_t value)
+{
+    if (reg >= 0x30) {
+        return;
+    }
+    if (IRQ_CLEAR == reg) {
+        _reg[IRQ_STATUS] &= ~value;
+        return;
+    }
+    if (SYSTEM_CONFIG == reg) {
+        uint32_t command = value & 0x07;
+        _reg[SYSTEM_CONFIG] = value;
+        if (0 == command) { // Idle/StopCom
+            _rxPending = false;
+            setTransceiveState(PN5180_TS_Idle);
+        }
+        else if ((3 == command) && (PN5180_TS_Idle == ((_reg[RF_STATUS] >> 24) & 0x07))) { // Transceive
+            setTransceiveState(PN5180_TS_WaitTransmit);
+        }
+        return;
+    }
+    _reg[reg] = value;
+}
+
+void PN5180Simulator::setTransceiveState(uint32_t state)
+{
+    _reg[RF_STATUS] = (_reg[RF_STATUS] & ~(0x07UL << 24)) | (state << 24);
+}
+
+/*
+ * Apply the progress of the RF exchange in flight up to the current time.
+ */
+void PN5180Simulator::updateRF()
+{
+    if (!_rxPending) {
+        return;
+    }
+    if (*_clock < _txEnd_ns) {
+        return;
+    }
+    _reg[IRQ_STATUS] |= TX_IRQ_STAT;
+    setTransceiveState(PN5180_TS_WaitForData);
+    if (!_rxResponse || (*_clock < _rxSof_ns)) {
+        return;
+    }
+    _reg[IRQ_STATUS] |= RX_SOF_DET_IRQ_STAT;
+    setTransceiveState(PN5180_TS_Receiving);
+    if (*_clock < _rxEnd_ns) {
+        return;
+    }
+    _reg[IRQ_STATUS] |= RX_IRQ_STAT;
+    _reg[RX_STATUS] = (_rxFrame.size() & PN5180_SIM_RX_NUM_BYTES_MASK) | _rxErrorBits;
+    _rxBuffer = _rxFrame;
+    _rxPending = false;
+    setTransceiveState(PN5180_TS_WaitTransmit); // transceive loops back
+}
+
+void PN5180Simulator::transmit(const uint8_t *data, size_t len)
+{
+    if ((3 != (_reg[SYSTEM_CONFIG] & 0x07)) || (PN5180_TS_WaitTransmit != ((_reg[RF_STATUS] >> 24) & 0x07))) {
+        return; // SEND_DATA is only executed in WaitTransmit
+    }
+
+    _rfExchanges++;
+    _reg[RX_STATUS] = 0;
+    setTransceiveState(PN5180_TS_Transmitting);
+    _rxPending = true;
+    _rxResponse = false;
+
+    bool eofOnly = (0 == (_reg[TX_CONFIG] & SIM_TX_DATA_ENABLE));
+    if (eofOnly) {
+        // next slot of a 16 slot inventory
+        _txEnd_ns = *_clock + (uint64_t)SIM_REQUEST_EOF_US * 1000;
+        if (_inventorySlot >= 15) {
+            _inventorySlot = 16;
+            return;
+        }
+        _inventorySlot++;
+        data = &_inventoryRequest[0];
+        len = _inventoryRequest.size();
+    }
+    else {
+        _txEnd_ns = *_clock + (uint64_t)(SIM_REQUEST_SOF_EOF_US + (len + 2) * SIM_BYTE_TIME_US) * 1000;
+        if ((len >= 2) && (data[0] & 0x04) && (0 == (data[0] & 0x20))) {
+            _inventoryRequest.assign(data, data + len);
+            _inventorySlot = 0;
+        }
+        else {
+            _inventorySlot = 16;
+        }
+    }
+    if (!_rfOn) {
+        return;
+    }
+
+    bool isWrite = false;
+    _rxErrorBits = 0;
+    _rxResponse = processRequest(data, len, _rxFrame, &_rxErrorBits, &isWrite);
+    if (!_rxResponse) {
+        return;
+    }
+    if (_corruptCount > 0) {
+        _rxErrorBits |= _corruptBits;
+        _corruptCount--;
+    }
+    // FAST INVENTORY READ and FAST READ MULTIPLE BLOCKS respond at double data rate
+    uint32_t rate = ((0xA1 == data[1]) || (0xC3 == data[1])) ? 2 : 1;
+    if ((2 == rate) != (PN5180_RF_RX_CFG_ISO15693_53KBIT == _rxConfig)) {
+        _rxErrorBits |= PN5180_SIM_RX_PROTOCOL_ERROR;
+    }
+    _rxSof_ns = _txEnd_ns + (uint64_t)(SIM_T1_US + (isWrite ? _writeTime_us : 0)) * 1000;
+    _rxEnd_ns = _rxSof_ns + (uint64_t)(SIM_RESPONSE_SOF_EOF_US + (_rxFrame.size() + 2) * SIM_BYTE_TIME_US) * 1000 / rate;
+}
+
+/*
+ * Let all tags in the field answer the request. Differing responses of more
+ * than one tag collide.
+ */
+bool PN5180Simulator::processRequest(const uint8_t *req, size_t len, std::vector<uint8_t> &response, uint32_t *rxErrorBits, bool *isWrite)
+{
+    if (len < 2) {
+        return false;
+    }
+    if ((0 == (req[0] & 0x04)) && (0x25 == req[1]) && (req[0] & 0x20) && (len >= 10)) {
+        // SELECT: any other selected tag returns to ready
+        for (size_t i=0; i<_tags.size(); i++) {
+            if ((PN5180_SIM_SELECTED == _tags[i].state) && (0 != memcmp(_tags[i].uid, &req[2], 8))) {
+                _tags[i].state = PN5180_SIM_READY;
+            }
+        }
+    }
+
+    int responders = 0;
+    std::vector<uint8_t> r;
+    for (size_t i=0; i<_tags.size(); i++) {
+        if (!_tags[i].inField) {
+            continue;
+        }
+        r.clear();
+        if (!tagResponse(_tags[i], req, len, r, isWrite)) {
+            continue;
+        }
+        if (0 == responders) {
+            response = r;
+        }
+        else if (r != response) {
+            *rxErrorBits |= PN5180_SIM_RX_COLLISION;
+        }
+        responders++;
+    }
+    return (responders > 0);
+}
+
+bool PN5180Simulator::tagResponse(PN5180SimTag &t, const uint8_t *req, size_t len, std::vector<uint8_t> &resp, bool *isWrite)
+{
+    uint8_t flags = req[0];
+    uint8_t cmd = req[1];
+    size_t pos = 2;
+
+    if (flags & 0x04) { // inventory
+        bool inventoryRead = ((0xA0 == cmd) || (0xA1 == cmd));
+        if (((0x01 != cmd) && !inventoryRead) || (PN5180_SIM_QUIET == t.state)) {
+            return false;
+        }
+        if (inventoryRead) { // ICODE INVENTORY READ, IC manufacturer code first
+            if (!t.nxpCommands || (pos >= len) || (req[pos++] != t.uid[6])) return false;
+        }
+        if (flags & 0x10) { // AFI
+            if (pos >= len) return false;
+            uint8_t afi = req[pos++];
+            if (((afi >> 4) && ((afi >> 4) != (t.afi >> 4))) || ((afi & 0x0f) && ((afi & 0x0f) != (t.afi & 0x0f)))) {
+                return false;
+            }
+        }
+        if (pos >= len) return false;
+        uint8_t maskLen = req[pos++];
+        for (uint8_t bit=0; bit<maskLen; bit++) {
+            if ((pos + bit/8) >= len) return false;
+            if (((req[pos + bit/8] >> (bit & 7)) & 1) != ((t.uid[bit/8] >> (bit & 7)) & 1)) {
+                return false;
+            }
+        }
+        if (0 == (flags & 0x20)) { // 16 slots: the next 4 UID bits select the slot
+            uint8_t slot = 0;
+            for (uint8_t bit=0; bit<4; bit++) {
+                uint8_t b = maskLen + bit;
+                slot |= ((t.uid[b/8] >> (b & 7)) & 1) << bit;
+            }
+            if (slot != _inventorySlot) return false;
+        }
+        if (inventoryRead) { // UID without the whole mask bytes, then the blocks
+            pos += (maskLen + 7) / 8;
+            if (pos + 2 > len) return false;
+            uint16_t first = req[pos];
+            uint16_t n = req[pos + 1] + 1;
+            if (first + n > t.numBlocks) { resp.push_back(0x01); resp.push_back(0x10); return true; }
+            resp.push_back(0x00);
+            resp.insert(resp.end(), t.uid + maskLen / 8, t.uid + 8);
+            resp.insert(resp.end(), &t.memory[first * t.blockSize], &t.memory[first * t.blockSize] + n * t.blockSize);
+            return true;
+        }
+        resp.push_back(0x00);
+        resp.push_back(t.dsfid);
+        resp.insert(resp.end(), t.uid, t.uid + 8);
+        return true;
+    }
+
+    if ((cmd >= 0xA0) && (cmd <= 0xDF)) { // custom command, only for the IC manufacturer
+        if ((pos >= len) || (req[pos++] != t.uid[6])) return false;
+    }
+    bool addressed = (0 != (flags & 0x20));
+    if (addressed) {
+        if ((len < pos + 8) || (0 != memcmp(&req[pos], t.uid, 8))) return false;
+        pos += 8;
+    }
+    else if (flags & 0x10) {
+        if (PN5180_SIM_SELECTED != t.state) return false;
+    }
+    else if (PN5180_SIM_QUIET == t.state) {
+        return false;
+    }
+
+    switch (cmd)
+    {
+        case 0x02: // STAY QUIET, no response
+            if (addressed) t.state = PN5180_SIM_QUIET;
+            return false;
+        case 0x25: // SELECT
+            if (!addressed) return false;
+            t.state = PN5180_SIM_SELECTED;
+            resp.push_back(0x00);
+            return true;
+        case 0x26: // RESET TO READY
+            t.state = PN5180_SIM_READY;
+            resp.push_back(0x00);
+            return true;
+        case 0x20: // READ SINGLE BLOCK
+        {
+            if (pos >= len) break;
+            uint8_t block = req[pos];
+            if (block >= t.numBlocks) { resp.push_back(0x01); resp.push_back(0x10); return true; }
+            resp.push_back(0x00);
+            resp.insert(resp.end(), &t.memory[block * t.blockSize], &t.memory[block * t.blockSize] + t.blockSize);
+            return true;
+        }
+        case 0x21: // WRITE SINGLE BLOCK
+        {
+            if (pos + 1 + t.blockSize > len) break;
+            uint8_t block = req[pos];
+            if (block >= t.numBlocks) { resp.push_back(0x01); resp.push_back(0x10); return true; }
+            if (t.locked[block]) { resp.push_back(0x01); resp.push_back(0x12); return true; }
+            memcpy(&t.memory[block * t.blockSize], &req[pos + 1], t.blockSize);
+            *isWrite = true;
+            resp.push_back(0x00);
+            return true;
+        }
+        case 0x22: // LOCK BLOCK
+        {
+            if (pos >= len) break;
+            uint8_t block = req[pos];
+            if (block >= t.numBlocks) { resp.push_back(0x01); resp.push_back(0x10); return true; }
+            if (t.locked[block]) { resp.push_back(0x01); resp.push_back(0x11); return true; }
+            t.locked[block] = true;
+            *isWrite = true;
+            resp.push_back(0x00);
+            return true;
+        }
+        case 0xC3: // ICODE FAST READ MULTIPLE BLOCKS
+            if (!t.nxpCommands) { resp.push_back(0x01); resp.push_back(0x01); return true; }
+            // fall through
+        case 0x23: // READ MULTIPLE BLOCKS
+        case 0x2C: // GET MULTIPLE BLOCK SECURITY STATUS
+        {
+            if (pos + 2 > len) break;
+            if ((0x23 == cmd) && !t.readMultiple) { resp.push_back(0x01); resp.push_back(0x01); return true; }
+            uint16_t first = req[pos];
+            uint16_t n = req[pos + 1] + 1;
+            if (first + n > t.numBlocks) { resp.push_back(0x01); resp.push_back(0x10); return true; }
+            resp.push_back(0x00);
+            for (uint16_t b=first; b<first+n; b++) {
+                if (0x2C != cmd) {
+                    resp.insert(resp.end(), &t.memory[b * t.blockSize], &t.memory[b * t.blockSize] + t.blockSize);
+                }
+                else {
+                    resp.push_back(t.locked[b] ? 0x01 : 0x00);
+                }
+            }
+            return true;
+        }
+        case 0x2B: // GET SYSTEM INFORMATION
+            resp.push_back(0x00);
+            resp.push_back(0x0f); // DSFID, AFI, memory size, IC reference
+            resp.insert(resp.end(), t.uid, t.uid + 8);
+            resp.push_back(t.dsfid);
+            resp.push_back(t.afi);
+            resp.push_back((t.numBlocks - 1) & 0xff);
+            resp.push_back((t.blockSize - 1) & 0x1f);
+            resp.push_back(t.icRef);
+            return true;
+        default:
+            resp.push_back(0x01);
+            resp.push_back(0x01); // not supported
+            return true;
+    }
+
+    resp.push_back(0x01);
+    resp.push_back(0x02); // not recognized
+    return true;
+}
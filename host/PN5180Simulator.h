@@ -0,0 +1,169 @@
+// NAME: PN5180Simulator.h
+//
+// DESC: Host side simulation of a PN5180 with ISO15693 tags in its field.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180SIMULATOR_H
+#define PN5180SIMULATOR_H
+
+#include <vector>
+#include "PN5180HAL.h"
+
+// RX_STATUS bits as in the datasheet, not taken from the driver so that a wrong define shows
+#define PN5180_SIM_RX_NUM_BYTES_MASK    (0x000001ffUL)
+#define PN5180_SIM_RX_CRC_ERROR         (1UL << 16)     // RX_DATA_INTEGRITY_ERROR
+#define PN5180_SIM_RX_PROTOCOL_ERROR    (1UL << 17)
+#define PN5180_SIM_RX_COLLISION         (1UL << 18)
+
+enum PN5180SimTagState {
+    PN5180_SIM_READY = 0,
+    PN5180_SIM_SELECTED = 1,
+    PN5180_SIM_QUIET = 2
+};
+
+struct PN5180SimTag {
+    uint8_t uid[8];             // LSB first, as sent over the air
+    uint8_t dsfid;
+    uint8_t afi;
+    uint8_t icRef;
+    uint8_t blockSize;
+    uint16_t numBlocks;
+    bool readMultiple;          // READ MULTIPLE BLOCKS supported
+    bool nxpCommands;           // ICODE custom commands, for NXP UIDs by default
+    bool inField;
+    PN5180SimTagState state;
+    std::vector<uint8_t> memory;
+    std::vector<bool> locked;
+};
+
+/*
+ * PN5180 host interface with a simulated clock, for running the driver on a
+ * host. The clock only advances when the driver waits (delayMicros(),
+ * sleepMillis()), by the SPI transfer time of each byte and by advance(), so
+ * tests step it manually and are fully deterministic. Simulators sharing a
+ * clock (shareClock()) model readers on separate buses working in parallel:
+ * the air time of one overlaps with the host interface traffic of the others.
+ *
+ * Host interface commands complete immediately (BUSY is high only between the
+ * data exchange and NSS deassert) unless a command time is set; startup, EEPROM access,
+ * LOAD_RF_CONFIG, RF_ON and RF_OFF keep BUSY high while they execute. RF exchanges
+ * take their ISO15693 air time at 26 kbit/s: RX_SOF_DET and RX_IRQ are set once the clock passed the
+ * start and the end of the tag response. Fast ICODE commands are answered at 53 kbit/s, a response
+ * at another rate than the RX configuration of LOAD_RF_CONFIG fails with a protocol error. A 16 slot inventory answers in slot 0,
+ * each following transmission with TX_DATA_ENABLE cleared in TX_CONFIG (EOF
+ * only) moves on to the next slot.
+ */
+class PN5180Simulator : public PN5180HAL
+{
+public:
+    PN5180Simulator();
+
+    // PN5180HAL
+    virtual void begin() {}
+    virtual void setNSS(bool level);
+    virtual void setReset(bool level);
+    virtual bool getBusy();
+    virtual void transfer(const uint8_t *tx, uint8_t *rx, size_t len);
+    virtual uint32_t micros() { return (uint32_t)(*_clock / 1000); }
+    virtual void delayMicros(uint32_t us) { advance(us); }
+
+    void advance(uint32_t us) { *_clock += (uint64_t)us * 1000; }
+    uint64_t now_ns() { return *_clock; }
+    // run on the clock of another simulator, e.g. several readers driven by one loop
+    void shareClock(PN5180Simulator &other) { _clock = other._clock; }
+    void setSpiByteTime(uint32_t ns) { _spiByteTime_ns = ns; }
+    // BUSY time after each host interface command, every BUSY poll takes 1 us
+    void setCommandTime(uint32_t us) { _commandTime_us = us; }
+
+    PN5180SimTag & addTag(const uint8_t *uid, uint16_t numBlocks = 28, uint8_t blockSize = 4);
+    PN5180SimTag & tag(size_t i) { return _tags[i]; }
+    size_t numTags() { return _tags.size(); }
+    void removeTags() { _tags.clear(); }
+
+    // RX_STATUS error bits (PN5180_SIM_RX_...) reported with the next n responses
+    void corruptResponses(uint32_t rxErrorBits, uint32_t n = 1);
+    // additional response delay of write commands (programming time)
+    void setWriteTime(uint32_t us) { _writeTime_us = us; }
+
+    // power-on of the chip alone: registers cleared, EEPROM kept
+    void powerCycle();
+    uint8_t * eeprom() { return _eeprom; }
+    uint32_t getEEpromWrites() { return _eepromWrites; }
+
+    bool isRFOn() { return _rfOn; }
+    // total time the RF field was on
+    uint64_t getFieldOnTime_us();
+    uint32_t getSpiFrames() { return _spiFrames; }
+    uint32_t getRFExchanges() { return _rfExchanges; }
+
+private:
+    uint64_t _ownClock;
+    uint64_t *_clock;
+    uint32_t _spiByteTime_ns;
+    uint32_t _writeTime_us;
+    uint32_t _commandTime_us;
+    uint32_t _executeTime_us;   // of the slow command just received
+    uint64_t _busyUntil_ns;
+
+    bool _inReset;
+    bool _nss;
+    bool _busy;
+    std::vector<uint8_t> _frame;
+    std::vector<uint8_t> _response;
+    size_t _responsePos;
+    bool _responsePending;
+
+    uint32_t _reg[0x30];
+    uint8_t _eeprom[256];
+    bool _rfOn;
+    uint8_t _rxConfig;          // of the last LOAD_RF_CONFIG
+    uint64_t _fieldOnSince_ns;
+    uint64_t _fieldOnTime_ns;
+    uint32_t _spiFrames;
+    uint32_t _rfExchanges;
+    uint32_t _eepromWrites;
+
+    // RF exchange in flight
+    bool _rxPending;
+    bool _rxResponse;           // a tag answers the request in flight
+    uint64_t _txEnd_ns;
+    uint64_t _rxSof_ns;
+    uint64_t _rxEnd_ns;
+    std::vector<uint8_t> _rxFrame;
+    uint32_t _rxErrorBits;
+    std::vector<uint8_t> _rxBuffer;
+
+    std::vector<uint8_t> _inventoryRequest;  // 16 slot inventory in progress
+    uint8_t _inventorySlot;                 // 16: none
+
+    uint32_t _corruptBits;
+    uint32_t _corruptCount;
+
+    std::vector<PN5180SimTag> _tags;
+    bool _readFrame;
+
+    void powerOn();
+    void switchField(bool on);
+    void executeCommand();
+    void writeRegister(uint8_t reg, uint32_t value);
+    void setTransceiveState(uint32_t state);
+    void updateRF();
+    void transmit(const uint8_t *data, size_t len);
+    bool processRequest(const uint8_t *req, size_t len, std::vector<uint8_t> &response, uint32_t *rxErrorBits, bool *isWrite);
+    bool tagResponse(PN5180SimTag &t, const uint8_t *req, size_t len, std::vector<uint8_t> &response, bool *isWrite);
+};
+
+#endif // PN5180SIMULATOR_H
@@ -0,0 +1,138 @@
+// NAME: bench_operation_scheduler.cpp
+//
+// DESC: Latency of HIGH priority reads under a bulk load with PN5180OperationScheduler.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// Build and run from the library directory, optionally with another step size
+// (-DMBED_CONF_PN5180_OPERATION_SCHEDULER_CHUNK_BYTES=512 runs each transfer to its end):
+//   g++ -std=gnu++11 -O2 -I. -Ihost -o bench_operation_scheduler host/bench_operation_scheduler.cpp
+//       PN5180OperationScheduler.cpp PN5180ISO15693Async.cpp PN5180ISO15693.cpp PN5180.cpp
+//       PN5180Metrics.cpp pn5180_trace.cpp host/PN5180Simulator.cpp
+//   ./bench_operation_scheduler
+//
+// A BULK dump of 128 blocks of 4 bytes is kept queued all the time. A HIGH
+// single block read of a second tag is submitted 2 to 12 ms (pseudo random)
+// after the previous one completed. The latency of each HIGH read, from its
+// submission to its completion, is recorded for 3 s of the simulated clock,
+// the percentiles are taken from the sorted latencies.
+//
+#include <assert.h>
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+#include "PN5180OperationScheduler.h"
+#include "PN5180Simulator.h"
+
+#define DUMP_BLOCKS     128
+#define RUN_US          3000000
+#define LOOP_US         10
+
+static PN5180Simulator sim;
+static std::vector<uint32_t> latencies;
+static uint32_t highSubmitted;
+static bool highPending;
+static unsigned dumps;
+
+static void highCompleted(void *context, ISO15693ErrorCode rc)
+{
+    (void)context;
+    assert(ISO15693_EC_OK == rc);
+    latencies.push_back(sim.micros() - highSubmitted);
+    highPending = false;
+}
+
+static void bulkCompleted(void *context, ISO15693ErrorCode rc)
+{
+    (void)context;
+    assert(ISO15693_EC_OK == rc);
+    dumps++;
+}
+
+static uint32_t percentile(unsigned p)
+{
+    return latencies[(latencies.size() - 1) * p / 100];
+}
+
+static void run(PN5180OperationScheduler &scheduler)
+{
+    while (scheduler.poll()) {
+        sim.advance(LOOP_US);
+    }
+}
+
+int main()
+{
+    uint8_t dumpUid[8] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x04, 0xE0 };
+    uint8_t badgeUid[8] = { 0x09, 0x02, 0x03, 0x04, 0x05, 0x06, 0x04, 0xE0 };
+    sim.addTag(dumpUid, DUMP_BLOCKS, 4);
+    sim.addTag(badgeUid, 28, 4);
+    PN5180ISO15693 nfc(sim);
+    nfc.powerUp();
+    nfc.reset();
+    assert(nfc.setupRF());
+    PN5180ISO15693Async async(nfc);
+    PN5180OperationScheduler scheduler(async);
+
+    static uint8_t dump[DUMP_BLOCKS * 4];
+    uint8_t block[4];
+
+    // each operation alone on an idle reader
+    uint32_t start = sim.micros();
+    assert(scheduler.readBlocks(PN5180_PRIORITY_HIGH, badgeUid, 3, 1, block, 4, 0L, 0L));
+    run(scheduler);
+    uint32_t highAlone = sim.micros() - start;
+    start = sim.micros();
+    assert(scheduler.readBlocks(PN5180_PRIORITY_BULK, dumpUid, 0, DUMP_BLOCKS, dump, 4, 0L, 0L));
+    run(scheduler);
+    uint32_t dumpAlone = sim.micros() - start;
+
+    // HIGH reads under a steady bulk load
+    scheduler.resetStats();
+    uint32_t seed = 1;
+    uint32_t nextHigh = sim.micros() + 5000;
+    unsigned dumpsQueued = 0;
+    start = sim.micros();
+    while (sim.micros() - start < RUN_US) {
+        if (dumpsQueued == dumps) {
+            assert(scheduler.readBlocks(PN5180_PRIORITY_BULK, dumpUid, 0, DUMP_BLOCKS, dump, 4, bulkCompleted, 0L));
+            dumpsQueued++;
+        }
+        if (!highPending && ((int32_t)(sim.micros() - nextHigh) >= 0)) {
+            highSubmitted = sim.micros();
+            highPending = true;
+            assert(scheduler.readBlocks(PN5180_PRIORITY_HIGH, badgeUid, 3, 1, block, 4, highCompleted, 0L));
+        }
+        bool wasPending = highPending;
+        scheduler.poll();
+        if (wasPending && !highPending) {
+            seed = seed * 1103515245 + 12345;
+            nextHigh = sim.micros() + 2000 + (seed >> 16) % 10000;
+        }
+        sim.advance(LOOP_US);
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    const PN5180PriorityStats &stats = scheduler.getStats(PN5180_PRIORITY_HIGH);
+    assert(stats.completed == latencies.size());
+    assert(stats.maxLatency_us == latencies.back());
+
+    printf("step %d bytes: high read alone %.1f ms, dump of %d blocks alone %.1f ms\n",
+        MBED_CONF_PN5180_OPERATION_SCHEDULER_CHUNK_BYTES, highAlone / 1000.0, DUMP_BLOCKS, dumpAlone / 1000.0);
+    printf("%u high reads in %.0f s: p50 %.1f ms, p99 %.1f ms, max %.1f ms; %u dumps\n",
+        (unsigned)latencies.size(), RUN_US / 1e6, percentile(50) / 1000.0, percentile(99) / 1000.0,
+        latencies.back() / 1000.0, dumps);
+    return 0;
+}
@@ -0,0 +1,125 @@
+// NAME: bench_pipeline.cpp
+//
+// DESC: Commands per second of serial and pipelined block reads on the simulator.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// Build and run from the library directory:
+//   g++ -std=gnu++11 -O2 -I. -Ihost -o bench_pipeline host/bench_pipeline.cpp PN5180ISO15693Async.cpp
+//       PN5180ISO15693.cpp PN5180.cpp PN5180Metrics.cpp pn5180_trace.cpp host/PN5180Simulator.cpp
+//   ./bench_pipeline
+//
+// A tag without READ MULTIPLE BLOCKS is read block by block, 28 blocks of
+// 4 bytes: with readSingleBlock() in a loop (sync), which encodes each request
+// after the previous response was read, and with readBlocksAsync() polled
+// from a main loop (async), which encodes the next request while the response
+// is on air; it starts with a READ MULTIPLE BLOCKS request the tag rejects,
+// which counts as a command as well. The simulator runs SPI at 5 MHz and keeps BUSY high for a command
+// time after each host interface command. The times are those of the
+// simulated clock, so the results are the same on every host.
+//
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "PN5180ISO15693Async.h"
+#include "PN5180Simulator.h"
+
+#define BLOCKS      28
+
+static PN5180Simulator sim;
+static unsigned completions;
+
+static void completed(void *context, ISO15693ErrorCode rc)
+{
+    (void)context;
+    assert(ISO15693_EC_OK == rc);
+    completions++;
+}
+
+static void print(const char *flow, uint32_t commandTime, uint32_t poll, uint64_t start_ns, uint32_t exchanges, uint32_t frames)
+{
+    double ms = (sim.now_ns() - start_ns) / 1e6;
+    char interval[16] = "-";
+    if (poll > 0) {
+        snprintf(interval, sizeof(interval), "%u us", poll);
+    }
+    printf("%-6s | %7u us | %8s | %7.1f ms | %5.0f | %12.1f\n", flow, commandTime, interval, ms,
+        exchanges * 1000.0 / ms, (double)frames / exchanges);
+}
+
+int main()
+{
+    uint8_t uid[8] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x04, 0xE0 };
+    PN5180SimTag &tag = sim.addTag(uid, BLOCKS, 4);
+    tag.readMultiple = false;
+    for (int i=0; i<BLOCKS*4; i++) {
+        tag.memory[i] = (uint8_t)i;
+    }
+    PN5180ISO15693 nfc(sim);
+    nfc.powerUp();
+    nfc.reset();
+    assert(nfc.setupRF());
+    PN5180ISO15693Async async(nfc);
+
+    // addressed READ SINGLE BLOCK: 11 bytes and CRC on air, t1, flags, 4 bytes and CRC back
+    uint32_t airTime = ISO15693_REQUEST_SOF_EOF_US + 13 * ISO15693_REQUEST_BYTE_US + ISO15693_T1_MIN_US +
+        ISO15693_RESPONSE_SOF_EOF_US + 7 * ISO15693_RESPONSE_BYTE_US;
+    printf("%d single block reads, air time bound %.0f cmd/s (%u us per command)\n\n", BLOCKS, 1e6 / airTime, airTime);
+    printf("flow   | BUSY time  | poll     | total      | cmd/s | SPI frames/cmd\n");
+
+    const uint32_t commandTimes[] = { 25, 0 };
+    const uint32_t polls[] = { 1000, 100, 20 };
+    uint8_t data[BLOCKS*4];
+    for (int c=0; c<2; c++) {
+        sim.setCommandTime(commandTimes[c]);
+
+        memset(data, 0, sizeof(data));
+        uint64_t start = sim.now_ns();
+        uint32_t frames = sim.getSpiFrames();
+        for (int b=0; b<BLOCKS; b++) {
+            assert(ISO15693_EC_OK == nfc.readSingleBlock(uid, b, &data[4 * b], 4));
+        }
+        assert(0 == memcmp(data, &tag.memory[0], sizeof(data)));
+        print("sync", commandTimes[c], 0, start, BLOCKS, sim.getSpiFrames() - frames);
+
+        for (int p=0; p<3; p++) {
+            memset(data, 0, sizeof(data));
+            start = sim.now_ns();
+            frames = sim.getSpiFrames();
+            uint32_t exchanges = sim.getRFExchanges();
+            assert(async.readBlocksAsync(uid, 0, BLOCKS, data, 4, completed, 0L));
+            while (async.poll()) {
+                sim.advance(polls[p]);
+            }
+            assert(0 == memcmp(data, &tag.memory[0], sizeof(data)));
+            exchanges = sim.getRFExchanges() - exchanges;
+            assert(1 + BLOCKS == exchanges);
+            print("async", commandTimes[c], polls[p], start, exchanges, sim.getSpiFrames() - frames);
+        }
+    }
+
+    // writes are bound by the programming time of the tag
+    sim.setCommandTime(25);
+    uint64_t start = sim.now_ns();
+    uint32_t frames = sim.getSpiFrames();
+    assert(async.writeBlocksAsync(uid, 0, BLOCKS, data, 4, completed, 0L));
+    while (async.poll()) {
+        sim.advance(100);
+    }
+    printf("\nwrites:\n");
+    print("async", 25, 100, start, BLOCKS, sim.getSpiFrames() - frames);
+    assert(2 * 3 + 1 == completions);
+    return 0;
+}
@@ -0,0 +1,131 @@
+// NAME: bench_uid_index.cpp
+//
+// DESC: Insert, lookup and eviction times of PN5180UidIndex with 10k to 100k UIDs.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// Build and run from the library directory, the index needs the same number
+// of slots in all files:
+//   g++ -std=gnu++11 -O2 -I. -DMBED_CONF_PN5180_UID_INDEX_SLOTS=262144 -o bench_uid_index
+//       host/bench_uid_index.cpp PN5180UidIndex.cpp PN5180ISO15693.cpp PN5180.cpp PN5180Metrics.cpp pn5180_trace.cpp
+//   ./bench_uid_index
+//
+// For each size the index is filled with distinct UIDs (insert), all of them
+// are looked up (hit) as well as as many unknown ones (miss), then expire()
+// evicts them all (expire). With the index filled to its capacity, further
+// new UIDs each evict the least recently seen one (evict).
+//
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "PN5180UidIndex.h"
+
+#define BENCH_MAX_UIDS  100000
+
+#if MBED_CONF_PN5180_UID_INDEX_SLOTS / 4 * 3 < BENCH_MAX_UIDS
+#error "build with -DMBED_CONF_PN5180_UID_INDEX_SLOTS=262144"
+#endif
+
+static PN5180UidIndex idx;
+static uint32_t evicted;
+
+static void onEvict(void *context, const PN5180UidEntry *entry)
+{
+    (void)context;
+    (void)entry;
+    evicted++;
+}
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// ICODE SLIX UIDs with scattered serial numbers, as on a reel of labels
+static void makeUids(std::vector<uint8_t> &uids, uint32_t first, uint32_t n)
+{
+    uids.resize(8 * n);
+    for (uint32_t i=0; i<n; i++) {
+        uint32_t serial = (first + i) * 2654435761UL;
+        uint8_t *uid = &uids[8 * i];
+        uid[0] = serial;
+        uid[1] = serial >> 8;
+        uid[2] = serial >> 16;
+        uid[3] = serial >> 24;
+        uid[4] = (first + i) >> 24;
+        uid[5] = 0x02;
+        uid[6] = 0x04;
+        uid[7] = 0xE0;
+    }
+}
+
+static void bench(uint32_t n)
+{
+    std::vector<uint8_t> uids, unknown;
+    makeUids(uids, 0, n);
+    makeUids(unknown, 0x40000000, n);
+    idx.clear();
+    evicted = 0;
+
+    double t0 = now_ns();
+    for (uint32_t i=0; i<n; i++) {
+        bool isNew;
+        idx.seen(&uids[8 * i], i, &isNew);
+        assert(isNew);
+    }
+    double t1 = now_ns();
+    for (uint32_t i=0; i<n; i++) {
+        assert(0L != idx.find(&uids[8 * i]));
+    }
+    double t2 = now_ns();
+    for (uint32_t i=0; i<n; i++) {
+        assert(0L == idx.find(&unknown[8 * i]));
+    }
+    double t3 = now_ns();
+    assert(n == idx.expire(n, 0));
+    double t4 = now_ns();
+    assert((0 == idx.size()) && (n == evicted));
+
+    // LRU eviction at full load
+    std::vector<uint8_t> fill;
+    makeUids(fill, 0x80000000, idx.capacity());
+    for (uint32_t i=0; i<idx.capacity(); i++) {
+        idx.seen(&fill[8 * i], i, 0L);
+    }
+    evicted = 0;
+    double t5 = now_ns();
+    for (uint32_t i=0; i<n; i++) {
+        idx.seen(&uids[8 * i], idx.capacity() + i, 0L);
+    }
+    double t6 = now_ns();
+    assert(n == evicted);
+
+    printf("%6u UIDs: insert %5.1f ns, hit %5.1f ns, miss %5.1f ns, expire %5.1f ns, evict %5.1f ns\n",
+        n, (t1 - t0) / n, (t2 - t1) / n, (t3 - t2) / n, (t4 - t3) / n, (t6 - t5) / n);
+}
+
+int main()
+{
+    idx.setEvictCallback(onEvict, 0L);
+    printf("%u slots, capacity %u, %u bytes\n", MBED_CONF_PN5180_UID_INDEX_SLOTS, idx.capacity(), (unsigned)sizeof(idx));
+    bench(10000);
+    bench(50000);
+    bench(BENCH_MAX_UIDS);
+    return 0;
+}
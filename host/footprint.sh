@@ -0,0 +1,73 @@
+#!/bin/sh
+# NAME: footprint.sh
+#
+# DESC: Flash/RAM footprint of the library per compile-time configuration.
+#
+# Compiles all library sources with -Os and function/data sections, as an mbed
+# build does, and sums up the sections of the objects:
+#   flash = text + data, RAM = data + bss (static RAM only, without the stack
+#   and the reader objects of the application)
+# Mbed headers are replaced by stubs, so the numbers cover the library alone.
+#
+# Usage: host/footprint.sh [compiler], e.g. host/footprint.sh arm-none-eabi-g++
+#        with CXXFLAGS="-mcpu=cortex-m4 -mthumb" for target numbers.
+#
+
+CXX=${1:-g++}
+SIZE=$(echo "$CXX" | sed 's/g++$/size/;s/clang++$/llvm-size/')
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+mkdir -p "$TMP/stub/platform"
+: > "$TMP/stub/mbed.h"
+cat > "$TMP/stub/platform/mbed_critical.h" <<EOF
+extern "C" void core_util_critical_section_enter(void);
+extern "C" void core_util_critical_section_exit(void);
+EOF
+cat > "$TMP/stub/mbed_trace.h" <<EOF
+#include <stdint.h>
+#if defined (MBED_CONF_MBED_TRACE_ENABLE) && (MBED_CONF_MBED_TRACE_ENABLE == 1)
+extern "C" void mbed_tracef(uint8_t dlevel, const char *grp, const char *fmt, ...);
+#define tr_debug(...)   mbed_tracef(0x10, TRACE_GROUP, __VA_ARGS__)
+#define tr_info(...)    mbed_tracef(0x08, TRACE_GROUP, __VA_ARGS__)
+#define tr_warn(...)    mbed_tracef(0x04, TRACE_GROUP, __VA_ARGS__)
+#define tr_warning(...) mbed_tracef(0x04, TRACE_GROUP, __VA_ARGS__)
+#define tr_error(...)   mbed_tracef(0x02, TRACE_GROUP, __VA_ARGS__)
+#define tr_err(...)     mbed_tracef(0x02, TRACE_GROUP, __VA_ARGS__)
+#else
+#define tr_debug(...)
+#define tr_info(...)
+#define tr_warn(...)
+#define tr_warning(...)
+#define tr_error(...)
+#define tr_err(...)
+#endif
+EOF
+
+MINIMAL="-DMBED_CONF_PN5180_STRINGS_ENABLE=0 -DMBED_CONF_PN5180_NDEF_ENABLE=0 -DMBED_CONF_PN5180_READ_AHEAD_ENABLE=0 \
+ -DMBED_CONF_PN5180_SESSION_ENABLE=0 -DMBED_CONF_PN5180_ASYNC_ENABLE=0 -DMBED_CONF_PN5180_UID_INDEX_ENABLE=0 \
+ -DMBED_CONF_PN5180_CAPTURE_ENABLE=0 -DMBED_CONF_PN5180_SCANNER_ENABLE=0 \
+ -DMBED_CONF_PN5180_FIELD_SCHEDULER_ENABLE=0 -DMBED_CONF_PN5180_BATCH_ENABLE=0 \
+ -DMBED_CONF_PN5180_OPERATION_SCHEDULER_ENABLE=0 -DMBED_CONF_PN5180_METRICS_ENABLE=0"
+
+footprint() {
+    name=$1
+    shift
+    rm -f "$TMP"/*.o
+    for src in "$ROOT"/*.cpp; do
+        $CXX -std=gnu++14 -Os -ffunction-sections -fdata-sections -fno-exceptions -fno-rtti $CXXFLAGS \
+            -D__MBED__=1 "$@" -I"$TMP/stub" -I"$ROOT" -c "$src" -o "$TMP/$(basename "$src" .cpp).o" || exit 1
+    done
+    $SIZE -t "$TMP"/*.o | awk -v name="$name" '/TOTALS/ {
+        printf "| %-40s | %7d | %6d |\n", name, $1 + $2, $2 + $3 }'
+}
+
+echo "| Configuration                            |   Flash |    RAM |"
+echo "|------------------------------------------|---------|--------|"
+footprint "default, mbed-trace enabled" -DMBED_CONF_MBED_TRACE_ENABLE=1
+footprint "default, mbed-trace disabled"
+footprint "TRACE_ENABLE=0 (mbed-trace enabled)" -DMBED_CONF_MBED_TRACE_ENABLE=1 -DMBED_CONF_PN5180_TRACE_ENABLE=0
+footprint "STRINGS_ENABLE=0" -DMBED_CONF_PN5180_STRINGS_ENABLE=0
+footprint "minimal (no strings, layers or async)" $MINIMAL
+footprint "minimal, RX_BUFFERS=1, RX_BUFFER_SIZE=64" $MINIMAL -DMBED_CONF_PN5180_RX_BUFFERS=1 -DMBED_CONF_PN5180_RX_BUFFER_SIZE=64
@@ -0,0 +1,164 @@
+// NAME: pn5180metrics.cpp
+//
+// DESC: Decoder of PN5180 metrics records, see PN5180Metrics.h.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// Build from the library directory:
+//   g++ -std=gnu++11 -O2 -I. -o pn5180metrics host/pn5180metrics.cpp PN5180Metrics.cpp
+//
+// Usage: pn5180metrics [-c] [file]
+//
+// Reads records from the file or stdin, e.g. a UART log with other output in
+// between, and prints one line per record with the rates since the previous
+// record of the same reader. -c prints the raw fields as CSV instead.
+//
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <vector>
+#include "PN5180Metrics.h"
+
+static double rate(uint32_t now, uint32_t before, double seconds)
+{
+    // a counter going back was reset: count from 0
+    uint32_t delta = (now >= before) ? (now - before) : now;
+    return (seconds > 0) ? delta / seconds : 0;
+}
+
+static void printCsvHeader()
+{
+    printf("reader,sequence,time_ms,rf_on_time_ms,host_commands,busy_timeouts,irq_timeouts,resets,recoveries,rf_on,"
+           "commands,retries,no_card,collision,crc_error,protocol_error,data_integrity_error,tag_error,"
+           "inventories,tags_found,tags_in_field,last_error\n");
+}
+
+static void printCsv(const PN5180Metrics &m)
+{
+    printf("%u,%u,%llu,%llu,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u\n",
+        m.readerId, m.sequence, (unsigned long long)m.time_ms, (unsigned long long)m.rfOnTime_ms,
+        m.hostCommands, m.busyTimeouts, m.irqTimeouts, m.resets, m.recoveries, m.rfOn,
+        m.commands, m.retries, m.noCard, m.collision, m.crcError, m.protocolError, m.dataIntegrityError,
+        m.tagError, m.inventories, m.tagsFound, m.tagsInField, m.lastError);
+}
+
+static void printRates(const PN5180Metrics &m, const PN5180Metrics *prev)
+{
+    printf("reader %u #%u t=%.3f s", m.readerId, m.sequence, m.time_ms / 1000.0);
+    if ((0L == prev) || (m.time_ms <= prev->time_ms)) {
+        printf("  commands %u, tags found %u, no card %u, busy timeouts %u\n",
+            m.commands, m.tagsFound, m.noCard, m.busyTimeouts);
+        return;
+    }
+
+    double s = (m.time_ms - prev->time_ms) / 1000.0;
+    uint32_t commands = (m.commands >= prev->commands) ? (m.commands - prev->commands) : m.commands;
+    uint32_t noCard = (m.noCard >= prev->noCard) ? (m.noCard - prev->noCard) : m.noCard;
+    double rfOn = (m.rfOnTime_ms >= prev->rfOnTime_ms) ? (m.rfOnTime_ms - prev->rfOnTime_ms) : 0;
+    if (rfOn > m.time_ms - prev->time_ms) {
+        rfOn = m.time_ms - prev->time_ms; // both rounded down to ms
+    }
+    uint32_t lost = m.sequence - prev->sequence - 1;
+    uint32_t errors = (m.crcError + m.protocolError + m.dataIntegrityError + m.collision) -
+                      (prev->crcError + prev->protocolError + prev->dataIntegrityError + prev->collision);
+
+    printf("  cmd/s %.1f  host/s %.1f  inv/s %.1f  tags %u (found/s %.1f)  no card %.1f%%  retries/s %.1f"
+           "  rx errors/s %.1f  busy timeouts %u  irq timeouts %u  recoveries %u  rf on %.1f%%  error %u",
+        commands / s, rate(m.hostCommands, prev->hostCommands, s), rate(m.inventories, prev->inventories, s),
+        m.tagsInField, rate(m.tagsFound, prev->tagsFound, s), commands ? (100.0 * noCard / commands) : 0.0,
+        rate(m.retries, prev->retries, s), (errors < 0x80000000) ? errors / s : 0.0,
+        m.busyTimeouts - prev->busyTimeouts, m.irqTimeouts - prev->irqTimeouts, m.recoveries - prev->recoveries,
+        100.0 * rfOn / (m.time_ms - prev->time_ms), m.lastError);
+    if (lost && (lost < 0x80000000)) {
+        printf("  (%u lost)", lost);
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    bool csv = false;
+    const char *path = 0L;
+    for (int i=1; i<argc; i++) {
+        if (0 == strcmp(argv[i], "-c")) {
+            csv = true;
+        }
+        else if ((0L == path) && ('-' != argv[i][0])) {
+            path = argv[i];
+        }
+        else {
+            fprintf(stderr, "usage: pn5180metrics [-c] [file]\n");
+            return 2;
+        }
+    }
+    FILE *f = path ? fopen(path, "rb") : stdin;
+    if (0L == f) {
+        perror(path);
+        return 1;
+    }
+
+    std::vector<uint8_t> data;
+    std::map<uint32_t, PN5180Metrics> previous;
+    size_t pos = 0;
+    unsigned records = 0, skipped = 0;
+    if (csv) {
+        printCsvHeader();
+    }
+
+    uint8_t buf[4096];
+    size_t n;
+    bool eof = false;
+    while (!eof) {
+        n = fread(buf, 1, sizeof(buf), f);
+        eof = (0 == n);
+        data.insert(data.end(), buf, buf + n);
+
+        while (pos < data.size()) {
+            PN5180Metrics m;
+            size_t len = 0;
+            PN5180MetricsStatus status = PN5180MetricsCodec::decode(&data[pos], data.size() - pos, &m, &len);
+            if (PN5180_METRICS_TRUNCATED == status) {
+                if (!eof) {
+                    break; // wait for the rest of the record
+                }
+                status = PN5180_METRICS_INVALID;
+            }
+            if (PN5180_METRICS_INVALID == status) {
+                pos++;
+                skipped++;
+                continue;
+            }
+
+            records++;
+            pos += len;
+            if (csv) {
+                printCsv(m);
+            }
+            else {
+                std::map<uint32_t, PN5180Metrics>::iterator it = previous.find(m.readerId);
+                printRates(m, (it != previous.end()) ? &it->second : 0L);
+            }
+            previous[m.readerId] = m;
+        }
+        data.erase(data.begin(), data.begin() + pos);
+        pos = 0;
+    }
+
+    if (path) {
+        fclose(f);
+    }
+    fprintf(stderr, "%u records, %u bytes skipped\n", records, skipped);
+    return 0;
+}
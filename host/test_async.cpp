@@ -0,0 +1,216 @@
+// NAME: test_async.cpp
+//
+// DESC: Results, timing and receive buffers of PN5180ISO15693Async on the simulator.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// Build and run from the library directory:
+//   g++ -std=gnu++11 -I. -Ihost -o test_async host/test_async.cpp PN5180ISO15693Async.cpp
+//       PN5180ISO15693.cpp PN5180.cpp PN5180Metrics.cpp pn5180_trace.cpp host/PN5180Simulator.cpp
+//   ./test_async
+//
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "PN5180ISO15693Async.h"
+#include "PN5180Simulator.h"
+
+// interval of the application's main loop
+#define LOOP_US     100
+
+static PN5180Simulator sim;
+static unsigned completions;
+static ISO15693ErrorCode result;
+
+static void completed(void *context, ISO15693ErrorCode rc)
+{
+    (void)context;
+    completions++;
+    result = rc;
+}
+
+static uint64_t now_us()
+{
+    return sim.now_ns() / 1000;
+}
+
+// main loop of the application: poll, which must never block, until the completion
+static ISO15693ErrorCode run(PN5180ISO15693Async &async)
+{
+    unsigned before = completions;
+    while (true) {
+        uint64_t start = now_us();
+        bool busy = async.poll();
+        assert(now_us() - start < 1000);
+        if (!busy) {
+            break;
+        }
+        sim.advance(LOOP_US);
+    }
+    assert(completions == before + 1);
+    assert(PN5180RxBufferPool::available() == MBED_CONF_PN5180_RX_BUFFERS);
+    return result;
+}
+
+int main()
+{
+    uint8_t uid[8] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x04, 0xE0 };
+    PN5180SimTag &tag = sim.addTag(uid, 28, 4);
+    for (int i=0; i<28*4; i++) {
+        tag.memory[i] = (uint8_t)i;
+    }
+
+    PN5180ISO15693 nfc(sim);
+    nfc.powerUp();
+    nfc.reset();
+    assert(nfc.setupRF());
+    PN5180ISO15693Async async(nfc);
+
+    // inventory, one request at a time
+    uint8_t found[8];
+    assert(async.inventoryAsync(found, completed, 0L));
+    assert(!async.inventoryAsync(found, completed, 0L));
+    assert(ISO15693_EC_OK == run(async));
+    assert(0 == memcmp(found, uid, 8));
+
+    uint8_t blockSize = 0, numBlocks = 0;
+    assert(async.getSystemInfoAsync(uid, &blockSize, &numBlocks, completed, 0L));
+    assert(ISO15693_EC_OK == run(async));
+    assert((4 == blockSize) && (28 == numBlocks));
+
+    // READ MULTIPLE BLOCKS as far as a receive buffer holds the response
+    uint8_t data[28*4];
+    uint32_t exchanges = sim.getRFExchanges();
+    assert(async.readBlocksAsync(uid, 0, 28, data, 4, completed, 0L));
+    assert(ISO15693_EC_OK == run(async));
+    assert(0 == memcmp(data, &tag.memory[0], sizeof(data)));
+    uint32_t chunk = (MBED_CONF_PN5180_RX_BUFFER_SIZE - 1) / 4;
+    assert((28 + chunk - 1) / chunk == sim.getRFExchanges() - exchanges);
+
+    // without READ MULTIPLE BLOCKS: one rejected request, then single blocks
+    tag.readMultiple = false;
+    memset(data, 0, sizeof(data));
+    exchanges = sim.getRFExchanges();
+    assert(async.readBlocksAsync(uid, 4, 6, data, 4, completed, 0L));
+    assert(ISO15693_EC_OK == run(async));
+    assert(0 == memcmp(data, &tag.memory[16], 24));
+    assert(1 + 6 == sim.getRFExchanges() - exchanges);
+    tag.readMultiple = true;
+
+    // transmission errors retried after 5, 10 and 20 ms without blocking
+    uint64_t start = now_us();
+    assert(async.readBlocksAsync(uid, 0, 1, data, 4, completed, 0L));
+    assert(ISO15693_EC_OK == run(async));
+    uint64_t single = now_us() - start;
+    ISO15693RetryPolicy policy = { 3, 5, false };
+    nfc.setRetryPolicy(policy);
+    nfc.resetErrorCounters();
+    sim.corruptResponses(PN5180_SIM_RX_CRC_ERROR, 3);
+    start = now_us();
+    assert(async.readBlocksAsync(uid, 0, 1, data, 4, completed, 0L));
+    assert(ISO15693_EC_OK == run(async));
+    uint64_t retried = now_us() - start;
+    printf("read of one block: %.1f ms, with 3 retries: %.1f ms\n", single / 1000.0, retried / 1000.0);
+    assert(retried >= 35000 + 4 * single - 4 * LOOP_US);
+    assert(retried <= 35000 + 4 * single + 4 * LOOP_US);
+    assert(3 == nfc.getErrorCounters().retries);
+    assert(3 == nfc.getErrorCounters().crcError);
+    assert(1 == nfc.getErrorCounters().commands);
+
+    // retries exhausted: the last error is reported
+    sim.corruptResponses(PN5180_SIM_RX_CRC_ERROR, 4);
+    start = now_us();
+    assert(async.readBlocksAsync(uid, 0, 1, data, 4, completed, 0L));
+    assert(EC_CRC_ERROR == run(async));
+    assert(now_us() - start >= 35000 + 4 * single - 4 * LOOP_US);
+    policy.retries = 0;
+    nfc.setRetryPolicy(policy);
+
+    // receive buffers are returned on every error path
+    assert(async.readBlocksAsync(uid, 26, 4, data, 4, completed, 0L));
+    assert(ISO15693_EC_BLOCK_NOT_AVAILABLE == run(async));
+    sim.corruptResponses(PN5180_SIM_RX_PROTOCOL_ERROR, 1);
+    assert(async.readBlocksAsync(uid, 0, 8, data, 4, completed, 0L));
+    assert(EC_PROTOCOL_ERROR == run(async));
+    tag.locked[20] = true;
+    uint8_t write[12] = { 0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xAB };
+    assert(async.writeBlocksAsync(uid, 19, 3, write, 4, completed, 0L));
+    assert(ISO15693_EC_BLOCK_IS_LOCKED == run(async));
+    assert(0 == memcmp(&tag.memory[19*4], write, 4));
+    tag.inField = false;
+    assert(async.inventoryAsync(found, completed, 0L));
+    assert(EC_NO_CARD == run(async));
+    tag.inField = true;
+
+    // cancel() with the response on air, in the backoff and in a multi-slot round
+    unsigned before = completions;
+    assert(async.readBlocksAsync(uid, 0, 28, data, 4, completed, 0L));
+    assert(async.poll());
+    assert(async.isBusy());
+    async.cancel();
+    assert(!async.isBusy() && !async.poll());
+    sim.advance(20000);
+
+    policy.retries = 1;
+    policy.backoff_ms = 50;
+    nfc.setRetryPolicy(policy);
+    sim.corruptResponses(PN5180_SIM_RX_CRC_ERROR, 1);
+    uint32_t retries = nfc.getErrorCounters().retries;
+    assert(async.readBlocksAsync(uid, 0, 1, data, 4, completed, 0L));
+    while (retries == nfc.getErrorCounters().retries) {
+        async.poll();
+        sim.advance(LOOP_US);
+    }
+    async.cancel();
+    assert(!async.isBusy());
+    exchanges = sim.getRFExchanges();
+    sim.advance(100000);
+    assert(!async.poll());
+    assert(exchanges == sim.getRFExchanges());
+    policy.retries = 0;
+    nfc.setRetryPolicy(policy);
+
+    uint8_t uid2[8] = { 0x02, 0x02, 0x03, 0x04, 0x05, 0x06, 0x04, 0xE0 };
+    uint8_t uid3[8] = { 0x03, 0x02, 0x03, 0x04, 0x05, 0x06, 0x04, 0xE0 };
+    sim.addTag(uid2); // tag is no longer valid
+    sim.addTag(uid3);
+    nfc.setInventoryMode(ISO15693_INVENTORY_16_SLOTS);
+    uint8_t uids[8*4];
+    uint8_t numTags;
+    exchanges = sim.getRFExchanges();
+    assert(async.inventoryMultipleAsync(uids, 4, &numTags, completed, 0L));
+    while (sim.getRFExchanges() - exchanges < 3) { // a few slots into the round
+        async.poll();
+        sim.advance(LOOP_US);
+    }
+    assert(async.isBusy());
+    async.cancel();
+    assert(before == completions);
+    assert(PN5180RxBufferPool::available() == MBED_CONF_PN5180_RX_BUFFERS);
+
+    // the reader is usable after each cancel(): EOF only slots were ended
+    assert(async.inventoryMultipleAsync(uids, 4, &numTags, completed, 0L));
+    assert(ISO15693_EC_OK == run(async));
+    assert(3 == numTags);
+    assert(ISO15693_EC_OK == nfc.getInventoryMultiple(uids, 4, &numTags));
+    assert(3 == numTags);
+    memset(data, 0, sizeof(data));
+    assert(async.readBlocksAsync(uid, 0, 28, data, 4, completed, 0L));
+    assert(ISO15693_EC_OK == run(async));
+    assert(0 == memcmp(data, &sim.tag(0).memory[0], sizeof(data)));
+
+    printf("all ok\n");
+    return 0;
+}
@@ -0,0 +1,186 @@
+// NAME: test_coroutine.cpp
+//
+// DESC: Frame pool and interleaving of the coroutine API on the simulator.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// Build and run from the library directory (C++20):
+//   g++ -std=gnu++20 -I. -Ihost -o test_coroutine host/test_coroutine.cpp PN5180Coroutine.cpp PN5180ISO15693Async.cpp
+//       PN5180ISO15693.cpp PN5180.cpp PN5180Metrics.cpp pn5180_trace.cpp host/PN5180Simulator.cpp
+//   ./test_coroutine
+//
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <utility>
+#include "PN5180Coroutine.h"
+#include "PN5180Simulator.h"
+
+#if !PN5180_COROUTINES
+#error "test_coroutine needs C++20 coroutines and MBED_CONF_PN5180_ASYNC_ENABLE"
+#endif
+
+#define FRAMES      MBED_CONF_PN5180_COROUTINE_FRAMES
+
+static PN5180Simulator sim;
+
+// completed reader operations, by session
+static char steps[64];
+static uint8_t numSteps;
+
+static void step(char session)
+{
+    assert(numSteps < sizeof(steps) - 1);
+    steps[numSteps++] = session;
+}
+
+static PN5180Task tagSession(PN5180CoReader &reader, const uint8_t *tagUid, uint8_t fill, char session)
+{
+    uint8_t uid[8];
+    memcpy(uid, tagUid, 8);
+    uint8_t blockSize = 0, numBlocks = 0;
+    ISO15693ErrorCode rc = co_await reader.getSystemInfo(uid, &blockSize, &numBlocks);
+    step(session);
+    if (ISO15693_EC_OK != rc) {
+        co_return rc;
+    }
+    uint8_t data[16];
+    rc = co_await reader.readBlocks(uid, 0, 4, data, blockSize);
+    step(session);
+    if (ISO15693_EC_OK != rc) {
+        co_return rc;
+    }
+    memset(data, fill, sizeof(data));
+    rc = co_await reader.writeBlocks(uid, 4, 4, data, blockSize);
+    step(session);
+    co_return rc;
+}
+
+// a session with a sub-task: two frames
+static ISO15693ErrorCode results[FRAMES];
+
+static PN5180Task readUid(PN5180CoReader &reader, uint8_t *uid)
+{
+    co_return co_await reader.inventory(uid);
+}
+
+static PN5180Task inventorySession(PN5180CoReader &reader, ISO15693ErrorCode *result)
+{
+    uint8_t uid[8];
+    *result = co_await readUid(reader, uid);
+    co_return *result;
+}
+
+static void runAll(PN5180Scheduler &scheduler)
+{
+    int loops = 0;
+    while (scheduler.runOnce()) {
+        sim.advance(250);
+        assert(++loops < 100000);
+    }
+    assert(PN5180FramePool::available() == FRAMES);
+    assert(PN5180RxBufferPool::available() == MBED_CONF_PN5180_RX_BUFFERS);
+}
+
+int main()
+{
+    uint8_t uidA[8] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x04, 0xE0 };
+    uint8_t uidB[8] = { 0x09, 0x02, 0x03, 0x04, 0x05, 0x06, 0x04, 0xE0 };
+    sim.addTag(uidA);
+    sim.addTag(uidB);
+    PN5180ISO15693 nfc(sim);
+    nfc.powerUp();
+    nfc.reset();
+    assert(nfc.setupRF());
+    PN5180Scheduler scheduler;
+    PN5180CoReader reader(nfc, scheduler);
+
+    // two sessions on one reader: their operations are queued alternately
+    assert(scheduler.spawn(tagSession(reader, uidA, 0x11, 'A')));
+    assert(scheduler.spawn(tagSession(reader, uidB, 0x22, 'B')));
+    assert(FRAMES - 2 == PN5180FramePool::available());
+    assert(2 == scheduler.getNumTasks());
+    runAll(scheduler);
+    steps[numSteps] = 0;
+    printf("interleaved sessions: %s\n", steps);
+    assert(0 == strcmp(steps, "ABABAB"));
+    assert((0x11 == sim.tag(0).memory[16]) && (0x11 == sim.tag(0).memory[31]));
+    assert((0x22 == sim.tag(1).memory[16]) && (0x22 == sim.tag(1).memory[31]));
+    assert(0 == scheduler.getNumTasks());
+
+    // frames are returned when a task finishes and reused by the next ones
+    for (int round=0; round<3*FRAMES; round++) {
+        numSteps = 0;
+        assert(scheduler.spawn(tagSession(reader, uidA, (uint8_t)round, 'A')));
+        runAll(scheduler);
+        assert(round == sim.tag(0).memory[16]);
+    }
+
+    // every frame in use: the next task cannot start
+    numSteps = 0;
+    for (int i=0; i<FRAMES; i++) {
+        assert(scheduler.spawn(tagSession(reader, (i & 1) ? uidB : uidA, 0x33, 'A' + i)));
+    }
+    assert(0 == PN5180FramePool::available());
+    PN5180Task task = tagSession(reader, uidA, 0x44, 'X');
+    assert(!task.valid());
+    assert(!scheduler.spawn(std::move(task)));
+    runAll(scheduler);
+    assert(3 * FRAMES == numSteps);
+    assert(0 == memchr(steps, 'X', numSteps));
+
+    // sessions with a sub-task need two frames each: half of the frames serve FRAMES/2 sessions
+    sim.tag(1).inField = false;
+    for (int i=0; i<FRAMES/2; i++) {
+        results[i] = EC_NO_CARD;
+        assert(scheduler.spawn(inventorySession(reader, &results[i])));
+    }
+    scheduler.runOnce();
+    assert(0 == PN5180FramePool::available());
+    runAll(scheduler);
+    for (int i=0; i<FRAMES/2; i++) {
+        assert(ISO15693_EC_OK == results[i]);
+    }
+
+    // one session more: two sub-tasks find no frame
+    for (int i=0; i<FRAMES/2+1; i++) {
+        results[i] = EC_NO_CARD;
+        assert(scheduler.spawn(inventorySession(reader, &results[i])));
+    }
+    runAll(scheduler);
+    int failed = 0;
+    for (int i=0; i<FRAMES/2+1; i++) {
+        if (ISO15693_EC_UNKNOWN_ERROR == results[i]) {
+            failed++;
+        }
+        else {
+            assert(ISO15693_EC_OK == results[i]);
+        }
+    }
+    assert(2 == failed);
+
+    // FRAMES sessions take all frames, their sub-tasks fail to allocate
+    for (int i=0; i<FRAMES; i++) {
+        results[i] = EC_NO_CARD;
+        assert(scheduler.spawn(inventorySession(reader, &results[i])));
+    }
+    runAll(scheduler);
+    for (int i=0; i<FRAMES; i++) {
+        assert(ISO15693_EC_UNKNOWN_ERROR == results[i]);
+    }
+
+    printf("all ok\n");
+    return 0;
+}
@@ -0,0 +1,129 @@
+// NAME: test_field_scheduler.cpp
+//
+// DESC: Scan period and field on ratio of PN5180FieldScheduler on the simulator.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// Build and run from the library directory:
+//   g++ -std=gnu++11 -I. -Ihost -o test_field_scheduler host/test_field_scheduler.cpp PN5180FieldScheduler.cpp
+//       PN5180ISO15693.cpp PN5180.cpp PN5180Metrics.cpp pn5180_trace.cpp host/PN5180Simulator.cpp
+//   ./test_field_scheduler
+//
+#include <assert.h>
+#include <stdio.h>
+#include "PN5180FieldScheduler.h"
+#include "PN5180Simulator.h"
+
+static PN5180Simulator sim;
+static unsigned tagsReported;
+
+static void onTag(void *context, const uint8_t *uid)
+{
+    (void)context;
+    (void)uid;
+    tagsReported++;
+}
+
+static uint64_t now_us()
+{
+    return sim.now_ns() / 1000;
+}
+
+// main loop of the application: poll, sleep until the next window
+static void runUntil(PN5180FieldScheduler &scheduler, uint64_t end_us)
+{
+    while (now_us() < end_us) {
+        if (!scheduler.poll()) {
+            uint64_t sleep = scheduler.getTimeToNextWindow_us();
+            uint64_t left = end_us - now_us();
+            sim.advance((uint32_t)((sleep < left) ? (sleep ? sleep : 1) : left));
+        }
+        assert(!sim.isRFOn());
+    }
+}
+
+// runs windows until the next one, returns the period it set
+static uint32_t nextWindow(PN5180FieldScheduler &scheduler)
+{
+    while (!scheduler.poll()) {
+        sim.advance(scheduler.getTimeToNextWindow_us());
+    }
+    assert(!sim.isRFOn());
+    return scheduler.getPeriod_ms();
+}
+
+// field on ratio of the simulator over the given time against the expected one
+static void checkOnRatio(PN5180FieldScheduler &scheduler, uint32_t time_ms, const char *name)
+{
+    uint64_t fieldOn = sim.getFieldOnTime_us();
+    uint64_t start = now_us();
+    runUntil(scheduler, start + time_ms * 1000ULL);
+    double measured = (sim.getFieldOnTime_us() - fieldOn) * 1e6 / (now_us() - start);
+    uint32_t expected = scheduler.getExpectedOnRatio_ppm();
+    printf("%-8s period %4u ms, window %u us, field on %.0f ppm, expected %u ppm\n",
+        name, scheduler.getPeriod_ms(), scheduler.getStats().lastWindow_us, measured, expected);
+    assert((measured > 0.9 * expected) && (measured < 1.1 * expected));
+}
+
+int main()
+{
+    PN5180ISO15693 nfc(sim);
+    nfc.powerUp();
+    nfc.reset();
+    assert(nfc.setupRF());
+
+    PN5180FieldScheduler scheduler(nfc);
+    scheduler.setCallback(onTag, 0L);
+    assert(scheduler.start());
+    assert(!sim.isRFOn());
+    assert(0 == scheduler.getTimeToNextWindow_us());
+
+    // empty field with the default schedule: 10 windows at 100 ms, then doubling up to 2 s
+    for (int i=0; i<10; i++) {
+        assert(100 == nextWindow(scheduler));
+    }
+    assert(200 == nextWindow(scheduler));
+    assert(400 == nextWindow(scheduler));
+    assert(800 == nextWindow(scheduler));
+    assert(1600 == nextWindow(scheduler));
+    assert(2000 == nextWindow(scheduler));
+    assert(2000 == nextWindow(scheduler));
+    assert(0 == tagsReported);
+    checkOnRatio(scheduler, 60000, "idle");
+
+    // a tag resets the period to minPeriod_ms and keeps it there
+    uint8_t uid[8] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x04, 0xE0 };
+    sim.addTag(uid);
+    assert(100 == nextWindow(scheduler));
+    assert(1 == tagsReported);
+    checkOnRatio(scheduler, 10000, "1 tag");
+    assert(100 == scheduler.getPeriod_ms());
+
+    // backs off again once the tag left
+    sim.removeTags();
+    runUntil(scheduler, now_us() + 20000000);
+    assert(2000 == scheduler.getPeriod_ms());
+
+    // trigger() schedules a window at once at minPeriod_ms
+    scheduler.trigger();
+    assert(0 == scheduler.getTimeToNextWindow_us());
+    assert(100 == scheduler.getPeriod_ms());
+    assert(scheduler.poll());
+    assert(100 == scheduler.getPeriod_ms());
+
+    assert(0 == scheduler.getStats().failedWindows);
+    printf("all ok\n");
+    return 0;
+}
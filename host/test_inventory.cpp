@@ -0,0 +1,96 @@
+// NAME: test_inventory.cpp
+//
+// DESC: Inventory time of getInventoryMultiple() per slot mode on the simulator.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// Build and run from the library directory:
+//   g++ -std=gnu++11 -I. -Ihost -o test_inventory host/test_inventory.cpp PN5180ISO15693.cpp PN5180.cpp
+//       PN5180Metrics.cpp pn5180_trace.cpp host/PN5180Simulator.cpp
+//   ./test_inventory
+//
+// For each number of tags, random populations are inventoried repeatedly in
+// every mode; once the population estimate settled, adaptive mode must be as
+// fast as the better of 1 slot and 16 slots on average.
+//
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "PN5180ISO15693.h"
+#include "PN5180Simulator.h"
+
+#define POPULATIONS     16      // random tag sets per number of tags
+#define WARMUP_CALLS    4       // calls to settle the population estimate
+#define MEASURED_CALLS  4
+
+static const char *modeNames[] = { "adaptive", "1 slot", "16 slots" };
+
+// average time of a steady state inventory in ms
+static double inventoryTime(unsigned numTags, ISO15693InventoryMode mode, unsigned seed)
+{
+    PN5180Simulator sim;
+    srand(seed);
+    for (unsigned i=0; i<numTags; i++) {
+        uint8_t uid[8];
+        for (int j=0; j<6; j++) {
+            uid[j] = (uint8_t)rand();
+        }
+        uid[6] = ISO15693_MFG_NXP;
+        uid[7] = 0xE0;
+        sim.addTag(uid);
+    }
+    PN5180ISO15693 nfc(sim);
+    nfc.powerUp();
+    nfc.reset();
+    assert(nfc.setupRF());
+    nfc.setInventoryMode(mode);
+
+    static uint8_t uids[8 * 128];
+    uint64_t time_ns = 0;
+    for (int call=0; call<WARMUP_CALLS+MEASURED_CALLS; call++) {
+        uint8_t found = 0;
+        uint64_t start = sim.now_ns();
+        ISO15693ErrorCode rc = nfc.getInventoryMultiple(uids, 128, &found);
+        if (call >= WARMUP_CALLS) {
+            time_ns += sim.now_ns() - start;
+        }
+        assert((ISO15693_EC_OK == rc) && (numTags == found));
+    }
+    if (ISO15693_INVENTORY_ADAPTIVE == mode) {
+        assert(numTags == nfc.getPopulationEstimate());
+    }
+    return time_ns / 1e6 / MEASURED_CALLS;
+}
+
+int main()
+{
+    const unsigned tagCounts[] = { 1, 2, 3, 4, 5, 10, 20, 50, 100 };
+    printf("tags | %8s | %8s | %8s | tags/s adaptive\n", modeNames[0], modeNames[1], modeNames[2]);
+    for (size_t t=0; t<sizeof(tagCounts)/sizeof(tagCounts[0]); t++) {
+        unsigned n = tagCounts[t];
+        double ms[3] = { 0, 0, 0 };
+        for (int mode=0; mode<3; mode++) {
+            for (unsigned p=0; p<POPULATIONS; p++) {
+                ms[mode] += inventoryTime(n, (ISO15693InventoryMode)mode, 1000 * n + p) / POPULATIONS;
+            }
+        }
+        double best = (ms[1] < ms[2]) ? ms[1] : ms[2];
+        printf("%4u | %5.1f ms | %5.1f ms | %5.1f ms | %.0f\n", n, ms[0], ms[1], ms[2], n * 1000 / ms[0]);
+        assert(ms[0] <= best * 1.01);
+    }
+    printf("all ok\n");
+    return 0;
+}
@@ -0,0 +1,167 @@
+// NAME: test_metrics.cpp
+//
+// DESC: Round trip test of the metrics record encoding, see PN5180Metrics.h.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// Build and run from the library directory:
+//   g++ -std=gnu++11 -I. -o test_metrics host/test_metrics.cpp PN5180Metrics.cpp && ./test_metrics
+//
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "PN5180Metrics.h"
+
+// every field set to value32 (32 bit fields) or value64 (time_ms, rfOnTime_ms)
+static PN5180Metrics makeMetrics(uint32_t value32, uint64_t value64)
+{
+    PN5180Metrics m;
+    memset(&m, 0, sizeof(m));
+    uint32_t *fields32[] = { &m.readerId, &m.sequence, &m.hostCommands, &m.busyTimeouts, &m.irqTimeouts,
+        &m.resets, &m.recoveries, &m.rfOn, &m.commands, &m.retries, &m.noCard, &m.collision, &m.crcError,
+        &m.protocolError, &m.dataIntegrityError, &m.tagError, &m.inventories, &m.tagsFound, &m.tagsInField,
+        &m.lastError };
+    assert(sizeof(fields32) / sizeof(fields32[0]) == PN5180_METRICS_FIELDS_32);
+    for (size_t i=0; i<PN5180_METRICS_FIELDS_32; i++) {
+        *fields32[i] = value32;
+    }
+    m.time_ms = value64;
+    m.rfOnTime_ms = value64;
+    return m;
+}
+
+static bool sameMetrics(const PN5180Metrics &a, const PN5180Metrics &b)
+{
+    return 0 == memcmp(&a, &b, sizeof(a));
+}
+
+static size_t putVarint(uint8_t *p, uint64_t value)
+{
+    size_t n = 0;
+    while (value >= 0x80) {
+        p[n++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    p[n++] = (uint8_t)value;
+    return n;
+}
+
+// hand-built record with the fields 1000, 1001, ... to test other encoders
+static size_t buildRecord(uint8_t *record, uint8_t version, unsigned numFields)
+{
+    memcpy(record, PN5180_METRICS_MAGIC, 3);
+    record[3] = version;
+    size_t n = 5;
+    n += putVarint(&record[n], numFields);
+    for (unsigned i=0; i<numFields; i++) {
+        n += putVarint(&record[n], 1000 + i);
+    }
+    record[4] = (uint8_t)(n - 5);
+    uint16_t crc = PN5180MetricsCodec::crc16(record, n);
+    record[n++] = crc & 0xff;
+    record[n++] = crc >> 8;
+    return n;
+}
+
+static void testRoundTrip(const PN5180Metrics &m, const char *name)
+{
+    uint8_t record[PN5180_METRICS_MAX_SIZE];
+    size_t len = PN5180MetricsCodec::encode(m, record, sizeof(record));
+    assert((len > 0) && (len <= PN5180_METRICS_MAX_SIZE));
+    assert(0 == PN5180MetricsCodec::encode(m, record, len - 1)); // buffer too short
+
+    PN5180Metrics decoded;
+    size_t recordLen = 0;
+    assert(PN5180_METRICS_OK == PN5180MetricsCodec::decode(record, len, &decoded, &recordLen));
+    assert(recordLen == len);
+    assert(sameMetrics(m, decoded));
+
+    // trailing bytes belong to the next record
+    uint8_t stream[PN5180_METRICS_MAX_SIZE + 8];
+    memcpy(stream, record, len);
+    memset(&stream[len], 0x55, 8);
+    assert(PN5180_METRICS_OK == PN5180MetricsCodec::decode(stream, len + 8, &decoded, &recordLen));
+    assert(recordLen == len);
+
+    for (size_t i=0; i<len; i++) {
+        assert(PN5180_METRICS_TRUNCATED == PN5180MetricsCodec::decode(record, i, &decoded, &recordLen));
+    }
+    for (size_t i=0; i<len; i++) {
+        for (int bit=0; bit<8; bit++) {
+            record[i] ^= 1 << bit;
+            PN5180MetricsStatus status = PN5180MetricsCodec::decode(record, len, &decoded, &recordLen);
+            assert(PN5180_METRICS_OK != status);
+            record[i] ^= 1 << bit;
+        }
+    }
+    printf("%-8s %3d bytes ok\n", name, (int)len);
+}
+
+int main()
+{
+    testRoundTrip(makeMetrics(0, 0), "min");
+    testRoundTrip(makeMetrics(0xffffffff, 0xffffffffffffffffULL), "max");
+
+    PN5180Metrics typical = makeMetrics(0, 0);
+    typical.readerId = 7;
+    typical.sequence = 3600;
+    typical.time_ms = 3600123;
+    typical.rfOnTime_ms = 1800456;
+    typical.hostCommands = 10500000;
+    typical.resets = 1;
+    typical.rfOn = 1800;
+    typical.commands = 201000;
+    typical.retries = 12;
+    typical.noCard = 25000;
+    typical.crcError = 3;
+    typical.inventories = 90000;
+    typical.tagsFound = 270000;
+    typical.tagsInField = 3;
+    testRoundTrip(typical, "typical");
+
+    uint8_t record[256];
+    PN5180Metrics m;
+    size_t recordLen;
+
+    // version bump and unknown magic
+    size_t len = buildRecord(record, PN5180_METRICS_VERSION, PN5180_METRICS_FIELDS_32 + PN5180_METRICS_FIELDS_64);
+    assert(PN5180_METRICS_OK == PN5180MetricsCodec::decode(record, len, &m, &recordLen));
+    len = buildRecord(record, PN5180_METRICS_VERSION + 1, PN5180_METRICS_FIELDS_32 + PN5180_METRICS_FIELDS_64);
+    assert(PN5180_METRICS_INVALID == PN5180MetricsCodec::decode(record, len, &m, &recordLen));
+    len = buildRecord(record, 0, 3);
+    assert(PN5180_METRICS_INVALID == PN5180MetricsCodec::decode(record, len, &m, &recordLen));
+    len = buildRecord(record, PN5180_METRICS_VERSION, 3);
+    record[1] = 'X';
+    assert(PN5180_METRICS_INVALID == PN5180MetricsCodec::decode(record, len, &m, &recordLen));
+
+    // CRC flip
+    len = buildRecord(record, PN5180_METRICS_VERSION, 3);
+    record[len - 1] ^= 0x01;
+    assert(PN5180_METRICS_INVALID == PN5180MetricsCodec::decode(record, len, &m, &recordLen));
+
+    // appended unknown fields of a newer encoder are skipped
+    len = buildRecord(record, PN5180_METRICS_VERSION, PN5180_METRICS_FIELDS_32 + PN5180_METRICS_FIELDS_64 + 3);
+    assert(PN5180_METRICS_OK == PN5180MetricsCodec::decode(record, len, &m, &recordLen));
+    assert(recordLen == len);
+    assert((1000 == m.readerId) && (1001 == m.sequence) && (1002 == m.time_ms) && (1021 == m.lastError));
+
+    // fields missing in an older record read as 0
+    len = buildRecord(record, PN5180_METRICS_VERSION, 3);
+    assert(PN5180_METRICS_OK == PN5180MetricsCodec::decode(record, len, &m, &recordLen));
+    assert((1000 == m.readerId) && (1002 == m.time_ms) && (0 == m.rfOnTime_ms) && (0 == m.lastError));
+
+    printf("all ok\n");
+    return 0;
+}
@@ -0,0 +1,193 @@
+// NAME: test_scanner.cpp
+//
+// DESC: Cycle time and events of PN5180Scanner with several readers on the simulator.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// Build and run from the library directory:
+//   g++ -std=gnu++11 -I. -Ihost -o test_scanner host/test_scanner.cpp PN5180Scanner.cpp PN5180ISO15693Async.cpp
+//       PN5180ISO15693.cpp PN5180.cpp PN5180Metrics.cpp pn5180_trace.cpp host/PN5180Simulator.cpp
+//   ./test_scanner
+//
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "PN5180Scanner.h"
+#include "PN5180Simulator.h"
+
+#define MAX_READERS     MBED_CONF_PN5180_SCANNER_READERS
+#define CYCLES          10
+
+// readers sharing the clock of the first, tag k of reader i has the UID k, i, ...
+struct Readers {
+    PN5180Simulator sim[MAX_READERS];
+    PN5180ISO15693 *nfc[MAX_READERS];
+    PN5180ISO15693Async *async[MAX_READERS];
+    PN5180Scanner scanner;
+
+    Readers(int numReaders, int tagsPerReader) {
+        for (int i=0; i<numReaders; i++) {
+            if (i > 0) {
+                sim[i].shareClock(sim[0]);
+            }
+            for (int k=0; k<tagsPerReader; k++) {
+                uint8_t uid[8] = { (uint8_t)k, (uint8_t)i, 0x03, 0x04, 0x05, 0x06, 0x04, 0xE0 };
+                sim[i].addTag(uid);
+            }
+            nfc[i] = new PN5180ISO15693(sim[i]);
+            nfc[i]->powerUp();
+            nfc[i]->reset();
+            assert(nfc[i]->setupRF());
+            async[i] = new PN5180ISO15693Async(*nfc[i]);
+            assert(scanner.addReader(*async[i], 10 + i));
+        }
+    }
+};
+
+// events of the scan so far: every tag of a cycle once, in the order the readers completed
+struct Seen {
+    uint16_t tags[MAX_READERS];
+    uint32_t last;
+};
+
+static void readEvents(Readers &r, Seen &seen, int numReaders, int tagsPerReader)
+{
+    PN5180ScanEvent e;
+    while (r.scanner.readEvent(&e)) {
+        assert(e.time >= seen.last);
+        seen.last = e.time;
+        assert((e.reader >= 10) && (e.reader < 10 + numReaders));
+        assert(ISO15693_EC_OK == e.rc);
+        int i = e.reader - 10;
+        assert((e.uid[1] == i) && (e.uid[0] < tagsPerReader) && (e.uid[7] == 0xE0));
+        assert(0 == (seen.tags[i] & (1 << e.uid[0])));
+        seen.tags[i] |= 1 << e.uid[0];
+    }
+}
+
+// main loop of the application
+static void poll(Readers &r)
+{
+    r.scanner.poll();
+    r.sim[0].advance(10);
+}
+
+int main()
+{
+    // cycle time by readers: overlapping air times keep it flat, serial inventories add up
+    printf("tags/reader | readers | scanner cycle | serial getInventoryMultiple\n");
+    const int tagCounts[] = { 1, 3, 8 };
+    for (int t=0; t<3; t++) {
+        int tags = tagCounts[t];
+        uint32_t single = 0;
+        for (int n=1; n<=MAX_READERS; n++) {
+            Readers r(n, tags);
+            assert(r.scanner.start(false));
+            uint32_t cycle = 0;
+            for (int c=0; c<CYCLES; c++) {
+                if (c > 0) {
+                    assert(r.scanner.start(false));
+                }
+                Seen seen;
+                memset(&seen, 0, sizeof(seen));
+                while (r.scanner.isScanning()) {
+                    poll(r);
+                    readEvents(r, seen, n, tags);
+                }
+                readEvents(r, seen, n, tags);
+                for (int i=0; i<n; i++) {
+                    assert(seen.tags[i] == (1 << tags) - 1);
+                }
+                cycle = r.scanner.getLastCycleTime(); // last cycle, with a settled estimate
+            }
+            assert(0 == r.scanner.getDroppedEvents());
+            if (1 == n) {
+                single = cycle;
+            }
+            assert(cycle <= single + single / 5);
+
+            uint64_t start = r.sim[0].now_ns();
+            for (int i=0; i<n; i++) {
+                uint8_t uids[8 * 8];
+                uint8_t numTags;
+                assert(ISO15693_EC_OK == r.nfc[i]->getInventoryMultiple(uids, 8, &numTags));
+                assert(tags == numTags);
+            }
+            double serial = (r.sim[0].now_ns() - start) / 1000.0;
+            printf("%11d | %7d | %10.1f ms | %10.1f ms\n", tags, n, cycle / 1000.0, serial / 1000.0);
+        }
+    }
+
+    // more tags than MBED_CONF_PN5180_SCANNER_TAGS: the first ones are reported
+    {
+        Readers r(2, 12);
+        assert(r.scanner.start(false));
+        while (r.scanner.isScanning()) {
+            poll(r);
+        }
+        assert(2 * MBED_CONF_PN5180_SCANNER_TAGS == r.scanner.available());
+    }
+
+    // a tag whose responses always collide cannot be told apart: one EC_COLLISION event
+    {
+        Readers r(2, 2);
+        r.sim[1].corruptResponses(PN5180_SIM_RX_COLLISION, 1000);
+        assert(r.scanner.start(false));
+        while (r.scanner.isScanning()) {
+            poll(r);
+        }
+        PN5180ScanEvent e;
+        int uids = 0;
+        int collisions = 0;
+        while (r.scanner.readEvent(&e)) {
+            if (ISO15693_EC_OK == e.rc) {
+                assert(10 == e.reader);
+                uids++;
+            }
+            else {
+                assert((EC_COLLISION == e.rc) && (11 == e.reader));
+                collisions++;
+            }
+        }
+        assert((2 == uids) && (1 == collisions));
+        assert(r.nfc[1]->getInventoryStats().unresolved > 0);
+    }
+
+    // continuous scan, stopped in the middle of a cycle: the readers are left idle
+    {
+        Readers r(3, 3);
+        assert(r.scanner.start());
+        while (r.scanner.getCycles() < 5) {
+            assert(r.scanner.isScanning());
+            poll(r);
+        }
+        for (int k=0; k<7; k++) {
+            poll(r);
+        }
+        r.scanner.stop();
+        assert(!r.scanner.poll());
+        for (int i=0; i<3; i++) {
+            assert(!r.async[i]->isBusy());
+            uint8_t uids[8 * 8];
+            uint8_t numTags;
+            assert(ISO15693_EC_OK == r.nfc[i]->getInventoryMultiple(uids, 8, &numTags));
+            assert(3 == numTags);
+        }
+        assert(PN5180RxBufferPool::available() == MBED_CONF_PN5180_RX_BUFFERS);
+    }
+
+    printf("all ok\n");
+    return 0;
+}
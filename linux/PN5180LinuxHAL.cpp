@@ -0,0 +1,199 @@
+// NAME: PN5180LinuxHAL.cpp
+//
+// DESC: PN5180 host interface on Linux, spidev and GPIO character device.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include <linux/spi/spidev.h>
+#include "PN5180LinuxHAL.h"
+
+#define PN5180_LINUX_CONSUMER   "pn5180"
+
+PN5180LinuxHAL::PN5180LinuxHAL(const char *spiDevice, const char *gpioChip, unsigned nssLine, unsigned resetLine,
+                               unsigned busyLine, uint32_t spiSpeed) :
+    _spiDevice(spiDevice),
+    _gpioChip(gpioChip),
+    _nssLine(nssLine),
+    _resetLine(resetLine),
+    _busyLine(busyLine),
+    _spiSpeed(spiSpeed),
+    _spiFd(-1),
+    _outFd(-1),
+    _busyFd(-1),
+    _failedStep("")
+{
+}
+
+PN5180LinuxHAL::~PN5180LinuxHAL()
+{
+    close();
+}
+
+bool PN5180LinuxHAL::fail(const char *step)
+{
+    int err = errno;
+    _failedStep = step;
+    close();
+    errno = err;
+    return false;
+}
+
+/*
+ * SPI mode 0, 8 bits, chip select by the NSS line; NSS starts high (not
+ * selected) and RESET low, as with PN5180MbedHAL.
+ */
+bool PN5180LinuxHAL::open()
+{
+    close();
+
+    _spiFd = ::open(_spiDevice, O_RDWR | O_CLOEXEC);
+    if (_spiFd < 0) {
+        return fail(_spiDevice);
+    }
+    uint32_t mode = SPI_MODE_0 | SPI_NO_CS;
+    uint8_t bits = 8;
+    if ((ioctl(_spiFd, SPI_IOC_WR_MODE32, &mode) < 0) || (ioctl(_spiFd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0) ||
+        (ioctl(_spiFd, SPI_IOC_WR_MAX_SPEED_HZ, &_spiSpeed) < 0)) {
+        return fail("SPI mode");
+    }
+
+    int chipFd = ::open(_gpioChip, O_RDWR | O_CLOEXEC);
+    if (chipFd < 0) {
+        return fail(_gpioChip);
+    }
+
+    struct gpio_v2_line_request req;
+    memset(&req, 0, sizeof(req));
+    req.offsets[0] = _nssLine;
+    req.offsets[1] = _resetLine;
+    req.num_lines = 2;
+    strncpy(req.consumer, PN5180_LINUX_CONSUMER, sizeof(req.consumer) - 1);
+    req.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+    req.config.num_attrs = 1;
+    req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+    req.config.attrs[0].attr.values = 1;   // NSS high, RESET low
+    req.config.attrs[0].mask = 3;
+    if (ioctl(chipFd, GPIO_V2_GET_LINE_IOCTL, &req) < 0) {
+        ::close(chipFd);
+        return fail("NSS/RESET lines");
+    }
+    _outFd = req.fd;
+
+    memset(&req, 0, sizeof(req));
+    req.offsets[0] = _busyLine;
+    req.num_lines = 1;
+    strncpy(req.consumer, PN5180_LINUX_CONSUMER, sizeof(req.consumer) - 1);
+    req.config.flags = GPIO_V2_LINE_FLAG_INPUT;
+    if (ioctl(chipFd, GPIO_V2_GET_LINE_IOCTL, &req) < 0) {
+        ::close(chipFd);
+        return fail("BUSY line");
+    }
+    _busyFd = req.fd;
+    ::close(chipFd);
+    return true;
+}
+
+void PN5180LinuxHAL::close()
+{
+    if (_busyFd >= 0) {
+        ::close(_busyFd);
+        _busyFd = -1;
+    }
+    if (_outFd >= 0) {
+        ::close(_outFd);
+        _outFd = -1;
+    }
+    if (_spiFd >= 0) {
+        ::close(_spiFd);
+        _spiFd = -1;
+    }
+}
+
+void PN5180LinuxHAL::setOutput(unsigned bit, bool level)
+{
+    struct gpio_v2_line_values values;
+    values.bits = level ? (1ULL << bit) : 0;
+    values.mask = 1ULL << bit;
+    ioctl(_outFd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values);
+}
+
+bool PN5180LinuxHAL::getBusy()
+{
+    struct gpio_v2_line_values values;
+    values.bits = 0;
+    values.mask = 1;
+    if (ioctl(_busyFd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0) {
+        return true; // the driver runs into its BUSY timeout
+    }
+    return 0 != (values.bits & 1);
+}
+
+/*
+ * One spidev message per frame; the NSS line frames it, see setNSS().
+ */
+void PN5180LinuxHAL::transfer(const uint8_t *tx, uint8_t *rx, size_t len)
+{
+    if (0L == tx) {
+        if (_fill.size() < len) {
+            _fill.resize(len, 0xff);
+        }
+        tx = &_fill[0];
+    }
+
+    struct spi_ioc_transfer xfer;
+    memset(&xfer, 0, sizeof(xfer));
+    xfer.tx_buf = (unsigned long)tx;
+    xfer.rx_buf = (unsigned long)rx;
+    xfer.len = (uint32_t)len;
+    xfer.speed_hz = _spiSpeed;
+    xfer.bits_per_word = 8;
+    if ((ioctl(_spiFd, SPI_IOC_MESSAGE(1), &xfer) < 0) && (0L != rx)) {
+        memset(rx, 0xff, len);
+    }
+}
+
+uint32_t PN5180LinuxHAL::micros()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+void PN5180LinuxHAL::delayMicros(uint32_t us)
+{
+    if (us > PN5180_LINUX_SPIN_US) {
+        struct timespec ts = { (time_t)(us / 1000000), (long)(us % 1000000) * 1000 };
+        while ((nanosleep(&ts, &ts) < 0) && (EINTR == errno)) {
+        }
+        return;
+    }
+    uint32_t start = micros();
+    while ((uint32_t)(micros() - start) < us) {
+    }
+}
+
+void PN5180LinuxHAL::sleepMillis(uint32_t ms)
+{
+    struct timespec ts = { (time_t)(ms / 1000), (long)(ms % 1000) * 1000000 };
+    while ((nanosleep(&ts, &ts) < 0) && (EINTR == errno)) {
+    }
+}
@@ -0,0 +1,84 @@
+// NAME: PN5180LinuxHAL.h
+//
+// DESC: PN5180 host interface on Linux, spidev and GPIO character device.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180LINUXHAL_H
+#define PN5180LINUXHAL_H
+
+#include <vector>
+#include "PN5180HAL.h"
+
+/*
+ * PN5180 on a Linux board (e.g. a Raspberry Pi): SPI frames through
+ * /dev/spidevB.C, NSS, RESET and BUSY through the GPIO character device
+ * /dev/gpiochipN (uAPI v2, kernel 5.10 or later), no libraries needed.
+ *
+ * NSS has to be a GPIO line: the driver keeps NSS low after the send frame
+ * until BUSY goes high, the chip select of spidev is released at the end of
+ * every transfer. The SPI device is opened with SPI_NO_CS, so the CE pin of
+ * the controller can stay unconnected. The IRQ pin is not needed, the driver
+ * polls IRQ_STATUS.
+ *
+ * delayMicros() spins for short delays and sleeps beyond
+ * PN5180_LINUX_SPIN_US, sleepMillis() always sleeps.
+ */
+#define PN5180_LINUX_SPIN_US    200
+
+class PN5180LinuxHAL : public PN5180HAL
+{
+public:
+    // gpio lines are offsets on gpioChip, spiSpeed in Hz (max. 7 MHz)
+    PN5180LinuxHAL(const char *spiDevice, const char *gpioChip, unsigned nssLine, unsigned resetLine,
+                   unsigned busyLine, uint32_t spiSpeed = 7000000);
+    virtual ~PN5180LinuxHAL();
+
+    // open the devices and request the lines, false with errno set on failure
+    bool open();
+    void close();
+    bool isOpen() { return _spiFd >= 0; }
+    // what open() failed at, e.g. for an error message with strerror(errno)
+    const char * getFailedStep() { return _failedStep; }
+
+    // PN5180HAL
+    virtual void begin() {}
+    virtual void setNSS(bool level) { setOutput(0, level); }
+    virtual void setReset(bool level) { setOutput(1, level); }
+    virtual bool getBusy();
+    virtual void transfer(const uint8_t *tx, uint8_t *rx, size_t len);
+    virtual uint32_t micros();
+    virtual void delayMicros(uint32_t us);
+    virtual void sleepMillis(uint32_t ms);
+
+private:
+    const char *_spiDevice;
+    const char *_gpioChip;
+    unsigned _nssLine;
+    unsigned _resetLine;
+    unsigned _busyLine;
+    uint32_t _spiSpeed;
+
+    int _spiFd;
+    int _outFd;                 // line request of NSS (bit 0) and RESET (bit 1)
+    int _busyFd;
+    const char *_failedStep;
+    std::vector<uint8_t> _fill; // 0xff bytes sent for tx == NULL
+
+    void setOutput(unsigned bit, bool level);
+    bool fail(const char *step);
+};
+
+#endif // PN5180LINUXHAL_H
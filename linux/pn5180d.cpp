@@ -0,0 +1,733 @@
+// NAME: pn5180d.cpp
+//
+// DESC: Reader daemon serving ISO15693 requests of local clients over a Unix socket.
+//
+// Copyright (c) 2018 by Andreas Trappmann. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// Build from the library directory:
+//   g++ -std=gnu++11 -O2 -I. -Ilinux -Ihost -o pn5180d linux/pn5180d.cpp linux/PN5180LinuxHAL.cpp
+//       host/PN5180Simulator.cpp PN5180.cpp PN5180ISO15693.cpp PN5180Metrics.cpp pn5180_trace.cpp
+//
+// Usage:
+//   pn5180d [-s socket] [-w window_ms] [-i idle_ms] --spi /dev/spidev0.0 --gpiochip /dev/gpiochip0
+//           --nss 8 --reset 7 --busy 25 [--speed hz]
+//   pn5180d [-s socket] [-w window_ms] --sim tags       simulated chip with tags in the field
+//
+// Protocol: one request per line, one response line per request, in order.
+// UIDs are 16 hex digits as printed on tags (E004...), block data is hex.
+//
+//   INVENTORY                      OK <n> <uid> ...
+//   READ <uid> <block> <count>     OK <data>
+//   WRITE <uid> <block> <data>     OK
+//   STATS                          OK requests=.. cycles=.. ...
+//   errors                         ERR <code> <message>
+//
+// Requests of all clients pending at the same time are served in one RF
+// cycle: one inventory round answers every INVENTORY, READs of a tag are
+// merged into one READ MULTIPLE BLOCKS per contiguous range, then the WRITEs
+// follow with the field still on. A cycle takes the oldest request of every
+// client, so the requests of one client are executed in order; within a cycle
+// reads are served before writes. The cycle starts window_ms after the first
+// request arrived, the field is switched off after idle_ms without requests.
+//
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include "PN5180ISO15693.h"
+#include "PN5180LinuxHAL.h"
+#include "PN5180Simulator.h"
+
+#define PN5180D_MAX_CLIENTS     32
+#define PN5180D_MAX_TAGS        32
+#define PN5180D_MAX_LINE        1024
+
+enum RequestType {
+    REQ_INVENTORY,
+    REQ_READ,
+    REQ_WRITE,
+    REQ_STATS
+};
+
+struct Request {
+    RequestType type;
+    uint8_t uid[8];             // LSB first, as sent over the air
+    unsigned blockNo;
+    unsigned numBlocks;
+    std::vector<uint8_t> data;
+    std::string response;
+};
+
+struct Client {
+    int fd;
+    std::string in;
+    std::string out;
+    std::deque<Request> queue;
+    bool eof;                   // no more requests, close once answered
+};
+
+struct TagInfo {
+    uint8_t blockSize;
+    uint16_t numBlocks;
+    bool readMultiple;
+};
+
+struct Stats {
+    uint32_t requests;
+    uint32_t cycles;
+    uint32_t inventories;       // inventory rounds run
+    uint32_t reads;             // RF read commands
+    uint32_t writes;            // RF write commands
+    uint64_t rfTime_us;         // time spent in cycles
+};
+
+static volatile sig_atomic_t stopRequested = 0;
+static PN5180ISO15693 *nfc;
+static PN5180HAL *hal;
+static std::map<uint64_t, TagInfo> tagInfo;
+static Stats stats;
+
+static void onSignal(int)
+{
+    stopRequested = 1;
+}
+
+static uint64_t nowMillis()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t uidKey(const uint8_t *uid)
+{
+    uint64_t key = 0;
+    for (int i=7; i>=0; i--) {
+        key = (key << 8) | uid[i];
+    }
+    return key;
+}
+
+static std::string formatUid(const uint8_t *uid)
+{
+    char s[17];
+    for (int i=0; i<8; i++) {
+        sprintf(&s[2*i], "%02X", uid[7-i]);
+    }
+    return std::string(s, 16);
+}
+
+static std::string formatData(const uint8_t *data, size_t len)
+{
+    std::string s;
+    char hex[3];
+    for (size_t i=0; i<len; i++) {
+        sprintf(hex, "%02X", data[i]);
+        s += hex;
+    }
+    return s;
+}
+
+static bool parseHex(const char *s, std::vector<uint8_t> &bytes)
+{
+    size_t len = strlen(s);
+    if ((0 == len) || (len & 1)) {
+        return false;
+    }
+    bytes.clear();
+    for (size_t i=0; i<len; i+=2) {
+        char byte[3] = { s[i], s[i+1], 0 };
+        char *end;
+        unsigned long v = strtoul(byte, &end, 16);
+        if (*end) {
+            return false;
+        }
+        bytes.push_back((uint8_t)v);
+    }
+    return true;
+}
+
+static bool parseUid(const char *s, uint8_t *uid)
+{
+    std::vector<uint8_t> bytes;
+    if (!parseHex(s, bytes) || (8 != bytes.size())) {
+        return false;
+    }
+    for (int i=0; i<8; i++) {
+        uid[i] = bytes[7-i];
+    }
+    return true;
+}
+
+static bool parseNumber(const char *s, unsigned max, unsigned *value)
+{
+    char *end;
+    unsigned long v = strtoul(s, &end, 0);
+    if (!*s || *end || (v > max)) {
+        return false;
+    }
+    *value = (unsigned)v;
+    return true;
+}
+
+static std::string errorResponse(int rc)
+{
+    char s[128];
+    snprintf(s, sizeof(s), "ERR %d %s", rc, nfc->errorToString(rc));
+    return s;
+}
+
+/*
+ * Parse one request line; a malformed request is answered right away by
+ * leaving its response set.
+ */
+static Request parseRequest(const std::string &line)
+{
+    Request req;
+    req.type = REQ_STATS;
+    req.blockNo = 0;
+    req.numBlocks = 0;
+    memset(req.uid, 0, sizeof(req.uid));
+
+    char buf[PN5180D_MAX_LINE];
+    strncpy(buf, line.c_str(), sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = 0;
+    char *argv[5];
+    int argc = 0;
+    for (char *tok = strtok(buf, " \t\r"); tok && (argc < 5); tok = strtok(0L, " \t\r")) {
+        argv[argc++] = tok;
+    }
+
+    if ((1 == argc) && (0 == strcasecmp(argv[0], "INVENTORY"))) {
+        req.type = REQ_INVENTORY;
+    }
+    else if ((1 == argc) && (0 == strcasecmp(argv[0], "STATS"))) {
+        req.type = REQ_STATS;
+    }
+    else if ((4 == argc) && (0 == strcasecmp(argv[0], "READ"))) {
+        req.type = REQ_READ;
+        if (!parseUid(argv[1], req.uid) || !parseNumber(argv[2], 255, &req.blockNo) ||
+            !parseNumber(argv[3], 256, &req.numBlocks) || (0 == req.numBlocks)) {
+            req.response = "ERR -2 invalid arguments";
+        }
+    }
+    else if ((4 == argc) && (0 == strcasecmp(argv[0], "WRITE"))) {
+        req.type = REQ_WRITE;
+        if (!parseUid(argv[1], req.uid) || !parseNumber(argv[2], 255, &req.blockNo) || !parseHex(argv[3], req.data)) {
+            req.response = "ERR -2 invalid arguments";
+        }
+    }
+    else {
+        req.response = "ERR -2 unknown request";
+    }
+    return req;
+}
+
+/*
+ * Block size and number of blocks of a tag, from GET SYSTEM INFO once per tag.
+ */
+static ISO15693ErrorCode getTagInfo(uint8_t *uid, TagInfo **info)
+{
+    std::map<uint64_t, TagInfo>::iterator it = tagInfo.find(uidKey(uid));
+    if (it != tagInfo.end()) {
+        *info = &it->second;
+        return ISO15693_EC_OK;
+    }
+    uint8_t blockSize, numBlocks;
+    ISO15693ErrorCode rc = nfc->getSystemInfo(uid, &blockSize, &numBlocks);
+    if (ISO15693_EC_OK != rc) {
+        return rc;
+    }
+    TagInfo t = { blockSize, numBlocks, true };
+    *info = &(tagInfo[uidKey(uid)] = t);
+    return ISO15693_EC_OK;
+}
+
+/*
+ * Read blocks first..first+count-1 of a tag, READ MULTIPLE BLOCKS in pieces
+ * fitting a receive buffer, single blocks if the tag lacks the command.
+ */
+static ISO15693ErrorCode readRange(uint8_t *uid, TagInfo *info, unsigned first, unsigned count, uint8_t *data)
+{
+    unsigned maxBlocks = (MBED_CONF_PN5180_RX_BUFFER_SIZE - 1) / info->blockSize;
+    if (maxBlocks > 256) {
+        maxBlocks = 256;
+    }
+    while (count > 0) {
+        unsigned n = (count < maxBlocks) ? count : maxBlocks;
+        ISO15693ErrorCode rc = ISO15693_EC_NOT_SUPPORTED;
+        if (info->readMultiple && (n > 1)) {
+            stats.reads++;
+            rc = nfc->readMultipleBlocks(uid, (uint8_t)first, (uint8_t)n, data, info->blockSize);
+            if (ISO15693_EC_NOT_SUPPORTED == rc) {
+                info->readMultiple = false;
+            }
+        }
+        if (ISO15693_EC_NOT_SUPPORTED == rc) {
+            n = 1;
+            stats.reads++;
+            rc = nfc->readSingleBlock(uid, (uint8_t)first, data, info->blockSize);
+        }
+        if (ISO15693_EC_OK != rc) {
+            return rc;
+        }
+        first += n;
+        count -= n;
+        data += n * info->blockSize;
+    }
+    return ISO15693_EC_OK;
+}
+
+static bool byBlockNo(const Request *a, const Request *b)
+{
+    return a->blockNo < b->blockNo;
+}
+
+/*
+ * All READs of one tag: overlapping and adjacent ranges are read once.
+ */
+static void serveReads(std::vector<Request *> &reads)
+{
+    TagInfo *info;
+    ISO15693ErrorCode rc = getTagInfo(reads[0]->uid, &info);
+    if (ISO15693_EC_OK != rc) {
+        for (size_t i=0; i<reads.size(); i++) {
+            reads[i]->response = errorResponse(rc);
+        }
+        return;
+    }
+
+    std::sort(reads.begin(), reads.end(), byBlockNo);
+    size_t i = 0;
+    while (i < reads.size()) {
+        if (reads[i]->blockNo + reads[i]->numBlocks > info->numBlocks) {
+            reads[i++]->response = errorResponse(ISO15693_EC_BLOCK_NOT_AVAILABLE);
+            continue;
+        }
+        unsigned first = reads[i]->blockNo;
+        unsigned end = first + reads[i]->numBlocks;
+        size_t j = i + 1;
+        while ((j < reads.size()) && (reads[j]->blockNo <= end) &&
+               (reads[j]->blockNo + reads[j]->numBlocks <= info->numBlocks)) {
+            end = std::max(end, reads[j]->blockNo + reads[j]->numBlocks);
+            j++;
+        }
+
+        std::vector<uint8_t> data((end - first) * info->blockSize);
+        rc = readRange(reads[i]->uid, info, first, end - first, &data[0]);
+        for (; i<j; i++) {
+            if (ISO15693_EC_OK != rc) {
+                reads[i]->response = errorResponse(rc);
+                continue;
+            }
+            reads[i]->response = "OK " + formatData(&data[(reads[i]->blockNo - first) * info->blockSize],
+                                                    reads[i]->numBlocks * info->blockSize);
+        }
+    }
+}
+
+static void serveWrite(Request *req)
+{
+    TagInfo *info;
+    ISO15693ErrorCode rc = getTagInfo(req->uid, &info);
+    if (ISO15693_EC_OK != rc) {
+        req->response = errorResponse(rc);
+        return;
+    }
+    unsigned numBlocks = req->data.size() / info->blockSize;
+    if ((0 == numBlocks) || (req->data.size() % info->blockSize)) {
+        req->response = "ERR -2 data is not a multiple of the block size";
+        return;
+    }
+    if (req->blockNo + numBlocks > info->numBlocks) {
+        req->response = errorResponse(ISO15693_EC_BLOCK_NOT_AVAILABLE);
+        return;
+    }
+    for (unsigned i=0; i<numBlocks; i++) {
+        stats.writes++;
+        rc = nfc->writeSingleBlock(req->uid, (uint8_t)(req->blockNo + i), &req->data[i * info->blockSize], info->blockSize);
+        if (ISO15693_EC_OK != rc) {
+            req->response = errorResponse(rc);
+            return;
+        }
+    }
+    req->response = "OK";
+}
+
+static void serveStats(Request *req)
+{
+    char s[256];
+    snprintf(s, sizeof(s), "OK requests=%u cycles=%u inventories=%u reads=%u writes=%u rf_time_us=%llu",
+             stats.requests, stats.cycles, stats.inventories, stats.reads, stats.writes,
+             (unsigned long long)stats.rfTime_us);
+    req->response = s;
+}
+
+/*
+ * One RF cycle over the oldest request of every client.
+ */
+static void runCycle(std::vector<Client> &clients)
+{
+    std::vector<Request *> batch;
+    for (size_t i=0; i<clients.size(); i++) {
+        if (!clients[i].queue.empty()) {
+            batch.push_back(&clients[i].queue.front());
+        }
+    }
+    if (batch.empty()) {
+        return;
+    }
+
+    uint32_t start = hal->micros();
+    stats.cycles++;
+    stats.requests += batch.size();
+    if (!nfc->isRFOn() && !nfc->setupRF()) {
+        for (size_t i=0; i<batch.size(); i++) {
+            batch[i]->response = "ERR -3 RF field cannot be switched on";
+        }
+        nfc->recover();
+    }
+
+    // inventory, shared by all INVENTORY requests
+    bool inventory = false;
+    for (size_t i=0; i<batch.size(); i++) {
+        inventory |= batch[i]->response.empty() && (REQ_INVENTORY == batch[i]->type);
+    }
+    if (inventory) {
+        uint8_t uids[8 * PN5180D_MAX_TAGS];
+        uint8_t numTags = 0;
+        stats.inventories++;
+        ISO15693ErrorCode rc = nfc->getInventoryMultiple(uids, PN5180D_MAX_TAGS, &numTags);
+        char s[16];
+        snprintf(s, sizeof(s), "OK %u", numTags);
+        std::string response = s;
+        for (uint8_t i=0; i<numTags; i++) {
+            response += " " + formatUid(&uids[8*i]);
+        }
+        if ((ISO15693_EC_OK != rc) && (EC_NO_CARD != rc) && (0 == numTags)) {
+            response = errorResponse(rc);
+        }
+        for (size_t i=0; i<batch.size(); i++) {
+            if (batch[i]->response.empty() && (REQ_INVENTORY == batch[i]->type)) {
+                batch[i]->response = response;
+            }
+        }
+    }
+
+    // reads, grouped by tag
+    std::map<uint64_t, std::vector<Request *> > reads;
+    for (size_t i=0; i<batch.size(); i++) {
+        if (batch[i]->response.empty() && (REQ_READ == batch[i]->type)) {
+            reads[uidKey(batch[i]->uid)].push_back(batch[i]);
+        }
+    }
+    for (std::map<uint64_t, std::vector<Request *> >::iterator it = reads.begin(); it != reads.end(); ++it) {
+        serveReads(it->second);
+    }
+
+    // writes, in order of the clients
+    for (size_t i=0; i<batch.size(); i++) {
+        if (batch[i]->response.empty() && (REQ_WRITE == batch[i]->type)) {
+            serveWrite(batch[i]);
+        }
+    }
+
+    stats.rfTime_us += (uint32_t)(hal->micros() - start);
+    for (size_t i=0; i<batch.size(); i++) {
+        if (batch[i]->response.empty() && (REQ_STATS == batch[i]->type)) {
+            serveStats(batch[i]);
+        }
+    }
+
+    for (size_t i=0; i<clients.size(); i++) {
+        if (!clients[i].queue.empty()) {
+            clients[i].out += clients[i].queue.front().response + "\n";
+            clients[i].queue.pop_front();
+        }
+    }
+}
+
+/*
+ * Split the input of a client into requests; false if the client misbehaves.
+ */
+static bool receiveRequests(Client &c)
+{
+    char buf[512];
+    ssize_t n = read(c.fd, buf, sizeof(buf));
+    if (0 == n) {
+        c.eof = true;
+        return true;
+    }
+    if (n < 0) {
+        return (EAGAIN == errno) || (EINTR == errno);
+    }
+    c.in.append(buf, n);
+    size_t eol;
+    while (std::string::npos != (eol = c.in.find('\n'))) {
+        std::string line = c.in.substr(0, eol);
+        c.in.erase(0, eol + 1);
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+        c.queue.push_back(parseRequest(line));
+    }
+    return c.in.size() < PN5180D_MAX_LINE;
+}
+
+/*
+ * Answer malformed requests at the head of the queue right away.
+ */
+static void answerInvalid(Client &c)
+{
+    while (!c.queue.empty() && !c.queue.front().response.empty()) {
+        c.out += c.queue.front().response + "\n";
+        c.queue.pop_front();
+    }
+}
+
+static int listenOn(const char *path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if ((fd < 0) || (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) || (listen(fd, 8) < 0)) {
+        return -1;
+    }
+    return fd;
+}
+
+static void serve(int listenFd, uint32_t window_ms, uint32_t idle_ms)
+{
+    std::vector<Client> clients;
+    uint64_t firstPending = 0;    // arrival of the oldest unserved request, 0: none
+    uint64_t lastCycle = nowMillis();
+
+    while (!stopRequested) {
+        std::vector<struct pollfd> fds(1 + clients.size());
+        fds[0].fd = listenFd;
+        fds[0].events = POLLIN;
+        for (size_t i=0; i<clients.size(); i++) {
+            fds[1+i].fd = clients[i].fd;
+            fds[1+i].events = (clients[i].eof ? 0 : POLLIN) | (clients[i].out.empty() ? 0 : POLLOUT);
+        }
+
+        int timeout = -1;
+        uint64_t now = nowMillis();
+        if (firstPending) {
+            timeout = (now >= firstPending + window_ms) ? 0 : (int)(firstPending + window_ms - now);
+        }
+        else if (nfc->isRFOn()) {
+            timeout = (now >= lastCycle + idle_ms) ? 0 : (int)(lastCycle + idle_ms - now);
+        }
+        if ((poll(&fds[0], fds.size(), timeout) < 0) && (EINTR != errno)) {
+            perror("poll");
+            return;
+        }
+
+        std::vector<bool> closed(clients.size(), false);
+        for (size_t i=0; i<clients.size(); i++) {
+            Client &c = clients[i];
+            if (!c.eof && (fds[1+i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                closed[i] = !receiveRequests(c);
+                answerInvalid(c);
+            }
+            if (!closed[i] && !c.out.empty() && (fds[1+i].revents & POLLOUT)) {
+                ssize_t n = write(c.fd, c.out.data(), c.out.size());
+                if (n > 0) {
+                    c.out.erase(0, n);
+                }
+                else if ((EAGAIN != errno) && (EINTR != errno)) {
+                    closed[i] = true;
+                }
+            }
+        }
+        for (size_t i=clients.size(); i-- > 0; ) {
+            if (closed[i] || (clients[i].eof && clients[i].queue.empty() && clients[i].out.empty())) {
+                close(clients[i].fd);
+                clients.erase(clients.begin() + i);
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept4(listenFd, 0L, 0L, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if ((fd >= 0) && (clients.size() >= PN5180D_MAX_CLIENTS)) {
+                close(fd);
+            }
+            else if (fd >= 0) {
+                Client c;
+                c.fd = fd;
+                c.eof = false;
+                clients.push_back(c);
+            }
+        }
+
+        bool pending = false;
+        for (size_t i=0; i<clients.size(); i++) {
+            pending |= !clients[i].queue.empty();
+        }
+        now = nowMillis();
+        if (!pending) {
+            firstPending = 0;
+            if (nfc->isRFOn() && (now >= lastCycle + idle_ms)) {
+                nfc->setRF_off();
+            }
+            continue;
+        }
+        if (0 == firstPending) {
+            firstPending = now ? now : 1;
+        }
+        if (now >= firstPending + window_ms) {
+            runCycle(clients);
+            for (size_t i=0; i<clients.size(); i++) {
+                answerInvalid(clients[i]);
+            }
+            lastCycle = nowMillis();
+            firstPending = 0;
+            for (size_t i=0; i<clients.size(); i++) {
+                if (!clients[i].queue.empty()) {
+                    firstPending = lastCycle ? lastCycle : 1; // next cycle right away
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: pn5180d [-s socket] [-w window_ms] [-i idle_ms]\n"
+        "               --spi dev --gpiochip dev --nss line --reset line --busy line [--speed hz]\n"
+        "       pn5180d [-s socket] [-w window_ms] [-i idle_ms] --sim tags\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *socketPath = "/tmp/pn5180.sock";
+    const char *spiDevice = 0L;
+    const char *gpioChip = "/dev/gpiochip0";
+    unsigned nssLine = 0, resetLine = 0, busyLine = 0;
+    unsigned speed = 7000000;
+    unsigned window_ms = 2, idle_ms = 1000;
+    int simTags = -1;
+
+    static const struct option options[] = {
+        { "socket", required_argument, 0L, 's' },
+        { "window", required_argument, 0L, 'w' },
+        { "idle", required_argument, 0L, 'i' },
+        { "spi", required_argument, 0L, 'S' },
+        { "gpiochip", required_argument, 0L, 'G' },
+        { "nss", required_argument, 0L, 'N' },
+        { "reset", required_argument, 0L, 'R' },
+        { "busy", required_argument, 0L, 'B' },
+        { "speed", required_argument, 0L, 'F' },
+        { "sim", required_argument, 0L, 'M' },
+        { 0L, 0, 0L, 0 }
+    };
+    int opt;
+    bool ok = true;
+    while (ok && (-1 != (opt = getopt_long(argc, argv, "s:w:i:", options, 0L)))) {
+        unsigned v = 0;
+        if (('s' != opt) && ('S' != opt) && ('G' != opt)) {
+            ok = (0L != optarg) && parseNumber(optarg, 0x7fffffff, &v);
+        }
+        switch (opt) {
+            case 's': socketPath = optarg; break;
+            case 'w': window_ms = v; break;
+            case 'i': idle_ms = v; break;
+            case 'S': spiDevice = optarg; break;
+            case 'G': gpioChip = optarg; break;
+            case 'N': nssLine = v; break;
+            case 'R': resetLine = v; break;
+            case 'B': busyLine = v; break;
+            case 'F': speed = v; break;
+            case 'M': simTags = (int)v; break;
+            default: ok = false; break;
+        }
+    }
+    if (!ok || (optind != argc) || ((0L == spiDevice) == (simTags < 0))) {
+        usage();
+        return 2;
+    }
+
+    PN5180Simulator sim;
+    PN5180LinuxHAL linuxHal(spiDevice ? spiDevice : "", gpioChip, nssLine, resetLine, busyLine, speed);
+    if (simTags >= 0) {
+        for (int i=0; i<simTags; i++) {
+            uint8_t uid[8] = { (uint8_t)(0x10 + i), (uint8_t)(i * 37), 0x5A, 0x01, 0x80, 0x01, 0x04, 0xE0 };
+            PN5180SimTag &t = sim.addTag(uid, 64, 4);
+            for (size_t b=0; b<t.memory.size(); b++) {
+                t.memory[b] = (uint8_t)(i + b);
+            }
+        }
+        hal = &sim;
+    }
+    else {
+        if (!linuxHal.open()) {
+            fprintf(stderr, "pn5180d: %s: %s\n", linuxHal.getFailedStep(), strerror(errno));
+            return 1;
+        }
+        hal = &linuxHal;
+    }
+
+    PN5180ISO15693 reader(*hal);
+    nfc = &reader;
+    reader.powerUp();
+    if (!reader.reset()) {
+        fprintf(stderr, "pn5180d: no response from the PN5180\n");
+        return 1;
+    }
+
+    int listenFd = listenOn(socketPath);
+    if (listenFd < 0) {
+        fprintf(stderr, "pn5180d: %s: %s\n", socketPath, strerror(errno));
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;
+    sigaction(SIGINT, &sa, 0L);
+    sigaction(SIGTERM, &sa, 0L);
+    signal(SIGPIPE, SIG_IGN);
+
+    serve(listenFd, window_ms, idle_ms);
+
+    close(listenFd);
+    unlink(socketPath);
+    reader.setRF_off();
+    reader.powerDown();
+    return 0;
+}
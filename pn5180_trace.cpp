@@ -20,6 +20,8 @@
 #include <inttypes.h>
 #include "pn5180_trace.h"
 
+#if DEBUG_PN5180
+
 static const char hexChar[] = "0123456789ABCDEF";
 static char hexBuffer[9];
 
@@ -49,4 +51,6 @@ char * formatHex(uint32_t val)
     }
     hexBuffer[8] = '\0';
     return hexBuffer;
-}
\ No newline at end of file
+}
+
+#endif // DEBUG_PN5180
@@ -19,12 +19,27 @@
 #ifndef PN5180_TRACE_H
 #define PN5180_TRACE_H
 
+// Trace output of the library, requires mbed-trace (0 compiles all trace calls out)
+#ifndef MBED_CONF_PN5180_TRACE_ENABLE
+#define MBED_CONF_PN5180_TRACE_ENABLE 1
+#endif
+
+#if defined (__MBED__) && MBED_CONF_PN5180_TRACE_ENABLE
 #include "mbed_trace.h"
+#else
+// host builds (simulator, Linux backend) and builds without tracing trace nothing
+#define tr_debug(...)
+#define tr_info(...)
+#define tr_warn(...)
+#define tr_warning(...)
+#define tr_error(...)
+#define tr_err(...)
+#endif
 
 #ifndef MBED_CONF_MBED_TRACE_ENABLE
 #define MBED_CONF_MBED_TRACE_ENABLE 0
 #endif
-#if MBED_CONF_MBED_TRACE_ENABLE == 1
+#if (MBED_CONF_MBED_TRACE_ENABLE == 1) && MBED_CONF_PN5180_TRACE_ENABLE
 #define TRACE_GROUP     "PN5180"
 #define DEBUG_PN5180    1
 extern char * formatHex(const uint8_t val);